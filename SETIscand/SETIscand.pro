@@ -14,14 +14,26 @@ INCLUDEPATH += \
 		/usr/local/include
 
 SOURCES += \
+        classes/allocwatch.cc \
+        classes/arena.cc \
+        classes/blockpool.cc \
         classes/config.cc \
+        classes/converter.cc \
         classes/datablock.cc \
         classes/datamgr.cc \
+        classes/ddc.cc \
+        classes/dspengine.cc \
         classes/fftaggregator.cc \
+        classes/fftplanner.cc \
+        classes/filesource.cc \
+        classes/iqrecorder.cc \
         classes/msgio.cc \
         classes/processor.cc \
+        classes/ringconsumer.cc \
+        classes/samplering.cc \
         classes/soapyio.cc \
         classes/soapyworker.cc \
+        classes/synthsource.cc \
         classes/taskfft.cc \
         classes/tester.cc \
         main.cc
@@ -29,6 +41,9 @@ SOURCES += \
 LIBS += \
         -L/usr/local/lib \
         -lfftw3 \
+        -lfftw3f \
+        -lfftw3_threads \
+        -lfftw3f_threads \
         -lSoapySDR
 
 # Default rules for deployment.
@@ -41,13 +56,29 @@ HEADERS += \
     ../Shared/include/properties.h \
     ../Shared/include/singleton.h \
     ../Shared/include/testable.h \
+    classes/allocwatch.h \
+    classes/arena.h \
+    classes/blockpool.h \
+    classes/boundedqueue.h \
+    classes/blockref.h \
     classes/config.h \
+    classes/converter.h \
     classes/datablock.h \
     classes/datamgr.h \
+    classes/ddc.h \
+    classes/dspengine.h \
     classes/fftaggregator.h \
+    classes/fftplanner.h \
+    classes/filesource.h \
+    classes/iqrecorder.h \
     classes/msgio.h \
     classes/processor.h \
+    classes/reorderbuffer.h \
+    classes/ringconsumer.h \
+    classes/samplering.h \
+    classes/samplesource.h \
     classes/soapyio.h \
     classes/soapyworker.h \
+    classes/synthsource.h \
     classes/taskfft.h \
     classes/tester.h
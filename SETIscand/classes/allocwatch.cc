@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+#include "allocwatch.h"
+#include "constants.h"
+#include "datamgr.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* State. The scope depth is per-thread, the rest is global. None of this may
+|* allocate, since it's touched from operator new
+\******************************************************************************/
+static std::atomic<int>		_mode(AllocWatch::MODE_OFF);
+static std::atomic<int64_t>	_count(0);
+static std::atomic<int64_t>	_bytes(0);
+static int64_t				_reported = 0;
+static thread_local int		_depth = 0;
+
+/******************************************************************************\
+|* Scope: mark the calling thread as running pipeline code
+\******************************************************************************/
+AllocWatch::Scope::Scope(void)
+	{
+	_depth ++;
+	}
+
+AllocWatch::Scope::~Scope(void)
+	{
+	_depth --;
+	}
+
+/******************************************************************************\
+|* Arm or disarm the watch. Pooled blocks are covered by the DataMgr, so tell
+|* it too
+\******************************************************************************/
+void AllocWatch::arm(Mode mode)
+	{
+	_count		= 0;
+	_bytes		= 0;
+	_reported	= 0;
+	_mode		= mode;
+
+	DataMgr::instance().setWarm(mode != MODE_OFF, mode == MODE_ABORT);
+	if (mode != MODE_OFF)
+		LOG << "Watching for pipeline heap allocations"
+			<< ((mode == MODE_ABORT) ? "(abort on allocation)" : "");
+	}
+
+AllocWatch::Mode AllocWatch::mode(void)
+	{
+	return (Mode)_mode.load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the counters
+\******************************************************************************/
+int64_t AllocWatch::count(void)
+	{
+	return _count.load(std::memory_order_relaxed);
+	}
+
+int64_t AllocWatch::bytes(void)
+	{
+	return _bytes.load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Report any allocations seen since the last time
+\******************************************************************************/
+void AllocWatch::report(void)
+	{
+	int64_t now = count();
+	if (now != _reported)
+		{
+		WARN << "Pipeline made" << now << "heap allocations ("
+			 << bytes() << "bytes) since warm-up";
+		_reported = now;
+		}
+	DataMgr::instance().logPoolStats();
+	}
+
+/******************************************************************************\
+|* Note an allocation. Cheap when we're not armed or not in the pipeline
+\******************************************************************************/
+void AllocWatch::noteAllocation(size_t size)
+	{
+	if ((_depth == 0) || (_mode.load(std::memory_order_relaxed) == MODE_OFF))
+		return;
+
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_bytes.fetch_add((int64_t)size, std::memory_order_relaxed);
+
+	if (_mode.load(std::memory_order_relaxed) == MODE_ABORT)
+		{
+		static const char msg[] = "Heap allocation in pipeline after warm-up\n";
+		ssize_t rc = ::write(2, msg, sizeof(msg) - 1);
+		Q_UNUSED(rc);
+		::abort();
+		}
+	}
+
+/******************************************************************************\
+|* Replacement global allocator. The other forms (array, nothrow) are
+|* implemented by the runtime in terms of these, for both the plain and the
+|* over-aligned allocations
+\******************************************************************************/
+void * operator new(size_t size)
+	{
+	AllocWatch::noteAllocation(size);
+
+	void *ptr = ::malloc((size == 0) ? 1 : size);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+	}
+
+void * operator new(size_t size, std::align_val_t align)
+	{
+	AllocWatch::noteAllocation(size);
+
+	void *ptr = nullptr;
+	size_t alignment = std::max((size_t)align, sizeof(void *));
+	if (::posix_memalign(&ptr, alignment, (size == 0) ? 1 : size) != 0)
+		throw std::bad_alloc();
+	return ptr;
+	}
+
+void operator delete(void *ptr) noexcept
+	{
+	::free(ptr);
+	}
+
+void operator delete(void *ptr, size_t) noexcept
+	{
+	::free(ptr);
+	}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+	{
+	::free(ptr);
+	}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+	{
+	::free(ptr);
+	}
@@ -0,0 +1,69 @@
+#ifndef ALLOCWATCH_H
+#define ALLOCWATCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/******************************************************************************\
+|* Counts heap allocations made from inside the processing pipeline once the
+|* daemon has warmed up. The per-sample and per-bin loops open a Scope; any
+|* operator-new made on that thread while a scope is open (and the watch is
+|* armed) is counted, and in abort-mode stops the process so it can be
+|* debugged.
+|*
+|* This is how we show the steady-state allocates nothing: pooled blocks are
+|* covered by the DataMgr late-miss counters, everything else by this. The
+|* scopes cover sample conversion and windowing, the DDC, the FFTs, summing
+|* power, merging the workers' sums and taking each window's mean. Left out
+|* is the code around those that allocates by design: queued signals (Qt
+|* allocates an event per emit), logging, the websocket send, and the SDR
+|* driver's read.
+\******************************************************************************/
+class AllocWatch
+	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef enum
+			{
+			MODE_OFF	= 0,
+			MODE_COUNT,
+			MODE_ABORT
+			} Mode;
+
+		/**********************************************************************\
+		|* Mark a region of code as being part of the pipeline
+		\**********************************************************************/
+		class Scope
+			{
+			public:
+				Scope(void);
+				~Scope(void);
+			};
+
+		/**********************************************************************\
+		|* Start watching (or stop, with MODE_OFF)
+		\**********************************************************************/
+		static void arm(Mode mode);
+		static Mode mode(void);
+
+		/**********************************************************************\
+		|* Allocations and bytes seen since the watch was armed
+		\**********************************************************************/
+		static int64_t count(void);
+		static int64_t bytes(void);
+
+		/**********************************************************************\
+		|* Log the counters if they've changed since the last report
+		\**********************************************************************/
+		static void report(void);
+
+		/**********************************************************************\
+		|* Called from operator new
+		\**********************************************************************/
+		static void noteAllocation(size_t size);
+	};
+
+#endif // ALLOCWATCH_H
@@ -0,0 +1,215 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "constants.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Not all libc headers carry these
+\******************************************************************************/
+#ifndef MAP_HUGE_SHIFT
+#  define MAP_HUGE_SHIFT	(26)
+#endif
+#ifndef MAP_HUGE_2MB
+#  define MAP_HUGE_2MB		(21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#  define MAP_HUGE_1GB		(30 << MAP_HUGE_SHIFT)
+#endif
+
+#define MPOL_BIND			(2)		// From <numaif.h>, without needing libnuma
+#define MPOL_MF_MOVE		(1<<1)
+
+#define CACHE_LINE			(64)
+#define NORMAL_PAGE			(4096)
+
+/******************************************************************************\
+|* Round up to a power-of-two alignment
+\******************************************************************************/
+static inline size_t _alignUp(size_t value, size_t align)
+	{
+	return (value + align - 1) & ~(align - 1);
+	}
+
+/******************************************************************************\
+|* Constructor. Bind before locking, since mlock() faults the pages in and the
+|* NUMA policy only applies to pages that haven't been touched yet
+\******************************************************************************/
+Arena::Arena(size_t size, size_t hugePageSize, bool lock, int numaNode)
+	  :_size(size)
+	  ,_pageSize(NORMAL_PAGE)
+	  ,_base(nullptr)
+	  ,_isValid(false)
+	  ,_isLocked(false)
+	  ,_numaNode(NUMA_NONE)
+	  ,_used(0)
+	  ,_exhausted(false)
+	{
+	_map(hugePageSize);
+	if (!_isValid)
+		return;
+
+	if (numaNode != NUMA_NONE)
+		_bind(numaNode);
+	if (lock)
+		_lock();
+
+	LOG << "Arena of" << (qint64)(_size >> 20) << "MiB using"
+		<< (qint64)(_pageSize >> 10) << "KiB pages"
+		<< (_isLocked ? "(locked)" : "")
+		<< "numa node" << _numaNode;
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+Arena::~Arena(void)
+	{
+	if (_base != nullptr)
+		{
+		if (_isLocked)
+			::munlock(_base, _size);
+		::munmap(_base, _size);
+		}
+	}
+
+/******************************************************************************\
+|* Map the region, trying explicit huge pages, then transparent huge pages,
+|* then normal pages
+\******************************************************************************/
+void Arena::_map(size_t hugePageSize)
+	{
+	int prot	= PROT_READ | PROT_WRITE;
+	int flags	= MAP_PRIVATE | MAP_ANONYMOUS;
+	void *addr	= MAP_FAILED;
+
+	if (hugePageSize > 0)
+		{
+		int huge	= (hugePageSize >= (((size_t)1) << 30)) ? MAP_HUGE_1GB
+															: MAP_HUGE_2MB;
+		size_t len	= _alignUp(_size, hugePageSize);
+		addr		= ::mmap(nullptr, len, prot, flags | MAP_HUGETLB | huge, -1, 0);
+		if (addr != MAP_FAILED)
+			{
+			_size		= len;
+			_pageSize	= hugePageSize;
+			}
+		else
+			WARN << "No" << (qint64)(hugePageSize >> 20)
+				 << "MiB huge pages available for the arena,"
+				 << "falling back to normal pages";
+		}
+
+	if (addr == MAP_FAILED)
+		{
+		_size	= _alignUp(_size, NORMAL_PAGE);
+		addr	= ::mmap(nullptr, _size, prot, flags, -1, 0);
+		if (addr == MAP_FAILED)
+			{
+			ERR << "Cannot map arena of" << (qint64)_size << "bytes";
+			return;
+			}
+
+#ifdef MADV_HUGEPAGE
+		if (hugePageSize > 0)
+			{
+			if (::madvise(addr, _size, MADV_HUGEPAGE) == 0)
+				WARN << "Arena is using transparent huge pages";
+			else
+				WARN << "Transparent huge pages unavailable, arena is using"
+					 << "4 KiB pages";
+			}
+#endif
+		}
+
+	_base		= reinterpret_cast<uint8_t *>(addr);
+	_isValid	= true;
+	}
+
+/******************************************************************************\
+|* Bind the arena to a NUMA node. The auto setting uses the node of the
+|* calling thread, which should be the one the workers are started from
+\******************************************************************************/
+void Arena::_bind(int node)
+	{
+	if (node == NUMA_AUTO)
+		{
+		unsigned cpu = 0, current = 0;
+		if (::syscall(SYS_getcpu, &cpu, &current, nullptr) != 0)
+			{
+			WARN << "Cannot determine NUMA node, arena is not bound";
+			return;
+			}
+		node = (int)current;
+		}
+
+	unsigned long mask[4] = {0, 0, 0, 0};
+	int bits = (int)(8 * sizeof(unsigned long));
+	if ((node < 0) || (node >= 4 * bits))
+		{
+		WARN << "NUMA node" << node << "out of range, arena is not bound";
+		return;
+		}
+	mask[node / bits] = 1UL << (node % bits);
+
+	if (::syscall(SYS_mbind, _base, _size, MPOL_BIND, mask,
+				  (unsigned long)(4 * bits), MPOL_MF_MOVE) != 0)
+		WARN << "Cannot bind arena to NUMA node" << node;
+	else
+		_numaNode = node;
+	}
+
+/******************************************************************************\
+|* Lock the arena into RAM
+\******************************************************************************/
+void Arena::_lock(void)
+	{
+	if (::mlock(_base, _size) == 0)
+		_isLocked = true;
+	else
+		WARN << "Cannot mlock() the arena (check RLIMIT_MEMLOCK),"
+			 << "it may be paged out";
+	}
+
+/******************************************************************************\
+|* Hand out some space
+\******************************************************************************/
+uint8_t * Arena::allocate(size_t size)
+	{
+	if (!_isValid)
+		return nullptr;
+
+	size_t align	= (size >= _pageSize) ? _pageSize : CACHE_LINE;
+	size_t old		= _used.load(std::memory_order_relaxed);
+	size_t start;
+	do
+		{
+		start = _alignUp(old, align);
+		if (start + size > _size)
+			{
+			if (!_exhausted.exchange(true))
+				WARN << "Arena is full, further blocks use normal pages";
+			return nullptr;
+			}
+		}
+	while (!_used.compare_exchange_weak(old, start + size,
+										std::memory_order_relaxed));
+
+	return _base + start;
+	}
+
+/******************************************************************************\
+|* Return the amount used
+\******************************************************************************/
+size_t Arena::used(void)
+	{
+	return _used.load(std::memory_order_relaxed);
+	}
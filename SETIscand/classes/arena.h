@@ -0,0 +1,83 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* A single large mapping that pooled DataBlocks are carved out of, so the big
+|* buffers (FFT frames, the conversion buffer) sit on huge pages instead of
+|* being spread over 4 KiB ones. The mapping can be locked into RAM and bound
+|* to a NUMA node. Space is handed out with a lock-free bump pointer and is
+|* never given back - blocks live in the pools for the life of the process.
+|*
+|* Each of the options degrades gracefully, and says so in the log: no huge
+|* pages -> transparent huge pages -> normal pages; mlock and NUMA binding
+|* failures are reported and ignored.
+\******************************************************************************/
+class Arena
+	{
+	NON_COPYABLE_NOR_MOVEABLE(Arena);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			NUMA_NONE		= -1,		// Don't bind to a node
+			NUMA_AUTO		= -2		// Bind to the node we're running on
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(size_t, size);					// Size of the mapping in bytes
+	GET(size_t, pageSize);				// Page size actually in use
+	GET(uint8_t *, base);				// Start of the mapping
+	GET(bool, isValid);					// Mapping succeeded
+	GET(bool, isLocked);				// Mapping is mlock()ed
+	GET(int, numaNode);					// Node we're bound to, or -1
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		std::atomic<size_t>	_used;		// Bytes handed out so far
+		std::atomic<bool>	_exhausted;	// Set (and logged) on first overflow
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		void _map(size_t hugePageSize);
+		void _bind(int node);
+		void _lock(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. hugePageSize is 0 for normal pages, or
+		|* 2 MiB / 1 GiB
+		\**********************************************************************/
+		explicit Arena(size_t size,
+					   size_t hugePageSize,
+					   bool lock,
+					   int numaNode = NUMA_NONE);
+		~Arena(void);
+
+		/**********************************************************************\
+		|* Carve out 'size' bytes. Blocks of a huge page or more are aligned
+		|* to a page, everything else to a cache line. Returns nullptr once
+		|* the arena is full
+		\**********************************************************************/
+		uint8_t * allocate(size_t size);
+
+		/**********************************************************************\
+		|* Return the number of bytes handed out
+		\**********************************************************************/
+		size_t used(void);
+	};
+
+#endif // ARENA_H
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "arena.h"
+#include "blockpool.h"
+#include "constants.h"
+#include "datablock.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Tagged-pointer helpers for the depot heads
+\******************************************************************************/
+#define PTR_BITS			(48)
+#define PTR_MASK			((((uint64_t)1) << PTR_BITS) - 1)
+
+static inline DataBlock * _ptrOf(uint64_t tagged)
+	{
+	return reinterpret_cast<DataBlock *>(tagged & PTR_MASK);
+	}
+
+static inline uint64_t _pack(DataBlock *block, uint64_t prev)
+	{
+	uint64_t tag = (prev >> PTR_BITS) + 1;
+	return (tag << PTR_BITS) | (reinterpret_cast<uint64_t>(block) & PTR_MASK);
+	}
+
+/******************************************************************************\
+|* Per-thread cache of recently released blocks, one set per pool. When the
+|* thread exits, or the pool has asked for a flush since this cache last
+|* looked, anything still cached goes back to the owning pool's depot
+\******************************************************************************/
+struct ThreadCache
+	{
+	BlockPool *	owner;
+	int64_t		flushes;		// Owner's flush requests seen so far
+	int			count[BlockPool::NUM_CLASSES];
+	DataBlock *	blocks[BlockPool::NUM_CLASSES][BlockPool::CACHE_DEPTH];
+
+	ThreadCache(void)
+		:owner(nullptr)
+		,flushes(0)
+		,count{}
+		{}
+
+	~ThreadCache(void)
+		{
+		flush();
+		}
+
+	void flush(void)
+		{
+		if (owner == nullptr)
+			return;
+		int64_t bytes = 0;
+		for (int i=0; i<BlockPool::NUM_CLASSES; i++)
+			{
+			while (count[i] > 0)
+				{
+				DataBlock *block = blocks[i][--count[i]];
+				bytes += (int64_t)block->capacity();
+				owner->_push(i, block);
+				}
+			}
+		owner->_bytesCached.fetch_sub(bytes, std::memory_order_relaxed);
+		}
+
+	/**************************************************************************\
+	|* Flush if the owner has asked for it since we last looked
+	\**************************************************************************/
+	inline void honourFlush(void)
+		{
+		int64_t now = owner->_flushes.load(std::memory_order_relaxed);
+		if (now != flushes)
+			{
+			flush();
+			flushes = now;
+			}
+		}
+	};
+
+static thread_local ThreadCache _tls[BlockPool::MAX_POOLS];
+
+std::atomic<int64_t> BlockPool::_epoch(0);
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+BlockPool::BlockPool(int poolId, bool isFFT)
+		  :_isFFT(isFFT)
+		  ,_poolId(poolId)
+		  ,_isWarm(false)
+		  ,_abortOnMiss(false)
+		  ,_arena(nullptr)
+		  ,_bytesHeld(0)
+		  ,_bytesCached(0)
+		  ,_flushes(0)
+	{
+	Q_ASSERT(poolId >= 0 && poolId < MAX_POOLS);
+	for (SizeClass& sc : _classes)
+		{
+		sc.head			= 0;
+		sc.hits			= 0;
+		sc.misses		= 0;
+		sc.live			= 0;
+		sc.highWater	= 0;
+		sc.created		= 0;
+		sc.lateMisses	= 0;
+		sc.trimmed		= 0;
+		sc.lastUse		= 0;
+		}
+	}
+
+/******************************************************************************\
+|* Destructor. Only called at process-exit via the DataMgr singleton, after
+|* the worker threads have gone. Blocks still live are owned by their clients
+\******************************************************************************/
+BlockPool::~BlockPool(void)
+	{
+	flushThreadCache();
+	_tls[_poolId].owner = nullptr;
+
+	for (int i=0; i<NUM_CLASSES; i++)
+		{
+		DataBlock *block;
+		while ((block = _pop(i)) != nullptr)
+			delete block;
+		}
+
+	for (DataBlock *shell : _shells)
+		delete shell;
+	}
+
+/******************************************************************************\
+|* Map a byte-size to the smallest size-class that will hold it. Classes are
+|* 64 bytes, then four evenly spaced steps per power-of-two, so at most 25%
+|* of a block is wasted
+\******************************************************************************/
+int BlockPool::classFor(size_t size)
+	{
+	if (size <= (((size_t)1) << MIN_SHIFT))
+		return 0;
+
+	int shift	= 63 - __builtin_clzll((unsigned long long)(size - 1));
+	if (shift > MAX_SHIFT - 1)
+		return -1;
+
+	size_t step	= ((size_t)1) << (shift - 2);
+	int sub		= (int)((size - 1 - (((size_t)1) << shift)) / step);
+	return 1 + (shift - MIN_SHIFT) * STEPS + sub;
+	}
+
+/******************************************************************************\
+|* Return the number of bytes a given size-class holds
+\******************************************************************************/
+size_t BlockPool::classSize(int sizeClass)
+	{
+	if (sizeClass <= 0)
+		return ((size_t)1) << MIN_SHIFT;
+
+	int shift	= MIN_SHIFT + (sizeClass - 1) / STEPS;
+	int sub		= (sizeClass - 1) % STEPS;
+	return (((size_t)1) << shift) + (sub + 1) * (((size_t)1) << (shift - 2));
+	}
+
+/******************************************************************************\
+|* Obtain a block for the given size
+\******************************************************************************/
+DataBlock * BlockPool::acquire(size_t size, bool mayCreate)
+	{
+	return _acquire(size, mayCreate, true);
+	}
+
+/******************************************************************************\
+|* Obtain a block for the given size, from the thread cache, then the depot,
+|* then (if allowed) the heap. Blocks taken other than for a client (by a
+|* prewarm) still count as created, but not as hits, misses or live blocks
+\******************************************************************************/
+DataBlock * BlockPool::_acquire(size_t size, bool mayCreate, bool traffic)
+	{
+	int sizeClass = classFor(size);
+	if (sizeClass < 0)
+		{
+		ERR << "Block request for" << size << "bytes exceeds the largest class";
+		return nullptr;
+		}
+
+	SizeClass& sc		= _classes[sizeClass];
+	DataBlock *block	= _cachePop(sizeClass);
+	if (block == nullptr)
+		block = _pop(sizeClass);
+
+	if (block != nullptr)
+		{
+		if (traffic)
+			sc.hits.fetch_add(1, std::memory_order_relaxed);
+		sc.lastUse.store(_epoch.load(std::memory_order_relaxed),
+						 std::memory_order_relaxed);
+		}
+	else if (!mayCreate)
+		return nullptr;
+	else
+		{
+		block = _create(sizeClass);
+		if (block == nullptr)
+			return nullptr;
+		if (traffic)
+			sc.misses.fetch_add(1, std::memory_order_relaxed);
+		sc.created.fetch_add(1, std::memory_order_relaxed);
+		sc.lastUse.store(_epoch.fetch_add(1, std::memory_order_relaxed) + 1,
+						 std::memory_order_relaxed);
+		_bytesHeld.fetch_add((int64_t)block->capacity(), std::memory_order_relaxed);
+
+		if (traffic && _isWarm.load(std::memory_order_relaxed))
+			{
+			sc.lateMisses.fetch_add(1, std::memory_order_relaxed);
+			if (_abortOnMiss.load(std::memory_order_relaxed))
+				{
+				ERR << "Pool miss for" << size << "bytes after warm-up";
+				::abort();
+				}
+			}
+		}
+
+	/**************************************************************************\
+	|* Track the high-water mark of simultaneously-live blocks
+	\**************************************************************************/
+	if (traffic)
+		{
+		int64_t live	= sc.live.fetch_add(1, std::memory_order_relaxed) + 1;
+		int64_t high	= sc.highWater.load(std::memory_order_relaxed);
+		while ((live > high) &&
+			   !sc.highWater.compare_exchange_weak(high, live,
+												   std::memory_order_relaxed))
+			;
+		}
+
+	block->setSize(size);
+	block->setNext(nullptr);
+	block->retain();
+	return block;
+	}
+
+/******************************************************************************\
+|* Create a new block for a size-class, carving it from the arena if there is
+|* one with space left, otherwise from the heap. A shell left over from a trim
+|* is used in preference to a new DataBlock, so it keeps its handle
+\******************************************************************************/
+DataBlock * BlockPool::_create(int sizeClass)
+	{
+	size_t size			= classSize(sizeClass);
+	DataBlock *block	= nullptr;
+	bool isShell		= false;
+
+		{
+		QMutexLocker guard(&_shellLock);
+		if (!_shells.empty())
+			{
+			block	= _shells.back();
+			isShell	= true;
+			_shells.pop_back();
+			}
+		}
+
+	uint8_t *memory		= (_arena != nullptr) ? _arena->allocate(size) : nullptr;
+	if (block != nullptr)
+		block->reallocate(size, memory);
+	else if (memory != nullptr)
+		block = new DataBlock(memory, size, _isFFT);
+	else
+		block = new DataBlock(size, _isFFT);
+
+	if (!block->isValid())
+		{
+		ERR << "Cannot allocate block of" << size << "bytes";
+		if (isShell)
+			{
+			// Someone may still be looking at it from a depot pop
+			QMutexLocker guard(&_shellLock);
+			_shells.push_back(block);
+			}
+		else
+			delete block;
+		return nullptr;
+		}
+
+	block->setSizeClass(sizeClass);
+	return block;
+	}
+
+/******************************************************************************\
+|* Give a block back to the pool
+\******************************************************************************/
+void BlockPool::recycle(DataBlock *block)
+	{
+	int sizeClass = block->sizeClass();
+	if ((sizeClass < 0) || (sizeClass >= NUM_CLASSES))
+		{
+		ERR << "Asked to recycle a block with no size-class";
+		return;
+		}
+
+	_classes[sizeClass].live.fetch_sub(1, std::memory_order_relaxed);
+	if (!_cachePush(sizeClass, block))
+		_push(sizeClass, block);
+	}
+
+/******************************************************************************\
+|* Flush the calling thread's cache
+\******************************************************************************/
+void BlockPool::flushThreadCache(void)
+	{
+	if (_tls[_poolId].owner == this)
+		_tls[_poolId].flush();
+	}
+
+/******************************************************************************\
+|* Ask all threads to flush their caches. Relaxed is enough: a thread that
+|* sees the request late just keeps its blocks a little longer
+\******************************************************************************/
+void BlockPool::requestCacheFlush(void)
+	{
+	_flushes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Pre-allocate blocks. Take them out of the pool (allocating if need be), then
+|* put them all back on the shared depot so any thread can use them. None of
+|* this is client traffic, so it doesn't touch the hit/miss/live counters
+\******************************************************************************/
+void BlockPool::prewarm(size_t size, int count)
+	{
+	int sizeClass = classFor(size);
+	if ((sizeClass < 0) || (count <= 0))
+		return;
+
+	DataBlock **blocks = new DataBlock* [count];
+	int got = 0;
+	for (int i=0; i<count; i++)
+		if ((blocks[got] = _acquire(size, true, false)) != nullptr)
+			got ++;
+
+	for (int i=0; i<got; i++)
+		{
+		blocks[i]->release();
+		_push(sizeClass, blocks[i]);
+		}
+	delete [] blocks;
+	}
+
+/******************************************************************************\
+|* Mark the pool as warm
+\******************************************************************************/
+void BlockPool::setWarm(bool warm, bool abortOnMiss)
+	{
+	_abortOnMiss	= abortOnMiss;
+	_isWarm			= warm;
+	}
+
+/******************************************************************************\
+|* Trim parked blocks. Classes are visited oldest-use first, and by size
+|* (largest first) within the same epoch, so a burst of big transient blocks
+|* is the first thing to go. Blocks are popped from the depot, which is safe
+|* against concurrent acquires - at worst an acquire misses and creates a new
+|* block (and is then subject to the caller's budget check). If the depot
+|* runs dry while other threads still have blocks cached, they're asked to
+|* flush, so the next trim can have those
+\******************************************************************************/
+int64_t BlockPool::trim(int64_t bytes)
+	{
+	flushThreadCache();
+
+	std::vector<std::pair<int64_t, int>> order;
+	for (int i=0; i<NUM_CLASSES; i++)
+		if (_ptrOf(_classes[i].head.load(std::memory_order_relaxed)) != nullptr)
+			order.push_back({_classes[i].lastUse.load(std::memory_order_relaxed), -i});
+	std::sort(order.begin(), order.end());
+
+	int64_t freed = 0;
+	std::vector<DataBlock *> keep;
+	for (auto& entry : order)
+		{
+		int sizeClass	= -entry.second;
+		SizeClass& sc	= _classes[sizeClass];
+		DataBlock *block;
+		while ((freed < bytes) && ((block = _pop(sizeClass)) != nullptr))
+			{
+			if (block->isBorrowed())
+				{
+				keep.push_back(block);
+				continue;
+				}
+
+			int64_t size = (int64_t)block->capacity();
+			block->discard();
+			freed += size;
+			sc.trimmed.fetch_add(1, std::memory_order_relaxed);
+
+			QMutexLocker guard(&_shellLock);
+			_shells.push_back(block);
+			}
+
+		for (DataBlock *block : keep)
+			_push(sizeClass, block);
+		keep.clear();
+
+		if (freed >= bytes)
+			break;
+		}
+
+	_bytesHeld.fetch_sub(freed, std::memory_order_relaxed);
+	if ((freed < bytes) && (_bytesCached.load(std::memory_order_relaxed) > 0))
+		requestCacheFlush();
+	return freed;
+	}
+
+/******************************************************************************\
+|* Push a block onto a depot stack
+\******************************************************************************/
+void BlockPool::_push(int sizeClass, DataBlock *block)
+	{
+	std::atomic<uint64_t>& head = _classes[sizeClass].head;
+
+	uint64_t old = head.load(std::memory_order_relaxed);
+	uint64_t now;
+	do
+		{
+		block->setNext(_ptrOf(old));
+		now = _pack(block, old);
+		}
+	while (!head.compare_exchange_weak(old, now,
+									   std::memory_order_release,
+									   std::memory_order_relaxed));
+	}
+
+/******************************************************************************\
+|* Pop a block off a depot stack, or return nullptr if it is empty. Blocks are
+|* never deleted while the pool is running, so reading next() from a block
+|* that was popped by another thread in the meantime is safe - the tag makes
+|* the CAS fail in that case
+\******************************************************************************/
+DataBlock * BlockPool::_pop(int sizeClass)
+	{
+	std::atomic<uint64_t>& head = _classes[sizeClass].head;
+
+	uint64_t old = head.load(std::memory_order_acquire);
+	DataBlock *block;
+	while ((block = _ptrOf(old)) != nullptr)
+		{
+		uint64_t now = _pack(block->next(), old);
+		if (head.compare_exchange_weak(old, now,
+									   std::memory_order_acquire,
+									   std::memory_order_acquire))
+			break;
+		}
+	return block;
+	}
+
+/******************************************************************************\
+|* Pop a block from the calling thread's cache
+\******************************************************************************/
+DataBlock * BlockPool::_cachePop(int sizeClass)
+	{
+	ThreadCache& tc = _tls[_poolId];
+	if (tc.owner != this)
+		return nullptr;
+
+	tc.honourFlush();
+	if (tc.count[sizeClass] == 0)
+		return nullptr;
+
+	DataBlock *block = tc.blocks[sizeClass][--tc.count[sizeClass]];
+	_bytesCached.fetch_sub((int64_t)block->capacity(), std::memory_order_relaxed);
+	return block;
+	}
+
+/******************************************************************************\
+|* Push a block onto the calling thread's cache, if there's room
+\******************************************************************************/
+bool BlockPool::_cachePush(int sizeClass, DataBlock *block)
+	{
+	ThreadCache& tc = _tls[_poolId];
+	if (tc.owner != this)
+		{
+		if (tc.owner != nullptr)
+			tc.flush();
+		tc.owner	= this;
+		tc.flushes	= _flushes.load(std::memory_order_relaxed);
+		}
+	else
+		tc.honourFlush();
+
+	if (tc.count[sizeClass] >= CACHE_DEPTH)
+		return false;
+
+	tc.blocks[sizeClass][tc.count[sizeClass]++] = block;
+	_bytesCached.fetch_add((int64_t)block->capacity(), std::memory_order_relaxed);
+	return true;
+	}
+
+/******************************************************************************\
+|* Return the counters for a single class
+\******************************************************************************/
+BlockPool::Stats BlockPool::stats(int sizeClass)
+	{
+	SizeClass& sc = _classes[sizeClass];
+	Stats stats;
+	stats.hits		= sc.hits.load(std::memory_order_relaxed);
+	stats.misses	= sc.misses.load(std::memory_order_relaxed);
+	stats.live		= sc.live.load(std::memory_order_relaxed);
+	stats.highWater	= sc.highWater.load(std::memory_order_relaxed);
+	stats.created	= sc.created.load(std::memory_order_relaxed);
+	stats.lateMisses= sc.lateMisses.load(std::memory_order_relaxed);
+	stats.trimmed	= sc.trimmed.load(std::memory_order_relaxed);
+	return stats;
+	}
+
+/******************************************************************************\
+|* Return the counters summed over all classes. The high-water mark is the sum
+|* of the per-class marks, so is an upper bound on the simultaneous total
+\******************************************************************************/
+BlockPool::Stats BlockPool::stats(void)
+	{
+	Stats total = {0, 0, 0, 0, 0, 0, 0};
+	for (int i=0; i<NUM_CLASSES; i++)
+		{
+		Stats sc = stats(i);
+		total.hits		+= sc.hits;
+		total.misses	+= sc.misses;
+		total.live		+= sc.live;
+		total.highWater	+= sc.highWater;
+		total.created	+= sc.created;
+		total.lateMisses+= sc.lateMisses;
+		total.trimmed	+= sc.trimmed;
+		}
+	return total;
+	}
@@ -0,0 +1,191 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <QMutex>
+
+#include "properties.h"
+
+class Arena;
+class DataBlock;
+
+/******************************************************************************\
+|* A size-class slab pool of DataBlocks. Requests are rounded up to one of a set
+|* of size-classes (four per power-of-two), and released blocks are parked on a
+|* small per-thread cache first, then on a lock-free per-class depot. Nothing
+|* on the hit path takes a lock - only a miss (which has to allocate anyway)
+|* touches the heap.
+|*
+|* There is one pool for plain blocks and one for fftw-aligned blocks, so the
+|* two kinds of memory are never handed out in place of each other.
+|*
+|* Parked blocks can be trimmed to give memory back. A trimmed block loses its
+|* memory but the DataBlock object itself is kept (lock-free pops may still be
+|* reading it) and is re-used as the shell for the next block created. Blocks
+|* in another thread's cache can't be reached from here, so a trim that comes
+|* up short asks every thread to flush its cache back to the depot, which each
+|* does on its next acquire or release from the pool.
+\******************************************************************************/
+class BlockPool
+	{
+	NON_COPYABLE_NOR_MOVEABLE(BlockPool);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			MIN_SHIFT		= 6,		// Smallest class is 64 bytes
+			MAX_SHIFT		= 36,		// Largest class is 64 GiB
+			STEPS			= 4,		// Size-classes per power of two
+			NUM_CLASSES		= 1 + (MAX_SHIFT - MIN_SHIFT) * STEPS,
+			CACHE_DEPTH		= 8,		// Blocks per class per thread
+			MAX_POOLS		= 2			// Plain and FFT
+			};
+
+		typedef struct
+			{
+			int64_t		hits;			// Requests served from the pool
+			int64_t		misses;			// Requests that had to allocate
+			int64_t		live;			// Blocks currently handed out
+			int64_t		highWater;		// Maximum simultaneous live blocks
+			int64_t		created;		// Blocks ever allocated
+			int64_t		lateMisses;		// Misses after the pool was warmed
+			int64_t		trimmed;		// Blocks given back by trim()
+			} Stats;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(bool, isFFT);					// Pool hands out fftw-aligned blocks
+	GET(int, poolId);					// Index into the per-thread caches
+	GET(std::atomic<bool>, isWarm);		// Pre-warmed: misses are unexpected
+	GET(std::atomic<bool>, abortOnMiss);	// Stop dead on a late miss
+	GETSET(Arena *, arena, Arena);		// Backing arena, or nullptr for heap
+	GET(std::atomic<int64_t>, bytesHeld);	// Bytes in live + parked blocks
+	GET(std::atomic<int64_t>, bytesCached);	// Of those, in thread caches
+
+	private:
+		/**********************************************************************\
+		|* A lock-free stack of blocks plus the counters for one size-class.
+		|* The head is a tagged pointer (16-bit ABA tag in the top bits, which
+		|* are unused in user-space addresses on x86-64 and aarch64). Aligned
+		|* so that classes don't false-share.
+		\**********************************************************************/
+		struct alignas(64) SizeClass
+			{
+			std::atomic<uint64_t>	head;
+			std::atomic<int64_t>	hits;
+			std::atomic<int64_t>	misses;
+			std::atomic<int64_t>	live;
+			std::atomic<int64_t>	highWater;
+			std::atomic<int64_t>	created;
+			std::atomic<int64_t>	lateMisses;
+			std::atomic<int64_t>	trimmed;
+			std::atomic<int64_t>	lastUse;	// Epoch of the last acquire
+			};
+
+		SizeClass					_classes[NUM_CLASSES];
+		QMutex						_shellLock;	// Guards _shells
+		std::vector<DataBlock *>	_shells;	// Trimmed, memory-less blocks
+
+		std::atomic<int64_t>		_flushes;	// Cache flushes requested
+
+		static std::atomic<int64_t>	_epoch;		// Advances on every miss
+
+		/**********************************************************************\
+		|* Private methods - depot push/pop
+		\**********************************************************************/
+		void _push(int sizeClass, DataBlock *block);
+		DataBlock * _pop(int sizeClass);
+
+		/**********************************************************************\
+		|* Private methods - per-thread cache access
+		\**********************************************************************/
+		DataBlock * _cachePop(int sizeClass);
+		bool _cachePush(int sizeClass, DataBlock *block);
+
+		/**********************************************************************\
+		|* Private methods - allocate a new block, from the arena if possible
+		\**********************************************************************/
+		DataBlock * _create(int sizeClass);
+
+		/**********************************************************************\
+		|* Private methods - obtain a block, counting it as traffic (hits,
+		|* misses, live blocks) only if 'traffic' is set
+		\**********************************************************************/
+		DataBlock * _acquire(size_t size, bool mayCreate, bool traffic);
+
+		friend struct ThreadCache;
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit BlockPool(int poolId, bool isFFT);
+		~BlockPool(void);
+
+		/**********************************************************************\
+		|* Map a byte-size to a size-class and back
+		\**********************************************************************/
+		static int classFor(size_t size);
+		static size_t classSize(int sizeClass);
+
+		/**********************************************************************\
+		|* Obtain a block able to hold 'size' bytes. The block is retained once
+		|* on return. Returns nullptr if the allocation fails, or if there's
+		|* nothing parked and mayCreate is false
+		\**********************************************************************/
+		DataBlock * acquire(size_t size, bool mayCreate = true);
+
+		/**********************************************************************\
+		|* Return a block (whose ref-count has reached 0) to the pool
+		\**********************************************************************/
+		void recycle(DataBlock *block);
+
+		/**********************************************************************\
+		|* Flush the calling thread's cache for this pool back to the depot
+		\**********************************************************************/
+		void flushThreadCache(void);
+
+		/**********************************************************************\
+		|* Ask every thread to flush its cache for this pool, which each one
+		|* does the next time it acquires or releases a block from it
+		\**********************************************************************/
+		void requestCacheFlush(void);
+
+		/**********************************************************************\
+		|* Make sure at least 'count' blocks big enough for 'size' bytes are
+		|* available, allocating them now rather than on the hot path
+		\**********************************************************************/
+		void prewarm(size_t size, int count);
+
+		/**********************************************************************\
+		|* Mark the pool as warmed-up (so misses are counted as late), and
+		|* optionally abort on a late miss
+		\**********************************************************************/
+		void setWarm(bool warm, bool abortOnMiss);
+
+		/**********************************************************************\
+		|* Give back up to 'bytes' of parked memory, least-recently used size
+		|* classes first and the largest blocks first within the same epoch.
+		|* Arena blocks are left alone (freeing those wouldn't return anything).
+		|* The calling thread's cache is flushed first; if that still isn't
+		|* enough, the other threads are asked to flush theirs so that a later
+		|* trim can reach those blocks. Returns the bytes freed
+		\**********************************************************************/
+		int64_t trim(int64_t bytes);
+
+		/**********************************************************************\
+		|* Return the counters, summed over all classes or for one class
+		\**********************************************************************/
+		Stats stats(void);
+		Stats stats(int sizeClass);
+	};
+
+#endif // BLOCKPOOL_H
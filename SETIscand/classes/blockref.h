@@ -0,0 +1,182 @@
+#ifndef BLOCKREF_H
+#define BLOCKREF_H
+
+#include <cstddef>
+#include <utility>
+
+#include <QMetaType>
+#include <fftw3.h>
+
+#include "datablock.h"
+
+/******************************************************************************\
+|* Non-template part of BlockRef - the hand-off back to the DataMgr pools
+\******************************************************************************/
+class BlockRefBase
+	{
+	protected:
+		static void _release(DataBlock *block);
+	};
+
+/******************************************************************************\
+|* A typed, counted reference to a pooled DataBlock. The data pointer is held
+|* directly so there's no handle lookup on access, and the block goes back to
+|* its pool when the last reference is dropped.
+|*
+|* Moving a BlockRef transfers the reference. Copying takes another (atomic)
+|* reference on the block - that's what lets a ref travel through a queued
+|* signal, since Qt copies the arguments of queued connections.
+\******************************************************************************/
+template <typename T>
+class BlockRef : public BlockRefBase
+	{
+	template <typename U> friend class BlockRef;
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		DataBlock *		_block;			// Block we hold a reference on
+		T *				_data;			// Typed view of the block's data
+
+	public:
+		/**********************************************************************\
+		|* Constructors - the empty ref, and adopting an existing reference
+		\**********************************************************************/
+		BlockRef(void)
+			:_block(nullptr)
+			,_data(nullptr)
+			{}
+
+		explicit BlockRef(DataBlock *block)
+			:_block(block)
+			,_data(block ? reinterpret_cast<T *>(block->data()) : nullptr)
+			{}
+
+		/**********************************************************************\
+		|* Copy and move
+		\**********************************************************************/
+		BlockRef(const BlockRef& other)
+			:_block(other._block)
+			,_data(other._data)
+			{
+			if (_block != nullptr)
+				_block->retain();
+			}
+
+		BlockRef(BlockRef&& other) noexcept
+			:_block(other._block)
+			,_data(other._data)
+			{
+			other._block	= nullptr;
+			other._data		= nullptr;
+			}
+
+		BlockRef& operator=(const BlockRef& other)
+			{
+			if (this != &other)
+				{
+				if (other._block != nullptr)
+					other._block->retain();
+				reset();
+				_block	= other._block;
+				_data	= other._data;
+				}
+			return *this;
+			}
+
+		BlockRef& operator=(BlockRef&& other) noexcept
+			{
+			if (this != &other)
+				{
+				reset();
+				_block			= other._block;
+				_data			= other._data;
+				other._block	= nullptr;
+				other._data		= nullptr;
+				}
+			return *this;
+			}
+
+		/**********************************************************************\
+		|* Destructor - drop our reference
+		\**********************************************************************/
+		~BlockRef(void)
+			{
+			reset();
+			}
+
+		/**********************************************************************\
+		|* Drop the reference, leaving this ref empty
+		\**********************************************************************/
+		void reset(void)
+			{
+			if (_block != nullptr)
+				_release(_block);
+			_block	= nullptr;
+			_data	= nullptr;
+			}
+
+		/**********************************************************************\
+		|* Re-interpret the block as a different element type
+		\**********************************************************************/
+		template <typename U>
+		BlockRef<U> as(void) const &
+			{
+			if (_block != nullptr)
+				_block->retain();
+			return BlockRef<U>(_block);
+			}
+
+		template <typename U>
+		BlockRef<U> as(void) &&
+			{
+			DataBlock *block	= _block;
+			_block				= nullptr;
+			_data				= nullptr;
+			return BlockRef<U>(block);
+			}
+
+		/**********************************************************************\
+		|* Accessors
+		\**********************************************************************/
+		inline T * data(void) const
+			{
+			return _data;
+			}
+		inline T& operator[](size_t idx) const
+			{
+			return _data[idx];
+			}
+		inline size_t size(void) const
+			{
+			return (_block != nullptr) ? _block->size() : 0;
+			}
+		inline size_t count(void) const
+			{
+			return size() / sizeof(T);
+			}
+		inline bool isValid(void) const
+			{
+			return _data != nullptr;
+			}
+		inline explicit operator bool(void) const
+			{
+			return _data != nullptr;
+			}
+		inline int64_t handle(void) const
+			{
+			return (_block != nullptr) ? _block->handle() : -1;
+			}
+		inline DataBlock * block(void) const
+			{
+			return _block;
+			}
+	};
+
+Q_DECLARE_METATYPE(BlockRef<uint8_t>)
+Q_DECLARE_METATYPE(BlockRef<double>)
+Q_DECLARE_METATYPE(BlockRef<fftw_complex>)
+Q_DECLARE_METATYPE(BlockRef<fftwf_complex>)
+
+#endif // BLOCKREF_H
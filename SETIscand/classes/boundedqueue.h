@@ -0,0 +1,276 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Non-template part of BoundedQueue - the counters it reports
+\******************************************************************************/
+class BoundedQueueBase
+	{
+	public:
+		typedef struct
+			{
+			int64_t		depth;			// Items waiting now
+			int64_t		highWater;		// Most items ever waiting at once
+			int64_t		capacity;		// Most items it can hold
+			int64_t		pushed;			// Items handed over
+			int64_t		full;			// Items refused with the queue full
+			} Stats;
+	};
+
+/******************************************************************************\
+|* A bounded, lock-free, multi-producer / multi-consumer queue, to carry work
+|* between the stages of the DSP engine. It's the array-based design where
+|* each cell carries a sequence number saying whether it is free for the
+|* producer of that lap or full for its consumer, so producers and consumers
+|* only contend on their own index, with one CAS each per item.
+|*
+|* push() never waits: if the queue is full the item is refused and counted,
+|* and the caller decides what to drop. Consumers can wait() for an item.
+|* They sleep on an eventfd, which a producer only writes to if someone is
+|* asleep, so a busy queue makes no system calls. Items are moved in and out,
+|* so a queue of BlockRefs doesn't hold on to blocks it has handed over.
+\******************************************************************************/
+template <typename T>
+class BoundedQueue : public BoundedQueueBase
+	{
+	NON_COPYABLE_NOR_MOVEABLE(BoundedQueue);
+
+	public:
+		enum
+			{
+			CACHE_LINE		= 64
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(const char *, name);			// What to call it in the logs
+	GET(size_t, capacity);				// Cells in the queue, a power of two
+
+	private:
+		/**********************************************************************\
+		|* A cell: free for the producer at position p when its sequence is p,
+		|* and full for the consumer at p when it is p+1
+		\**********************************************************************/
+		struct alignas(CACHE_LINE) Cell
+			{
+			std::atomic<size_t>	seq;
+			T					item;
+			};
+
+		/**********************************************************************\
+		|* Private variables - the cells, and each side's index on its own
+		|* cache line
+		\**********************************************************************/
+		Cell *					_cells;
+		size_t					_mask;
+
+		alignas(CACHE_LINE)
+		std::atomic<size_t>		_head;		// Next position to push to
+		std::atomic<int64_t>	_full;
+		std::atomic<int64_t>	_highWater;
+
+		alignas(CACHE_LINE)
+		std::atomic<size_t>		_tail;		// Next position to pop from
+
+		alignas(CACHE_LINE)
+		std::atomic<int>		_sleepers;	// Consumers (about to be) asleep
+		int						_eventFd;	// What they sleep on
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. The capacity is rounded up to a power of
+		|* two, and is at least 2
+		\**********************************************************************/
+		explicit BoundedQueue(size_t capacity, const char *name = "queue")
+			:_name(name)
+			,_capacity(2)
+			,_head(0)
+			,_full(0)
+			,_highWater(0)
+			,_tail(0)
+			,_sleepers(0)
+			{
+			while (_capacity < capacity)
+				_capacity <<= 1;
+			_mask	= _capacity - 1;
+			_cells	= new Cell[_capacity];
+			for (size_t i=0; i<_capacity; i++)
+				_cells[i].seq.store(i, std::memory_order_relaxed);
+
+			_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+			}
+
+		~BoundedQueue(void)
+			{
+			delete [] _cells;
+			if (_eventFd >= 0)
+				::close(_eventFd);
+			}
+
+		/**********************************************************************\
+		|* Producer: hand an item over. Returns false, leaving the item where
+		|* it is, if the queue is full. Publishing the cell and reading
+		|* _sleepers are both sequentially consistent, pairing with wait(),
+		|* so either a consumer going to sleep sees the item or it is woken
+		\**********************************************************************/
+		bool push(T&& item)
+			{
+			Cell *cell;
+			size_t pos = _head.load(std::memory_order_relaxed);
+			for (;;)
+				{
+				cell			= &_cells[pos & _mask];
+				size_t seq		= cell->seq.load(std::memory_order_acquire);
+				intptr_t diff	= (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+					{
+					if (_head.compare_exchange_weak(pos, pos + 1,
+													std::memory_order_relaxed))
+						break;
+					}
+				else if (diff < 0)
+					{
+					_full.fetch_add(1, std::memory_order_relaxed);
+					return false;
+					}
+				else
+					pos = _head.load(std::memory_order_relaxed);
+				}
+
+			cell->item = std::move(item);
+			cell->seq.store(pos + 1, std::memory_order_seq_cst);
+
+			int64_t depth	= (int64_t)(pos + 1 - _tail.load(std::memory_order_relaxed));
+			int64_t high	= _highWater.load(std::memory_order_relaxed);
+			while ((depth > high)
+				   && !_highWater.compare_exchange_weak(high, depth,
+														std::memory_order_relaxed))
+				;
+
+			if (_sleepers.load(std::memory_order_seq_cst) > 0)
+				_wake(1);
+			return true;
+			}
+
+		/**********************************************************************\
+		|* Consumer: take the oldest item, if there is one, without waiting
+		\**********************************************************************/
+		bool pop(T& item)
+			{
+			Cell *cell;
+			size_t pos = _tail.load(std::memory_order_relaxed);
+			for (;;)
+				{
+				cell			= &_cells[pos & _mask];
+				size_t seq		= cell->seq.load(std::memory_order_acquire);
+				intptr_t diff	= (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0)
+					{
+					if (_tail.compare_exchange_weak(pos, pos + 1,
+													std::memory_order_relaxed))
+						break;
+					}
+				else if (diff < 0)
+					return false;
+				else
+					pos = _tail.load(std::memory_order_relaxed);
+				}
+
+			item = std::move(cell->item);
+			cell->seq.store(pos + _mask + 1, std::memory_order_release);
+			return true;
+			}
+
+		/**********************************************************************\
+		|* Consumer: take the oldest item, waiting up to timeoutMs for one.
+		|* Returns false on timeout, or when woken by wakeAll()
+		\**********************************************************************/
+		bool wait(T& item, int timeoutMs)
+			{
+			if (pop(item))
+				return true;
+
+			_sleepers.fetch_add(1, std::memory_order_seq_cst);
+			size_t pos	= _tail.load(std::memory_order_relaxed);
+			bool ready	= _cells[pos & _mask].seq.load(std::memory_order_seq_cst)
+						== pos + 1;
+			if (!(ready && pop(item)))
+				{
+				struct pollfd pfd = {_eventFd, POLLIN, 0};
+				if (::poll(&pfd, 1, timeoutMs) > 0)
+					{
+					uint64_t value;
+					ssize_t rc = ::read(_eventFd, &value, sizeof(value));
+					(void)rc;
+					}
+				_sleepers.fetch_sub(1, std::memory_order_relaxed);
+				return pop(item);
+				}
+			_sleepers.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+			}
+
+		/**********************************************************************\
+		|* Wake every consumer that is waiting, eg: so they can see a stop
+		\**********************************************************************/
+		void wakeAll(void)
+			{
+			int sleepers = _sleepers.load(std::memory_order_seq_cst);
+			if (sleepers > 0)
+				_wake(sleepers);
+			}
+
+		/**********************************************************************\
+		|* Return the number of items waiting, and the counters
+		\**********************************************************************/
+		int64_t depth(void) const
+			{
+			int64_t depth = (int64_t)(_head.load(std::memory_order_relaxed)
+									- _tail.load(std::memory_order_relaxed));
+			return (depth < 0) ? 0 : depth;
+			}
+
+		Stats stats(void) const
+			{
+			Stats s;
+			s.depth		= depth();
+			s.highWater	= _highWater.load(std::memory_order_relaxed);
+			s.capacity	= (int64_t)_capacity;
+			s.pushed	= (int64_t)_head.load(std::memory_order_relaxed);
+			s.full		= _full.load(std::memory_order_relaxed);
+			return s;
+			}
+
+		/**********************************************************************\
+		|* Return whether it was set up ok (the eventfd was created)
+		\**********************************************************************/
+		inline bool isValid(void) const
+			{
+			return _eventFd >= 0;
+			}
+
+	private:
+		/**********************************************************************\
+		|* Let 'count' sleeping consumers go
+		\**********************************************************************/
+		void _wake(int count)
+			{
+			uint64_t value	= (uint64_t)count;
+			ssize_t rc		= ::write(_eventFd, &value, sizeof(value));
+			(void)rc;
+			}
+	};
+
+#endif // BOUNDEDQUEUE_H
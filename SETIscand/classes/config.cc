@@ -1,15 +1,24 @@
+#include <algorithm>
+#include <cmath>
+
 #include <QCoreApplication>
 #include <QObject>
 #include <QSettings>
+#include <QStandardPaths>
 
+#include "arena.h"
 #include "config.h"
+#include "dspengine.h"
+#include "taskfft.h"
 
 /******************************************************************************\
 |* These are the keys we look for in the config file
 \******************************************************************************/
 #define RADIO_GROUP			"radio"
 #define DSP_GROUP			"dsp"
+#define MEMORY_GROUP		"memory"
 #define NETWORK_GROUP		"network"
+#define RECORD_GROUP		"record"
 
 #define DRIVER_KEY			"filter-driver"
 #define MODEL_KEY			"filter-model"
@@ -22,9 +31,33 @@
 
 #define FFT_WINDOW_TYPE_KEY	"fft-window-type"
 #define FFT_SIZE_KEY		"fft-size"
+#define FFT_OVERLAP_KEY		"fft-overlap"
+#define FFT_PRECISION_KEY	"fft-precision"
+#define FFT_BATCH_KEY		"fft-batch"
+#define FFT_WISDOM_KEY		"fft-wisdom-dir"
+#define FFT_MAX_SKEW_KEY	"fft-max-skew"
+#define FFT_PFB_TAPS_KEY	"fft-pfb-taps"
+#define FFT_THREADS_KEY		"fft-threads"
 #define UPDATE_TIME_KEY		"fft-update-time"
 #define SAMPLE_TIME_KEY		"fft-sample-time"
 
+#define DSP_THREADS_KEY		"dsp-threads"
+#define DSP_CPUS_KEY		"dsp-cpus"
+#define SUBBANDS_KEY		"subbands"
+
+#define FRAMES_IN_FLIGHT_KEY "frames-in-flight"
+#define RING_SLOTS_KEY		"ring-slots"
+
+#define ARENA_SIZE_KEY		"arena-size"
+#define ARENA_PAGES_KEY		"arena-pages"
+#define ARENA_LOCK_KEY		"arena-lock"
+#define ARENA_NUMA_KEY		"arena-numa-node"
+#define MEMORY_BUDGET_KEY	"memory-budget"
+
+#define RECORD_DIR_KEY		"record-dir"
+#define RECORD_SIZE_KEY		"record-rotate-size"
+#define RECORD_TIME_KEY		"record-rotate-time"
+
 #define DEFAULT_FFT_SIZE	"1024"
 
 #define NET_PORT_KEY		"network-port"
@@ -39,6 +72,24 @@ Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_antenna,
 		(ANTENNA_KEY, "Antenna to use (name or index)", "0"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_arenaSize,
+		(ARENA_SIZE_KEY, "Size of the block arena in MiB (0=none)", "0"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_arenaPages,
+		(ARENA_PAGES_KEY, "Arena page size: 4k, 2m or 1g", "2m"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_arenaLock,
+		(ARENA_LOCK_KEY, "Lock the arena into RAM"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_arenaNuma,
+		(ARENA_NUMA_KEY, "Bind the arena to a NUMA node: none, auto or N", "none"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_dspCpus,
+		(DSP_CPUS_KEY, "CPUs to pin the FFT workers to: auto, none or a list (eg: 2-5,7)", "auto"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_dspThreads,
+		(DSP_THREADS_KEY, "Number of FFT threads, shared by the workers (0=auto)", "0"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_driverFilter,
 		(DRIVER_KEY, "Filter for the driver name", "sdrplay"))
@@ -54,18 +105,89 @@ Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_fftSize,
 		({"n", "fft-num-bins"}, "Size of the FFT in bins", DEFAULT_FFT_SIZE))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftBatch,
+		(FFT_BATCH_KEY, "FFT frames per task (0=auto)", "0"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftMaxSkew,
+		(FFT_MAX_SKEW_KEY, "Most FFT frames to wait out of order before giving up on one (0=auto)", "0"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftOverlap,
+		(FFT_OVERLAP_KEY, "FFT frame overlap, as a percentage (eg: 50%) or a hop in samples", "0%"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftPfbTaps,
+		(FFT_PFB_TAPS_KEY, "Taps per branch of the polyphase filter bank (with -w pfb)", "4"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftPrecision,
+		(FFT_PRECISION_KEY, "FFT precision: double or single", "double"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftThreads,
+		(FFT_THREADS_KEY, "Threads each FFT runs on (0=auto: all the DSP cores from 2^20 bins)", "0"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_fftWindow,
 		({"w", "fft-window-type"}, "Window-type for FFT", "hamming"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_fftWisdom,
+		(FFT_WISDOM_KEY, "Directory to keep FFTW wisdom in (none=don't)", "dir"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_framesInFlight,
+		(FRAMES_IN_FLIGHT_KEY, "FFT frames in flight, to size the pools (0=auto)", "0"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_gain,
 		({"g", "gain"}, "Gain to apply"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_memoryBudget,
+		(MEMORY_BUDGET_KEY, "Most memory the block pools may hold, in MiB (0=unlimited)", "0"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_networkPort,
 		({"p", "network-port"}, "Network port to communicate over", "5417"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_recordDir,
+		(RECORD_DIR_KEY, "Record the raw IQ to SigMF files in this directory", "dir"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_recordSize,
+		(RECORD_SIZE_KEY, "Start a new recording after this many MiB (0=never)", "1024"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_recordTime,
+		(RECORD_TIME_KEY, "Start a new recording after this many seconds (0=never)", "0"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_replay,
+		("replay", "Replay a recording (raw IQ or SigMF) instead of using a radio", "file"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_replayFormat,
+		("replay-format", "Sample format of a raw recording: cs8, cu8, cs12, cs16 or cf32", "format"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_replayFast,
+		("replay-fast", "Replay as fast as possible rather than in real time"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_ringSlots,
+		(RING_SLOTS_KEY, "Device buffers queued for processing before dropping", "16"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_sampleRate,
 		({"s", "sample-rate"}, "Baseband Sample rate", "2048000"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_subbands,
+		(SUBBANDS_KEY, "Sub-bands to zoom in on, as offset-Hz:decimation (eg: 150000:32,-80000:64)", "list", "none"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synth,
+		("synth", "Use a synthetic signal generator instead of a radio"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synthFast,
+		("synth-fast", "Generate as fast as possible rather than in real time"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synthFormat,
+		("synth-format", "Synthetic sample format: cs8, cs16 or cf32", "format", "cs16"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synthNoise,
+		("synth-noise", "Synthetic noise sigma, relative to full scale", "sigma", "0.05"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synthSeed,
+		("synth-seed", "Seed for the synthetic noise", "seed", "1"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_synthSignal,
+		("synth-signal", "Add a synthetic signal (repeatable): tone:Hz:amp, "
+		 "drift:Hz:Hz/s:amp, pulse:Hz:amp:period:width or rfi:amp:period:width",
+		 "spec"))
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_timeSample,
 		({"t", "time-between-samples"}, "Time to aggregate data over", "300"))
@@ -100,6 +222,15 @@ Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 		_listNativeFormat,
 		("list-native-format", "List native streaming format and exit"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_strictAlloc,
+		("strict-alloc", "Count pipeline heap allocations after warm-up"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_strictAllocAbort,
+		("strict-alloc-abort", "Abort on any pipeline heap allocation after warm-up"))
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+		_selfTest,
+		("self-test", "Run the internal tests and exit"))
 
 /******************************************************************************\
 |* Read configuration from both commandline and settings
@@ -109,10 +240,24 @@ Config::Config()
 	{
 	_parser.setApplicationDescription("Seti scanning daemon");
 	_parser.addOption(*_antenna);
+	_parser.addOption(*_arenaLock);
+	_parser.addOption(*_arenaNuma);
+	_parser.addOption(*_arenaPages);
+	_parser.addOption(*_arenaSize);
 	_parser.addOption(*_driverFilter);
+	_parser.addOption(*_dspCpus);
+	_parser.addOption(*_dspThreads);
 	_parser.addOption(*_idFilter);
 	_parser.addOption(*_frequency);
+	_parser.addOption(*_fftBatch);
+	_parser.addOption(*_fftMaxSkew);
+	_parser.addOption(*_fftOverlap);
+	_parser.addOption(*_fftPfbTaps);
+	_parser.addOption(*_fftPrecision);
 	_parser.addOption(*_fftSize);
+	_parser.addOption(*_fftThreads);
+	_parser.addOption(*_fftWisdom);
+	_parser.addOption(*_framesInFlight);
 	_parser.addOption(*_gain);
 	_parser.addOption(*_help);
 	_parser.addOption(*_listAllInfo);
@@ -123,9 +268,27 @@ Config::Config()
 	_parser.addOption(*_listGains);
 	_parser.addOption(*_listNativeFormat);
 	_parser.addOption(*_listSampleRates);
+	_parser.addOption(*_memoryBudget);
 	_parser.addOption(*_modeFilter);
 	_parser.addOption(*_networkPort);
+	_parser.addOption(*_recordDir);
+	_parser.addOption(*_recordSize);
+	_parser.addOption(*_recordTime);
+	_parser.addOption(*_replay);
+	_parser.addOption(*_replayFast);
+	_parser.addOption(*_replayFormat);
+	_parser.addOption(*_ringSlots);
 	_parser.addOption(*_sampleRate);
+	_parser.addOption(*_selfTest);
+	_parser.addOption(*_strictAlloc);
+	_parser.addOption(*_strictAllocAbort);
+	_parser.addOption(*_subbands);
+	_parser.addOption(*_synth);
+	_parser.addOption(*_synthFast);
+	_parser.addOption(*_synthFormat);
+	_parser.addOption(*_synthNoise);
+	_parser.addOption(*_synthSeed);
+	_parser.addOption(*_synthSignal);
 	_parser.addOption(*_timeSample);
 	_parser.addOption(*_timeUpdate);
 	_parser.addOption(*_version);
@@ -140,7 +303,8 @@ Config::Config()
 		fprintf(stderr, "%s\n\n"
 			"Window types for the FFT can be (use name or index):\n"
 			" 0: Rectangle     1: Hamming      2: Hanning\n"
-			" 3: Blackman      4: Welch        5: Parzen\n\n"
+			" 3: Blackman      4: Welch        5: Parzen\n"
+			" 6: PFB (polyphase filter bank, see --fft-pfb-taps)\n\n"
 			,qUtf8Printable(help)
 			);
 		exit(0);
@@ -318,6 +482,454 @@ int Config::fftSize(void)
 	return rate.toInt();
 	}
 
+/******************************************************************************\
+|* Get the hop between the starts of successive FFT frames. The overlap is
+|* either a percentage of the frame (0%, 50%, 75%...) or the hop itself, in
+|* samples. Every overlapping frame costs another conversion pass over the
+|* samples, so the hop is kept to at least 1/16 of the frame
+\******************************************************************************/
+int Config::fftHop(void)
+	{
+	QString overlap = "0%";
+	if (_parser.isSet(*_fftOverlap))
+		overlap = _parser.value(*_fftOverlap);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		overlap = s.value(FFT_OVERLAP_KEY, "0%").toString();
+		s.endGroup();
+		}
+
+	int size	= fftSize();
+	int hop		= size;
+	overlap		= overlap.trimmed();
+	if (overlap.endsWith("%"))
+		{
+		double percent = overlap.chopped(1).toDouble();
+		hop = (int) lround(size * (100.0 - percent) / 100.0);
+		}
+	else
+		hop = overlap.toInt();
+
+	int least = std::max(size / 16, 1);
+	if ((hop < least) || (hop > size))
+		{
+		qWarning() << "FFT overlap" << overlap << "is out of range, using"
+				   << ((hop < least) ? least : size) << "sample hop";
+		hop = (hop < least) ? least : size;
+		}
+	return hop;
+	}
+
+/******************************************************************************\
+|* Get the number of FFT frames per task. A task marks which of its frames a
+|* worker has summed with a bit each, so it can't hold more than MAX_BATCH
+\******************************************************************************/
+int Config::fftBatch(void)
+	{
+	QString batch = "0";
+	if (_parser.isSet(*_fftBatch))
+		batch = _parser.value(*_fftBatch);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		batch = s.value(FFT_BATCH_KEY, "0").toString();
+		s.endGroup();
+		}
+
+	int frames = batch.toInt();
+	if (frames > TaskFFT::MAX_BATCH)
+		{
+		qWarning() << "FFT batch of" << frames << "frames is too large, using"
+				   << (int)TaskFFT::MAX_BATCH;
+		frames = TaskFFT::MAX_BATCH;
+		}
+	return frames;
+	}
+
+/******************************************************************************\
+|* Get the most FFT frames to wait out of order
+\******************************************************************************/
+int Config::fftMaxSkew(void)
+	{
+	if (_parser.isSet(*_fftMaxSkew))
+		return _parser.value(*_fftMaxSkew).toInt();
+
+	QSettings s;
+	s.beginGroup(DSP_GROUP);
+	QString skew = s.value(FFT_MAX_SKEW_KEY, "0").toString();
+	s.endGroup();
+	return skew.toInt();
+	}
+
+/******************************************************************************\
+|* Get the threads each FFT runs on
+\******************************************************************************/
+int Config::fftThreads(void)
+	{
+	if (_parser.isSet(*_fftThreads))
+		return _parser.value(*_fftThreads).toInt();
+
+	QSettings s;
+	s.beginGroup(DSP_GROUP);
+	QString threads = s.value(FFT_THREADS_KEY, "0").toString();
+	s.endGroup();
+	return threads.toInt();
+	}
+
+/******************************************************************************\
+|* Get the taps per branch of the polyphase filter bank
+\******************************************************************************/
+int Config::fftPfbTaps(void)
+	{
+	QString taps = "4";
+	if (_parser.isSet(*_fftPfbTaps))
+		taps = _parser.value(*_fftPfbTaps);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		taps = s.value(FFT_PFB_TAPS_KEY, "4").toString();
+		s.endGroup();
+		}
+
+	int count = taps.toInt();
+	if (count < 1)
+		{
+		qWarning() << "Polyphase filter bank needs at least 1 tap, using 4";
+		count = 4;
+		}
+	return count;
+	}
+
+/******************************************************************************\
+|* Get whether to run the FFT pipeline in single precision
+\******************************************************************************/
+bool Config::fftSinglePrecision(void)
+	{
+	QString precision = "double";
+	if (_parser.isSet(*_fftPrecision))
+		precision = _parser.value(*_fftPrecision);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		precision = s.value(FFT_PRECISION_KEY, "double").toString();
+		s.endGroup();
+		}
+
+	precision = precision.toLower();
+	if ((precision == "single") || (precision == "float"))
+		return true;
+	if (precision != "double")
+		qWarning() << "Unknown FFT precision" << precision << "- using double";
+	return false;
+	}
+
+/******************************************************************************\
+|* Get the directory to keep FFTW wisdom in, or empty for none
+\******************************************************************************/
+QString Config::fftWisdomDir(void)
+	{
+	QString dir;
+	if (_parser.isSet(*_fftWisdom))
+		dir = _parser.value(*_fftWisdom);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		dir = s.value(FFT_WISDOM_KEY, "").toString();
+		s.endGroup();
+		}
+
+	if (dir.isEmpty())
+		dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)
+			+ "/wisdom";
+	return (dir == "none") ? QString() : dir;
+	}
+
+/******************************************************************************\
+|* Get the number of FFT worker threads
+\******************************************************************************/
+int Config::dspThreads(void)
+	{
+	if (_parser.isSet(*_dspThreads))
+		return _parser.value(*_dspThreads).toInt();
+
+	QSettings s;
+	s.beginGroup(DSP_GROUP);
+	QString threads = s.value(DSP_THREADS_KEY, "0").toString();
+	s.endGroup();
+	return threads.toInt();
+	}
+
+/******************************************************************************\
+|* Get the CPUs to pin the FFT workers to
+\******************************************************************************/
+QList<int> Config::dspCpus(void)
+	{
+	QString spec = "auto";
+	if (_parser.isSet(*_dspCpus))
+		spec = _parser.value(*_dspCpus);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		spec = s.value(DSP_CPUS_KEY, "auto").toString();
+		s.endGroup();
+		}
+
+	QList<int> cpus;
+	spec = spec.toLower();
+	if (spec == "auto")
+		cpus << DSPEngine::PIN_AUTO;
+	else if (spec != "none")
+		for (const QString& range : spec.split(','))
+			{
+			bool okFrom		= false;
+			bool okTo		= false;
+			QStringList ends = range.split('-');
+			int from		= ends.front().toInt(&okFrom);
+			int to			= ends.back().toInt(&okTo);
+			if (!okFrom || !okTo || (ends.size() > 2) || (from < 0) || (to < from))
+				{
+				qWarning() << "Cannot understand DSP CPU list" << spec
+						   << "- not pinning";
+				return QList<int>();
+				}
+			for (int cpu=from; cpu<=to; cpu++)
+				cpus << cpu;
+			}
+	return cpus;
+	}
+
+/******************************************************************************\
+|* Get the sub-bands, each as offset:decimation, comma-separated
+\******************************************************************************/
+QList<Config::Subband> Config::subbands(void)
+	{
+	QString spec = "none";
+	if (_parser.isSet(*_subbands))
+		spec = _parser.value(*_subbands);
+	else
+		{
+		QSettings s;
+		s.beginGroup(DSP_GROUP);
+		spec = s.value(SUBBANDS_KEY, "none").toString();
+		s.endGroup();
+		}
+
+	QList<Subband> bands;
+	spec = spec.trimmed().toLower();
+	if (spec.isEmpty() || (spec == "none"))
+		return bands;
+
+	for (const QString& band : spec.split(','))
+		{
+		bool okOffset	= false;
+		bool okRate		= false;
+		QStringList parts = band.split(':');
+		Subband sub;
+		sub.offsetHz	= parts.front().toDouble(&okOffset);
+		sub.decimation	= parts.back().toInt(&okRate);
+		if (!okOffset || !okRate || (parts.size() != 2) || (sub.decimation < 2))
+			{
+			qWarning() << "Cannot understand sub-band" << band << "- ignoring it";
+			continue;
+			}
+		bands << sub;
+		}
+	return bands;
+	}
+
+/******************************************************************************\
+|* Get the number of frames expected in flight
+\******************************************************************************/
+int Config::framesInFlight(void)
+	{
+	if (_parser.isSet(*_framesInFlight))
+		return _parser.value(*_framesInFlight).toInt();
+
+	QSettings s;
+	s.beginGroup(DSP_GROUP);
+	QString frames = s.value(FRAMES_IN_FLIGHT_KEY, "0").toString();
+	s.endGroup();
+	return frames.toInt();
+	}
+
+/******************************************************************************\
+|* Get the number of slots in the sample ring
+\******************************************************************************/
+int Config::ringSlots(void)
+	{
+	int count = 0;
+	if (_parser.isSet(*_ringSlots))
+		count = _parser.value(*_ringSlots).toInt();
+	else
+		{
+		QSettings s;
+		s.beginGroup(RADIO_GROUP);
+		count = s.value(RING_SLOTS_KEY, "16").toString().toInt();
+		s.endGroup();
+		}
+	return (count < 2) ? 2 : count;
+	}
+
+/******************************************************************************\
+|* Get the arena size in MiB
+\******************************************************************************/
+int Config::arenaSize(void)
+	{
+	if (_parser.isSet(*_arenaSize))
+		return _parser.value(*_arenaSize).toInt();
+
+	QSettings s;
+	s.beginGroup(MEMORY_GROUP);
+	QString size = s.value(ARENA_SIZE_KEY, "0").toString();
+	s.endGroup();
+	return size.toInt();
+	}
+
+/******************************************************************************\
+|* Get the memory budget in MiB
+\******************************************************************************/
+int Config::memoryBudget(void)
+	{
+	if (_parser.isSet(*_memoryBudget))
+		return _parser.value(*_memoryBudget).toInt();
+
+	QSettings s;
+	s.beginGroup(MEMORY_GROUP);
+	QString budget = s.value(MEMORY_BUDGET_KEY, "0").toString();
+	s.endGroup();
+	return budget.toInt();
+	}
+
+/******************************************************************************\
+|* Get the directory to record raw IQ into, or empty for none
+\******************************************************************************/
+QString Config::recordDir(void)
+	{
+	if (_parser.isSet(*_recordDir))
+		return _parser.value(*_recordDir);
+
+	QSettings s;
+	s.beginGroup(RECORD_GROUP);
+	QString dir = s.value(RECORD_DIR_KEY, "").toString();
+	s.endGroup();
+	return dir;
+	}
+
+/******************************************************************************\
+|* Get the size in MiB at which to start a new recording
+\******************************************************************************/
+int Config::recordRotateSize(void)
+	{
+	if (_parser.isSet(*_recordSize))
+		return _parser.value(*_recordSize).toInt();
+
+	QSettings s;
+	s.beginGroup(RECORD_GROUP);
+	QString size = s.value(RECORD_SIZE_KEY, "1024").toString();
+	s.endGroup();
+	return size.toInt();
+	}
+
+/******************************************************************************\
+|* Get the age in seconds at which to start a new recording
+\******************************************************************************/
+int Config::recordRotateTime(void)
+	{
+	if (_parser.isSet(*_recordTime))
+		return _parser.value(*_recordTime).toInt();
+
+	QSettings s;
+	s.beginGroup(RECORD_GROUP);
+	QString secs = s.value(RECORD_TIME_KEY, "0").toString();
+	s.endGroup();
+	return secs.toInt();
+	}
+
+/******************************************************************************\
+|* Get the arena huge-page size in bytes, or 0 for normal pages
+\******************************************************************************/
+size_t Config::arenaHugePageSize(void)
+	{
+	QString pages = "";
+	if (_parser.isSet(*_arenaPages))
+		pages = _parser.value(*_arenaPages);
+	else
+		{
+		QSettings s;
+		s.beginGroup(MEMORY_GROUP);
+		pages = s.value(ARENA_PAGES_KEY, "2m").toString();
+		s.endGroup();
+		}
+
+	pages = pages.toLower();
+	if (pages == "1g")
+		return ((size_t)1) << 30;
+	if (pages == "2m")
+		return ((size_t)2) << 20;
+	if (pages != "4k")
+		qWarning() << "Unknown arena page size " << pages << " - using 4k";
+	return 0;
+	}
+
+/******************************************************************************\
+|* Get whether to lock the arena into RAM
+\******************************************************************************/
+bool Config::arenaLock(void)
+	{
+	if (_parser.isSet(*_arenaLock))
+		return true;
+
+	QSettings s;
+	s.beginGroup(MEMORY_GROUP);
+	bool lock = s.value(ARENA_LOCK_KEY, false).toBool();
+	s.endGroup();
+	return lock;
+	}
+
+/******************************************************************************\
+|* Get the NUMA node to bind the arena to
+\******************************************************************************/
+int Config::arenaNumaNode(void)
+	{
+	QString node = "";
+	if (_parser.isSet(*_arenaNuma))
+		node = _parser.value(*_arenaNuma);
+	else
+		{
+		QSettings s;
+		s.beginGroup(MEMORY_GROUP);
+		node = s.value(ARENA_NUMA_KEY, "none").toString();
+		s.endGroup();
+		}
+
+	node = node.toLower();
+	if (node == "auto")
+		return Arena::NUMA_AUTO;
+
+	bool ok		= false;
+	int index	= node.toInt(&ok);
+	return ok ? index : Arena::NUMA_NONE;
+	}
+
+/******************************************************************************\
+|* Get the strict-allocation mode. Commandline only
+\******************************************************************************/
+int Config::strictAlloc(void)
+	{
+	if (_parser.isSet(*_strictAllocAbort))
+		return 2;
+	if (_parser.isSet(*_strictAlloc))
+		return 1;
+	return 0;
+	}
+
 /******************************************************************************\
 |* Get the fft-windowing function
 \******************************************************************************/
@@ -342,12 +954,14 @@ Config::WindowType Config::fftWindowType(void)
 			{"3", Config::W_BLACKMAN},
 			{"4", Config::W_WELCH},
 			{"5", Config::W_PARZEN},
+			{"6", Config::W_PFB},
 			{"rectangle", Config::W_RECTANGLE},
 			{"hamming", Config::W_HAMMING},
 			{"hanning", Config::W_HANNING},
 			{"blackman", Config::W_BLACKMAN},
 			{"welch", Config::W_WELCH},
 			{"parzen", Config::W_PARZEN},
+			{"pfb", Config::W_PFB},
 		};
 
 	QString key = window.toLower();
@@ -414,3 +1028,62 @@ bool Config::listChannels(void)
 	return _listAll || _parser.isSet(*_listChannels);
 	}
 
+
+/******************************************************************************\
+|* Get the replay settings
+\******************************************************************************/
+QString Config::replayFile(void)
+	{
+	return _parser.isSet(*_replay) ? _parser.value(*_replay) : QString();
+	}
+
+QString Config::replayFormat(void)
+	{
+	return _parser.isSet(*_replayFormat) ? _parser.value(*_replayFormat) : QString();
+	}
+
+bool Config::replayFast(void)
+	{
+	return _parser.isSet(*_replayFast);
+	}
+
+/******************************************************************************\
+|* Get the synthetic source settings
+\******************************************************************************/
+bool Config::synth(void)
+	{
+	return _parser.isSet(*_synth);
+	}
+
+bool Config::synthFast(void)
+	{
+	return _parser.isSet(*_synthFast);
+	}
+
+QString Config::synthFormat(void)
+	{
+	return _parser.value(*_synthFormat);
+	}
+
+double Config::synthNoise(void)
+	{
+	return _parser.value(*_synthNoise).toDouble();
+	}
+
+quint64 Config::synthSeed(void)
+	{
+	return _parser.value(*_synthSeed).toULongLong();
+	}
+
+QStringList Config::synthSignals(void)
+	{
+	return _parser.values(*_synthSignal);
+	}
+
+/******************************************************************************\
+|* Get whether to run the internal tests
+\******************************************************************************/
+bool Config::runSelfTests(void)
+	{
+	return _parser.isSet(*_selfTest);
+	}
@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <QCommandLineParser>
+#include <QList>
 
 #include "singleton.h"
 
@@ -22,9 +23,16 @@ class Config : public Singleton<Config>
 			W_HANNING,
 			W_BLACKMAN,
 			W_WELCH,
-			W_PARZEN
+			W_PARZEN,
+			W_PFB						// Polyphase filter bank, not a window
 			} WindowType;
 
+		typedef struct
+			{
+			double		offsetHz;		// Centre, from the tuned frequency
+			int			decimation;		// Samples in per sample out
+			} Subband;
+
 		/**********************************************************************\
 		|* Constructor
 		\**********************************************************************/
@@ -70,6 +78,110 @@ class Config : public Singleton<Config>
 		\******************************************************************/
 		int fftSize(void);
 
+		/******************************************************************\
+		|* Return the hop, in samples, between the starts of successive FFT
+		|* frames. The same as fftSize() if the frames don't overlap
+		\******************************************************************/
+		int fftHop(void);
+
+		/******************************************************************\
+		|* Return the number of FFT frames each task transforms in one go.
+		|* 0 means work it out from the FFT size and the sample rate
+		\******************************************************************/
+		int fftBatch(void);
+
+		/******************************************************************\
+		|* Return the most FFT frames the DSP engine waits out of order, to
+		|* put them back in sequence, before giving up on a late one. 0
+		|* means work it out from the number of workers
+		\******************************************************************/
+		int fftMaxSkew(void);
+
+		/******************************************************************\
+		|* Return the threads each FFT is split across. 0 means one, unless
+		|* the FFT is so large (FFTPlanner::LARGE_FFT) that the frames come
+		|* too slowly to keep more than one worker busy, in which case all
+		|* the DSP cores work on each FFT together
+		\******************************************************************/
+		int fftThreads(void);
+
+		/******************************************************************\
+		|* Return the taps per branch of the polyphase filter bank, used if
+		|* the window type is W_PFB. Each frame is filtered from this many
+		|* frames' worth of samples
+		\******************************************************************/
+		int fftPfbTaps(void);
+
+		/******************************************************************\
+		|* Return whether to run the FFT pipeline in single precision. The
+		|* aggregation is always done in double
+		\******************************************************************/
+		bool fftSinglePrecision(void);
+
+		/******************************************************************\
+		|* Return the directory to keep FFTW wisdom in, so plans are only
+		|* searched for once per machine. Empty if it's not to be kept
+		\******************************************************************/
+		QString fftWisdomDir(void);
+
+		/******************************************************************\
+		|* Return the number of FFT threads (0 means one per core, less
+		|* those ingest needs), which is the number of workers unless each
+		|* FFT runs on several (see fftThreads()), and the CPUs to pin them
+		|* to: a list, {DSPEngine::PIN_AUTO} to pick them, or empty not to pin
+		\******************************************************************/
+		int dspThreads(void);
+		QList<int> dspCpus(void);
+
+		/******************************************************************\
+		|* Return the sub-bands to down-convert and process on their own,
+		|* as well as the full band. Empty if there are none
+		\******************************************************************/
+		QList<Subband> subbands(void);
+
+		/******************************************************************\
+		|* Return the number of FFT frames expected to be in flight at once,
+		|* used to pre-size the pools. 0 means work it out
+		\******************************************************************/
+		int framesInFlight(void);
+
+		/******************************************************************\
+		|* Return the number of device buffers that can be queued between
+		|* the radio and the processor before data is dropped
+		\******************************************************************/
+		int ringSlots(void);
+
+		/******************************************************************\
+		|* Return how to police heap allocations in the pipeline after
+		|* warm-up: 0 = off, 1 = count them, 2 = abort on the first one
+		\******************************************************************/
+		int strictAlloc(void);
+
+		/******************************************************************\
+		|* Return the arena settings: size in MiB (0 = no arena), huge-page
+		|* size in bytes (0 = normal pages), whether to mlock it, and the
+		|* NUMA node to bind it to (Arena::NUMA_NONE / NUMA_AUTO / node)
+		\******************************************************************/
+		int arenaSize(void);
+		size_t arenaHugePageSize(void);
+		bool arenaLock(void);
+		int arenaNumaNode(void);
+
+		/******************************************************************\
+		|* Return the most memory (in MiB) the block pools may hold before
+		|* they trim and then refuse new blocks. 0 means no limit
+		\******************************************************************/
+		int memoryBudget(void);
+
+		/******************************************************************\
+		|* Return the directory to record raw IQ into (empty for none), and
+		|* the size (MiB) and age (seconds) at which to start a new file.
+		|* 0 means never rotate on that
+		\******************************************************************/
+		QString recordDir(void);
+		int recordRotateSize(void);
+		int recordRotateTime(void);
+
 		/******************************************************************\
 		|* Return whether to list out criteria. These are only on the
 		|* commandline
@@ -82,6 +194,33 @@ class Config : public Singleton<Config>
 		bool listNativeFormat(void);
 		bool listChannels(void);
 
+		/******************************************************************\
+		|* Return the recording to replay instead of a radio (empty for
+		|* none), its sample format if it's raw, and whether to replay it
+		|* flat-out rather than in real time. These are only on the
+		|* commandline
+		\******************************************************************/
+		QString replayFile(void);
+		QString replayFormat(void);
+		bool replayFast(void);
+
+		/******************************************************************\
+		|* Return whether to use the synthetic source instead of a radio,
+		|* and how to set it up (see SynthSource for the signal specs).
+		|* These are only on the commandline
+		\******************************************************************/
+		bool synth(void);
+		bool synthFast(void);
+		QString synthFormat(void);
+		double synthNoise(void);
+		quint64 synthSeed(void);
+		QStringList synthSignals(void);
+
+		/******************************************************************\
+		|* Return whether to run the internal tests and exit. Commandline only
+		\******************************************************************/
+		bool runSelfTests(void);
+
 		/******************************************************************\
 		|* Return the filter on the driver to select out the one we want
 		\******************************************************************/
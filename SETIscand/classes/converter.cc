@@ -0,0 +1,1534 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <fftw3.h>
+
+#include "constants.h"
+#include "converter.h"
+
+/******************************************************************************\
+|* Test parameters
+\******************************************************************************/
+#define MAX_TESTS			(8)
+#define CHECK_COUNT			(4099)			// Components: not a whole vector
+#define BENCH_COUNT			(32768)			// Components: stays in L2
+#define BENCH_REPEATS		(512)			// ~8M complex samples per kernel
+#define FRAME_SAMPLES		(65536)			// Complex samples per frame
+#define FRAME_COUNT			(32)			// 32 MB of doubles: out of cache
+#define PRECISION_BINS		(4096)			// FFT size for the equivalence test
+#define PRECISION_TONE		(300.25)		// Bins: off-centre, so it leaks
+#define PFB_BINS			(4096)			// Channels for the filter bank
+#define PFB_TAPS			(4)				// ... and taps per branch
+#define PFB_FRAMES			(256)			// 8 MB of doubles per pass
+#define PFB_TONE			(1000)			// Bin the test tone is centred on
+#define POWER_BINS			(65536)			// Bins per frame for the power
+#define POWER_FRAMES		(16)			// 16 MB of doubles per window
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Which kernels we can build
+\******************************************************************************/
+#if defined(__x86_64__) || defined(__i386__)
+#  define HAVE_X86_KERNELS	1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#  define HAVE_NEON_KERNELS	1
+#endif
+
+/******************************************************************************\
+|* The generic kernel: N components at a time, as vectors of N source and N
+|* destination elements, optionally multiplied by a window with one entry per
+|* component, and optionally added to what's already there (A), which makes
+|* it one branch of an FIR. Always inlined, so each instruction set's wrapper
+|* below gets its own copy compiled for that instruction set
+\******************************************************************************/
+template <typename S, typename D, int N, bool W, bool A = false>
+static inline __attribute__((always_inline))
+void _vector(const void *src, D *dst, int count, D scale, D offset,
+			 const D *window)
+	{
+	typedef S vs __attribute__((vector_size(N * sizeof(S))));
+	typedef D vd __attribute__((vector_size(N * sizeof(D))));
+
+	const S *in = reinterpret_cast<const S *>(src);
+	int i		= 0;
+	for (; i + N <= count; i += N)
+		{
+		vs v;
+		::memcpy(&v, in + i, sizeof(v));
+		vd out = __builtin_convertvector(v, vd) * scale + offset;
+		if constexpr (W)
+			{
+			vd w;
+			::memcpy(&w, window + i, sizeof(w));
+			out *= w;
+			}
+		if constexpr (A)
+			{
+			vd sum;
+			::memcpy(&sum, dst + i, sizeof(sum));
+			out += sum;
+			}
+		::memcpy(dst + i, &out, sizeof(out));
+		}
+
+	for (; i<count; i++)
+		{
+		D out = (D)in[i] * scale + offset;
+		if constexpr (W)
+			out *= window[i];
+		if constexpr (A)
+			out += dst[i];
+		dst[i] = out;
+		}
+	}
+
+/******************************************************************************\
+|* The scalar kernel, the reference for the others
+\******************************************************************************/
+template <typename S, typename D, bool W, bool A = false>
+static void _scalar(const void *src, D *dst, int count, D scale, D offset,
+					const D *window)
+	{
+	const S *in = reinterpret_cast<const S *>(src);
+	for (int i=0; i<count; i++)
+		{
+		D out = (D)in[i] * scale + offset;
+		if constexpr (W)
+			out *= window[i];
+		if constexpr (A)
+			out += dst[i];
+		dst[i] = out;
+		}
+	}
+
+template <typename S, typename D>
+static void _scalar(const void *src, D *dst, int count, D scale, D offset)
+	{
+	_scalar<S, D, false>(src, dst, count, scale, offset, nullptr);
+	}
+
+template <typename S, typename D>
+static void _scalarWindowed(const void *src, D *dst, int count, D scale,
+							D offset, const D *window)
+	{
+	_scalar<S, D, true>(src, dst, count, scale, offset, window);
+	}
+
+template <typename S, typename D>
+static void _scalarAccumulated(const void *src, D *dst, int count, D scale,
+							   D offset, const D *window)
+	{
+	_scalar<S, D, true, true>(src, dst, count, scale, offset, window);
+	}
+
+/******************************************************************************\
+|* The power kernel: N bins at a time, from interleaved complex S. The real
+|* and imaginary parts are split into a vector each with shuffles (L is just
+|* 0..N-1), so each bin's power lands in its own lane and is added to both
+|* accumulators in the one pass. The sums are always double
+\******************************************************************************/
+template <typename S, int N, size_t... L>
+static inline __attribute__((always_inline))
+void _vectorPower(const S *src, double *update, double *sample, int bins,
+				  std::index_sequence<L...>)
+	{
+	typedef S vs __attribute__((vector_size(2 * N * sizeof(S))));
+	typedef double vd __attribute__((vector_size(N * sizeof(double))));
+
+	int i = 0;
+	for (; i + N <= bins; i += N)
+		{
+		vs v;
+		::memcpy(&v, src + 2 * i, sizeof(v));
+		vd re	= __builtin_convertvector(__builtin_shufflevector(v, v, (2 * L)...), vd);
+		vd im	= __builtin_convertvector(__builtin_shufflevector(v, v, (2 * L + 1)...), vd);
+		vd power = re * re + im * im;
+
+		vd sum;
+		::memcpy(&sum, update + i, sizeof(sum));
+		sum += power;
+		::memcpy(update + i, &sum, sizeof(sum));
+		::memcpy(&sum, sample + i, sizeof(sum));
+		sum += power;
+		::memcpy(sample + i, &sum, sizeof(sum));
+		}
+
+	for (; i<bins; i++)
+		{
+		double re		= src[2 * i];
+		double im		= src[2 * i + 1];
+		double power	= re * re + im * im;
+		update[i]	   += power;
+		sample[i]	   += power;
+		}
+	}
+
+/******************************************************************************\
+|* The scalar power kernel, the reference for the others
+\******************************************************************************/
+template <typename S>
+static void _scalarPower(const S *src, double *update, double *sample, int bins)
+	{
+	for (int i=0; i<bins; i++)
+		{
+		double re		= src[2 * i];
+		double im		= src[2 * i + 1];
+		double power	= re * re + im * im;
+		update[i]	   += power;
+		sample[i]	   += power;
+		}
+	}
+
+/******************************************************************************\
+|* Instantiate the generic kernel for each input and output type, for one
+|* instruction set. N is the number of floats in a register, doubled
+\******************************************************************************/
+#define KERNEL(ISA, TARGET, N, NAME, S, D)									\
+	TARGET static void ISA##NAME(const void *s, D *d, int n, D k, D o)		\
+		{ _vector<S, D, N, false>(s, d, n, k, o, nullptr); }
+
+#define WINDOWED(ISA, TARGET, N, NAME, S, D)								\
+	TARGET static void ISA##NAME(const void *s, D *d, int n,				\
+								 D k, D o, const D *w)						\
+		{ _vector<S, D, N, true>(s, d, n, k, o, w); }
+
+#define ACCUMULATED(ISA, TARGET, N, NAME, S, D)								\
+	TARGET static void ISA##NAME(const void *s, D *d, int n,				\
+								 D k, D o, const D *w)						\
+		{ _vector<S, D, N, true, true>(s, d, n, k, o, w); }
+
+#define POWER(ISA, TARGET, N, NAME, S)										\
+	TARGET static void ISA##NAME(const S *s, double *u, double *p, int n)	\
+		{ _vectorPower<S, N>(s, u, p, n, std::make_index_sequence<N>()); }
+
+#define KERNELS(ISA, TARGET, N)												\
+	KERNEL(ISA, TARGET, N, S8ToDouble, int8_t, double)						\
+	KERNEL(ISA, TARGET, N, U8ToDouble, uint8_t, double)						\
+	KERNEL(ISA, TARGET, N, S16ToDouble, int16_t, double)					\
+	KERNEL(ISA, TARGET, N, F32ToDouble, float, double)						\
+	KERNEL(ISA, TARGET, N, S8ToFloat, int8_t, float)						\
+	KERNEL(ISA, TARGET, N, U8ToFloat, uint8_t, float)						\
+	KERNEL(ISA, TARGET, N, S16ToFloat, int16_t, float)						\
+	KERNEL(ISA, TARGET, N, F32ToFloat, float, float)						\
+	WINDOWED(ISA, TARGET, N, S8Windowed, int8_t, double)					\
+	WINDOWED(ISA, TARGET, N, U8Windowed, uint8_t, double)					\
+	WINDOWED(ISA, TARGET, N, S16Windowed, int16_t, double)					\
+	WINDOWED(ISA, TARGET, N, F32Windowed, float, double)					\
+	WINDOWED(ISA, TARGET, N, S8WindowedF, int8_t, float)					\
+	WINDOWED(ISA, TARGET, N, U8WindowedF, uint8_t, float)					\
+	WINDOWED(ISA, TARGET, N, S16WindowedF, int16_t, float)					\
+	WINDOWED(ISA, TARGET, N, F32WindowedF, float, float)					\
+	ACCUMULATED(ISA, TARGET, N, S8Accumulated, int8_t, double)				\
+	ACCUMULATED(ISA, TARGET, N, U8Accumulated, uint8_t, double)				\
+	ACCUMULATED(ISA, TARGET, N, S16Accumulated, int16_t, double)			\
+	ACCUMULATED(ISA, TARGET, N, F32Accumulated, float, double)				\
+	ACCUMULATED(ISA, TARGET, N, S8AccumulatedF, int8_t, float)				\
+	ACCUMULATED(ISA, TARGET, N, U8AccumulatedF, uint8_t, float)				\
+	ACCUMULATED(ISA, TARGET, N, S16AccumulatedF, int16_t, float)			\
+	ACCUMULATED(ISA, TARGET, N, F32AccumulatedF, float, float)				\
+	POWER(ISA, TARGET, N, Power, double)									\
+	POWER(ISA, TARGET, N, PowerF, float)
+
+#define TABLE(ISA)															\
+	{{ISA##S8ToDouble, ISA##U8ToDouble, ISA##S16ToDouble, ISA##F32ToDouble},\
+	 {ISA##S8ToFloat, ISA##U8ToFloat, ISA##S16ToFloat, ISA##F32ToFloat},	\
+	 {ISA##S8Windowed, ISA##U8Windowed, ISA##S16Windowed, ISA##F32Windowed},\
+	 {ISA##S8WindowedF, ISA##U8WindowedF,									\
+	  ISA##S16WindowedF, ISA##F32WindowedF},								\
+	 {ISA##S8Accumulated, ISA##U8Accumulated,								\
+	  ISA##S16Accumulated, ISA##F32Accumulated},							\
+	 {ISA##S8AccumulatedF, ISA##U8AccumulatedF,								\
+	  ISA##S16AccumulatedF, ISA##F32AccumulatedF},							\
+	 ISA##Power,															\
+	 ISA##PowerF}
+
+#define NO_TABLE															\
+	{{nullptr, nullptr, nullptr, nullptr},									\
+	 {nullptr, nullptr, nullptr, nullptr},									\
+	 {nullptr, nullptr, nullptr, nullptr},									\
+	 {nullptr, nullptr, nullptr, nullptr},									\
+	 {nullptr, nullptr, nullptr, nullptr},									\
+	 {nullptr, nullptr, nullptr, nullptr},									\
+	 nullptr,																\
+	 nullptr}
+
+#ifdef HAVE_X86_KERNELS
+KERNELS(_sse4,		__attribute__((target("sse4.1"))),				8)
+KERNELS(_avx2,		__attribute__((target("avx2"))),				16)
+KERNELS(_avx512,	__attribute__((target("avx512f,avx512bw"))),	32)
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+KERNELS(_neon,		,												8)
+#endif
+
+/******************************************************************************\
+|* All the kernels, by instruction set and input type
+\******************************************************************************/
+typedef struct
+	{
+	Converter::ToDouble	toDouble[Converter::IN_MAX];
+	Converter::ToFloat	toFloat[Converter::IN_MAX];
+	Converter::Windowed	windowed[Converter::IN_MAX];
+	Converter::WindowedFloat windowedFloat[Converter::IN_MAX];
+	Converter::Windowed	accumulated[Converter::IN_MAX];
+	Converter::WindowedFloat accumulatedFloat[Converter::IN_MAX];
+	Converter::Power	power;
+	Converter::PowerFloat powerFloat;
+	} Kernels;
+
+static const Kernels _kernels[Converter::ISA_MAX] =
+	{
+	{{_scalar<int8_t, double>, _scalar<uint8_t, double>,
+	  _scalar<int16_t, double>, _scalar<float, double>},
+	 {_scalar<int8_t, float>, _scalar<uint8_t, float>,
+	  _scalar<int16_t, float>, _scalar<float, float>},
+	 {_scalarWindowed<int8_t, double>, _scalarWindowed<uint8_t, double>,
+	  _scalarWindowed<int16_t, double>, _scalarWindowed<float, double>},
+	 {_scalarWindowed<int8_t, float>, _scalarWindowed<uint8_t, float>,
+	  _scalarWindowed<int16_t, float>, _scalarWindowed<float, float>},
+	 {_scalarAccumulated<int8_t, double>, _scalarAccumulated<uint8_t, double>,
+	  _scalarAccumulated<int16_t, double>, _scalarAccumulated<float, double>},
+	 {_scalarAccumulated<int8_t, float>, _scalarAccumulated<uint8_t, float>,
+	  _scalarAccumulated<int16_t, float>, _scalarAccumulated<float, float>},
+	 _scalarPower<double>,
+	 _scalarPower<float>},
+#ifdef HAVE_X86_KERNELS
+	TABLE(_sse4),
+	TABLE(_avx2),
+	TABLE(_avx512),
+#else
+	NO_TABLE,
+	NO_TABLE,
+	NO_TABLE,
+#endif
+#ifdef HAVE_NEON_KERNELS
+	TABLE(_neon)
+#else
+	NO_TABLE
+#endif
+	};
+
+/******************************************************************************\
+|* CU8 is offset binary: 0..255 centred on 127.5
+\******************************************************************************/
+#define U8_CENTRE			(127.5)
+
+/******************************************************************************\
+|* Unpack CS12: each sample is three bytes, I in the low 12 bits and Q in the
+|* high 12. Each is shifted up into an int16_t to sign-extend it, so the
+|* scale carries the 1/16 back
+\******************************************************************************/
+template <typename D, bool W, bool A>
+static inline __attribute__((always_inline))
+void _unpack12(const uint8_t *src, D *dst, int samples, D scale,
+			   const D *window)
+	{
+	for (int i=0; i<samples; i++)
+		{
+		uint16_t b0	= src[0];
+		uint16_t b1	= src[1];
+		uint16_t b2	= src[2];
+		D i12		= (int16_t)((b1 << 12) | (b0 << 4)) * scale;
+		D q12		= (int16_t)((b2 << 8) | (b1 & 0xF0)) * scale;
+		if constexpr (W)
+			{
+			i12	   *= window[0];
+			q12	   *= window[1];
+			window += 2;
+			}
+		if constexpr (A)
+			{
+			i12	   += dst[0];
+			q12	   += dst[1];
+			}
+		dst[0]		= i12;
+		dst[1]		= q12;
+		src		   += 3;
+		dst		   += 2;
+		}
+	}
+
+/******************************************************************************\
+|* The windowed (or accumulating) kernel for an input type, in the precision
+|* of the output
+\******************************************************************************/
+template <bool A>
+static inline Converter::Windowed _windowedFor(const Kernels& k,
+											   Converter::Input input,
+											   double *)
+	{
+	return A ? k.accumulated[input] : k.windowed[input];
+	}
+
+template <bool A>
+static inline Converter::WindowedFloat _windowedFor(const Kernels& k,
+													Converter::Input input,
+													float *)
+	{
+	return A ? k.accumulatedFloat[input] : k.windowedFloat[input];
+	}
+
+/******************************************************************************\
+|* Ingest a buffer of format F into D (double or float) with instruction set
+|* I's kernels, adding to what's there if A. The kernel is a constant for
+|* each instantiation, so this is one direct call
+\******************************************************************************/
+template <typename D, int F, int I, bool A>
+static void _ingest(const uint8_t *src, D *dst, int samples,
+					double fullScale, const D *window)
+	{
+	const Kernels& k	= _kernels[I];
+	int count			= samples * 2;
+	D scale				= (D)(1.0 / fullScale);
+
+	if constexpr (F == SampleSource::FMT_CS8)
+		_windowedFor<A>(k, Converter::IN_S8, dst)(src, dst, count, scale, 0, window);
+	else if constexpr (F == SampleSource::FMT_CU8)
+		_windowedFor<A>(k, Converter::IN_U8, dst)(src, dst, count,
+											   (D)(1.0 / U8_CENTRE), -1, window);
+	else if constexpr (F == SampleSource::FMT_CS12)
+		_unpack12<D, true, A>(src, dst, samples, (D)(1.0 / (16.0 * fullScale)), window);
+	else if constexpr (F == SampleSource::FMT_CS16)
+		_windowedFor<A>(k, Converter::IN_S16, dst)(src, dst, count, scale, 0, window);
+	else
+		_windowedFor<A>(k, Converter::IN_F32, dst)(src, dst, count, scale, 0, window);
+	}
+
+#define INGESTS(D, I, A)													\
+	{nullptr,																\
+	 _ingest<D, SampleSource::FMT_CS8, I, A>,								\
+	 _ingest<D, SampleSource::FMT_CU8, I, A>,								\
+	 _ingest<D, SampleSource::FMT_CS12, I, A>,								\
+	 _ingest<D, SampleSource::FMT_CS16, I, A>,								\
+	 _ingest<D, SampleSource::FMT_CF32, I, A>}
+
+static const Converter::Ingest _ingests[Converter::ISA_MAX][SampleSource::FMT_MAX] =
+	{
+	INGESTS(double, Converter::ISA_SCALAR, false),
+	INGESTS(double, Converter::ISA_SSE4, false),
+	INGESTS(double, Converter::ISA_AVX2, false),
+	INGESTS(double, Converter::ISA_AVX512, false),
+	INGESTS(double, Converter::ISA_NEON, false)
+	};
+
+static const Converter::IngestFloat _ingestsFloat[Converter::ISA_MAX][SampleSource::FMT_MAX] =
+	{
+	INGESTS(float, Converter::ISA_SCALAR, false),
+	INGESTS(float, Converter::ISA_SSE4, false),
+	INGESTS(float, Converter::ISA_AVX2, false),
+	INGESTS(float, Converter::ISA_AVX512, false),
+	INGESTS(float, Converter::ISA_NEON, false)
+	};
+
+static const Converter::Ingest _ingestsAdd[Converter::ISA_MAX][SampleSource::FMT_MAX] =
+	{
+	INGESTS(double, Converter::ISA_SCALAR, true),
+	INGESTS(double, Converter::ISA_SSE4, true),
+	INGESTS(double, Converter::ISA_AVX2, true),
+	INGESTS(double, Converter::ISA_AVX512, true),
+	INGESTS(double, Converter::ISA_NEON, true)
+	};
+
+static const Converter::IngestFloat _ingestsFloatAdd[Converter::ISA_MAX][SampleSource::FMT_MAX] =
+	{
+	INGESTS(float, Converter::ISA_SCALAR, true),
+	INGESTS(float, Converter::ISA_SSE4, true),
+	INGESTS(float, Converter::ISA_AVX2, true),
+	INGESTS(float, Converter::ISA_AVX512, true),
+	INGESTS(float, Converter::ISA_NEON, true)
+	};
+
+/******************************************************************************\
+|* Normalise a buffer of format F to CF32, with instruction set I's kernels
+\******************************************************************************/
+template <int F, int I>
+static void _normalise(const uint8_t *src, float *dst, int samples,
+					   double fullScale)
+	{
+	const Kernels& k	= _kernels[I];
+	int count			= samples * 2;
+	float scale			= (float)(1.0 / fullScale);
+
+	if constexpr (F == SampleSource::FMT_CS8)
+		k.toFloat[Converter::IN_S8](src, dst, count, scale, 0);
+	else if constexpr (F == SampleSource::FMT_CU8)
+		k.toFloat[Converter::IN_U8](src, dst, count, (float)(1.0 / U8_CENTRE), -1);
+	else if constexpr (F == SampleSource::FMT_CS12)
+		_unpack12<float, false, false>(src, dst, samples,
+									   (float)(1.0 / (16.0 * fullScale)),
+									   nullptr);
+	else if constexpr (F == SampleSource::FMT_CS16)
+		k.toFloat[Converter::IN_S16](src, dst, count, scale, 0);
+	else
+		k.toFloat[Converter::IN_F32](src, dst, count, scale, 0);
+	}
+
+#define NORMALISES(I)														\
+	{nullptr,																\
+	 _normalise<SampleSource::FMT_CS8, I>,									\
+	 _normalise<SampleSource::FMT_CU8, I>,									\
+	 _normalise<SampleSource::FMT_CS12, I>,									\
+	 _normalise<SampleSource::FMT_CS16, I>,									\
+	 _normalise<SampleSource::FMT_CF32, I>}
+
+static const Converter::Normalise _normalises[Converter::ISA_MAX][SampleSource::FMT_MAX] =
+	{
+	NORMALISES(Converter::ISA_SCALAR),
+	NORMALISES(Converter::ISA_SSE4),
+	NORMALISES(Converter::ISA_AVX2),
+	NORMALISES(Converter::ISA_AVX512),
+	NORMALISES(Converter::ISA_NEON)
+	};
+
+/******************************************************************************\
+|* Constructor: pick the best instruction set this CPU supports
+\******************************************************************************/
+Converter::Converter(void)
+		  :_isa(ISA_SCALAR)
+	{
+	const Isa best[] = {ISA_AVX512, ISA_AVX2, ISA_SSE4, ISA_NEON};
+	for (Isa isa : best)
+		if (isSupported(isa))
+			{
+			_isa = isa;
+			break;
+			}
+
+	for (int i=0; i<IN_MAX; i++)
+		{
+		_toDouble[i]	= _kernels[_isa].toDouble[i];
+		_toFloat[i]		= _kernels[_isa].toFloat[i];
+		_windowed[i]	= _kernels[_isa].windowed[i];
+		_windowedFloat[i] = _kernels[_isa].windowedFloat[i];
+		_accumulated[i]	= _kernels[_isa].accumulated[i];
+		_accumulatedFloat[i] = _kernels[_isa].accumulatedFloat[i];
+		}
+	_power		= _kernels[_isa].power;
+	_powerFloat	= _kernels[_isa].powerFloat;
+
+	LOG << "Sample conversion using" << isaName(_isa) << "kernels";
+	}
+
+/******************************************************************************\
+|* Return the kernel for an input type and instruction set
+\******************************************************************************/
+Converter::ToDouble Converter::toDouble(Input input, Isa isa)
+	{
+	return _kernels[isa].toDouble[input];
+	}
+
+Converter::ToFloat Converter::toFloat(Input input, Isa isa)
+	{
+	return _kernels[isa].toFloat[input];
+	}
+
+Converter::Windowed Converter::windowed(Input input, Isa isa)
+	{
+	return _kernels[isa].windowed[input];
+	}
+
+Converter::WindowedFloat Converter::windowedFloat(Input input, Isa isa)
+	{
+	return _kernels[isa].windowedFloat[input];
+	}
+
+Converter::Windowed Converter::accumulated(Input input, Isa isa)
+	{
+	return _kernels[isa].accumulated[input];
+	}
+
+Converter::WindowedFloat Converter::accumulatedFloat(Input input, Isa isa)
+	{
+	return _kernels[isa].accumulatedFloat[input];
+	}
+
+/******************************************************************************\
+|* Return the power kernel for an instruction set
+\******************************************************************************/
+Converter::Power Converter::power(Isa isa)
+	{
+	return _kernels[isa].power;
+	}
+
+Converter::PowerFloat Converter::powerFloat(Isa isa)
+	{
+	return _kernels[isa].powerFloat;
+	}
+
+/******************************************************************************\
+|* Return the ingest for a sample format, selected or by instruction set
+\******************************************************************************/
+Converter::Ingest Converter::ingest(SampleSource::Format format) const
+	{
+	return ingest(format, _isa);
+	}
+
+Converter::Ingest Converter::ingest(SampleSource::Format format, Isa isa)
+	{
+	if ((format <= SampleSource::FMT_UNKNOWN) || (format >= SampleSource::FMT_MAX))
+		return nullptr;
+	return _ingests[isa][format];
+	}
+
+Converter::IngestFloat Converter::ingestFloat(SampleSource::Format format) const
+	{
+	return ingestFloat(format, _isa);
+	}
+
+Converter::IngestFloat Converter::ingestFloat(SampleSource::Format format,
+											  Isa isa)
+	{
+	if ((format <= SampleSource::FMT_UNKNOWN) || (format >= SampleSource::FMT_MAX))
+		return nullptr;
+	return _ingestsFloat[isa][format];
+	}
+
+/******************************************************************************\
+|* Return the accumulating ingest for a sample format, selected or by
+|* instruction set
+\******************************************************************************/
+Converter::Ingest Converter::ingestAdd(SampleSource::Format format) const
+	{
+	return ingestAdd(format, _isa);
+	}
+
+Converter::Ingest Converter::ingestAdd(SampleSource::Format format, Isa isa)
+	{
+	if ((format <= SampleSource::FMT_UNKNOWN) || (format >= SampleSource::FMT_MAX))
+		return nullptr;
+	return _ingestsAdd[isa][format];
+	}
+
+Converter::IngestFloat Converter::ingestFloatAdd(SampleSource::Format format) const
+	{
+	return ingestFloatAdd(format, _isa);
+	}
+
+Converter::IngestFloat Converter::ingestFloatAdd(SampleSource::Format format,
+												 Isa isa)
+	{
+	if ((format <= SampleSource::FMT_UNKNOWN) || (format >= SampleSource::FMT_MAX))
+		return nullptr;
+	return _ingestsFloatAdd[isa][format];
+	}
+
+/******************************************************************************\
+|* Return the normalisation for a sample format, selected or by instruction
+|* set
+\******************************************************************************/
+Converter::Normalise Converter::normalise(SampleSource::Format format) const
+	{
+	return normalise(format, _isa);
+	}
+
+Converter::Normalise Converter::normalise(SampleSource::Format format, Isa isa)
+	{
+	if ((format <= SampleSource::FMT_UNKNOWN) || (format >= SampleSource::FMT_MAX))
+		return nullptr;
+	return _normalises[isa][format];
+	}
+
+/******************************************************************************\
+|* Whether this CPU can run an instruction set (CPUID on x86)
+\******************************************************************************/
+bool Converter::isSupported(Isa isa)
+	{
+	if (_kernels[isa].toDouble[IN_S8] == nullptr)
+		return false;
+
+	switch (isa)
+		{
+#ifdef HAVE_X86_KERNELS
+		case ISA_SSE4:
+			return __builtin_cpu_supports("sse4.1");
+		case ISA_AVX2:
+			return __builtin_cpu_supports("avx2");
+		case ISA_AVX512:
+			return __builtin_cpu_supports("avx512f")
+				&& __builtin_cpu_supports("avx512bw");
+#endif
+		case ISA_SCALAR:
+		case ISA_NEON:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+/******************************************************************************\
+|* Name an instruction set
+\******************************************************************************/
+const char * Converter::isaName(Isa isa)
+	{
+	switch (isa)
+		{
+		case ISA_SCALAR:
+			return "scalar";
+		case ISA_SSE4:
+			return "SSE4.1";
+		case ISA_AVX2:
+			return "AVX2";
+		case ISA_AVX512:
+			return "AVX-512";
+		case ISA_NEON:
+			return "NEON";
+		default:
+			return "unknown";
+		}
+	}
+
+/******************************************************************************\
+|* Names of the input types, for test output
+\******************************************************************************/
+static const char * _inputName[Converter::IN_MAX] =
+	{
+	"s8", "u8", "s16", "f32"
+	};
+
+/******************************************************************************\
+|* Fill a buffer with test data of an input type, including the extremes
+\******************************************************************************/
+static void _fill(std::vector<uint8_t>& buf, Converter::Input input, int count)
+	{
+	uint32_t state = 0x9E3779B9;
+	buf.assign((size_t)count * sizeof(float), 0);
+
+	for (int i=0; i<count; i++)
+		{
+		state = state * 1664525 + 1013904223;
+		int16_t v = (int16_t)(state >> 16);
+		if (i == 0)
+			v = INT16_MIN;
+		else if (i == 1)
+			v = INT16_MAX;
+
+		switch (input)
+			{
+			case Converter::IN_S8:
+			case Converter::IN_U8:
+				buf[i] = (uint8_t)(v >> 8);
+				break;
+			case Converter::IN_S16:
+				::memcpy(buf.data() + i * sizeof(int16_t), &v, sizeof(v));
+				break;
+			default:
+				{
+				float f = v / 32768.0f;
+				::memcpy(buf.data() + i * sizeof(float), &f, sizeof(f));
+				break;
+				}
+			}
+		}
+	}
+
+/******************************************************************************\
+|* Test interface : return the number of tests
+\******************************************************************************/
+int Converter::numTests(void)
+	{
+	return MAX_TESTS;
+	}
+
+/******************************************************************************\
+|* Test interface : run a test
+\******************************************************************************/
+Testable::TestResult Converter::runTest(int idx)
+	{
+	switch (idx)
+		{
+		case 0:
+			return _checkKernels();
+		case 1:
+			return _checkIngest();
+		case 2:
+			return _checkPrecision();
+		case 3:
+			return _checkPower();
+		case 4:
+			return _benchmark();
+		case 5:
+			return _benchmarkFraming();
+		case 6:
+			return _benchmarkPfb();
+		case 7:
+			return _benchmarkPower();
+		}
+
+	ERR << "Test requested outside of range";
+	return Testable::TEST_FAIL;
+	}
+
+/******************************************************************************\
+|* Test interface : Check every kernel this CPU can run against the scalar
+|* one, with a count that leaves a tail, and that none writes past the end
+\******************************************************************************/
+Testable::TestResult Converter::_checkKernels(void)
+	{
+	const double scale	= 1.0 / 128.0;
+	const double offset	= -127.5 / 128.0;
+
+	std::vector<uint8_t> src;
+	std::vector<double> refD(CHECK_COUNT), outD(CHECK_COUNT + 1);
+	std::vector<float> refF(CHECK_COUNT), outF(CHECK_COUNT + 1);
+	std::vector<double> refW(CHECK_COUNT), outW(CHECK_COUNT + 1);
+	std::vector<float> refWF(CHECK_COUNT), outWF(CHECK_COUNT + 1);
+	std::vector<double> refA(CHECK_COUNT), outA(CHECK_COUNT + 1);
+	std::vector<float> refAF(CHECK_COUNT), outAF(CHECK_COUNT + 1);
+	std::vector<double> window(CHECK_COUNT);
+	std::vector<float> windowF(CHECK_COUNT);
+
+	for (int j=0; j<CHECK_COUNT; j++)
+		{
+		window[j]	= 0.5 + 0.5 * sin(j * 0.01);
+		windowF[j]	= (float)window[j];
+		}
+
+	for (int in=0; in<IN_MAX; in++)
+		{
+		Input input = (Input)in;
+		_fill(src, input, CHECK_COUNT);
+		toDouble(input, ISA_SCALAR)(src.data(), refD.data(), CHECK_COUNT,
+									scale, offset);
+		toFloat(input, ISA_SCALAR)(src.data(), refF.data(), CHECK_COUNT,
+								   (float)scale, (float)offset);
+		windowed(input, ISA_SCALAR)(src.data(), refW.data(), CHECK_COUNT,
+									scale, offset, window.data());
+		windowedFloat(input, ISA_SCALAR)(src.data(), refWF.data(), CHECK_COUNT,
+										 (float)scale, (float)offset,
+										 windowF.data());
+
+		// Accumulate onto the window itself, as something that isn't zero
+		refA.assign(window.begin(), window.end());
+		refAF.assign(windowF.begin(), windowF.end());
+		accumulated(input, ISA_SCALAR)(src.data(), refA.data(), CHECK_COUNT,
+									   scale, offset, window.data());
+		accumulatedFloat(input, ISA_SCALAR)(src.data(), refAF.data(),
+											CHECK_COUNT, (float)scale,
+											(float)offset, windowF.data());
+
+		for (int i=ISA_SCALAR+1; i<ISA_MAX; i++)
+			{
+			Isa isa = (Isa)i;
+			if (!isSupported(isa))
+				continue;
+
+			outD[CHECK_COUNT] = 42.0;
+			outF[CHECK_COUNT] = 42.0f;
+			outW[CHECK_COUNT] = 42.0;
+			outWF[CHECK_COUNT] = 42.0f;
+			std::copy(window.begin(), window.end(), outA.begin());
+			std::copy(windowF.begin(), windowF.end(), outAF.begin());
+			outA[CHECK_COUNT] = 42.0;
+			outAF[CHECK_COUNT] = 42.0f;
+			toDouble(input, isa)(src.data(), outD.data(), CHECK_COUNT,
+								 scale, offset);
+			toFloat(input, isa)(src.data(), outF.data(), CHECK_COUNT,
+								(float)scale, (float)offset);
+			windowed(input, isa)(src.data(), outW.data(), CHECK_COUNT,
+								 scale, offset, window.data());
+			windowedFloat(input, isa)(src.data(), outWF.data(), CHECK_COUNT,
+									  (float)scale, (float)offset,
+									  windowF.data());
+			accumulated(input, isa)(src.data(), outA.data(), CHECK_COUNT,
+									scale, offset, window.data());
+			accumulatedFloat(input, isa)(src.data(), outAF.data(), CHECK_COUNT,
+										 (float)scale, (float)offset,
+										 windowF.data());
+
+			if ((outD[CHECK_COUNT] != 42.0) || (outF[CHECK_COUNT] != 42.0f)
+			 || (outW[CHECK_COUNT] != 42.0) || (outWF[CHECK_COUNT] != 42.0f)
+			 || (outA[CHECK_COUNT] != 42.0) || (outAF[CHECK_COUNT] != 42.0f))
+				{
+				ERR << isaName(isa) << _inputName[in] << "kernel overran";
+				return Testable::TEST_FAIL;
+				}
+
+			// Allow for the vector code using fused multiply-adds
+			for (int j=0; j<CHECK_COUNT; j++)
+				if ((fabs(outD[j] - refD[j]) > 1e-12 * (1 + fabs(refD[j])))
+				 || (fabsf(outF[j] - refF[j]) > 1e-6f * (1 + fabsf(refF[j])))
+				 || (fabs(outW[j] - refW[j]) > 1e-12 * (1 + fabs(refW[j])))
+				 || (fabsf(outWF[j] - refWF[j]) > 1e-6f * (1 + fabsf(refWF[j])))
+				 || (fabs(outA[j] - refA[j]) > 1e-12 * (1 + fabs(refA[j])))
+				 || (fabsf(outAF[j] - refAF[j]) > 1e-6f * (1 + fabsf(refAF[j]))))
+					{
+					ERR << isaName(isa) << _inputName[in]
+						<< "kernel differs from scalar at" << j;
+					return Testable::TEST_FAIL;
+					}
+			}
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check each format's ingest turns known samples into the
+|* right values, in both precisions, with every instruction set this CPU
+|* can run, that the accumulating ingest adds them on, and that normalising
+|* gives them unwindowed
+\******************************************************************************/
+Testable::TestResult Converter::_checkIngest(void)
+	{
+	typedef struct
+		{
+		SampleSource::Format	format;
+		double					fullScale;
+		std::vector<uint8_t>	bytes;		// Two samples
+		double					expect[4];	// I, Q, I, Q
+		} Case;
+
+	int16_t s16[4]	= {-32768, 16384, 32767, 0};
+	float f32[4]	= {-1.0f, 0.5f, 0.25f, 0.0f};
+	std::vector<uint8_t> cs16(sizeof(s16)), cf32(sizeof(f32));
+	::memcpy(cs16.data(), s16, sizeof(s16));
+	::memcpy(cf32.data(), f32, sizeof(f32));
+
+	const Case cases[] =
+		{
+		{SampleSource::FMT_CS8, 128, {0x80, 0x40, 0x7F, 0x00},
+			{-1.0, 0.5, 127.0/128, 0}},
+		{SampleSource::FMT_CU8, 128, {0x00, 0xFF, 0x80, 0x7F},
+			{-1.0, 1.0, 0.5/U8_CENTRE, -0.5/U8_CENTRE}},
+		// I=-2048 Q=1024, then I=2047 Q=-1
+		{SampleSource::FMT_CS12, 2048, {0x00, 0x08, 0x40, 0xFF, 0xF7, 0xFF},
+			{-1.0, 0.5, 2047.0/2048, -1.0/2048}},
+		{SampleSource::FMT_CS16, 32768, cs16,
+			{-1.0, 0.5, 32767.0/32768, 0}},
+		{SampleSource::FMT_CF32, 1, cf32,
+			{-1.0, 0.5, 0.25, 0}}
+		};
+
+	const double window[4]	= {1.0, 1.0, 0.5, 0.5};
+	const float windowF[4]	= {1.0f, 1.0f, 0.5f, 0.5f};
+	double out[4];
+	float outF[4];
+	for (const Case& c : cases)
+		for (int i=0; i<ISA_MAX; i++)
+			{
+			Isa isa = (Isa)i;
+			if (!isSupported(isa))
+				continue;
+
+			ingest(c.format, isa)(c.bytes.data(), out, 2, c.fullScale, window);
+			ingestFloat(c.format, isa)(c.bytes.data(), outF, 2, c.fullScale,
+									   windowF);
+			for (int j=0; j<4; j++)
+				if ((fabs(out[j] - c.expect[j] * window[j]) > 1e-12)
+				 || (fabs(outF[j] - c.expect[j] * window[j]) > 1e-6))
+					{
+					ERR << isaName(isa) << "ingest of format" << c.format
+						<< "gave" << out[j] << "/" << outF[j]
+						<< "not" << c.expect[j] * window[j] << "at" << j;
+					return Testable::TEST_FAIL;
+					}
+
+			normalise(c.format, isa)(c.bytes.data(), outF, 2, c.fullScale);
+			for (int j=0; j<4; j++)
+				if (fabs(outF[j] - c.expect[j]) > 1e-6)
+					{
+					ERR << isaName(isa) << "normalise of format" << c.format
+						<< "gave" << outF[j] << "not" << c.expect[j]
+						<< "at" << j;
+					return Testable::TEST_FAIL;
+					}
+
+			ingestFloat(c.format, isa)(c.bytes.data(), outF, 2, c.fullScale,
+									   windowF);
+			ingestAdd(c.format, isa)(c.bytes.data(), out, 2, c.fullScale,
+									 window);
+			ingestFloatAdd(c.format, isa)(c.bytes.data(), outF, 2,
+										  c.fullScale, windowF);
+			for (int j=0; j<4; j++)
+				if ((fabs(out[j] - 2 * c.expect[j] * window[j]) > 1e-12)
+				 || (fabs(outF[j] - 2 * c.expect[j] * window[j]) > 1e-6))
+					{
+					ERR << isaName(isa) << "accumulating ingest of format"
+						<< c.format << "gave" << out[j] << "/" << outF[j]
+						<< "not" << 2 * c.expect[j] * window[j] << "at" << j;
+					return Testable::TEST_FAIL;
+					}
+			}
+
+	if ((ingest(SampleSource::FMT_UNKNOWN) != nullptr)
+	 || (ingestFloat(SampleSource::FMT_UNKNOWN) != nullptr)
+	 || (ingestAdd(SampleSource::FMT_UNKNOWN) != nullptr)
+	 || (ingestFloatAdd(SampleSource::FMT_UNKNOWN) != nullptr)
+	 || (normalise(SampleSource::FMT_UNKNOWN) != nullptr))
+		{
+		ERR << "Got an ingest for an unknown format";
+		return Testable::TEST_FAIL;
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Pack a complex sample, with components in -1..1, into a sample format
+\******************************************************************************/
+static void _pack(SampleSource::Format format, double i, double q,
+				  uint8_t *dst)
+	{
+	switch (format)
+		{
+		case SampleSource::FMT_CS8:
+			dst[0] = (uint8_t)(int8_t)lrint(i * 127);
+			dst[1] = (uint8_t)(int8_t)lrint(q * 127);
+			break;
+		case SampleSource::FMT_CU8:
+			dst[0] = (uint8_t)lrint(i * 127 + U8_CENTRE);
+			dst[1] = (uint8_t)lrint(q * 127 + U8_CENTRE);
+			break;
+		case SampleSource::FMT_CS12:
+			{
+			uint16_t vi = (uint16_t)lrint(i * 2047) & 0xFFF;
+			uint16_t vq = (uint16_t)lrint(q * 2047) & 0xFFF;
+			dst[0] = vi & 0xFF;
+			dst[1] = (vi >> 8) | ((vq & 0xF) << 4);
+			dst[2] = vq >> 4;
+			break;
+			}
+		case SampleSource::FMT_CS16:
+			{
+			int16_t v[2] = {(int16_t)lrint(i * 32767), (int16_t)lrint(q * 32767)};
+			::memcpy(dst, v, sizeof(v));
+			break;
+			}
+		default:
+			{
+			float v[2] = {(float)i, (float)q};
+			::memcpy(dst, v, sizeof(v));
+			break;
+			}
+		}
+	}
+
+/******************************************************************************\
+|* Test interface : Check the single-precision pipeline gives the same
+|* answer as the double one. A frame of each format (a tone off a bin centre
+|* in noise) is converted and windowed, transformed, and turned into power
+|* in double as the aggregator does. Float carries 24 bits, more than any
+|* ADC we support, so the spectra must agree to float rounding: within
+|* 1e-6 of the peak in every bin, and within 0.01 dB in every bin no more
+|* than 60 dB below it
+\******************************************************************************/
+Testable::TestResult Converter::_checkPrecision(void)
+	{
+	const SampleSource::Format formats[] =
+		{
+		SampleSource::FMT_CS8,	SampleSource::FMT_CU8, SampleSource::FMT_CS12,
+		SampleSource::FMT_CS16, SampleSource::FMT_CF32
+		};
+	const double fullScale[] = {128, 128, 2048, 32768, 1};
+
+	int bins = PRECISION_BINS;
+	std::vector<uint8_t> src(8 * (size_t)bins);
+	std::vector<double> window(2 * bins), inD(2 * bins), outD(2 * bins);
+	std::vector<float> windowF(2 * bins), inF(2 * bins), outF(2 * bins);
+	std::vector<double> powerD(bins), powerF(bins);
+
+	for (int i=0; i<bins; i++)
+		{
+		window[2*i]		= 0.54 - 0.46 * cos(2 * M_PI * i / bins);
+		window[2*i+1]	= window[2*i];
+		windowF[2*i]	= (float)window[2*i];
+		windowF[2*i+1]	= (float)window[2*i];
+		}
+
+	fftw_complex *cinD	= reinterpret_cast<fftw_complex *>(inD.data());
+	fftw_complex *coutD	= reinterpret_cast<fftw_complex *>(outD.data());
+	fftwf_complex *cinF	= reinterpret_cast<fftwf_complex *>(inF.data());
+	fftwf_complex *coutF = reinterpret_cast<fftwf_complex *>(outF.data());
+	fftw_plan planD		= fftw_plan_dft_1d(bins, cinD, coutD,
+										   FFTW_FORWARD, FFTW_ESTIMATE);
+	fftwf_plan planF	= fftwf_plan_dft_1d(bins, cinF, coutF,
+											FFTW_FORWARD, FFTW_ESTIMATE);
+
+	Testable::TestResult result = Testable::TEST_PASS;
+	for (int f=0; f<5; f++)
+		{
+		SampleSource::Format format	= formats[f];
+		int bytes					= SampleSource::bytesFor(format);
+
+		uint32_t state = 0x2545F491;
+		for (int i=0; i<bins; i++)
+			{
+			double noise[2];
+			for (double& n : noise)
+				{
+				state	= state * 1664525 + 1013904223;
+				n		= ((int32_t)state / 2147483648.0) * 0.05;
+				}
+			double phase = 2 * M_PI * PRECISION_TONE * i / bins;
+			_pack(format, 0.5 * cos(phase) + noise[0],
+				  0.5 * sin(phase) + noise[1], src.data() + i * bytes);
+			}
+
+		ingest(format)(src.data(), inD.data(), bins, fullScale[f],
+					   window.data());
+		ingestFloat(format)(src.data(), inF.data(), bins, fullScale[f],
+							windowF.data());
+		fftw_execute(planD);
+		fftwf_execute(planF);
+
+		double peak = 0;
+		for (int i=0; i<bins; i++)
+			{
+			powerD[i]	= outD[2*i] * outD[2*i] + outD[2*i+1] * outD[2*i+1];
+			powerF[i]	= (double)outF[2*i] * outF[2*i]
+						+ (double)outF[2*i+1] * outF[2*i+1];
+			peak		= std::max(peak, powerD[i]);
+			}
+
+		double worst = 0, worstDb = 0;
+		for (int i=0; i<bins; i++)
+			{
+			worst = std::max(worst, fabs(powerF[i] - powerD[i]) / peak);
+			if (powerD[i] > peak * 1e-6)
+				worstDb = std::max(worstDb,
+								   fabs(10 * log10(powerF[i] / powerD[i])));
+			}
+
+		LOG << "Precision: format" << format << "float differs by at most"
+			<< worst << "of peak," << worstDb << "dB";
+		if ((worst > 1e-6) || (worstDb > 0.01))
+			{
+			ERR << "Single-precision spectrum of format" << format
+				<< "differs from double";
+			result = Testable::TEST_FAIL;
+			}
+		}
+
+	fftw_destroy_plan(planD);
+	fftwf_destroy_plan(planF);
+	return result;
+	}
+
+/******************************************************************************\
+|* Test interface : Measure each kernel on one core, in complex samples per
+|* second, on data that stays in cache
+\******************************************************************************/
+Testable::TestResult Converter::_benchmark(void)
+	{
+	using namespace std::chrono;
+
+	std::vector<uint8_t> src;
+	std::vector<double> outD(BENCH_COUNT);
+	std::vector<float> outF(BENCH_COUNT);
+	double samples = (double)BENCH_COUNT / 2 * BENCH_REPEATS;
+
+	for (int i=0; i<ISA_MAX; i++)
+		{
+		Isa isa = (Isa)i;
+		if (!isSupported(isa))
+			continue;
+
+		for (int in=0; in<IN_MAX; in++)
+			{
+			Input input = (Input)in;
+			_fill(src, input, BENCH_COUNT);
+
+			ToDouble kd	= toDouble(input, isa);
+			auto start	= steady_clock::now();
+			for (int r=0; r<BENCH_REPEATS; r++)
+				kd(src.data(), outD.data(), BENCH_COUNT, 1.0 / 128, 0);
+			double secsD = duration<double>(steady_clock::now() - start).count();
+
+			ToFloat kf	= toFloat(input, isa);
+			start		= steady_clock::now();
+			for (int r=0; r<BENCH_REPEATS; r++)
+				kf(src.data(), outF.data(), BENCH_COUNT, 1.0f / 128, 0);
+			double secsF = duration<double>(steady_clock::now() - start).count();
+
+			LOG << "Converter:" << isaName(isa) << _inputName[in]
+				<< "-> double" << (secsD > 0 ? samples / secsD / 1e6 : 0)
+				<< "Msamples/sec, -> float"
+				<< (secsF > 0 ? samples / secsF / 1e6 : 0) << "Msamples/sec";
+			}
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Compare framing CS16 samples the old way - convert the
+|* buffer, copy each frame out of it, then window the frame in place - with
+|* converting and windowing straight into the frame, on buffers too big for
+|* the cache. Per complex sample the old way reads 4 bytes of input, writes
+|* and re-reads 16 of converted samples, writes 16 into the frame, then
+|* reads 8 of window and re-reads and writes 16 more: 92 bytes. The fused
+|* way reads the input and 16 bytes of (per-component) window, and writes
+|* the frame once: 36 bytes. Fused into single precision, that's 20 bytes
+\******************************************************************************/
+Testable::TestResult Converter::_benchmarkFraming(void)
+	{
+	using namespace std::chrono;
+
+	int count		= FRAME_SAMPLES * FRAME_COUNT;
+	std::vector<uint8_t> src;
+	std::vector<double> work(2 * (size_t)count);
+	std::vector<double> frames(2 * (size_t)count);
+	std::vector<double> window(FRAME_SAMPLES);
+	std::vector<double> window2(2 * FRAME_SAMPLES);
+	std::vector<float> window2F(2 * FRAME_SAMPLES);
+
+	_fill(src, IN_S16, 2 * count);
+	for (int i=0; i<FRAME_SAMPLES; i++)
+		{
+		window[i]		= 0.5 - 0.5 * cos(2 * M_PI * i / FRAME_SAMPLES);
+		window2[2*i]	= window[i];
+		window2[2*i+1]	= window[i];
+		window2F[2*i]	= (float)window[i];
+		window2F[2*i+1]	= (float)window[i];
+		}
+
+	ToDouble convert	= toDouble(IN_S16);
+	Ingest fused		= ingest(SampleSource::FMT_CS16);
+	IngestFloat fusedF	= ingestFloat(SampleSource::FMT_CS16);
+	float *framesF		= reinterpret_cast<float *>(work.data());
+	double best[3]		= {1e9, 1e9, 1e9};
+
+	for (int pass=0; pass<3; pass++)
+		{
+		auto start = steady_clock::now();
+		convert(src.data(), work.data(), 2 * count, 1.0 / 32768, 0.0);
+		for (int f=0; f<FRAME_COUNT; f++)
+			{
+			double *frame	= frames.data() + 2 * (size_t)f * FRAME_SAMPLES;
+			::memcpy(frame, work.data() + 2 * (size_t)f * FRAME_SAMPLES,
+					 2 * FRAME_SAMPLES * sizeof(double));
+			for (int i=0; i<FRAME_SAMPLES; i++)
+				{
+				frame[2*i]	 *= window[i];
+				frame[2*i+1] *= window[i];
+				}
+			}
+		best[0] = std::min(best[0],
+						   duration<double>(steady_clock::now() - start).count());
+
+		start = steady_clock::now();
+		for (int f=0; f<FRAME_COUNT; f++)
+			fused(src.data() + (size_t)f * FRAME_SAMPLES * 4,
+				  frames.data() + 2 * (size_t)f * FRAME_SAMPLES,
+				  FRAME_SAMPLES, 32768, window2.data());
+		best[1] = std::min(best[1],
+						   duration<double>(steady_clock::now() - start).count());
+
+		start = steady_clock::now();
+		for (int f=0; f<FRAME_COUNT; f++)
+			fusedF(src.data() + (size_t)f * FRAME_SAMPLES * 4,
+				   framesF + 2 * (size_t)f * FRAME_SAMPLES,
+				   FRAME_SAMPLES, 32768, window2F.data());
+		best[2] = std::min(best[2],
+						   duration<double>(steady_clock::now() - start).count());
+		}
+
+	double nsOld	= best[0] * 1e9 / count;
+	double nsNew	= best[1] * 1e9 / count;
+	double nsFloat	= best[2] * 1e9 / count;
+	LOG << "Framing: separate passes" << nsOld << "ns/sample (92 bytes moved),"
+		<< "fused" << nsNew << "ns/sample (36 bytes moved),"
+		<< (nsNew > 0 ? nsOld / nsNew : 0) << "x faster";
+	LOG << "Framing: fused to float" << nsFloat << "ns/sample (20 bytes moved),"
+		<< (nsFloat > 0 ? nsNew / nsFloat : 0) << "x faster than to double";
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Compare the polyphase filter bank with the plain windowed
+|* FFT, framing CS16 samples into critically sampled frames and transforming
+|* them. The filter bank runs PFB_TAPS branches of its FIR for each frame,
+|* reading every sample PFB_TAPS times, so its framing costs about that many
+|* times as much; the FFT is the same. Then show what that buys, from a tone
+|* framed both ways: the loss a quarter of a bin off centre, and the most
+|* that leaks into any bin 2 or more away
+\******************************************************************************/
+Testable::TestResult Converter::_benchmarkPfb(void)
+	{
+	using namespace std::chrono;
+
+	int bins		= PFB_BINS;
+	int span		= PFB_BINS * PFB_TAPS;
+	size_t samples	= (size_t)(PFB_FRAMES + PFB_TAPS) * bins;
+	std::vector<uint8_t> src;
+	std::vector<double> frames(2 * (size_t)PFB_FRAMES * bins);
+	std::vector<double> hamming(2 * bins), proto(2 * (size_t)span);
+
+	for (int i=0; i<bins; i++)
+		{
+		hamming[2*i]	= 0.54 - 0.46 * cos(2 * M_PI * i / bins);
+		hamming[2*i+1]	= hamming[2*i];
+		}
+	for (int i=0; i<span; i++)
+		{
+		double x		= (i - span / 2.0) / bins;
+		double sinc		= (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+		proto[2*i]		= sinc * (0.54 - 0.46 * cos(2 * M_PI * i / span));
+		proto[2*i+1]	= proto[2*i];
+		}
+
+	fftw_complex *data	= reinterpret_cast<fftw_complex *>(frames.data());
+	fftw_plan plan		= fftw_plan_many_dft(1, &bins, PFB_FRAMES,
+											 data, nullptr, 1, bins,
+											 data, nullptr, 1, bins,
+											 FFTW_FORWARD, FFTW_ESTIMATE);
+
+	Ingest fused		= ingest(SampleSource::FMT_CS16);
+	Ingest fusedAdd		= ingestAdd(SampleSource::FMT_CS16);
+	auto frame			= [&](bool pfb)
+		{
+		for (int f=0; f<PFB_FRAMES; f++)
+			{
+			const uint8_t *in	= src.data() + (size_t)f * bins * 4;
+			double *dst			= frames.data() + 2 * (size_t)f * bins;
+			if (!pfb)
+				fused(in, dst, bins, 32768, hamming.data());
+			else
+				for (int t=0; t<PFB_TAPS; t++)
+					(t == 0 ? fused : fusedAdd)(in + (size_t)t * bins * 4,
+												dst, bins, 32768,
+												proto.data() + 2 * (size_t)t * bins);
+			}
+		};
+
+	/**************************************************************************\
+	|* Cost: best of three passes each way, framing and FFT timed apart
+	\**************************************************************************/
+	_fill(src, IN_S16, 2 * samples);
+	double best[2][2] = {{1e9, 1e9}, {1e9, 1e9}};
+	for (int pass=0; pass<3; pass++)
+		for (int pfb=0; pfb<2; pfb++)
+			{
+			auto start	= steady_clock::now();
+			frame(pfb);
+			auto framed	= steady_clock::now();
+			fftw_execute(plan);
+			auto done	= steady_clock::now();
+			best[pfb][0] = std::min(best[pfb][0],
+									duration<double>(framed - start).count());
+			best[pfb][1] = std::min(best[pfb][1],
+									duration<double>(done - framed).count());
+			}
+
+	LOG << "FFT: framing" << best[0][0] * 1e6 / PFB_FRAMES << "us/frame, FFT"
+		<< best[0][1] * 1e6 / PFB_FRAMES << "us/frame, for" << bins << "bins";
+	LOG << "PFB: framing" << best[1][0] * 1e6 / PFB_FRAMES << "us/frame, FFT"
+		<< best[1][1] * 1e6 / PFB_FRAMES << "us/frame, with" << PFB_TAPS
+		<< "taps";
+	double plain	= best[0][0] + best[0][1];
+	double pfb		= best[1][0] + best[1][1];
+	LOG << "PFB: costs" << (plain > 0 ? pfb / plain : 0)
+		<< "x the windowed FFT";
+
+	/**************************************************************************\
+	|* Response: a tone on PFB_TONE's centre, then a quarter-bin off it,
+	|* looking at the first frame
+	\**************************************************************************/
+	src.assign(4 * samples, 0);
+	for (int pfb=0; pfb<2; pfb++)
+		{
+		double power[2] = {0, 0}, leak = 0;
+		for (int off=0; off<2; off++)
+			{
+			double tone = PFB_TONE + 0.25 * off;
+			for (size_t i=0; i<samples; i++)
+				{
+				double phase = 2 * M_PI * fmod(tone * i / bins, 1.0);
+				_pack(SampleSource::FMT_CS16, 0.5 * cos(phase),
+					  0.5 * sin(phase), src.data() + i * 4);
+				}
+			frame(pfb);
+			fftw_execute(plan);
+
+			for (int i=0; i<bins; i++)
+				{
+				double p = frames[2*i] * frames[2*i] + frames[2*i+1] * frames[2*i+1];
+				if (i == PFB_TONE)
+					power[off] = p;
+				else if (off && (std::abs(i - PFB_TONE) >= 2))
+					leak = std::max(leak, p);
+				}
+			}
+
+		LOG << (pfb ? "PFB:" : "FFT:") << "a quarter-bin off centre loses"
+			<< 10 * log10(power[0] / power[1]) << "dB, leakage 2+ bins away"
+			<< 10 * log10(std::max(leak, 1e-30) / power[1]) << "dB";
+		}
+
+	fftw_destroy_plan(plan);
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check every power kernel this CPU can run against the
+|* scalar one, in both precisions, adding to accumulators that aren't zero,
+|* with a count that leaves a tail, and that none writes past the end. The
+|* first bin is 3+4i, so its power must be exactly 25
+\******************************************************************************/
+Testable::TestResult Converter::_checkPower(void)
+	{
+	std::vector<double> binsD(2 * CHECK_COUNT);
+	std::vector<float> binsF(2 * CHECK_COUNT);
+	for (int i=0; i<2*CHECK_COUNT; i++)
+		{
+		binsD[i]	= 1000.0 * sin(i * 0.37) + ((i & 1) ? 0.25 : -0.5);
+		binsF[i]	= (float)binsD[i];
+		}
+	binsD[0] = binsF[0] = 3;
+	binsD[1] = binsF[1] = 4;
+
+	std::vector<double> start(CHECK_COUNT);
+	for (int i=0; i<CHECK_COUNT; i++)
+		start[i] = 1.0 + i;
+
+	for (int precision=0; precision<2; precision++)
+		{
+		std::vector<double> refU(start), refS(start);
+		refS[0] = 0;
+		if (precision == 0)
+			power(ISA_SCALAR)(binsD.data(), refU.data(), refS.data(), CHECK_COUNT);
+		else
+			powerFloat(ISA_SCALAR)(binsF.data(), refU.data(), refS.data(), CHECK_COUNT);
+
+		if ((refU[0] != 26) || (refS[0] != 25))
+			{
+			ERR << "Power of 3+4i came out as" << refS[0];
+			return Testable::TEST_FAIL;
+			}
+
+		for (int i=ISA_SCALAR+1; i<ISA_MAX; i++)
+			{
+			Isa isa = (Isa)i;
+			if (!isSupported(isa))
+				continue;
+
+			std::vector<double> outU(start), outS(start);
+			outS[0] = 0;
+			outU.push_back(42.0);
+			outS.push_back(42.0);
+			if (precision == 0)
+				power(isa)(binsD.data(), outU.data(), outS.data(), CHECK_COUNT);
+			else
+				powerFloat(isa)(binsF.data(), outU.data(), outS.data(), CHECK_COUNT);
+
+			if ((outU[CHECK_COUNT] != 42.0) || (outS[CHECK_COUNT] != 42.0))
+				{
+				ERR << isaName(isa) << "power kernel overran";
+				return Testable::TEST_FAIL;
+				}
+
+			// Allow for the vector code using fused multiply-adds
+			for (int j=0; j<CHECK_COUNT; j++)
+				if ((fabs(outU[j] - refU[j]) > 1e-12 * refU[j])
+				 || (fabs(outS[j] - refS[j]) > 1e-12 * refS[j]))
+					{
+					ERR << isaName(isa) << (precision ? "single" : "double")
+						<< "power kernel differs at bin" << j << ":"
+						<< outU[j] << "vs" << refU[j];
+					return Testable::TEST_FAIL;
+					}
+			}
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Time adding a window's worth of FFT frames' power to the
+|* accumulators, as the aggregator used to (a log per bin per frame, on the
+|* components squared twice) and with the power kernels, which leave the log
+|* to once per bin when the window is published
+\******************************************************************************/
+Testable::TestResult Converter::_benchmarkPower(void)
+	{
+	using std::chrono::duration;
+	using std::chrono::steady_clock;
+
+	int bins		= POWER_BINS;
+	size_t values	= 2 * (size_t)bins * POWER_FRAMES;
+	std::vector<double> framesD(values);
+	std::vector<float> framesF(values);
+	for (size_t i=0; i<values; i++)
+		{
+		framesD[i]	= 1000.0 * sin(i * 0.37);
+		framesF[i]	= (float)framesD[i];
+		}
+	std::vector<double> update(bins), sample(bins);
+
+	/**************************************************************************\
+	|* Best of three passes of each, the log included in the new ones' time
+	\**************************************************************************/
+	double best[3] = {1e9, 1e9, 1e9};
+	int64_t passes = 0;
+	for (int pass=0; pass<3; pass++)
+		{
+		std::fill(update.begin(), update.end(), 0.0);
+		std::fill(sample.begin(), sample.end(), 0.0);
+		auto start = steady_clock::now();
+		for (int f=0; f<POWER_FRAMES; f++)
+			{
+			const double *data = framesD.data() + 2 * (size_t)f * bins;
+			for (int i=0; i<bins; i++)
+				{
+				double creal	= data[2*i] * data[2*i];
+				double cimag	= data[2*i+1] * data[2*i+1];
+				double mag		= 0.05 * log(creal * creal + cimag * cimag + 1);
+				update[i]	   += mag;
+				passes ++;
+				sample[i]	   += mag;
+				passes ++;
+				}
+			}
+		best[0] = std::min(best[0],
+						   duration<double>(steady_clock::now() - start).count());
+
+		for (int precision=0; precision<2; precision++)
+			{
+			std::fill(update.begin(), update.end(), 0.0);
+			std::fill(sample.begin(), sample.end(), 0.0);
+			start = steady_clock::now();
+			for (int f=0; f<POWER_FRAMES; f++)
+				{
+				size_t at = 2 * (size_t)f * bins;
+				if (precision == 0)
+					_power(framesD.data() + at, update.data(), sample.data(), bins);
+				else
+					_powerFloat(framesF.data() + at, update.data(), sample.data(), bins);
+				}
+			for (int i=0; i<bins; i++)
+				update[i] = 10 * log10(update[i] / POWER_FRAMES);
+			best[1 + precision] = std::min(best[1 + precision],
+										   duration<double>(steady_clock::now()
+															- start).count());
+			}
+		}
+
+	double perBin = 1e9 / ((double)bins * POWER_FRAMES);
+	LOG << "Power: a log per bin per frame takes" << best[0] * perBin
+		<< "ns/bin, for" << passes / 6 << "bins";
+	LOG << "Power:" << isaName(_isa) << "kernels take" << best[1] * perBin
+		<< "ns/bin from double," << best[2] * perBin << "ns/bin from float,"
+		<< "with the log once per window";
+	LOG << "Power: aggregation is" << (best[1] > 0 ? best[0] / best[1] : 0)
+		<< "x faster";
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : identify the class being tested
+\******************************************************************************/
+const char * Converter::testClassName(void)
+	{
+	return "Converter";
+	}
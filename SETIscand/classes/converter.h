@@ -0,0 +1,255 @@
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include <cstdint>
+
+#include "properties.h"
+#include "samplesource.h"
+#include "singleton.h"
+#include "testable.h"
+
+/******************************************************************************\
+|* Sample conversion kernels: int8, uint8, int16 or float components to float
+|* or double, as dst = src * scale + offset, so the full-scale normalisation
+|* and any DC offset (eg: 127.5 for unsigned samples) cost nothing extra. The
+|* windowed kernels also multiply by a window, one entry per component, so
+|* samples can be converted and windowed in one pass, into double or float.
+|* The accumulating kernels add the windowed samples to what's already in
+|* the destination, so a polyphase filter bank's FIR is a run of them, one
+|* per branch, over the same frame. The power kernels go the other way, at
+|* the far end of the pipeline: they add each bin's power, re^2 + im^2, from
+|* an FFT's interleaved complex output to a pair of per-bin accumulators
+|* (the aggregation windows'), in one pass over the frame.
+|*
+|* Each kernel is written once with GCC/Clang vector types and compiled for
+|* each instruction set we might run on: SSE4.1, AVX2 and AVX-512 on x86-64,
+|* NEON on aarch64, plus a plain scalar loop. The best one the CPU supports
+|* (by CPUID on x86) is picked once, when the instance is first used, so
+|* callers just fetch a function pointer and call it per buffer.
+|*
+|* On top of those, ingest() returns the whole-buffer conversion for a
+|* source's native sample format, from complex samples to normalised and
+|* windowed doubles, and ingestFloat() the same for the single-precision
+|* pipeline. ingestAdd() and ingestFloatAdd() accumulate instead, and
+|* normalise() just converts to CF32, unwindowed, for the down-converters.
+|* There's one instantiation per format (and instruction set), so nothing
+|* tests the format per sample: CS8/CS16 scale by full scale, CU8 removes its
+|* 127.5 centre, CS12 is unpacked from three bytes, and CF32, which is
+|* already normalised, is only widened.
+\******************************************************************************/
+class Converter : public Singleton<Converter>, public Testable
+	{
+	NON_COPYABLE_NOR_MOVEABLE(Converter);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef enum
+			{
+			IN_S8 = 0,					// Signed 8-bit components
+			IN_U8,						// Unsigned 8-bit components
+			IN_S16,						// Signed 16-bit components
+			IN_F32,						// Float components
+			IN_MAX
+			} Input;
+
+		typedef enum
+			{
+			ISA_SCALAR = 0,				// Portable C++
+			ISA_SSE4,					// x86-64 SSE4.1
+			ISA_AVX2,					// x86-64 AVX2
+			ISA_AVX512,					// x86-64 AVX-512F/BW
+			ISA_NEON,					// aarch64 Advanced SIMD
+			ISA_MAX
+			} Isa;
+
+		typedef void (*ToDouble)(const void *src,
+								 double *dst,
+								 int count,
+								 double scale,
+								 double offset);
+
+		typedef void (*ToFloat)(const void *src,
+								float *dst,
+								int count,
+								float scale,
+								float offset);
+
+		typedef void (*Windowed)(const void *src,
+								 double *dst,
+								 int count,
+								 double scale,
+								 double offset,
+								 const double *window);
+
+		typedef void (*WindowedFloat)(const void *src,
+									  float *dst,
+									  int count,
+									  float scale,
+									  float offset,
+									  const float *window);
+
+		typedef void (*Ingest)(const uint8_t *src,
+							   double *dst,
+							   int samples,
+							   double fullScale,
+							   const double *window);
+
+		typedef void (*IngestFloat)(const uint8_t *src,
+									float *dst,
+									int samples,
+									double fullScale,
+									const float *window);
+
+		typedef void (*Normalise)(const uint8_t *src,
+								  float *dst,
+								  int samples,
+								  double fullScale);
+
+		typedef void (*Power)(const double *src,
+							  double *update,
+							  double *sample,
+							  int bins);
+
+		typedef void (*PowerFloat)(const float *src,
+								   double *update,
+								   double *sample,
+								   int bins);
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(Isa, isa);						// The instruction set in use
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		ToDouble		_toDouble[IN_MAX];	// Selected kernels, to double
+		ToFloat			_toFloat[IN_MAX];	// Selected kernels, to float
+		Windowed		_windowed[IN_MAX];	// Selected kernels, windowed
+		WindowedFloat	_windowedFloat[IN_MAX];	// ... and windowed to float
+		Windowed		_accumulated[IN_MAX];	// Selected kernels, accumulating
+		WindowedFloat	_accumulatedFloat[IN_MAX];	// ... into float
+		Power			_power;			// Selected kernel, FFT bin power
+		PowerFloat		_powerFloat;	// ... from single precision
+
+		/**********************************************************************\
+		|* Private Tests
+		\**********************************************************************/
+		Testable::TestResult _checkKernels(void);
+		Testable::TestResult _checkIngest(void);
+		Testable::TestResult _checkPrecision(void);
+		Testable::TestResult _checkPower(void);
+		Testable::TestResult _benchmark(void);
+		Testable::TestResult _benchmarkFraming(void);
+		Testable::TestResult _benchmarkPfb(void);
+		Testable::TestResult _benchmarkPower(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor: pick the kernels for this CPU
+		\**********************************************************************/
+		explicit Converter(void);
+
+		/**********************************************************************\
+		|* Return the selected kernel for an input type
+		\**********************************************************************/
+		inline ToDouble toDouble(Input input) const
+			{
+			return _toDouble[input];
+			}
+
+		inline ToFloat toFloat(Input input) const
+			{
+			return _toFloat[input];
+			}
+
+		inline Windowed windowed(Input input) const
+			{
+			return _windowed[input];
+			}
+
+		inline WindowedFloat windowedFloat(Input input) const
+			{
+			return _windowedFloat[input];
+			}
+
+		inline Windowed accumulated(Input input) const
+			{
+			return _accumulated[input];
+			}
+
+		inline WindowedFloat accumulatedFloat(Input input) const
+			{
+			return _accumulatedFloat[input];
+			}
+
+		/**********************************************************************\
+		|* Return the selected kernel to add FFT bins' power to accumulators,
+		|* from double or single precision bins. 'bins' is in complex values
+		\**********************************************************************/
+		inline Power power(void) const
+			{
+			return _power;
+			}
+
+		inline PowerFloat powerFloat(void) const
+			{
+			return _powerFloat;
+			}
+
+		/**********************************************************************\
+		|* Return the selected ingest for a sample format, to double or to
+		|* float, or nullptr if the format is unknown. 'samples' is in complex
+		|* samples, and the window has an entry per component
+		\**********************************************************************/
+		Ingest ingest(SampleSource::Format format) const;
+		IngestFloat ingestFloat(SampleSource::Format format) const;
+
+		/**********************************************************************\
+		|* The same, but adding the windowed samples to the destination
+		\**********************************************************************/
+		Ingest ingestAdd(SampleSource::Format format) const;
+		IngestFloat ingestFloatAdd(SampleSource::Format format) const;
+
+		/**********************************************************************\
+		|* Return the selected conversion of a sample format to normalised
+		|* CF32, with no window, or nullptr if the format is unknown
+		\**********************************************************************/
+		Normalise normalise(SampleSource::Format format) const;
+
+		/**********************************************************************\
+		|* Return the kernel for an input type and instruction set, or nullptr
+		|* if that instruction set wasn't built in
+		\**********************************************************************/
+		static ToDouble toDouble(Input input, Isa isa);
+		static ToFloat toFloat(Input input, Isa isa);
+		static Windowed windowed(Input input, Isa isa);
+		static WindowedFloat windowedFloat(Input input, Isa isa);
+		static Windowed accumulated(Input input, Isa isa);
+		static WindowedFloat accumulatedFloat(Input input, Isa isa);
+		static Ingest ingest(SampleSource::Format format, Isa isa);
+		static IngestFloat ingestFloat(SampleSource::Format format, Isa isa);
+		static Ingest ingestAdd(SampleSource::Format format, Isa isa);
+		static IngestFloat ingestFloatAdd(SampleSource::Format format, Isa isa);
+		static Normalise normalise(SampleSource::Format format, Isa isa);
+		static Power power(Isa isa);
+		static PowerFloat powerFloat(Isa isa);
+
+		/**********************************************************************\
+		|* Whether this CPU can run an instruction set, and what it's called
+		\**********************************************************************/
+		static bool isSupported(Isa isa);
+		static const char * isaName(Isa isa);
+
+		/**********************************************************************\
+		|* Public Tests interface
+		\**********************************************************************/
+		int numTests(void) override;
+		Testable::TestResult runTest(int idx) override;
+		const char * testClassName(void) override;
+	};
+
+#endif // CONVERTER_H
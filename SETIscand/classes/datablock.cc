@@ -13,18 +13,18 @@
 \******************************************************************************/
 DataBlock::DataBlock(size_t size, bool isFFT)
 		  :_size(size)
+		  ,_capacity(size)
 		  ,_data(nullptr)
-		  ,_refs(0)
 		  ,_isValid(false)
 		  ,_isFFT(isFFT)
+		  ,_isBorrowed(false)
+		  ,_sizeClass(-1)
+		  ,_tag(TAG_OTHER)
+		  ,_refs(0)
+		  ,_handle(-1)
+		  ,_next(nullptr)
 	{
-	if (_isFFT)
-		_data = reinterpret_cast<uint8_t *>(fftw_malloc(_size));
-	else
-		_data = new uint8_t [_size];
-
-	if (_data != nullptr)
-		_isValid = true;
+	_allocate(size);
 	}
 
 /******************************************************************************\
@@ -32,36 +32,100 @@ DataBlock::DataBlock(size_t size, bool isFFT)
 \******************************************************************************/
 DataBlock::DataBlock(size_t elements, size_t sizePerElement, bool isFFT)
 		  :_size(elements * sizePerElement)
+		  ,_capacity(elements * sizePerElement)
 		  ,_data(nullptr)
-		  ,_refs(0)
 		  ,_isValid(false)
 		  ,_isFFT(isFFT)
+		  ,_isBorrowed(false)
+		  ,_sizeClass(-1)
+		  ,_tag(TAG_OTHER)
+		  ,_refs(0)
+		  ,_handle(-1)
+		  ,_next(nullptr)
 	{
-	size_t size = elements * sizePerElement;
-	if (_isFFT)
-		_data = reinterpret_cast<uint8_t *>(fftw_malloc(size));
-	else
-		_data = new uint8_t [size];
-	if (_data != nullptr)
-		_isValid = true;
+	_allocate(elements * sizePerElement);
 	}
 
 
+/******************************************************************************\
+|* Construct a block over memory owned by someone else (an Arena). The memory
+|* must be suitably aligned for fftw if isFFT is set
+\******************************************************************************/
+DataBlock::DataBlock(uint8_t *memory, size_t size, bool isFFT)
+		  :_size(size)
+		  ,_capacity(size)
+		  ,_data(memory)
+		  ,_isValid(memory != nullptr)
+		  ,_isFFT(isFFT)
+		  ,_isBorrowed(true)
+		  ,_sizeClass(-1)
+		  ,_tag(TAG_OTHER)
+		  ,_refs(0)
+		  ,_handle(-1)
+		  ,_next(nullptr)
+	{}
+
 /******************************************************************************\
 |* Destroy a block
 \******************************************************************************/
 DataBlock::~DataBlock(void)
 	{
-	if (_refs != 0)
+	if (refs() != 0)
 		ERR << "Warning - deleting non-zero-references block!";
-	if (_data != nullptr)
+	discard();
+	}
+
+/******************************************************************************\
+|* Allocate the memory for the block from the heap
+\******************************************************************************/
+void DataBlock::_allocate(size_t size)
+	{
+	if (_isFFT)
+		_data = reinterpret_cast<uint8_t *>(fftw_malloc(size));
+	else
+		_data = new uint8_t [size];
+
+	_isBorrowed	= false;
+	_isValid	= (_data != nullptr);
+	}
+
+/******************************************************************************\
+|* Free the memory, leaving an empty block
+\******************************************************************************/
+void DataBlock::discard(void)
+	{
+	if ((_data != nullptr) && !_isBorrowed)
 		{
 		if (_isFFT)
 			fftw_free(_data);
 		else
 			delete [] _data;
-		_data = nullptr;
 		}
+	_data		= nullptr;
+	_isValid	= false;
+	_capacity	= 0;
+	_size		= 0;
+	}
+
+/******************************************************************************\
+|* Give an empty block new memory
+\******************************************************************************/
+bool DataBlock::reallocate(size_t size, uint8_t *memory)
+	{
+	discard();
+
+	if (memory != nullptr)
+		{
+		_data		= memory;
+		_isBorrowed	= true;
+		_isValid	= true;
+		}
+	else
+		_allocate(size);
+
+	_capacity	= _isValid ? size : 0;
+	_size		= _capacity;
+	return _isValid;
 	}
 
 /******************************************************************************\
@@ -69,19 +133,20 @@ DataBlock::~DataBlock(void)
 \******************************************************************************/
 void DataBlock::retain(void)
 	{
-	_refs ++;
+	_refs.fetch_add(1, std::memory_order_relaxed);
 	}
 
 /******************************************************************************\
-|* Retain a block to say it's in use
+|* Release a block to say it's no longer in use by this client
 \******************************************************************************/
-void DataBlock::release(void)
+bool DataBlock::release(void)
 	{
-	if (_refs <= 0)
+	int refs = _refs.fetch_sub(1, std::memory_order_acq_rel);
+	if (refs <= 0)
 		{
-		ERR << "Asked to de-ref data-block with ref count " << _refs;
-		_refs = 0;
+		ERR << "Asked to de-ref data-block with ref count " << refs;
+		_refs.fetch_add(1, std::memory_order_relaxed);
+		return false;
 		}
-	else
-		_refs --;
+	return (refs == 1);
 	}
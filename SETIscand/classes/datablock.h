@@ -1,6 +1,8 @@
 #ifndef DATABLOCK_H
 #define DATABLOCK_H
 
+#include <atomic>
+
 #include <QObject>
 #include <fftw3.h>
 
@@ -8,14 +10,44 @@
 
 class DataBlock
 	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums - the subsystem a block is accounted against
+		\**********************************************************************/
+		typedef enum
+			{
+			TAG_OTHER	= 0,
+			TAG_INGEST,
+			TAG_FFT,
+			TAG_AGGREGATION,
+			TAG_NETWORK,
+			TAG_COUNT
+			} Tag;
+
 	/**************************************************************************\
 	|* Properties
 	\**************************************************************************/
-	GET(size_t, size);				// Size of the block in bytes
-	GET(uint8_t *, data);			// Actual data block
-	GET(int, refs);					// Number of clients for this block
-	GET(bool, isValid);				// If the block is valid post construction
-	GET(bool, isFFT);				// Allocated via fftw3
+	GETSET(size_t, size, Size);			// Size of the block in bytes
+	GET(size_t, capacity);				// Allocated size of the block in bytes
+	GET(uint8_t *, data);				// Actual data block
+	GET(bool, isValid);					// If the block is valid post construction
+	GET(bool, isFFT);					// Allocated via fftw3
+	GET(bool, isBorrowed);				// Memory belongs to an Arena
+	GETSET(int, sizeClass, SizeClass);	// Pool size-class or -1 if unpooled
+	GETSET(int, tag, Tag);				// Subsystem currently using the block
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		std::atomic<int>		_refs;	// Number of clients for this block
+		std::atomic<int64_t>	_handle; // DataMgr handle, -1 if unregistered
+		std::atomic<DataBlock*>	_next;	// Link while parked in a pool
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		void _allocate(size_t size);
 
 	public:
 		/**********************************************************************\
@@ -25,18 +57,60 @@ class DataBlock
 						   size_t sizePerElement,
 						   bool isFFT=false);
 		explicit DataBlock(size_t size, bool isFFT=false);
+		explicit DataBlock(uint8_t *memory, size_t size, bool isFFT);
 		~DataBlock();
 
+		/**********************************************************************\
+		|* Free the memory but keep the (now invalid) block object around, or
+		|* give a discarded block new memory - from 'memory' if it's given,
+		|* which then belongs to an Arena, otherwise from the heap
+		\**********************************************************************/
+		void discard(void);
+		bool reallocate(size_t size, uint8_t *memory = nullptr);
+
+		/**********************************************************************\
+		|* Return the number of clients for this block
+		\**********************************************************************/
+		inline int refs(void) const
+			{
+			return _refs.load(std::memory_order_acquire);
+			}
+
 		/**********************************************************************\
 		|* Retain the block, marking it as in-use by some client
 		\**********************************************************************/
 		void retain(void);
 
 		/**********************************************************************\
-		|* Release the block, marking it as no-longer-in-use by some client
+		|* Release the block, marking it as no-longer-in-use by some client.
+		|* Returns true if that was the last reference
 		\**********************************************************************/
-		void release(void);
+		bool release(void);
 
+		/**********************************************************************\
+		|* The DataMgr handle. It changes generation each time the block comes
+		|* out of the pool, while other threads may be looking it up
+		\**********************************************************************/
+		inline int64_t handle(void) const
+			{
+			return _handle.load(std::memory_order_acquire);
+			}
+		inline void setHandle(int64_t handle)
+			{
+			_handle.store(handle, std::memory_order_release);
+			}
+
+		/**********************************************************************\
+		|* Pool linkage
+		\**********************************************************************/
+		inline DataBlock * next(void) const
+			{
+			return _next.load(std::memory_order_relaxed);
+			}
+		inline void setNext(DataBlock *next)
+			{
+			_next.store(next, std::memory_order_relaxed);
+			}
 	};
 
 #endif // DATABLOCK_H
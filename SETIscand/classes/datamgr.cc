@@ -1,140 +1,285 @@
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <QStringList>
+#include <QThread>
+
+#include "config.h"
 #include "constants.h"
 #include "datamgr.h"
+#include "fftaggregator.h"
+#include "taskfft.h"
 
 /******************************************************************************\
 |* Testing
 \******************************************************************************/
-#define MAX_TESTS (2)
+#define MAX_TESTS			(9)
+#define STRESS_THREADS		(8)
+#define STRESS_ITERATIONS	(20000)
+
+/******************************************************************************\
+|* Pool identifiers, used to index the per-thread caches
+\******************************************************************************/
+#define POOL_PLAIN			(0)
+#define POOL_FFT			(1)
+
+/******************************************************************************\
+|* Names for the accounting tags, in DataBlock::Tag order
+\******************************************************************************/
+static const char * _tagNames[DataBlock::TAG_COUNT] =
+	{
+	"other", "ingest", "fft", "aggregation", "network"
+	};
 
 /******************************************************************************\
 |* Categorised logging support
 \******************************************************************************/
 Q_LOGGING_CATEGORY(log_data, "seti.data  ")
 
-#define LOG qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
-#define ERR qCritical(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define LOG  qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
 
 /******************************************************************************\
 |* Create the data manager. Only called via the sharedInstance class method
 \******************************************************************************/
 DataMgr::DataMgr(void)
 		:_handle(0)
-	{}
+		,_plain(POOL_PLAIN, false)
+		,_fft(POOL_FFT, true)
+		,_arena(nullptr)
+		,_budget(0)
+		,_reserved(0)
+	{
+	for (int i=0; i<MAX_CHUNKS; i++)
+		_chunks[i].store(nullptr, std::memory_order_relaxed);
+
+	for (int i=0; i<DataBlock::TAG_COUNT; i++)
+		{
+		_tagBytes[i].store(0, std::memory_order_relaxed);
+		_tagDenied[i].store(0, std::memory_order_relaxed);
+		}
+	}
 
 
 /******************************************************************************\
-|* Destroy the data blocks
+|* Destroy the handle table. Pooled blocks are deleted by their pools, and
+|* any still-live blocks are deliberately left alone since a client may be
+|* tearing down in parallel at exit
 \******************************************************************************/
 DataMgr::~DataMgr(void)
 	{
-	for (DataBlock* block : _candidate)
-		delete block;
-	_candidate.clear();
+	for (int i=0; i<MAX_CHUNKS; i++)
+		delete [] _chunks[i].load(std::memory_order_relaxed);
 
-	QMap<int64_t, DataBlock*>::const_iterator i = _active.constBegin();
-		delete i.value();
-	_active.clear();
+	// Blocks carved from the arena don't touch it when they're deleted
+	delete _arena;
 	}
 
 /******************************************************************************\
 |* Create or find a block with a given size
 \******************************************************************************/
-int DataMgr::blockFor(size_t size)
+int64_t DataMgr::blockFor(size_t size)
 	{
-	int64_t result = (int64_t)-1;
-	QMutexLocker guard(&_lock);
+	return _acquire(_plain, size);
+	}
 
-	/**************************************************************************\
-	|* See if we can move one of the elements from the candidate list into the
-	|* active list
-	\**************************************************************************/
-	bool foundBlock = false;
-	int idx = 0;
-	for (DataBlock* block : _candidate)
+/******************************************************************************\
+|* Create or find a block with a given size-per-element and count
+\******************************************************************************/
+int64_t DataMgr::blockFor(size_t count, size_t sizePerElement)
+	{
+	return blockFor(count * sizePerElement);
+	}
+
+/******************************************************************************\
+|* Create or find a block with a given size using the FFTW3 allocation strategy
+\******************************************************************************/
+int64_t DataMgr::fftBlockFor(size_t bins)
+	{
+	return _acquire(_fft, sizeof(fftw_complex) * bins);
+	}
+
+/******************************************************************************\
+|* Return a counted reference to an fftw-allocated block
+\******************************************************************************/
+BlockRef<fftw_complex> DataMgr::fftRefFor(size_t bins, int tag)
+	{
+	return BlockRef<fftw_complex>(_acquireBlock(_fft,
+												sizeof(fftw_complex) * bins,
+												tag));
+	}
+
+/******************************************************************************\
+|* The same for single-precision fftw data, from the same (fftw-aligned) pool
+\******************************************************************************/
+BlockRef<fftwf_complex> DataMgr::fftfRefFor(size_t bins, int tag)
+	{
+	return BlockRef<fftwf_complex>(_acquireBlock(_fft,
+												 sizeof(fftwf_complex) * bins,
+												 tag));
+	}
+
+/******************************************************************************\
+|* Get a block from a pool, subject to the budget, and account it to a tag. A
+|* pool hit never grows the footprint so goes straight through; a miss has to
+|* be admitted first
+\******************************************************************************/
+DataBlock * DataMgr::_acquireBlock(BlockPool& pool, size_t size, int tag)
+	{
+	if ((tag < 0) || (tag >= DataBlock::TAG_COUNT))
+		tag = DataBlock::TAG_OTHER;
+
+	bool limited		= (_budget.load(std::memory_order_relaxed) > 0);
+	DataBlock *block	= pool.acquire(size, !limited);
+
+	if ((block == nullptr) && limited)
 		{
-		if (block->size() >= size)
+		int sizeClass = BlockPool::classFor(size);
+		if (sizeClass < 0)
+			return nullptr;
+
+		int64_t need = (int64_t)BlockPool::classSize(sizeClass);
+		if (_admit(pool, need))
+			{
+			block = pool.acquire(size);
+			_reserved.fetch_sub(need, std::memory_order_relaxed);
+			}
+		else
 			{
-			result = _handle ++;
-			_active[result] = block;
-			_candidate.removeAt(idx);
-			block->retain();
-			foundBlock = true;
-			break;
+			int64_t denied = _tagDenied[tag].fetch_add(1, std::memory_order_relaxed) + 1;
+			if ((denied & (denied - 1)) == 0)
+				WARN << "Memory budget reached:" << denied
+					 << _tagNames[tag] << "requests refused so far,"
+					 << (bytesCached() >> 10) << "KiB idle in thread caches";
 			}
-		idx ++;
 		}
 
+	if (block == nullptr)
+		return nullptr;
+
 	/**************************************************************************\
-	|* If not, create a new block of sufficient size
+	|* Every acquisition of a registered block gets a new generation, so a
+	|* handle from a previous owner no longer resolves to it
 	\**************************************************************************/
-	if (!foundBlock)
+	int64_t handle = block->handle();
+	if (handle >= 0)
 		{
-		result = _handle ++;
-		DataBlock *block = new DataBlock(size);
-		block->retain();
-		_active[result] = block;
-		result = _active.size()-1;
+		int64_t slot	= _slot(handle);
+		int64_t gen		= ((handle >> SLOT_BITS) + 1) & 0x7FFFFFFF;
+		block->setHandle((gen << SLOT_BITS) | slot);
 		}
 
-	return result;
+	block->setTag(tag);
+	_tagBytes[tag].fetch_add((int64_t)block->capacity(), std::memory_order_relaxed);
+	return block;
 	}
 
 /******************************************************************************\
-|* Create or find a block with a given size-per-element and count
+|* Reserve room for a new block of 'bytes' within the budget, trimming parked
+|* blocks if need be - first from the pool that missed (whatever it has parked
+|* is the wrong size, or it wouldn't have missed), then from the other one.
+|* On success the reservation is left in _reserved for the caller to drop
+|* once the block exists. Concurrent misses each reserve before checking, so
+|* between them they can't overshoot the budget
 \******************************************************************************/
-int DataMgr::blockFor(size_t count, size_t sizePerElement)
+bool DataMgr::_admit(BlockPool& pool, int64_t bytes)
 	{
-	return blockFor(count * sizePerElement);
+	int64_t budget	= _budget.load(std::memory_order_relaxed);
+	int64_t total	= _reserved.fetch_add(bytes, std::memory_order_relaxed)
+					+ bytes + bytesHeld();
+	if (total <= budget)
+		return true;
+
+	BlockPool& other = (&pool == &_plain) ? _fft : _plain;
+	int64_t excess	 = total - budget;
+	excess			-= pool.trim(excess);
+	if (excess > 0)
+		other.trim(excess);
+
+	total = _reserved.load(std::memory_order_relaxed) + bytesHeld();
+	if (total <= budget)
+		return true;
+
+	_reserved.fetch_sub(bytes, std::memory_order_relaxed);
+	return false;
 	}
 
 /******************************************************************************\
-|* Create or find a block with a given size using the FFTW3 allocation strategy
+|* Get a block from a pool, and give it a handle if it's newly allocated. Only
+|* a pool miss takes the lock
 \******************************************************************************/
-int DataMgr::fftBlockFor(size_t bins)
+int64_t DataMgr::_acquire(BlockPool& pool, size_t size)
 	{
-	int64_t result = (int64_t)-1;
-	QMutexLocker guard(&_lock);
+	DataBlock *block = _acquireBlock(pool, size, DataBlock::TAG_OTHER);
+	if (block == nullptr)
+		return -1;
 
-	size_t size = sizeof(fftw_complex) * bins;
+	if (block->handle() < 0)
+		{
+		int64_t handle = _register(block);
+		if (handle < 0)
+			release(block);
+		return handle;
+		}
 
-	/**************************************************************************\
-	|* See if we can move one of the elements from the candidate list into the
-	|* active list. Tighter constraints on the test due to the fft plan
-	|* requirements
-	\**************************************************************************/
-	bool foundBlock = false;
-	int idx = 0;
-	for (DataBlock* block : _candidate)
+	return block->handle();
+	}
+
+/******************************************************************************\
+|* Give a newly-created block a handle. Blocks keep their slot for life, and
+|* the handle carries the slot's generation in its upper bits, bumped each
+|* time the block comes back out of the pool
+\******************************************************************************/
+int64_t DataMgr::_register(DataBlock *block)
+	{
+	QMutexLocker guard(&_lock);
+
+	int64_t handle	= _handle;
+	int chunk		= (int)(handle >> CHUNK_SHIFT);
+	if (chunk >= MAX_CHUNKS)
 		{
-		if (block->size() == size && block->isFFT())
-			{
-			result = _handle ++;
-			_active[result] = block;
-			_candidate.removeAt(idx);
-			block->retain();
-			foundBlock = true;
-			break;
-			}
-		idx ++;
+		ERR << "Out of block handles";
+		return -1;
 		}
 
-	/**************************************************************************\
-	|* If not, create a new block of sufficient size using the FFTW allocator
-	\**************************************************************************/
-	if (!foundBlock)
+	std::atomic<DataBlock*> *table = _chunks[chunk].load(std::memory_order_relaxed);
+	if (table == nullptr)
 		{
-		result = _handle ++;
-		DataBlock *block = new DataBlock(size, true);
-		if (block == nullptr)
-			result = -1;
-		else
-			{
-			block->retain();
-			_active[result] = block;
-			}
+		table = new std::atomic<DataBlock*>[CHUNK_SIZE];
+		for (int i=0; i<CHUNK_SIZE; i++)
+			table[i].store(nullptr, std::memory_order_relaxed);
+		_chunks[chunk].store(table, std::memory_order_release);
 		}
 
-	return result;
+	block->setHandle(handle);
+	table[handle & (CHUNK_SIZE-1)].store(block, std::memory_order_release);
+	_handle ++;
+	return handle;
+	}
+
+/******************************************************************************\
+|* Find the block for a handle without locking. Returns nullptr unless the
+|* handle refers to a block that is currently in use, by the same owner - a
+|* stale handle to a block since recycled has the wrong generation
+\******************************************************************************/
+DataBlock * DataMgr::_lookup(int64_t handle)
+	{
+	int64_t slot = _slot(handle);
+	if ((handle < 0) || ((slot >> CHUNK_SHIFT) >= MAX_CHUNKS))
+		return nullptr;
+
+	std::atomic<DataBlock*> *table =
+		_chunks[slot >> CHUNK_SHIFT].load(std::memory_order_acquire);
+	if (table == nullptr)
+		return nullptr;
+
+	DataBlock *block = table[slot & (CHUNK_SIZE-1)].load(std::memory_order_acquire);
+	if ((block == nullptr) || (block->refs() <= 0) || (block->handle() != handle))
+		return nullptr;
+	return block;
 	}
 
 
@@ -143,11 +288,8 @@ int DataMgr::fftBlockFor(size_t bins)
 \******************************************************************************/
 size_t DataMgr::extent(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-	size_t extent = 0;
-	if (_active.contains(idx))
-		extent = _active[idx]->size();
-	return extent;
+	DataBlock *block = _lookup(idx);
+	return (block == nullptr) ? 0 : block->size();
 	}
 
 /******************************************************************************\
@@ -155,14 +297,13 @@ size_t DataMgr::extent(int64_t idx)
 \******************************************************************************/
 uint8_t * DataMgr::asUint8(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested uint8_t data for OOB index " << idx;
 		return nullptr;
 		}
-	return _active[idx]->data();
+	return block->data();
 	}
 
 /******************************************************************************\
@@ -170,14 +311,13 @@ uint8_t * DataMgr::asUint8(int64_t idx)
 \******************************************************************************/
 int8_t * DataMgr::asInt8(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested int8_t data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<int8_t *>(_active[idx]->data());
+	return reinterpret_cast<int8_t *>(block->data());
 	}
 
 
@@ -186,14 +326,13 @@ int8_t * DataMgr::asInt8(int64_t idx)
 \******************************************************************************/
 uint16_t * DataMgr::asUint16(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested uint16_t data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<uint16_t *>(_active[idx]->data());
+	return reinterpret_cast<uint16_t *>(block->data());
 	}
 
 /******************************************************************************\
@@ -201,14 +340,13 @@ uint16_t * DataMgr::asUint16(int64_t idx)
 \******************************************************************************/
 int16_t * DataMgr::asInt16(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested uint8_t data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<int16_t *>(_active[idx]->data());
+	return reinterpret_cast<int16_t *>(block->data());
 	}
 
 /******************************************************************************\
@@ -216,14 +354,13 @@ int16_t * DataMgr::asInt16(int64_t idx)
 \******************************************************************************/
 uint32_t * DataMgr::asUint32(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested int data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<uint32_t *>(_active[idx]->data());
+	return reinterpret_cast<uint32_t *>(block->data());
 	}
 
 /******************************************************************************\
@@ -231,14 +368,13 @@ uint32_t * DataMgr::asUint32(int64_t idx)
 \******************************************************************************/
 int32_t * DataMgr::asInt32(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested int data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<int32_t *>(_active[idx]->data());
+	return reinterpret_cast<int32_t *>(block->data());
 	}
 
 /******************************************************************************\
@@ -246,14 +382,13 @@ int32_t * DataMgr::asInt32(int64_t idx)
 \******************************************************************************/
 float * DataMgr::asFloat(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested float data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<float *>(_active[idx]->data());
+	return reinterpret_cast<float *>(block->data());
 	}
 
 /******************************************************************************\
@@ -261,14 +396,13 @@ float * DataMgr::asFloat(int64_t idx)
 \******************************************************************************/
 double * DataMgr::asDouble(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested double data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<double *>(_active[idx]->data());
+	return reinterpret_cast<double *>(block->data());
 	}
 
 /******************************************************************************\
@@ -276,14 +410,13 @@ double * DataMgr::asDouble(int64_t idx)
 \******************************************************************************/
 std::complex<float> * DataMgr::asComplexFloat(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested double data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<std::complex<float> *>(_active[idx]->data());
+	return reinterpret_cast<std::complex<float> *>(block->data());
 	}
 
 /******************************************************************************\
@@ -291,14 +424,13 @@ std::complex<float> * DataMgr::asComplexFloat(int64_t idx)
 \******************************************************************************/
 std::complex<double> * DataMgr::asComplexDouble(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested double data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<std::complex<double> *>(_active[idx]->data());
+	return reinterpret_cast<std::complex<double> *>(block->data());
 	}
 
 /******************************************************************************\
@@ -306,69 +438,270 @@ std::complex<double> * DataMgr::asComplexDouble(int64_t idx)
 \******************************************************************************/
 fftw_complex* DataMgr::asFFT(int64_t idx)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(idx))
+	DataBlock *block = _lookup(idx);
+	if (block == nullptr)
 		{
 		ERR << "Requested FFT data for OOB index " << idx;
 		return nullptr;
 		}
-	return reinterpret_cast<fftw_complex*>(_active[idx]->data());
+	return reinterpret_cast<fftw_complex*>(block->data());
 	}
 
 
 /******************************************************************************\
 |* Handle the retain-count for a given index
 \******************************************************************************/
-int DataMgr::retainCount(uint64_t handle)
+int DataMgr::retainCount(int64_t handle)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(handle))
+	DataBlock *block = _lookup(handle);
+	if (block == nullptr)
 		{
 		ERR << "Retain count requested for unknown handle " << handle;
 		return -1;
 		}
-	return _active[handle]->refs();
+	return block->refs();
 	}
 
 /******************************************************************************\
 |* Handle release for a given index
 \******************************************************************************/
-void DataMgr::release(uint64_t handle)
+void DataMgr::release(int64_t handle)
 	{
-	QMutexLocker guard(&_lock);
-
-	if (!_active.contains(handle))
+	DataBlock *block = _lookup(handle);
+	if (block == nullptr)
 		{
 		ERR << "Release requested for unknown handle " << handle;
 		return;
 		}
-	_active[handle]->release();
+
+	release(block);
+	}
+
+/******************************************************************************\
+|* Drop a reference on a block, returning it to its pool if the refs == 0
+\******************************************************************************/
+void DataMgr::release(DataBlock *block)
+	{
+	if (block->release())
+		{
+		_tagBytes[block->tag()].fetch_sub((int64_t)block->capacity(),
+										  std::memory_order_relaxed);
+		if (block->isFFT())
+			_fft.recycle(block);
+		else
+			_plain.recycle(block);
+		}
+	}
+
+/******************************************************************************\
+|* BlockRef hand-off: drop a reference held by a BlockRef
+\******************************************************************************/
+void BlockRefBase::_release(DataBlock *block)
+	{
+	DataMgr::instance().release(block);
+	}
+
+/******************************************************************************\
+|* Handle retain for a given index
+\******************************************************************************/
+void DataMgr::retain(int64_t handle)
+	{
+	DataBlock *block = _lookup(handle);
+	if (block == nullptr)
+		{
+		ERR << "Retain requested for unknown handle " << handle;
+		return;
+		}
+	block->retain();
+	}
+
+/******************************************************************************\
+|* Return the pool counters
+\******************************************************************************/
+BlockPool::Stats DataMgr::poolStats(bool isFFT)
+	{
+	return isFFT ? _fft.stats() : _plain.stats();
+	}
+
+/******************************************************************************\
+|* Log the pool counters
+\******************************************************************************/
+void DataMgr::logPoolStats(void)
+	{
+	for (BlockPool *pool : {&_plain, &_fft})
+		{
+		BlockPool::Stats s = pool->stats();
+		LOG << (pool->isFFT() ? "fft  " : "plain")
+			<< "pool: hits" << s.hits
+			<< "misses" << s.misses
+			<< "live" << s.live
+			<< "high-water" << s.highWater
+			<< "created" << s.created
+			<< "late-misses" << s.lateMisses
+			<< "trimmed" << s.trimmed;
+		}
+
+	QStringList tags;
+	for (int i=0; i<DataBlock::TAG_COUNT; i++)
+		tags << QString("%1 %2 KiB (%3 refused)")
+					.arg(_tagNames[i])
+					.arg(tagBytes(i) >> 10)
+					.arg(tagDenied(i));
+	LOG << "held" << (bytesHeld() >> 10) << "KiB of"
+		<< (budget() > 0 ? QString::number(budget() >> 10) + " KiB" : "unlimited")
+		<< QString("(%1 KiB in thread caches)").arg(bytesCached() >> 10)
+		<< "in use:" << tags.join(", ");
+	}
+
+/******************************************************************************\
+|* Pre-allocate the blocks the pipeline will use, so the first seconds of
+|* streaming don't have to go to the heap. Per batch of frames in flight we
+|* need an input and an output fftw block (single-precision ones, if that's
+|* the pipeline); the ingest side needs an MTU-sized buffer for each
+|* sample-ring slot plus the ring's scratch buffer; and the aggregator needs
+|* a spare snapshot for each of the update and the sample windows, for when
+|* the network side is still holding on to every one it has published
+\******************************************************************************/
+void DataMgr::prewarm(int mtu, int sampleBytes, double rate)
+	{
+	Config& cfg		= Config::instance();
+	int fftSize		= cfg.fftSize();
+	int hop			= cfg.fftHop();
+	int batch		= cfg.fftBatch();
+	int inFlight	= cfg.framesInFlight();
+
+	if (batch <= 0)
+		batch = TaskFFT::batchFor(fftSize, hop, rate);
 
 	/**************************************************************************\
-	|* Move to candidate if the refs == 0
+	|* A frame starts every hop, and with overlap several are being filled
+	|* at once
 	\**************************************************************************/
-	if (_active[handle]->refs() == 0)
+	if (inFlight <= 0)
+		inFlight = 2 * (mtu / hop + 1) + (fftSize + hop - 1) / hop
+				 + 2 * QThread::idealThreadCount();
+
+	size_t ingest	= (size_t)mtu * sampleBytes;
+	size_t frame	= cfg.fftSinglePrecision()
+					? (size_t)fftSize * sizeof(fftwf_complex)
+					: (size_t)fftSize * sizeof(fftw_complex);
+	size_t snapshot	= (FFTAggregator::SNAPSHOT_HEADER + (size_t)fftSize)
+					* sizeof(double);
+
+	_fft.prewarm(frame * batch, 2 * ((inFlight + batch - 1) / batch + 1));
+	_plain.prewarm(ingest, cfg.ringSlots() + 1);
+	_plain.prewarm(snapshot, 2);
+
+	LOG << "Pre-warmed pools for" << inFlight << "frames in flight,"
+		<< "in batches of" << batch << ", MTU" << mtu << "samples";
+	if ((budget() > 0) && (bytesHeld() > budget()))
+		WARN << "Pre-warmed pools already exceed the memory budget,"
+			 << "expect dropped frames";
+	logPoolStats();
+	}
+
+/******************************************************************************\
+|* Create the arena, if configured
+\******************************************************************************/
+void DataMgr::setupArena(void)
+	{
+	Config& cfg		= Config::instance();
+	size_t size		= ((size_t)cfg.arenaSize()) << 20;
+	if ((size == 0) || (_arena != nullptr))
+		return;
+
+	_arena = new Arena(size,
+					   cfg.arenaHugePageSize(),
+					   cfg.arenaLock(),
+					   cfg.arenaNumaNode());
+	if (!_arena->isValid())
 		{
-		DataBlock *block = _active[handle];
-		_candidate.append(block);
-		_active.remove(handle);
+		delete _arena;
+		_arena = nullptr;
+		return;
 		}
+
+	_plain.setArena(_arena);
+	_fft.setArena(_arena);
 	}
 
 /******************************************************************************\
-|* Handle retain for a given index
+|* Set the memory budget from the config
 \******************************************************************************/
-void DataMgr::retain(uint64_t handle)
+void DataMgr::setupBudget(void)
 	{
-	QMutexLocker guard(&_lock);
+	Config& cfg		= Config::instance();
+	setBudget(((int64_t)cfg.memoryBudget()) << 20);
 
-	if (!_active.contains(handle))
+	if (budget() > 0)
 		{
-		ERR << "Retain requested for unknown handle " << handle;
+		LOG << "Memory budget is" << (budget() >> 20) << "MiB";
+		if ((int64_t)(((size_t)cfg.arenaSize()) << 20) > budget())
+			WARN << "Arena is larger than the memory budget";
 		}
-	_active[handle]->retain();
+	}
+
+/******************************************************************************\
+|* Set the memory budget in bytes, 0 for unlimited
+\******************************************************************************/
+void DataMgr::setBudget(int64_t bytes)
+	{
+	_budget.store((bytes > 0) ? bytes : 0, std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the memory budget in bytes, 0 for unlimited
+\******************************************************************************/
+int64_t DataMgr::budget(void)
+	{
+	return _budget.load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the bytes held by both pools, live and parked
+\******************************************************************************/
+int64_t DataMgr::bytesHeld(void)
+	{
+	return _plain.bytesHeld().load(std::memory_order_relaxed)
+		 + _fft.bytesHeld().load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the bytes held in per-thread caches, part of bytesHeld()
+\******************************************************************************/
+int64_t DataMgr::bytesCached(void)
+	{
+	return _plain.bytesCached().load(std::memory_order_relaxed)
+		 + _fft.bytesCached().load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the bytes in use for a tag
+\******************************************************************************/
+int64_t DataMgr::tagBytes(int tag)
+	{
+	if ((tag < 0) || (tag >= DataBlock::TAG_COUNT))
+		return 0;
+	return _tagBytes[tag].load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Return the number of requests refused for a tag
+\******************************************************************************/
+int64_t DataMgr::tagDenied(int tag)
+	{
+	if ((tag < 0) || (tag >= DataBlock::TAG_COUNT))
+		return 0;
+	return _tagDenied[tag].load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Mark the pools as warm
+\******************************************************************************/
+void DataMgr::setWarm(bool warm, bool abortOnMiss)
+	{
+	_plain.setWarm(warm, abortOnMiss);
+	_fft.setWarm(warm, abortOnMiss);
 	}
 
 /******************************************************************************\
@@ -390,6 +723,20 @@ Testable::TestResult DataMgr::runTest(int idx)
 			return _checkAllocations();
 		case 1:
 			return _checkRetainRelease();
+		case 2:
+			return _checkSizeClasses();
+		case 3:
+			return _checkThreadedStress();
+		case 4:
+			return _checkBlockRefs();
+		case 5:
+			return _checkPrewarm();
+		case 6:
+			return _checkArena();
+		case 7:
+			return _checkBudget();
+		case 8:
+			return _checkCacheFlush();
 		}
 
 	ERR << "Test requested outside of range";
@@ -402,31 +749,36 @@ Testable::TestResult DataMgr::runTest(int idx)
 \******************************************************************************/
 Testable::TestResult DataMgr::_checkAllocations(void)
 	{
-	_active.clear();
-	_candidate.clear();
+	int64_t live = _plain.stats().live;
 
-	int handle = blockFor(1024000);
+	int64_t handle = blockFor(1024000);
 	if (handle < 0)
 		{
 		ERR << "Cannot allocate 1024000 bytes";
 		return Testable::TEST_FAIL;
 		}
 
-	if (_active.size() != 1)
+	if (_plain.stats().live != live + 1)
 		{
 		ERR << "Block is not in active list";
 		return Testable::TEST_FAIL;
 		}
 
-	if (_candidate.size() != 0)
+	if (extent(handle) != 1024000)
 		{
-		ERR << "Candidate list is not empty";
+		ERR << "Block extent is not the requested size";
 		return Testable::TEST_FAIL;
 		}
 
 	// Clean up tidily
 	release(handle);
 
+	if (_plain.stats().live != live)
+		{
+		ERR << "Block was not returned to the pool";
+		return Testable::TEST_FAIL;
+		}
+
 	return Testable::TEST_PASS;
 	}
 
@@ -435,10 +787,7 @@ Testable::TestResult DataMgr::_checkAllocations(void)
 \******************************************************************************/
 Testable::TestResult DataMgr::_checkRetainRelease(void)
 	{
-	_active.clear();
-	_candidate.clear();
-
-	int handle1 = blockFor(1024000);
+	int64_t handle1 = blockFor(1024000);
 	if (retainCount(handle1) != 1)
 		{
 		ERR << "Retain count invalid for " << handle1;
@@ -447,64 +796,482 @@ Testable::TestResult DataMgr::_checkRetainRelease(void)
 
 	release(handle1);
 
-	if (_active.size() != 0)
-		{
-		ERR << "Block was not moved to candidate list";
-		return Testable::TEST_FAIL;
-		}
-
-	if (_candidate.size() != 1)
+	if (_lookup(handle1) != nullptr)
 		{
-		ERR << "Candidate list was not populated";
+		ERR << "Block was not moved to the pool";
 		return Testable::TEST_FAIL;
 		}
 
 	// Allocate another, larger block
-	int handle2 = blockFor(2024000);
+	BlockPool::Stats before = _plain.stats();
+	int64_t handle2 = blockFor(2024000);
 	if (retainCount(handle2) != 1)
 		{
 		ERR << "Retain count invalid for " << handle2;
 		return Testable::TEST_FAIL;
 		}
 
-	if (_active.size() != 1)
+	if ((handle2 == handle1) || (_plain.stats().live != before.live + 1))
 		{
-		ERR << "New block not created in active list";
+		ERR << "New block not created for the larger size";
 		return Testable::TEST_FAIL;
 		}
 
-	if (_candidate.size() != 1)
+	// Now allocate another block of the initial size
+	before = _plain.stats();
+	int64_t handle3 = blockFor(1024000);
+	if (retainCount(handle3) != 1)
 		{
-		ERR << "Candidate list corrupted";
+		ERR << "Retain count invalid for " << handle3;
 		return Testable::TEST_FAIL;
 		}
 
-	// Now allocate another block of the initial size
-	handle1 = blockFor(1024000);
-	if (retainCount(handle1) != 1)
+	if ((_slot(handle3) != _slot(handle1))
+		|| (_plain.stats().hits != before.hits + 1))
 		{
-		ERR << "Retain count invalid for " << handle1;
+		ERR << "New block not moved from the pool";
 		return Testable::TEST_FAIL;
 		}
 
-	if (_active.size() != 2)
+	// The recycled block has a new handle, and the old one is now stale: a
+	// late release through it mustn't take the new owner's reference
+	if ((handle3 == handle1) || (_lookup(handle1) != nullptr))
 		{
-		ERR << "New block not moved from candidate list";
+		ERR << "Stale handle" << handle1 << "still resolves after reuse";
 		return Testable::TEST_FAIL;
 		}
 
-	if (_candidate.size() != 0)
+	// Retain/release pairs shouldn't return the block to the pool
+	retain(handle3);
+	release(handle3);
+	if (retainCount(handle3) != 1)
 		{
-		ERR << "Candidate list not empty";
+		ERR << "Retain/release pair changed the count for " << handle3;
 		return Testable::TEST_FAIL;
 		}
 
 	// Tidy up so we don't get warnings
-	release(handle1);
+	release(handle3);
 	release(handle2);
 	return Testable::TEST_PASS;
 	}
 
+/******************************************************************************\
+|* Test interface : Check the size-class mapping and the plain/fft separation
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkSizeClasses(void)
+	{
+	size_t sizes[] = {1, 64, 65, 80, 81, 1000, 4096, 4097, 1024000,
+					  2048*sizeof(double), 16*1024*1024+1};
+	for (size_t size : sizes)
+		{
+		int sizeClass = BlockPool::classFor(size);
+		if ((sizeClass < 0) || (BlockPool::classSize(sizeClass) < size))
+			{
+			ERR << "Size" << size << "maps to too small a class";
+			return Testable::TEST_FAIL;
+			}
+		if ((sizeClass > 0) && (BlockPool::classSize(sizeClass-1) >= size))
+			{
+			ERR << "Size" << size << "maps to too large a class";
+			return Testable::TEST_FAIL;
+			}
+		}
+
+	for (int i=1; i<BlockPool::NUM_CLASSES; i++)
+		if (BlockPool::classFor(BlockPool::classSize(i)) != i)
+			{
+			ERR << "Class" << i << "does not map back to itself";
+			return Testable::TEST_FAIL;
+			}
+
+	// An fft block must never be handed out as a plain block, or vice versa
+	int64_t fft = fftBlockFor(1024);
+	if ((reinterpret_cast<uintptr_t>(asFFT(fft)) & 15) != 0)
+		{
+		ERR << "FFT block is not aligned";
+		return Testable::TEST_FAIL;
+		}
+	release(fft);
+
+	int64_t plain = blockFor(1024 * sizeof(fftw_complex));
+	if (plain == fft)
+		{
+		ERR << "FFT block handed out from the plain pool";
+		return Testable::TEST_FAIL;
+		}
+	release(plain);
+
+	int64_t again = fftBlockFor(1024);
+	if (_slot(again) != _slot(fft))
+		{
+		ERR << "FFT block not reused from the fft pool";
+		return Testable::TEST_FAIL;
+		}
+	release(again);
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Hammer the pools from several threads, passing blocks
+|* between threads so that release happens on a different thread from
+|* allocation. Each block is stamped with its owner and checked before it's
+|* released, so a block handed out twice will show up as corruption
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkThreadedStress(void)
+	{
+	int64_t plainLive		= _plain.stats().live;
+	int64_t fftLive			= _fft.stats().live;
+	std::atomic<int> errors(0);
+
+	QMutex handoffLock;
+	std::vector<int64_t> handoff;
+
+	auto worker = [&](int id)
+		{
+		std::mt19937 rng((unsigned)id);
+		std::uniform_int_distribution<size_t> sizes(8, 64 * 1024);
+		std::vector<int64_t> mine;
+
+		for (int i=0; i<STRESS_ITERATIONS; i++)
+			{
+			size_t size		= sizes(rng);
+			bool isFFT		= (rng() & 3) == 0;
+			int64_t handle	= isFFT ? fftBlockFor(size / sizeof(fftw_complex) + 1)
+									: blockFor(size);
+			int32_t *data	= asInt32(handle);
+			if (data == nullptr)
+				{
+				errors ++;
+				continue;
+				}
+
+			data[0]			= id;
+			data[1]			= i;
+			mine.push_back(handle);
+
+			/******************************************************************\
+			|* Every so often, swap some blocks with the other threads
+			\******************************************************************/
+			if ((i & 15) == 15)
+				{
+				QMutexLocker guard(&handoffLock);
+				handoff.push_back(mine.back());
+				mine.pop_back();
+				if (handoff.size() > 64)
+					{
+					release(handoff.front());
+					handoff.erase(handoff.begin());
+					}
+				}
+
+			if (mine.size() > 32)
+				{
+				int64_t victim	= mine.front();
+				int32_t *check	= asInt32(victim);
+				if ((check == nullptr) || (check[0] != id))
+					errors ++;
+				mine.erase(mine.begin());
+				release(victim);
+				}
+			}
+
+		for (int64_t handle : mine)
+			{
+			int32_t *check = asInt32(handle);
+			if ((check == nullptr) || (check[0] != id))
+				errors ++;
+			release(handle);
+			}
+
+		_plain.flushThreadCache();
+		_fft.flushThreadCache();
+		};
+
+	std::vector<std::thread> threads;
+	for (int i=0; i<STRESS_THREADS; i++)
+		threads.emplace_back(worker, i);
+	for (std::thread& thread : threads)
+		thread.join();
+
+	for (int64_t handle : handoff)
+		release(handle);
+
+	if (errors.load() != 0)
+		{
+		ERR << "Stress test saw" << errors.load() << "corrupted blocks";
+		return Testable::TEST_FAIL;
+		}
+
+	if ((_plain.stats().live != plainLive) || (_fft.stats().live != fftLive))
+		{
+		ERR << "Stress test leaked blocks";
+		return Testable::TEST_FAIL;
+		}
+
+	logPoolStats();
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check that BlockRefs count references correctly
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkBlockRefs(void)
+	{
+	int64_t live = _fft.stats().live;
+	DataBlock *block = nullptr;
+		{
+		BlockRef<fftw_complex> ref = fftRefFor(1024);
+		block = ref.block();
+		if (!ref || (ref.count() != 1024) || (block->refs() != 1))
+			{
+			ERR << "New BlockRef is not valid";
+			return Testable::TEST_FAIL;
+			}
+
+		BlockRef<fftw_complex> copy = ref;
+		if (block->refs() != 2)
+			{
+			ERR << "Copying a BlockRef did not retain the block";
+			return Testable::TEST_FAIL;
+			}
+
+		BlockRef<fftw_complex> moved = std::move(copy);
+		if ((block->refs() != 2) || copy.isValid())
+			{
+			ERR << "Moving a BlockRef did not transfer the reference";
+			return Testable::TEST_FAIL;
+			}
+
+		BlockRef<double> view = ref.as<double>();
+		if ((view.count() != 2048) || (block->refs() != 3))
+			{
+			ERR << "Re-typed BlockRef is incorrect";
+			return Testable::TEST_FAIL;
+			}
+
+		moved.reset();
+		if (block->refs() != 2)
+			{
+			ERR << "Resetting a BlockRef did not release the block";
+			return Testable::TEST_FAIL;
+			}
+		}
+
+	if ((block->refs() != 0) || (_fft.stats().live != live))
+		{
+		ERR << "BlockRefs going out of scope did not return the block";
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check that pre-warmed blocks are served without misses,
+|* and that a miss once warm is counted
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkPrewarm(void)
+	{
+	const int bins		= 12345;
+	const int count		= 6;
+
+	_fft.flushThreadCache();
+	BlockPool::Stats before = _fft.stats();
+	_fft.prewarm(bins * sizeof(fftw_complex), count);
+
+	// Pre-warming isn't traffic, and mustn't wipe the traffic already counted
+	BlockPool::Stats warmed = _fft.stats();
+	if ((warmed.hits != before.hits) || (warmed.misses != before.misses)
+		|| (warmed.live != before.live))
+		{
+		ERR << "Pre-warm changed the pool's traffic counters";
+		return Testable::TEST_FAIL;
+		}
+
+	_fft.setWarm(true, false);
+	before = _fft.stats();
+	std::vector<BlockRef<fftw_complex>> refs;
+	for (int i=0; i<count; i++)
+		refs.push_back(fftRefFor(bins));
+
+	BlockPool::Stats after = _fft.stats();
+	if ((after.misses != before.misses) || (after.lateMisses != before.lateMisses))
+		{
+		ERR << "Pre-warmed pool still had to allocate";
+		_fft.setWarm(false, false);
+		return Testable::TEST_FAIL;
+		}
+
+	refs.push_back(fftRefFor(bins));
+	if (_fft.stats().lateMisses != before.lateMisses + 1)
+		{
+		ERR << "Late miss was not counted";
+		_fft.setWarm(false, false);
+		return Testable::TEST_FAIL;
+		}
+
+	_fft.setWarm(false, false);
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check the arena hands out aligned, non-overlapping space
+|* and reports when it's full
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkArena(void)
+	{
+	const size_t size = 4 << 20;
+	Arena arena(size, 0, false, Arena::NUMA_NONE);
+	if (!arena.isValid())
+		{
+		ERR << "Cannot create a test arena";
+		return Testable::TEST_FAIL;
+		}
+
+	uint8_t *small	= arena.allocate(100);
+	uint8_t *other	= arena.allocate(100);
+	uint8_t *page	= arena.allocate(arena.pageSize());
+	if ((small == nullptr) || (other == nullptr) || (page == nullptr)
+		|| ((reinterpret_cast<uintptr_t>(other) & 63) != 0)
+		|| ((reinterpret_cast<uintptr_t>(page) & (arena.pageSize()-1)) != 0)
+		|| (other < small + 100) || (page < other + 100))
+		{
+		ERR << "Arena allocations are misaligned or overlap";
+		return Testable::TEST_FAIL;
+		}
+
+	memset(page, 0xAA, arena.pageSize());
+	if (arena.allocate(size) != nullptr)
+		{
+		ERR << "Arena over-allocated";
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check the budget refuses new blocks once reached, that
+|* trimming parked blocks makes room, and that the tags are accounted
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkBudget(void)
+	{
+	const int64_t mib	= 1 << 20;
+	int64_t saved		= budget();
+	int64_t tagged		= tagBytes(DataBlock::TAG_NETWORK);
+	int64_t refused		= tagDenied(DataBlock::TAG_NETWORK);
+
+	// Start from nothing parked, so the arithmetic below is exact
+	_plain.flushThreadCache();
+	_fft.flushThreadCache();
+	_plain.trim(INT64_MAX);
+	_fft.trim(INT64_MAX);
+	int64_t base = bytesHeld();
+	setBudget(base + 3 * mib);
+
+	auto fail = [&](const char *msg)
+		{
+		ERR << msg;
+		setBudget(saved);
+		return Testable::TEST_FAIL;
+		};
+
+	std::vector<BlockRef<uint8_t>> refs;
+	for (int i=0; i<3; i++)
+		refs.push_back(refFor<uint8_t>(mib, DataBlock::TAG_NETWORK));
+	for (BlockRef<uint8_t>& ref : refs)
+		if (!ref)
+			return fail("Block within the budget was refused");
+
+	if (tagBytes(DataBlock::TAG_NETWORK) != tagged + 3 * mib)
+		return fail("Tagged bytes not accounted");
+
+	if (refFor<uint8_t>(mib, DataBlock::TAG_NETWORK).isValid()
+		|| (tagDenied(DataBlock::TAG_NETWORK) != refused + 1))
+		return fail("Block over the budget was not refused");
+
+	// Park one block, then ask for a different size: it has to be trimmed
+	int64_t trimmed = _plain.stats().trimmed;
+	refs.pop_back();
+	_plain.flushThreadCache();
+	if (tagBytes(DataBlock::TAG_NETWORK) != tagged + 2 * mib)
+		return fail("Released bytes not accounted");
+
+	BlockRef<uint8_t> half = refFor<uint8_t>(mib / 2, DataBlock::TAG_NETWORK);
+	if (!half || (_plain.stats().trimmed != trimmed + 1)
+		|| (bytesHeld() != base + 2 * mib + mib / 2))
+		return fail("Parked block was not trimmed to make room");
+
+	refs.clear();
+	half.reset();
+	if (tagBytes(DataBlock::TAG_NETWORK) != tagged)
+		return fail("Tagged bytes leaked");
+
+	setBudget(saved);
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check that a block idle in another thread's cache is
+|* counted as cached, that trim can't reach it, and that the thread hands it
+|* back to the depot (for the next trim) on its next trip to the pool
+\******************************************************************************/
+Testable::TestResult DataMgr::_checkCacheFlush(void)
+	{
+	const int64_t mib	= 1 << 20;
+	std::atomic<int> step(0);
+
+	_plain.flushThreadCache();
+	_plain.trim(INT64_MAX);
+	int64_t cached		= _plain.bytesCached().load();
+
+	auto waitFor = [&](int value)
+		{
+		while (step.load() != value)
+			std::this_thread::yield();
+		};
+
+	std::thread worker([&]()
+		{
+		refFor<uint8_t>(3 * mib).reset();
+		step = 1;
+		waitFor(2);
+		refFor<uint8_t>(64).reset();
+		step = 3;
+		waitFor(4);
+		});
+
+	auto fail = [&](const char *msg)
+		{
+		ERR << msg;
+		step = 4;
+		worker.join();
+		return Testable::TEST_FAIL;
+		};
+
+	waitFor(1);
+	if (_plain.bytesCached().load() != cached + 3 * mib)
+		return fail("Block parked in a thread cache not counted as cached");
+
+	if ((_plain.trim(INT64_MAX) >= 3 * mib)
+		|| (_plain.bytesCached().load() != cached + 3 * mib))
+		return fail("Trim reached into another thread's cache");
+
+	step = 2;
+	waitFor(3);
+	if (_plain.bytesCached().load() >= cached + 3 * mib)
+		return fail("Thread did not flush its cache when asked");
+
+	if (_plain.trim(3 * mib) < 3 * mib)
+		return fail("Flushed block could not be trimmed");
+
+	step = 4;
+	worker.join();
+	return Testable::TEST_PASS;
+	}
+
 /******************************************************************************\
 |* Test interface : identify the class being tested
 \******************************************************************************/
@@ -1,13 +1,15 @@
 #ifndef DATAMGR_H
 #define DATAMGR_H
 
+#include <atomic>
 #include <complex>
 #include <fftw3.h>
 
-#include <QMap>
 #include <QMutexLocker>
-#include <QVector>
 
+#include "arena.h"
+#include "blockpool.h"
+#include "blockref.h"
 #include "properties.h"
 #include "datablock.h"
 #include "singleton.h"
@@ -17,14 +19,51 @@ class DataMgr : public Singleton<DataMgr>, public Testable
 	{
 	NON_COPYABLE_NOR_MOVEABLE(DataMgr);
 
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			CHUNK_SHIFT		= 12,			// 4096 handles per chunk
+			CHUNK_SIZE		= 1 << CHUNK_SHIFT,
+			MAX_CHUNKS		= 1024,			// So 4M distinct blocks
+			SLOT_BITS		= 32			// Generation lives above this
+			};
+
 	private:
 		/**********************************************************************\
 		|* Private variables
 		\**********************************************************************/
-		QMutex						_lock;			// Thread safety
-		int64_t						_handle;		// Constantly increasing
-		QMap<int64_t, DataBlock*>	_active;		// Map of in-use blocks
-		QVector<DataBlock*>			_candidate;		// List of candidate blocks
+		QMutex						_lock;			// Guards registration
+		int64_t						_handle;		// Next free slot
+		BlockPool					_plain;			// Pool of normal blocks
+		BlockPool					_fft;			// Pool of fftw blocks
+		Arena *						_arena;			// Optional backing arena
+
+		// Memory budget in bytes (0 = unlimited), bytes reserved by
+		// in-progress pool misses, and the per-tag accounting
+		std::atomic<int64_t>		_budget;
+		std::atomic<int64_t>		_reserved;
+		std::atomic<int64_t>		_tagBytes[DataBlock::TAG_COUNT];
+		std::atomic<int64_t>		_tagDenied[DataBlock::TAG_COUNT];
+
+		// Handle -> block lookup, in lazily-allocated chunks so that
+		// readers never need the lock
+		std::atomic<std::atomic<DataBlock*>*> _chunks[MAX_CHUNKS];
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		int64_t _register(DataBlock *block);
+		DataBlock * _lookup(int64_t handle);
+		static inline int64_t _slot(int64_t handle)
+			{
+			return handle & ((1LL << SLOT_BITS) - 1);
+			}
+		int64_t _acquire(BlockPool& pool, size_t size);
+		DataBlock * _acquireBlock(BlockPool& pool, size_t size, int tag);
+		bool _admit(BlockPool& pool, int64_t bytes);
 
 	public:
 		/**********************************************************************\
@@ -36,13 +75,31 @@ class DataMgr : public Singleton<DataMgr>, public Testable
 		/**********************************************************************\
 		|* Public Methods - return a handle for a block of a given size
 		\**********************************************************************/
-		int blockFor(size_t size);
-		int blockFor(size_t count, size_t sizePerElement);
+		int64_t blockFor(size_t size);
+		int64_t blockFor(size_t count, size_t sizePerElement);
 
 		/**********************************************************************\
 		|* This will allocate the block using fftw3 memory allocation
 		\**********************************************************************/
-		int fftBlockFor(size_t bins);
+		int64_t fftBlockFor(size_t bins);
+
+		/**********************************************************************\
+		|* Public Methods - return a counted, typed reference to a block. The
+		|* preferred interface: no handle lookups, and the block goes back to
+		|* the pool when the last reference goes away. The tag says which
+		|* subsystem the bytes are accounted to. If the memory budget would
+		|* be exceeded the returned ref is invalid, and the caller is expected
+		|* to drop whatever it was going to do with it
+		\**********************************************************************/
+		template <typename T>
+		BlockRef<T> refFor(size_t count, int tag = DataBlock::TAG_OTHER)
+			{
+			return BlockRef<T>(_acquireBlock(_plain, count * sizeof(T), tag));
+			}
+		BlockRef<fftw_complex> fftRefFor(size_t bins,
+										 int tag = DataBlock::TAG_FFT);
+		BlockRef<fftwf_complex> fftfRefFor(size_t bins,
+										   int tag = DataBlock::TAG_FFT);
 
 		/**********************************************************************\
 		|* Public Methods - return a pointer to the data in a given block
@@ -67,9 +124,55 @@ class DataMgr : public Singleton<DataMgr>, public Testable
 		/**********************************************************************\
 		|* Public Methods - interface for retain counts from client side
 		\**********************************************************************/
-		int retainCount(uint64_t handle);
-		void retain(uint64_t handle);
-		void release(uint64_t handle);
+		int retainCount(int64_t handle);
+		void retain(int64_t handle);
+		void release(int64_t handle);
+		void release(DataBlock *block);
+
+		/**********************************************************************\
+		|* Public Methods - pool statistics
+		\**********************************************************************/
+		BlockPool::Stats poolStats(bool isFFT);
+		void logPoolStats(void);
+
+		/**********************************************************************\
+		|* Public Methods - allocate everything the pipeline will need up
+		|* front, sized from the config and the stream's MTU (in samples),
+		|* sample size and rate
+		\**********************************************************************/
+		void prewarm(int mtu, int sampleBytes, double rate);
+
+		/**********************************************************************\
+		|* Public Methods - mark the pools as warm, so any further pool miss
+		|* is counted (and optionally aborts)
+		\**********************************************************************/
+		void setWarm(bool warm, bool abortOnMiss);
+
+		/**********************************************************************\
+		|* Public Methods - set up the huge-page/locked/NUMA arena if the
+		|* config asks for one. Call before anything is allocated
+		\**********************************************************************/
+		void setupArena(void);
+
+		/**********************************************************************\
+		|* Public Methods - the memory budget. Once the pools hold this many
+		|* bytes, a pool miss first trims parked blocks and then, if that
+		|* isn't enough, is refused. Blocks idle in other threads' caches
+		|* count as held until those threads flush them, which a short trim
+		|* asks them to do. Set up from the config by setupBudget()
+		\**********************************************************************/
+		void setupBudget(void);
+		void setBudget(int64_t bytes);
+		int64_t budget(void);
+		int64_t bytesHeld(void);
+		int64_t bytesCached(void);
+
+		/**********************************************************************\
+		|* Public Methods - bytes currently in use, and requests refused, per
+		|* DataBlock::Tag
+		\**********************************************************************/
+		int64_t tagBytes(int tag);
+		int64_t tagDenied(int tag);
 
 		/**********************************************************************\
 		|* Public Tests interface
@@ -84,6 +187,13 @@ class DataMgr : public Singleton<DataMgr>, public Testable
 		\**********************************************************************/
 		Testable::TestResult _checkAllocations(void);
 		Testable::TestResult _checkRetainRelease(void);
+		Testable::TestResult _checkSizeClasses(void);
+		Testable::TestResult _checkThreadedStress(void);
+		Testable::TestResult _checkBlockRefs(void);
+		Testable::TestResult _checkPrewarm(void);
+		Testable::TestResult _checkArena(void);
+		Testable::TestResult _checkBudget(void);
+		Testable::TestResult _checkCacheFlush(void);
 
 	};
 
@@ -0,0 +1,570 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstring>
+
+#include "allocwatch.h"
+#include "constants.h"
+#include "ddc.h"
+
+/******************************************************************************\
+|* Testing
+\******************************************************************************/
+#define MAX_TESTS			(3)
+#define TEST_RATE			(2048000.0)		// The default sample rate
+#define TEST_OFFSET			(200000.0)		// Sub-band centre, Hz
+#define TEST_DECIMATION		(32)			// CIC by 4, then 3 half-bands
+#define TEST_OUTPUTS		(8192)			// Samples out, once settled
+#define TEST_SETTLE			(256)			// Samples out to ignore first
+#define TEST_AMPLITUDE		(0.5)
+#define BENCH_SAMPLES		(4 << 20)		// Samples in, per decimation
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* The CIC takes its input as integers at this scale: float carries 24 bits,
+|* and with CIC_ORDER stages decimating by up to CIC_MAX the integrators
+|* grow by another 32, which still fits in 64
+\******************************************************************************/
+#define CIC_INPUT_SCALE		(16777216.0)
+
+/******************************************************************************\
+|* Vector type: eight floats, whatever the target's SIMD unit makes of them
+\******************************************************************************/
+typedef float		v8f __attribute__((vector_size(32)));
+
+static inline void _load(v8f& v, const float *src)
+	{
+	::memcpy(&v, src, sizeof(v));
+	}
+
+static inline void _store(float *dst, const v8f& v)
+	{
+	::memcpy(dst, &v, sizeof(v));
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+DDC::DDC(double inputRate, double offsetHz, int decimation, int maxInput)
+	:_inputRate(inputRate)
+	,_offsetHz(offsetHz)
+	,_decimation(decimation)
+	,_cicRate(1)
+	,_halfbands(0)
+	,_maxInput(maxInput)
+	,_position(0)
+	,_cycles(0)
+	,_step(0)
+	,_cicPhase(0)
+	,_cicScale(CIC_INPUT_SCALE)
+	,_cicNorm(1)
+	{
+	/**************************************************************************\
+	|* The half-bands take the factors of two, the CIC the rest
+	\**************************************************************************/
+	while ((_halfbands < MAX_HALFBANDS)
+		   && (decimation > 0)
+		   && ((decimation % (2 << _halfbands)) == 0))
+		_halfbands ++;
+	_cicRate = (decimation > 0) ? decimation >> _halfbands : 0;
+
+	if (!isValid())
+		{
+		ERR << "Cannot down-convert" << offsetHz << "Hz by" << decimation
+			<< "at" << inputRate << "samples/sec";
+		return;
+		}
+
+	_step		= offsetHz / inputRate;
+	_cicNorm	= 1.0 / (CIC_INPUT_SCALE * std::pow((double)_cicRate, CIC_ORDER));
+	_i.assign(maxInput + LANES, 0.0f);
+	_q.assign(maxInput + LANES, 0.0f);
+
+	/**************************************************************************\
+	|* The half-band: a Blackman-windowed sinc cut off at a quarter of the
+	|* rate. Every other tap is zero, bar the centre one (0.5), and the rest
+	|* are symmetric, so only one side of the odd ones is kept, scaled so the
+	|* gain at 0 Hz is 1
+	\**************************************************************************/
+	int length	= 4 * HALFBAND_PAIRS - 1;
+	int centre	= 2 * HALFBAND_PAIRS - 1;
+	double sum	= 0;
+	for (int m=0; m<HALFBAND_PAIRS; m++)
+		{
+		int n		= 2 * m;
+		int d		= centre - n;
+		double w	= 0.42
+					- 0.5 * cos(2 * M_PI * n / (length - 1))
+					+ 0.08 * cos(4 * M_PI * n / (length - 1));
+		double h	= sin(M_PI * d / 2) / (M_PI * d) * w;
+		_taps[m]	= (float)h;
+		sum		   += 2 * h;
+		}
+	for (int m=0; m<HALFBAND_PAIRS; m++)
+		_taps[m] = (float)(_taps[m] * 0.5 / sum);
+
+	/**************************************************************************\
+	|* Room in each stage for its history and the most one call gives it
+	\**************************************************************************/
+	int in = maxInput / _cicRate + 1;
+	for (int s=0; s<_halfbands; s++)
+		{
+		size_t room = (size_t)(2 * HALFBAND_PAIRS + in / 2 + 1 + LANES);
+		_stages[s].ei.assign(room, 0.0f);
+		_stages[s].eq.assign(room, 0.0f);
+		_stages[s].oi.assign(room, 0.0f);
+		_stages[s].oq.assign(room, 0.0f);
+		in = in / 2 + 1;
+		}
+
+	reset(0);
+	LOG << "Sub-band at" << offsetHz << "Hz decimating by" << decimation
+		<< "(CIC" << _cicRate << "then" << _halfbands << "half-bands)";
+	}
+
+/******************************************************************************\
+|* Return whether the parameters were usable
+\******************************************************************************/
+bool DDC::isValid(void)
+	{
+	return (_inputRate > 0)
+		&& (_decimation >= 2)
+		&& (_cicRate <= CIC_MAX)
+		&& (_maxInput > 0)
+		&& (std::fabs(_offsetHz) < _inputRate / 2);
+	}
+
+/******************************************************************************\
+|* Start afresh at an input stream index
+\******************************************************************************/
+void DDC::reset(int64_t index)
+	{
+	double cycles	= (double)index * _step;
+	_cycles			= cycles - std::floor(cycles);
+	_cicPhase		= 0;
+	::memset(_integ, 0, sizeof(_integ));
+	::memset(_comb, 0, sizeof(_comb));
+
+	for (HalfBand& stage : _stages)
+		{
+		stage.evens	= 0;
+		stage.odds	= 0;
+		stage.odd	= false;
+		}
+	_position = index / std::max(_decimation, 1);
+	}
+
+/******************************************************************************\
+|* Down-convert a buffer
+\******************************************************************************/
+int DDC::process(const float *src, int count, float *dst)
+	{
+	AllocWatch::Scope pipeline;
+	_mix(src, count);
+	int n = _cic(count);
+	for (int s=0; s<_halfbands; s++)
+		n = _halfband(_stages[s], n);
+
+	for (int i=0; i<n; i++)
+		{
+		dst[2*i]	= _i[i];
+		dst[2*i+1]	= _q[i];
+		}
+	_position += n;
+	return n;
+	}
+
+/******************************************************************************\
+|* Split the interleaved input into planar I and Q, shifting it down by the
+|* offset on the way
+\******************************************************************************/
+void DDC::_mix(const float *src, int count)
+	{
+	float *I	= _i.data();
+	float *Q	= _q.data();
+
+	for (int b=0; b<count; b+=NCO_BLOCK)
+		{
+		int len			= std::min<int>(NCO_BLOCK, count - b);
+		double phase	= -2.0 * M_PI * _cycles;
+		double step		= -2.0 * M_PI * _step;
+
+		v8f re, im;
+		for (int k=0; k<LANES; k++)
+			{
+			re[k]	= (float)std::cos(phase + k * step);
+			im[k]	= (float)std::sin(phase + k * step);
+			}
+		float rr	= (float)std::cos(LANES * step);
+		float ri	= (float)std::sin(LANES * step);
+
+		int full	= len & ~(LANES - 1);
+		int i		= 0;
+		for (; i<full; i+=LANES)
+			{
+			const float *in = src + 2 * (b + i);
+			v8f vi, vq;
+			for (int k=0; k<LANES; k++)
+				{
+				vi[k] = in[2*k];
+				vq[k] = in[2*k+1];
+				}
+			_store(I + b + i, vi * re - vq * im);
+			_store(Q + b + i, vi * im + vq * re);
+
+			v8f next	= re * rr - im * ri;
+			im			= re * ri + im * rr;
+			re			= next;
+			}
+		for (int k=0; i<len; i++, k++)
+			{
+			float vi	= src[2 * (b + i)];
+			float vq	= src[2 * (b + i) + 1];
+			I[b+i]		= vi * re[k] - vq * im[k];
+			Q[b+i]		= vi * im[k] + vq * re[k];
+			}
+
+		_cycles += len * _step;
+		_cycles -= std::floor(_cycles);
+		}
+	}
+
+/******************************************************************************\
+|* The CIC, decimating _i and _q in place. The arithmetic is unsigned so it
+|* wraps, which the combs undo exactly
+\******************************************************************************/
+int DDC::_cic(int count)
+	{
+	if (_cicRate == 1)
+		return count;
+
+	float *I	= _i.data();
+	float *Q	= _q.data();
+	int out		= 0;
+	for (int n=0; n<count; n++)
+		{
+		uint64_t x[2] = {(uint64_t)(int64_t)(I[n] * _cicScale),
+						 (uint64_t)(int64_t)(Q[n] * _cicScale)};
+		for (int c=0; c<2; c++)
+			{
+			_integ[c][0] += x[c];
+			for (int s=1; s<CIC_ORDER; s++)
+				_integ[c][s] += _integ[c][s-1];
+			}
+
+		if (++ _cicPhase < _cicRate)
+			continue;
+		_cicPhase = 0;
+
+		for (int c=0; c<2; c++)
+			{
+			uint64_t y = _integ[c][CIC_ORDER-1];
+			for (int s=0; s<CIC_ORDER; s++)
+				{
+				uint64_t last	= _comb[c][s];
+				_comb[c][s]		= y;
+				y			   -= last;
+				}
+			x[c] = y;
+			}
+		I[out]	= (float)((int64_t)x[0] * _cicNorm);
+		Q[out]	= (float)((int64_t)x[1] * _cicNorm);
+		out ++;
+		}
+	return out;
+	}
+
+/******************************************************************************\
+|* A half-band stage, decimating _i and _q in place. With the even samples
+|* E and the odd ones O, output j is
+|*
+|*	0.5 O[j+K-1] + sum over m<K of tap[m] (E[j+m] + E[j+2K-1-m])
+|*
+|* so each tap is a multiply-add of two runs of consecutive samples, done
+|* LANES outputs at a time
+\******************************************************************************/
+int DDC::_halfband(HalfBand& stage, int count)
+	{
+	const int K = HALFBAND_PAIRS;
+	float *I	= _i.data();
+	float *Q	= _q.data();
+
+	for (int n=0; n<count; n++)
+		{
+		if (stage.odd)
+			{
+			stage.oi[stage.odds]	= I[n];
+			stage.oq[stage.odds]	= Q[n];
+			stage.odds ++;
+			}
+		else
+			{
+			stage.ei[stage.evens]	= I[n];
+			stage.eq[stage.evens]	= Q[n];
+			stage.evens ++;
+			}
+		stage.odd = !stage.odd;
+		}
+
+	int out = std::min(stage.evens - (2 * K - 1), stage.odds - (K - 1));
+	if (out <= 0)
+		return 0;
+
+	const float *ei	= stage.ei.data();
+	const float *eq	= stage.eq.data();
+	const float *oi	= stage.oi.data() + K - 1;
+	const float *oq	= stage.oq.data() + K - 1;
+
+	int full	= out & ~(LANES - 1);
+	int j		= 0;
+	for (; j<full; j+=LANES)
+		{
+		v8f ai, aq, lo, hi;
+		_load(ai, oi + j);
+		_load(aq, oq + j);
+		ai *= 0.5f;
+		aq *= 0.5f;
+		for (int m=0; m<K; m++)
+			{
+			_load(lo, ei + j + m);
+			_load(hi, ei + j + 2 * K - 1 - m);
+			ai += _taps[m] * (lo + hi);
+			_load(lo, eq + j + m);
+			_load(hi, eq + j + 2 * K - 1 - m);
+			aq += _taps[m] * (lo + hi);
+			}
+		_store(I + j, ai);
+		_store(Q + j, aq);
+		}
+	for (; j<out; j++)
+		{
+		float ai = 0.5f * oi[j];
+		float aq = 0.5f * oq[j];
+		for (int m=0; m<K; m++)
+			{
+			ai += _taps[m] * (ei[j + m] + ei[j + 2 * K - 1 - m]);
+			aq += _taps[m] * (eq[j + m] + eq[j + 2 * K - 1 - m]);
+			}
+		I[j] = ai;
+		Q[j] = aq;
+		}
+
+	/**************************************************************************\
+	|* Keep what the next outputs still need
+	\**************************************************************************/
+	stage.evens	-= out;
+	stage.odds	-= out;
+	::memmove(stage.ei.data(), ei + out, stage.evens * sizeof(float));
+	::memmove(stage.eq.data(), eq + out, stage.evens * sizeof(float));
+	::memmove(stage.oi.data(), stage.oi.data() + out, stage.odds * sizeof(float));
+	::memmove(stage.oq.data(), stage.oq.data() + out, stage.odds * sizeof(float));
+	return out;
+	}
+
+/******************************************************************************\
+|* SampleSource interface
+\******************************************************************************/
+int DDC::streamMTU(void)
+	{
+	return _maxInput / std::max(_decimation, 1) + MAX_HALFBANDS + 2;
+	}
+
+double DDC::streamRate(void)
+	{
+	return _inputRate / std::max(_decimation, 1);
+	}
+
+SampleSource::Format DDC::sampleFormat(void)
+	{
+	return FMT_CF32;
+	}
+
+int DDC::sampleBytes(void)
+	{
+	return bytesFor(FMT_CF32);
+	}
+
+int DDC::fullScale(void)
+	{
+	return 1;
+	}
+
+void DDC::startWorker(void)
+	{}
+
+void DDC::stopWorker(void)
+	{}
+
+/******************************************************************************\
+|* Run a tone 'delta' Hz from the sub-band's centre through a test DDC, in
+|* buffers of awkward sizes, and return the output once it's settled
+\******************************************************************************/
+static std::vector<std::complex<double>> _tone(DDC& ddc, double delta)
+	{
+	const int sizes[] = {1000, 333, 4096, 1, 2048, 517};
+	std::vector<float> in(2 * 4096), out(2 * ddc.streamMTU());
+	std::vector<std::complex<double>> got;
+
+	double freq		= (ddc.offsetHz() + delta) / ddc.inputRate();
+	int64_t index	= 0;
+	for (int b=0; (int)got.size() < TEST_SETTLE + TEST_OUTPUTS; b++)
+		{
+		int count = sizes[b % 6];
+		for (int i=0; i<count; i++)
+			{
+			double cycles	= freq * (double)(index + i);
+			double phase	= 2 * M_PI * (cycles - std::floor(cycles));
+			in[2*i]			= (float)(TEST_AMPLITUDE * cos(phase));
+			in[2*i+1]		= (float)(TEST_AMPLITUDE * sin(phase));
+			}
+		index	+= count;
+		int n	 = ddc.process(in.data(), count, out.data());
+		for (int i=0; i<n; i++)
+			got.push_back({out[2*i], out[2*i+1]});
+		}
+
+	got.erase(got.begin(), got.begin() + TEST_SETTLE);
+	got.resize(TEST_OUTPUTS);
+	return got;
+	}
+
+/******************************************************************************\
+|* Test interface : return the number of tests
+\******************************************************************************/
+int DDC::numTests(void)
+	{
+	return MAX_TESTS;
+	}
+
+/******************************************************************************\
+|* Test interface : run a test
+\******************************************************************************/
+Testable::TestResult DDC::runTest(int idx)
+	{
+	switch (idx)
+		{
+		case 0:
+			return _checkPassband();
+		case 1:
+			return _checkStopband();
+		case 2:
+			return _benchmark();
+		}
+
+	ERR << "Test requested outside of range";
+	return Testable::TEST_FAIL;
+	}
+
+/******************************************************************************\
+|* Test interface : Check tones in the sub-band come out at the right
+|* frequency, at the same amplitude (to within the CIC's droop), near the
+|* centre and 40% of the output rate off it
+\******************************************************************************/
+Testable::TestResult DDC::_checkPassband(void)
+	{
+	const double deltas[] = {5000, -25600};
+	for (double delta : deltas)
+		{
+		DDC ddc(TEST_RATE, TEST_OFFSET, TEST_DECIMATION, 4096);
+		std::vector<std::complex<double>> got = _tone(ddc, delta);
+
+		double level = 0;
+		std::complex<double> turn = 0;
+		for (int i=0; i<TEST_OUTPUTS; i++)
+			{
+			level += std::abs(got[i]);
+			if (i > 0)
+				turn += got[i] * std::conj(got[i-1]);
+			}
+		double db		= 20 * log10(level / TEST_OUTPUTS / TEST_AMPLITUDE);
+		double freq		= std::arg(turn) / (2 * M_PI) * ddc.streamRate();
+
+		LOG << "DDC: tone" << delta << "Hz off centre came out at" << freq
+			<< "Hz," << db << "dB";
+		if ((std::fabs(db) > 0.25) || (std::fabs(freq - delta) > 1.0))
+			{
+			ERR << "DDC passband is wrong at" << delta << "Hz";
+			return Testable::TEST_FAIL;
+			}
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Check tones outside the sub-band are rejected: one that
+|* the last half-band has to stop, and one far enough out to alias through
+|* the CIC
+\******************************************************************************/
+Testable::TestResult DDC::_checkStopband(void)
+	{
+	double rate				= TEST_RATE / TEST_DECIMATION;
+	const double deltas[]	= {0.75 * rate, -300000};
+	for (double delta : deltas)
+		{
+		DDC ddc(TEST_RATE, TEST_OFFSET, TEST_DECIMATION, 4096);
+		std::vector<std::complex<double>> got = _tone(ddc, delta);
+
+		double power = 0;
+		for (const std::complex<double>& v : got)
+			power += std::norm(v);
+		double db = 10 * log10(power / TEST_OUTPUTS
+							   / (TEST_AMPLITUDE * TEST_AMPLITUDE) + 1e-30);
+
+		LOG << "DDC: tone" << delta << "Hz off centre is down" << -db << "dB";
+		if (db > -60)
+			{
+			ERR << "DDC lets through a tone" << delta << "Hz off centre";
+			return Testable::TEST_FAIL;
+			}
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Measure the input rate one core can down-convert, with
+|* all the decimation in half-bands, and with the CIC doing some
+\******************************************************************************/
+Testable::TestResult DDC::_benchmark(void)
+	{
+	using namespace std::chrono;
+
+	const int decimations[]	= {8, 32, 256};
+	int chunk				= 16384;
+	std::vector<float> in(2 * chunk);
+	for (int i=0; i<chunk; i++)
+		{
+		in[2*i]		= (float)(0.5 * cos(i * 0.1));
+		in[2*i+1]	= (float)(0.5 * sin(i * 0.1));
+		}
+
+	for (int decimation : decimations)
+		{
+		DDC ddc(TEST_RATE, TEST_OFFSET, decimation, chunk);
+		std::vector<float> out(2 * ddc.streamMTU());
+
+		auto start = steady_clock::now();
+		for (int done=0; done<BENCH_SAMPLES; done+=chunk)
+			ddc.process(in.data(), chunk, out.data());
+		double secs = duration<double>(steady_clock::now() - start).count();
+
+		LOG << "DDC: decimating by" << decimation << "with a CIC of"
+			<< ddc.cicRate() << "takes"
+			<< (secs > 0 ? BENCH_SAMPLES / secs / 1e6 : 0) << "Msamples/sec in";
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : identify the class being tested
+\******************************************************************************/
+const char * DDC::testClassName(void)
+	{
+	return "DDC";
+	}
@@ -0,0 +1,158 @@
+#ifndef DDC_H
+#define DDC_H
+
+#include <cstdint>
+#include <vector>
+
+#include "properties.h"
+#include "samplesource.h"
+#include "testable.h"
+
+/******************************************************************************\
+|* A digital down-converter: takes the full band, as normalised CF32, and
+|* gives one sub-band of it, 'offset' Hz from the centre, decimated by
+|* 'decimation'. It's a streaming chain, each stage keeping whatever state
+|* it needs between buffers:
+|*
+|*	NCO mixer	- shifts the sub-band down to 0 Hz, with a phasor recurrence
+|*				  per lane, re-seeded from the exact phase every block
+|*	CIC			- an order-4 cascaded integrator-comb, doing whatever part
+|*				  of the decimation the half-bands don't. It runs in 64-bit
+|*				  integers, so the integrators wrap exactly rather than
+|*				  drifting as floats would
+|*	Half-bands	- up to three 47-tap half-band FIRs, each decimating by 2.
+|*				  Each works on the even and odd samples split apart, so
+|*				  every tap is a contiguous vector multiply-add
+|*
+|* The half-bands do the factors of 2 (up to 8), so the CIC's droop and
+|* aliasing are well outside the final band: with all three, the output is
+|* flat to 0.1 dB over 80% of its bandwidth, and aliases are down 75 dB.
+|*
+|* Work is on planar I and Q float buffers with GCC/Clang vector types, like
+|* the synthesiser, so the compiler emits AVX2, SSE or NEON as the target
+|* allows. The output is a SampleSource in its own right - CF32 at the
+|* decimated rate - so a Processor can frame, FFT and aggregate it just as
+|* it does the full band. Nothing is allocated after construction.
+\******************************************************************************/
+class DDC : public SampleSource, public Testable
+	{
+	NON_COPYABLE_NOR_MOVEABLE(DDC);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			LANES			= 8,		// Vector width, in floats
+			NCO_BLOCK		= 256,		// Samples between phase re-seeds
+			CIC_ORDER		= 4,		// Integrator / comb pairs
+			CIC_MAX			= 256,		// Most the CIC decimates by
+			HALFBAND_PAIRS	= 12,		// Tap pairs each side: 47 taps
+			MAX_HALFBANDS	= 3			// Half-band stages, at most
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(double, inputRate);				// Samples per second in
+	GET(double, offsetHz);				// Centre of the sub-band
+	GET(int, decimation);				// Samples in per sample out
+	GET(int, cicRate);					// ... of which the CIC does this
+	GET(int, halfbands);				// ... and half-bands the rest
+	GET(int, maxInput);					// Most samples in per call
+	GET(int64_t, position);				// Index of the next sample out
+
+	private:
+		/**********************************************************************\
+		|* A half-band stage: its input split into even and odd samples, with
+		|* the history the filter needs kept at the front
+		\**********************************************************************/
+		typedef struct
+			{
+			std::vector<float>	ei, eq;		// Even samples, I and Q
+			std::vector<float>	oi, oq;		// Odd samples
+			int					evens;		// Even samples held
+			int					odds;		// Odd samples held
+			bool				odd;		// Next sample in is odd
+			} HalfBand;
+
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		double				_cycles;		// NCO phase, in cycles
+		double				_step;			// ... per input sample
+		std::vector<float>	_i;				// Planar I working buffer
+		std::vector<float>	_q;				// Planar Q working buffer
+
+		uint64_t			_integ[2][CIC_ORDER];	// CIC integrators, I/Q
+		uint64_t			_comb[2][CIC_ORDER];	// ... and comb delays
+		int					_cicPhase;		// Samples into this output
+		double				_cicScale;		// Input to integer
+		double				_cicNorm;		// Output back to float
+
+		float				_taps[HALFBAND_PAIRS];	// Half-band coefficients
+		HalfBand			_stages[MAX_HALFBANDS];
+
+		/**********************************************************************\
+		|* Private methods: the stages, working in place on _i and _q
+		\**********************************************************************/
+		void _mix(const float *src, int count);
+		int _cic(int count);
+		int _halfband(HalfBand& stage, int count);
+
+		/**********************************************************************\
+		|* Private Tests
+		\**********************************************************************/
+		Testable::TestResult _checkPassband(void);
+		Testable::TestResult _checkStopband(void);
+		Testable::TestResult _benchmark(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor. The decimation is split between the CIC and up to
+		|* MAX_HALFBANDS half-bands, so it should have 8 as a factor to get
+		|* the full filtering; maxInput is the most samples any one call to
+		|* process() will be given
+		\**********************************************************************/
+		DDC(double inputRate, double offsetHz, int decimation, int maxInput);
+
+		/**********************************************************************\
+		|* Return whether the parameters were usable
+		\**********************************************************************/
+		bool isValid(void);
+
+		/**********************************************************************\
+		|* Down-convert 'count' (up to maxInput) CF32 samples from src, and
+		|* write the ones that come out to dst as CF32. Returns how many, at
+		|* most streamMTU()
+		\**********************************************************************/
+		int process(const float *src, int count, float *dst);
+
+		/**********************************************************************\
+		|* Start afresh after samples were lost, with 'index' the input stream
+		|* index of the next sample. The output position jumps to match
+		\**********************************************************************/
+		void reset(int64_t index);
+
+		/**********************************************************************\
+		|* SampleSource interface. The samples are pushed through by whoever
+		|* owns us, so there's no worker to start or stop
+		\**********************************************************************/
+		int streamMTU(void) override;
+		double streamRate(void) override;
+		Format sampleFormat(void) override;
+		int sampleBytes(void) override;
+		int fullScale(void) override;
+		void startWorker(void) override;
+		void stopWorker(void) override;
+
+		/**********************************************************************\
+		|* Public Tests interface
+		\**********************************************************************/
+		int numTests(void) override;
+		Testable::TestResult runTest(int idx) override;
+		const char * testClassName(void) override;
+	};
+
+#endif // DDC_H
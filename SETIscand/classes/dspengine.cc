@@ -0,0 +1,1054 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <QCoreApplication>
+#include <QDateTime>
+
+#include "allocwatch.h"
+#include "config.h"
+#include "constants.h"
+#include "datamgr.h"
+#include "dspengine.h"
+#include "fftaggregator.h"
+#include "fftplanner.h"
+#include "samplesource.h"
+
+/******************************************************************************\
+|* Testing
+\******************************************************************************/
+#define MAX_TESTS			(7)
+#define TEST_DEPTH			(8)
+#define TEST_THREADS		(3)
+#define TEST_ITEMS			(200000)
+#define TEST_BATCH			(4)
+#define TEST_SKEW			(3)
+#define TEST_WINDOW			(64)		// Frames per sample window
+#define TEST_DROP_DEPTH		(4)			// Queue depth when dropping
+#define TEST_DROP_WINDOWS	(4)			// Update windows to run through
+#define TEST_DROP_BOOST		(3.0)		// Amplitude of the batches dropped
+#define TEST_STALL_MS		(5000)		// Longest to hold up aggregation
+#define BENCH_MIN_SHIFT		(20)		// 1M-point FFTs ...
+#define BENCH_MAX_SHIFT		(24)		// ... up to 16M
+#define BENCH_FRAMES		(3)			// At least this many per size
+#define BENCH_SECS			(1.0)		// ... and for at least this long
+#define BENCH_MAX_WORKERS	(32)		// Scale workers up to this many
+#define BENCH_WINDOW		(1024)		// Frames per update window
+
+/******************************************************************************\
+|* How long threads sleep on a queue before checking for a stop, how often to
+|* report on the queues, and the cores left for the radio and framing threads
+|* when sizing the workers automatically
+\******************************************************************************/
+#define WAIT_MS				(100)
+#define REPORT_MS			(10000)
+#define INGEST_CORES		(2)
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+DSPEngine::DSPEngine(FFTAggregator *aggregator,
+					 int workers,
+					 const QList<int>& cpus,
+					 int maxSkew,
+					 int depth,
+					 int fftThreads)
+		  :_numWorkers(coresFor(workers))
+		  ,_cpus(cpus)
+		  ,_fftThreads(std::max(fftThreads, 1))
+		  ,_maxSkew((maxSkew > 0) ? maxSkew : SKEW_PER_WORKER * _numWorkers)
+		  ,_aggregator(aggregator)
+		  ,_fftQueue(depth, "FFT queue")
+		  ,_aggQueue(depth, "aggregation queue")
+		  ,_dropQueue(depth, "drop queue")
+		  ,_aggThread(nullptr)
+		  ,_stopping(false)
+		  ,_done(0)
+		  ,_reorder(_maxSkew)
+		  ,_held(0)
+		  ,_late(0)
+		  ,_lateBatches(0)
+		  ,_skipped(0)
+		  ,_flagged(0)
+	{
+	/**************************************************************************\
+	|* Pick CPUs if asked to: the highest-numbered ones we're allowed, since
+	|* the OS and interrupts tend to favour the lowest
+	\**************************************************************************/
+	if ((_cpus.size() == 1) && (_cpus.front() == PIN_AUTO))
+		{
+		_cpus.clear();
+
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		QList<int> allowed;
+		if (::sched_getaffinity(0, sizeof(mask), &mask) == 0)
+			for (int cpu=0; cpu<CPU_SETSIZE; cpu++)
+				if (CPU_ISSET(cpu, &mask))
+					allowed << cpu;
+
+		for (int i=0; (i<_numWorkers * _fftThreads) && !allowed.isEmpty(); i++)
+			_cpus << allowed[allowed.size() - 1 - (i % allowed.size())];
+		}
+
+	if (!_fftQueue.isValid() || !_aggQueue.isValid() || !_dropQueue.isValid())
+		ERR << "Cannot create the DSP engine's queues";
+
+	if (_aggregator != nullptr)
+		_aggregator->setWorkers(_numWorkers);
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+DSPEngine::~DSPEngine(void)
+	{
+	stop();
+	}
+
+/******************************************************************************\
+|* The cores to use, if not told
+\******************************************************************************/
+int DSPEngine::coresFor(int workers)
+	{
+	return (workers > 0)
+		 ? workers
+		 : std::max(1, QThread::idealThreadCount() - INGEST_CORES);
+	}
+
+/******************************************************************************\
+|* Start the threads
+\******************************************************************************/
+void DSPEngine::start(void)
+	{
+	if (!_workers.empty())
+		return;
+
+	_stopping = false;
+	for (int i=0; i<_numWorkers; i++)
+		{
+		QThread *worker = QThread::create([this, i]() { _fftLoop(i); });
+		worker->setObjectName(QString("fft-%1").arg(i));
+		worker->start(QThread::HighPriority);
+		_workers.push_back(worker);
+		}
+
+	_aggThread = QThread::create([this]() { _aggregateLoop(); });
+	_aggThread->setObjectName("aggregate");
+	_aggThread->start();
+
+	LOG << "DSP engine started with" << _numWorkers << "FFT workers of"
+		<< _fftThreads << (_fftThreads == 1 ? "thread," : "threads,")
+		<< (_cpus.isEmpty() ? QString("not pinned") : QString("pinned"))
+		<< "queues of" << _fftQueue.capacity() << "batches, and a reorder"
+		<< "window of" << _maxSkew << "batches";
+	}
+
+/******************************************************************************\
+|* Stop the threads, and let go of anything still queued
+\******************************************************************************/
+void DSPEngine::stop(void)
+	{
+	_stopping = true;
+	_fftQueue.wakeAll();
+	_aggQueue.wakeAll();
+
+	for (QThread *worker : _workers)
+		{
+		worker->wait();
+		delete worker;
+		}
+	_workers.clear();
+
+	if (_aggThread != nullptr)
+		{
+		_aggThread->wait();
+		delete _aggThread;
+		_aggThread = nullptr;
+		}
+
+	TaskFFT task;
+	while (_fftQueue.pop(task) || _aggQueue.pop(task))
+		;
+
+	Dropped dropped;
+	while (_dropQueue.pop(dropped))
+		;
+	}
+
+/******************************************************************************\
+|* Wait for the queues to empty and the last batch to be aggregated
+\******************************************************************************/
+void DSPEngine::drain(void)
+	{
+	for (;;)
+		{
+		Stats s = stats();
+		if ((s.done + _lateBatches.load() + s.aggregate.full >= s.fft.pushed)
+				|| _stopping.load(std::memory_order_relaxed))
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+/******************************************************************************\
+|* Framing: queue a batch for the workers
+\******************************************************************************/
+bool DSPEngine::submit(TaskFFT&& task)
+	{
+	return _fftQueue.push(std::move(task));
+	}
+
+/******************************************************************************\
+|* A worker: run batches' FFTs, sum their power into the worker's own
+|* partial sums while they're still in cache, and pass them on for
+|* aggregation. Between batches, help merge the partial sums if a window
+|* is closing.
+|*
+|* The partial sums are claimed before the batch is queued, and only added
+|* to once it has been: a batch the aggregation queue has no room for is
+|* never counted in a window, so its power mustn't be either. Its sequence
+|* goes on the drop queue instead, so the reorder buffer can skip it
+\******************************************************************************/
+void DSPEngine::_fftLoop(int worker)
+	{
+	_pin(worker);
+
+	TaskFFT task;
+	FFTAggregator::Claim claim;
+	while (!_stopping.load(std::memory_order_relaxed))
+		{
+		if (!_fftQueue.wait(task, WAIT_MS))
+			continue;
+
+		task.run();
+		if (_aggregator != nullptr)
+			_aggregator->claim(task, worker, claim);
+
+		Dropped dropped(task.sequence(), task.frames());
+		bool queued = _aggQueue.push(std::move(task));
+		if (!queued)
+			{
+			_dropQueue.push(std::move(dropped));
+			task = TaskFFT();
+			}
+
+		if (_aggregator != nullptr)
+			_aggregator->accumulate(claim, queued);
+
+		if (_aggregator != nullptr)
+			_aggregator->helpMerge();
+		}
+	}
+
+/******************************************************************************\
+|* The aggregator: put the batches back in order, hand each one over, and
+|* report on the queues now and then. Whatever is waiting is only flushed
+|* once nothing has arrived for WAIT_MS: a wait can come back empty early
+|* (woken for an item that was already taken), and flushing then would skip
+|* batches the workers are still on. Batches that were dropped on the way
+|* here are skipped first, so nothing after them waits
+\******************************************************************************/
+void DSPEngine::_aggregateLoop(void)
+	{
+	qint64 nextReport	= QDateTime::currentMSecsSinceEpoch() + REPORT_MS;
+	qint64 quietAt		= QDateTime::currentMSecsSinceEpoch() + WAIT_MS;
+	int64_t dropped		= 0;
+	int64_t late		= 0;
+	auto deliver		= [this](TaskFFT& task) { _deliver(task); };
+
+	TaskFFT task;
+	Dropped gone;
+	while (!_stopping.load(std::memory_order_relaxed))
+		{
+		bool arrived	= _aggQueue.wait(task, WAIT_MS);
+		qint64 now		= QDateTime::currentMSecsSinceEpoch();
+		while (_dropQueue.pop(gone))
+			_reorder.skip(gone.first, gone.second, deliver);
+
+		if (arrived)
+			{
+			int64_t wasLate = _reorder.late();
+			_reorder.push(std::move(task), deliver);
+			if (_reorder.late() != wasLate)
+				_lateBatches.fetch_add(1, std::memory_order_relaxed);
+			quietAt = now + WAIT_MS;
+			}
+		else if (now >= quietAt)
+			_reorder.flush(deliver);
+
+		_held.store(_reorder.held(), std::memory_order_relaxed);
+		_late.store(_reorder.late(), std::memory_order_relaxed);
+		_skipped.store(_reorder.skipped(), std::memory_order_relaxed);
+
+		/**********************************************************************\
+		|* Report periodically, and loudly if we've been dropping batches or
+		|* they've been arriving too late to put in order
+		\**********************************************************************/
+		if (now >= nextReport)
+			{
+			Stats s = stats();
+			if (s.fft.full + s.aggregate.full != dropped)
+				WARN << "DSP engine dropped" << (s.fft.full + s.aggregate.full - dropped)
+					 << "batches in the last" << REPORT_MS/1000 << "secs";
+			if (s.late != late)
+				WARN << "DSP engine released" << (s.late - late)
+					 << "frames too late to reorder in the last"
+					 << REPORT_MS/1000 << "secs";
+			logStats();
+			dropped		= s.fft.full + s.aggregate.full;
+			late		= s.late;
+			nextReport	= now + REPORT_MS;
+			}
+		}
+	}
+
+/******************************************************************************\
+|* Hand a batch to the aggregator, in whichever precision it is, and let go
+|* of it. If frames were skipped since the last one, its window is short
+\******************************************************************************/
+void DSPEngine::_deliver(TaskFFT& task)
+	{
+	if (_reorder.skipped() != _flagged)
+		{
+		task.setFlags(task.flags() | SampleSource::FLAG_DISCONTINUITY);
+		_flagged = _reorder.skipped();
+		}
+
+	if (task.resultsF().isValid())
+		_aggregator->fftfReady(task.resultsF(),
+							   task.frames(),
+							   task.first(),
+							   task.timeNs(),
+							   task.flags(),
+							   task.summed());
+	else
+		_aggregator->fftReady(task.results(),
+							  task.frames(),
+							  task.first(),
+							  task.timeNs(),
+							  task.flags(),
+							  task.summed());
+	task = TaskFFT();
+	_done.fetch_add(1, std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* Pin the calling worker to its CPUs, if we're pinning: the next
+|* _fftThreads from the list, for it and any threads its FFTs start
+\******************************************************************************/
+void DSPEngine::_pin(int worker)
+	{
+	if (_cpus.isEmpty())
+		return;
+
+	QList<int> mine;
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (int i=0; i<_fftThreads; i++)
+		{
+		int cpu = _cpus[(worker * _fftThreads + i) % _cpus.size()];
+		CPU_SET(cpu, &mask);
+		mine << cpu;
+		}
+	if (::pthread_setaffinity_np(::pthread_self(), sizeof(mask), &mask) != 0)
+		WARN << "Cannot pin FFT worker" << worker << "to CPUs" << mine;
+	}
+
+/******************************************************************************\
+|* Return the counters
+\******************************************************************************/
+DSPEngine::Stats DSPEngine::stats(void)
+	{
+	Stats s;
+	s.fft		= _fftQueue.stats();
+	s.aggregate	= _aggQueue.stats();
+	s.done		= _done.load(std::memory_order_relaxed);
+	s.held		= _held.load(std::memory_order_relaxed);
+	s.late		= _late.load(std::memory_order_relaxed);
+	s.skipped	= _skipped.load(std::memory_order_relaxed);
+	return s;
+	}
+
+/******************************************************************************\
+|* Log the counters
+\******************************************************************************/
+void DSPEngine::logStats(void)
+	{
+	Stats s = stats();
+	LOG << "DSP engine:" << (qint64)s.done << "batches aggregated;"
+		<< _fftQueue.name() << "depth" << (qint64)s.fft.depth
+		<< "high-water" << (qint64)s.fft.highWater << "of" << (qint64)s.fft.capacity
+		<< "full" << (qint64)s.fft.full << ";"
+		<< _aggQueue.name() << "depth" << (qint64)s.aggregate.depth
+		<< "high-water" << (qint64)s.aggregate.highWater
+		<< "of" << (qint64)s.aggregate.capacity
+		<< "full" << (qint64)s.aggregate.full << ";"
+		<< "reordered" << (qint64)s.held << "batches,"
+		<< (qint64)s.late << "frames late," << (qint64)s.skipped << "skipped";
+	}
+
+/******************************************************************************\
+|* Test interface : number of tests
+\******************************************************************************/
+int DSPEngine::numTests(void)
+	{
+	return MAX_TESTS;
+	}
+
+/******************************************************************************\
+|* Test interface : run a test
+\******************************************************************************/
+Testable::TestResult DSPEngine::runTest(int idx)
+	{
+	switch (idx)
+		{
+		case 0:
+			return _checkQueue();
+		case 1:
+			return _checkThreaded();
+		case 2:
+			return _checkReorder();
+		case 3:
+			return _checkAllocWatch();
+		case 4:
+			return _checkDroppedBatches();
+		case 5:
+			return _benchmarkLargeFFT();
+		case 6:
+			return _benchmarkScaling();
+		}
+
+	ERR << "Test requested outside of range";
+	return Testable::TEST_FAIL;
+	}
+
+/******************************************************************************\
+|* Test interface : Check a queue keeps order, refuses items when full
+|* without losing what it holds, and counts it
+\******************************************************************************/
+Testable::TestResult DSPEngine::_checkQueue(void)
+	{
+	BoundedQueue<int64_t> queue(TEST_DEPTH, "test queue");
+	if (!queue.isValid())
+		{
+		ERR << "Cannot create a test queue";
+		return Testable::TEST_FAIL;
+		}
+
+	for (int64_t lap=0; lap<3; lap++)
+		{
+		for (int64_t i=0; i<TEST_DEPTH+2; i++)
+			{
+			int64_t item = lap * 100 + i;
+			if (queue.push(std::move(item)) != (i < TEST_DEPTH))
+				{
+				ERR << "Queue accepted the wrong number of items";
+				return Testable::TEST_FAIL;
+				}
+			}
+
+		if (queue.depth() != TEST_DEPTH)
+			{
+			ERR << "Queue depth is" << queue.depth() << "not" << TEST_DEPTH;
+			return Testable::TEST_FAIL;
+			}
+
+		for (int64_t i=0; i<TEST_DEPTH; i++)
+			{
+			int64_t item = -1;
+			if (!queue.wait(item, 0) || (item != lap * 100 + i))
+				{
+				ERR << "Queue item" << i << "was lost or re-ordered";
+				return Testable::TEST_FAIL;
+				}
+			}
+
+		int64_t item;
+		if (queue.pop(item) || queue.wait(item, 1))
+			{
+			ERR << "Empty queue returned an item";
+			return Testable::TEST_FAIL;
+			}
+		}
+
+	BoundedQueue<int64_t>::Stats s = queue.stats();
+	if ((s.full != 6) || (s.pushed != 3 * TEST_DEPTH) || (s.highWater != TEST_DEPTH))
+		{
+		ERR << "Queue counters are wrong: full" << s.full << "pushed" << s.pushed
+			<< "high-water" << s.highWater;
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Run several producers flat out against several sleeping
+|* consumers. Every item accepted must arrive exactly once, each producer's
+|* in order, and everything else must be counted as refused
+\******************************************************************************/
+Testable::TestResult DSPEngine::_checkThreaded(void)
+	{
+	BoundedQueue<int64_t> queue(TEST_DEPTH, "test queue");
+	std::atomic<int> producing(TEST_THREADS);
+	std::atomic<int64_t> accepted(0);
+	std::atomic<int64_t> received(0);
+	std::atomic<int64_t> sum(0);
+	std::atomic<bool> ordered(true);
+
+	std::vector<std::thread> threads;
+	for (int p=0; p<TEST_THREADS; p++)
+		threads.emplace_back([&, p]()
+			{
+			for (int64_t i=0; i<TEST_ITEMS; i++)
+				{
+				int64_t item = i * TEST_THREADS + p;
+				if (queue.push(std::move(item)))
+					accepted += i * TEST_THREADS + p;
+				else
+					std::this_thread::yield();
+				if ((i & 4095) == 0)
+					std::this_thread::sleep_for(std::chrono::microseconds(500));
+				}
+			producing --;
+			});
+
+	for (int c=0; c<TEST_THREADS; c++)
+		threads.emplace_back([&]()
+			{
+			int64_t last[TEST_THREADS];
+			std::fill(last, last + TEST_THREADS, -1);
+
+			int64_t item;
+			for (;;)
+				{
+				if (queue.wait(item, 10))
+					{
+					int p = (int)(item % TEST_THREADS);
+					if (item <= last[p])
+						ordered = false;
+					last[p]	= item;
+					sum	   += item;
+					received ++;
+					}
+				else if ((producing == 0) && (queue.depth() == 0))
+					break;
+				}
+			});
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	BoundedQueue<int64_t>::Stats s = queue.stats();
+	if (!ordered || (sum != accepted) || (received != s.pushed)
+			|| (received + s.full != (int64_t)TEST_THREADS * TEST_ITEMS))
+		{
+		ERR << "Queue lost, duplicated or re-ordered data: received" << (qint64)received
+			<< "refused" << (qint64)s.full;
+		return Testable::TEST_FAIL;
+		}
+
+	LOG << "Queue passed" << (qint64)received << "items, refused" << (qint64)s.full
+		<< "high-water" << (qint64)s.highWater << "of" << (qint64)s.capacity;
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Feed a reorder buffer batches out of order: those within
+|* the window must come out in order, one too far ahead must make it give up
+|* on the oldest gap, and one behind it must be counted as late
+\******************************************************************************/
+Testable::TestResult DSPEngine::_checkReorder(void)
+	{
+	struct Item
+		{
+		int64_t seq;
+		int64_t sequence(void) const	{ return seq; }
+		int frames(void) const			{ return TEST_BATCH; }
+		};
+
+	ReorderBuffer<Item> reorder(TEST_SKEW);
+	std::vector<int64_t> out;
+	auto deliver = [&out](Item& item) { out.push_back(item.seq); };
+
+	/**************************************************************************\
+	|* Batches 0..7, shuffled but never more than TEST_SKEW out of place, then
+	|* 9..11 with 8 missing, then 8 after the buffer has given up on it
+	\**************************************************************************/
+	const int64_t order[] = {1, 0, 3, 2, 5, 6, 4, 7, 10, 9, 11, 12, 8};
+	for (int64_t batch : order)
+		reorder.push(Item{batch * TEST_BATCH}, deliver);
+	reorder.flush(deliver);
+
+	bool ordered = (out.size() == 12);
+	for (size_t i=1; i<out.size(); i++)
+		ordered = ordered && (out[i] > out[i-1]) && (out[i] % TEST_BATCH == 0);
+
+	if (!ordered || (reorder.late() != TEST_BATCH)
+			|| (reorder.skipped() != TEST_BATCH) || (reorder.pending() != 0))
+		{
+		ERR << "Reorder buffer delivered" << (qint64)out.size() << "batches,"
+			<< (ordered ? "in order," : "out of order,")
+			<< "late" << (qint64)reorder.late()
+			<< "skipped" << (qint64)reorder.skipped();
+		return Testable::TEST_FAIL;
+		}
+
+	/**************************************************************************\
+	|* Then 14 waits for 13, which was dropped, as was 15: skipping 13 lets
+	|* 14 go at once, and 15, skipped before it was due, is passed over
+	\**************************************************************************/
+	out.clear();
+	reorder.push(Item{14 * TEST_BATCH}, deliver);
+	reorder.skip(15 * TEST_BATCH, TEST_BATCH, deliver);
+	reorder.skip(13 * TEST_BATCH, TEST_BATCH, deliver);
+	reorder.push(Item{16 * TEST_BATCH}, deliver);
+
+	if ((out.size() != 2) || (out.front() != 14 * TEST_BATCH)
+			|| (out.back() != 16 * TEST_BATCH)
+			|| (reorder.skipped() != 3 * TEST_BATCH) || (reorder.pending() != 0))
+		{
+		ERR << "Reorder buffer delivered" << (qint64)out.size()
+			<< "batches around skipped ones, skipped"
+			<< (qint64)reorder.skipped() << "pending" << reorder.pending();
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Arm the allocation watch and run batches through the
+|* engine and an aggregator until windows of both kinds have been published
+|* to a queued receiver, as they are to MsgIO. Nothing inside the pipeline's
+|* scopes may go to the heap; the emits, with their queued events, are
+|* outside them. A window's worth goes through first, unwatched, so that
+|* whatever is set up on first use already has been
+\******************************************************************************/
+Testable::TestResult DSPEngine::_checkAllocWatch(void)
+	{
+	DataMgr& dmgr	= DataMgr::instance();
+	QString wisdom	= Config::instance().fftWisdomDir();
+
+	FFTAggregator aggregator;
+	int size		= aggregator.fftSize();
+	int hop			= aggregator.hop();
+	double rate		= TEST_WINDOW * (double)hop / aggregator.sampleSecs();
+
+	FFTPlanner planner(size, TEST_BATCH, false, 1, wisdom);
+	if (!planner.init())
+		{
+		ERR << "Cannot plan" << TEST_BATCH << "frames of" << size << "point FFTs";
+		return Testable::TEST_FAIL;
+		}
+
+	int windows[2]	= {0, 0};
+	QObject sink;
+	QObject::connect(&aggregator, &FFTAggregator::aggregatedDataReady, &sink,
+					 [&windows](FFTAggregator::DataType type,
+								FFTAggregator::WindowInfo,
+								BlockRef<double>)
+						{
+						windows[(type == FFTAggregator::TYPE_SAMPLE) ? 1 : 0] ++;
+						},
+					 Qt::QueuedConnection);
+
+	DSPEngine engine(&aggregator, TEST_THREADS, QList<int>());
+	aggregator.setSampleRate(rate);
+	engine.start();
+
+	int64_t frames	= 0;
+	auto feed		= [&](int batches)
+		{
+		for (int b=0; b<batches; b++)
+			{
+			BlockRef<fftw_complex> in = dmgr.fftRefFor(size * TEST_BATCH,
+													   DataBlock::TAG_FFT);
+			for (int i=0; in.isValid() && (i<size * TEST_BATCH); i++)
+				{
+				in.data()[i][0] = ((i + frames) & 0xFF) - 128;
+				in.data()[i][1] = (((i + frames) >> 8) & 0xFF) - 128;
+				}
+
+			TaskFFT task(in, size, TEST_BATCH);
+			if (task.isValid())
+				{
+				fftw_plan plan = planner.plan();
+				task.setPlan(plan);
+				task.setSequence(frames);
+				task.setFirst(frames * hop);
+				while (!engine.submit(std::move(task)))
+					std::this_thread::yield();
+				}
+			frames += TEST_BATCH;
+			QCoreApplication::sendPostedEvents(&sink);
+			}
+		engine.drain();
+		QCoreApplication::sendPostedEvents(&sink);
+		};
+
+	feed(TEST_WINDOW / TEST_BATCH + 1);
+	int before[2]	= {windows[0], windows[1]};
+
+	AllocWatch::arm(AllocWatch::MODE_COUNT);
+	feed(2 * TEST_WINDOW / TEST_BATCH);
+	int64_t count	= AllocWatch::count();
+	int64_t bytes	= AllocWatch::bytes();
+	AllocWatch::arm(AllocWatch::MODE_OFF);
+	engine.stop();
+
+	if ((windows[0] == before[0]) || (windows[1] == before[1]))
+		{
+		ERR << "No window published while the allocation watch was armed";
+		return Testable::TEST_FAIL;
+		}
+
+	if (count != 0)
+		{
+		ERR << "Pipeline made" << count << "heap allocations (" << bytes
+			<< "bytes) over" << (windows[1] - before[1]) << "sample windows";
+		return Testable::TEST_FAIL;
+		}
+
+	LOG << "No pipeline heap allocations over" << (windows[0] - before[0])
+		<< "update and" << (windows[1] - before[1]) << "sample windows";
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Stall the aggregation thread in its first update window's
+|* publish, so the aggregation queue fills and batches are dropped, then let
+|* it go. Every frame has the same power except in the batches that are
+|* bound to be dropped, which have more: so every window's mean must match
+|* the first, whose frames were all aggregated, and the frames the windows
+|* say they hold must add up to those that weren't dropped
+\******************************************************************************/
+Testable::TestResult DSPEngine::_checkDroppedBatches(void)
+	{
+	DataMgr& dmgr	= DataMgr::instance();
+	QString wisdom	= Config::instance().fftWisdomDir();
+
+	FFTAggregator aggregator;
+	int size		= aggregator.fftSize();
+	int hop			= aggregator.hop();
+	double rate		= TEST_WINDOW * (double)hop / aggregator.updateSecs();
+
+	FFTPlanner planner(size, TEST_BATCH, false, 1, wisdom);
+	if (!planner.init())
+		{
+		ERR << "Cannot plan" << TEST_BATCH << "frames of" << size << "point FFTs";
+		return Testable::TEST_FAIL;
+		}
+
+	/**************************************************************************\
+	|* The receiver runs on the aggregation thread, and holds it up the
+	|* first time it's called until told to let go
+	\**************************************************************************/
+	struct Window { int frames; int flags; double power; };
+	std::vector<Window> windows;
+	windows.reserve(TEST_DROP_WINDOWS);
+	std::mutex lock;
+	std::atomic<bool> stalled(false);
+	std::atomic<bool> release(false);
+
+	QObject sink;
+	QObject::connect(&aggregator, &FFTAggregator::aggregatedDataReady, &sink,
+					 [&](FFTAggregator::DataType type,
+						 FFTAggregator::WindowInfo info,
+						 BlockRef<double> snapshot)
+						{
+						if (type != FFTAggregator::TYPE_UPDATE)
+							return;
+
+						{
+						std::lock_guard<std::mutex> guard(lock);
+						windows.push_back({info.frames, info.flags,
+										   snapshot.data()[FFTAggregator::SNAPSHOT_HEADER]});
+						}
+
+						if (!stalled.exchange(true))
+							for (int ms=0; !release && (ms<TEST_STALL_MS); ms++)
+								std::this_thread::sleep_for(std::chrono::milliseconds(1));
+						},
+					 Qt::DirectConnection);
+
+	DSPEngine engine(&aggregator, TEST_THREADS, QList<int>(), 0, TEST_DROP_DEPTH);
+	aggregator.setSampleRate(rate);
+	engine.start();
+
+	/**************************************************************************\
+	|* Until it's let go, each batch is waited for until it's been queued or
+	|* dropped, so we know which. After that, each is aggregated in turn
+	\**************************************************************************/
+	int64_t frames	= 0;
+	int64_t total	= (int64_t)TEST_DROP_WINDOWS * TEST_WINDOW;
+	int boosted		= 0;
+	while (frames < total)
+		{
+		Stats s				= engine.stats();
+		bool dropping		= (s.aggregate.full > 0) && !release;
+		double amplitude	= dropping ? TEST_DROP_BOOST : 1.0;
+
+		BlockRef<fftw_complex> in = dmgr.fftRefFor(size * TEST_BATCH,
+												   DataBlock::TAG_FFT);
+		for (int i=0; in.isValid() && (i<size * TEST_BATCH); i++)
+			{
+			in.data()[i][0] = amplitude;
+			in.data()[i][1] = 0;
+			}
+
+		TaskFFT task(in, size, TEST_BATCH);
+		if (!task.isValid())
+			{
+			ERR << "Cannot make a batch of" << TEST_BATCH << "frames";
+			engine.stop();
+			return Testable::TEST_FAIL;
+			}
+
+		fftw_plan plan = planner.plan();
+		task.setPlan(plan);
+		task.setSequence(frames);
+		task.setFirst(frames * hop);
+		while (!engine.submit(std::move(task)))
+			std::this_thread::yield();
+		frames += TEST_BATCH;
+
+		if (release)
+			engine.drain();
+		else
+			{
+			int64_t sent = frames / TEST_BATCH;
+			for (int ms=0; (s.aggregate.pushed + s.aggregate.full < sent)
+						   && (ms<TEST_STALL_MS); ms++)
+				{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				s = engine.stats();
+				}
+
+			if (dropping)
+				boosted ++;
+			if (boosted == TEST_DROP_DEPTH - 1)
+				release = true;
+			}
+		}
+
+	engine.drain();
+	release = true;
+	Stats s = engine.stats();
+	engine.stop();
+
+	/**************************************************************************\
+	|* Check the windows against the first
+	\**************************************************************************/
+	std::lock_guard<std::mutex> guard(lock);
+	int64_t counted	= 0;
+	bool flagged	= false;
+	bool level		= !windows.empty();
+	for (const Window& window : windows)
+		{
+		counted	   += window.frames;
+		flagged		= flagged || (window.flags & FFTAggregator::FLAG_DISCONTINUITY);
+		level		= level && (fabs(window.power - windows.front().power) < 1e-9);
+		}
+
+	int64_t dropped = s.aggregate.full * TEST_BATCH;
+	if ((boosted == 0) || (s.aggregate.full != boosted + 1))
+		{
+		ERR << "Expected" << (boosted + 1) << "batches dropped, not"
+			<< (qint64)s.aggregate.full;
+		return Testable::TEST_FAIL;
+		}
+
+	if (((int)windows.size() != TEST_DROP_WINDOWS) || !level || !flagged
+			|| (counted + dropped + s.late != total))
+		{
+		ERR << "After dropping" << (qint64)dropped << "frames," << (int)windows.size()
+			<< "windows held" << (qint64)counted << "of" << (qint64)total << "frames,"
+			<< (level ? "at the same power" : "at different powers") << "and"
+			<< (flagged ? "flagged" : "unflagged");
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : time very large FFTs, from 2^20 to 2^24 points, on one
+|* thread and on all the DSP cores, as the processor would plan them (from
+|* wisdom if there is any, else estimated). Each is reported in frames per
+|* second and as a multiple of real time at the configured sample rate,
+|* for frames that don't overlap
+\******************************************************************************/
+Testable::TestResult DSPEngine::_benchmarkLargeFFT(void)
+	{
+	using std::chrono::duration;
+	using std::chrono::steady_clock;
+
+	double rate		= Config::instance().sampleRate();
+	QString wisdom	= Config::instance().fftWisdomDir();
+	DataMgr& dmgr	= DataMgr::instance();
+
+	QList<int> counts = {1};
+	if (coresFor(0) > 1)
+		counts << coresFor(0);
+
+	for (int shift=BENCH_MIN_SHIFT; shift<=BENCH_MAX_SHIFT; shift++)
+		{
+		int size = 1 << shift;
+		for (int threads : counts)
+			{
+			FFTPlanner planner(size, 1, false, threads, wisdom);
+			if (!planner.init())
+				{
+				ERR << "Cannot plan a" << size << "point FFT";
+				return Testable::TEST_FAIL;
+				}
+
+			int frames	= 0;
+			double secs	= 0;
+			while ((frames < BENCH_FRAMES) || (secs < BENCH_SECS))
+				{
+				BlockRef<fftw_complex> in = dmgr.fftRefFor(size, DataBlock::TAG_FFT);
+				if (!in.isValid())
+					{
+					ERR << "Cannot allocate a" << size << "point FFT frame";
+					return Testable::TEST_FAIL;
+					}
+				for (int i=0; i<size; i++)
+					{
+					in.data()[i][0] = (i & 0xFF) - 128;
+					in.data()[i][1] = ((i >> 8) & 0xFF) - 128;
+					}
+
+				fftw_plan plan = planner.plan();
+				TaskFFT task(in, size, 1, planner.inPlace());
+				task.setPlan(plan);
+				auto start	= steady_clock::now();
+				task.run();
+				secs	   += duration<double>(steady_clock::now() - start).count();
+				frames ++;
+				}
+
+			double fps	= frames / secs;
+			double rt	= (rate > 0) ? fps * size / rate : 0;
+			LOG << "DSP engine:" << size << "point FFT on" << planner.threads()
+				<< (planner.threads() == 1 ? "thread:" : "threads:")
+				<< fps << "frames/sec," << rt << "x real time at" << rate
+				<< "samples/sec";
+			}
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : time the whole engine - FFTs, summing and merging - at
+|* the configured FFT size with 1 to BENCH_MAX_WORKERS workers, first with
+|* the workers keeping partial sums, then with the aggregation thread
+|* summing everything. Batches are submitted flat out from one thread, as
+|* the processor would, with windows short enough that merges happen
+|* throughout. Each run is reported in frames aggregated per second (those
+|* dropped because the aggregation thread fell behind don't count) and as a
+|* multiple of one worker's; counts beyond the cores just show what
+|* oversubscribing them costs
+\******************************************************************************/
+Testable::TestResult DSPEngine::_benchmarkScaling(void)
+	{
+	using std::chrono::duration;
+	using std::chrono::steady_clock;
+
+	DataMgr& dmgr	= DataMgr::instance();
+	QString wisdom	= Config::instance().fftWisdomDir();
+
+	FFTAggregator aggregator;
+	int size		= aggregator.fftSize();
+	int hop			= aggregator.hop();
+	int fits		= TaskFFT::MAX_BATCH_BYTES / std::max<int>(size * sizeof(fftw_complex), 1);
+	int batch		= std::max(1, std::min(fits, (int)TaskFFT::MAX_BATCH));
+	double rate		= BENCH_WINDOW * (double)hop / aggregator.updateSecs();
+
+	FFTPlanner planner(size, batch, false, 1, wisdom);
+	BlockRef<fftw_complex> pattern = dmgr.fftRefFor(size * batch, DataBlock::TAG_FFT);
+	if (!planner.init() || !pattern.isValid())
+		{
+		ERR << "Cannot plan or allocate" << batch << "frames of" << size << "point FFTs";
+		return Testable::TEST_FAIL;
+		}
+	for (int i=0; i<size * batch; i++)
+		{
+		pattern.data()[i][0] = (i & 0xFF) - 128;
+		pattern.data()[i][1] = ((i >> 8) & 0xFF) - 128;
+		}
+
+	for (int partial=1; partial>=0; partial--)
+		{
+		double base = 0;
+		for (int workers=1; workers<=BENCH_MAX_WORKERS; workers*=2)
+			{
+			DSPEngine engine(&aggregator, workers, QList<int>());
+			if (!partial)
+				aggregator.setWorkers(1);
+			aggregator.setSampleRate(rate);
+			engine.start();
+
+			int64_t frames	= 0;
+			auto start		= steady_clock::now();
+			while (duration<double>(steady_clock::now() - start).count() < BENCH_SECS)
+				{
+				BlockRef<fftw_complex> in = dmgr.fftRefFor(size * batch, DataBlock::TAG_FFT);
+				if (in.isValid())
+					memcpy(in.data(), pattern.data(), (size_t)size * batch * sizeof(fftw_complex));
+
+				TaskFFT task(in, size, batch);
+				if (!task.isValid())
+					{
+					std::this_thread::yield();
+					continue;
+					}
+
+				fftw_plan plan = planner.plan();
+				task.setPlan(plan);
+				task.setSequence(frames);
+				task.setFirst(frames * hop);
+				while (!engine.submit(std::move(task)))
+					std::this_thread::yield();
+				frames += batch;
+				}
+			engine.drain();
+			double secs = duration<double>(steady_clock::now() - start).count();
+			engine.stop();
+
+			Stats s		= engine.stats();
+			double fps	= s.done * batch / secs;
+			base		= (workers == 1) ? fps : base;
+			LOG << "DSP engine:" << workers << (workers == 1 ? "worker" : "workers")
+				<< (partial ? "keeping partial sums:" : "with one thread summing:")
+				<< fps << "frames/sec," << fps / base << "x one worker's,"
+				<< (qint64)s.aggregate.full << "batches dropped waiting to aggregate";
+			}
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : identify the class being tested
+\******************************************************************************/
+const char * DSPEngine::testClassName(void)
+	{
+	return "DSPEngine";
+	}
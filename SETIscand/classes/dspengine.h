@@ -0,0 +1,186 @@
+#ifndef DSPENGINE_H
+#define DSPENGINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <QList>
+#include <QThread>
+
+#include "boundedqueue.h"
+#include "properties.h"
+#include "reorderbuffer.h"
+#include "taskfft.h"
+#include "testable.h"
+
+QT_FORWARD_DECLARE_CLASS(FFTAggregator)
+
+/******************************************************************************\
+|* The DSP engine: a fixed set of FFT worker threads and one aggregation
+|* thread, joined by bounded lock-free queues. The processor (on the ring
+|* consumer thread, which is fed by the SampleRing) frames the samples and
+|* submits batches to the FFT queue; a worker runs each batch's FFTs, sums
+|* their power into partial sums of its own, and passes it on to the
+|* aggregation queue; the aggregation thread hands it to the FFTAggregator,
+|* which merges the workers' sums as windows close. No QObject, event or
+|* lock is shared per batch, and nothing is allocated beyond the pooled
+|* buffers.
+|*
+|* Workers finish batches in any order, so the aggregation thread puts them
+|* back in order by their frame sequence numbers (see ReorderBuffer) before
+|* anything downstream sees them. The reorder window is the most skew we
+|* wait out; a batch later than that is counted as late and let go. If the
+|* stream goes quiet, whatever is waiting is handed on.
+|*
+|* Workers can be pinned to CPUs, to keep them off the cores the radio and
+|* ingest threads use and stop them migrating between caches. For very large
+|* FFTs, each worker's FFT runs on several threads, and the worker is pinned
+|* to that many CPUs, which FFTW's threads then share. If a queue is
+|* full the batch is dropped rather than queueing more work behind whatever
+|* is stalled, and counted. A batch dropped on its way to aggregation adds
+|* nothing to the partial sums, and the reorder buffer is told to skip it.
+|* The queue depths are logged periodically, and are available from stats()
+|* for anything else that wants to watch them.
+\******************************************************************************/
+class DSPEngine : public Testable
+	{
+	NON_COPYABLE_NOR_MOVEABLE(DSPEngine);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			PIN_AUTO		= -1,		// Pick CPUs from our affinity mask
+			DEFAULT_DEPTH	= 64,		// Batches each queue can hold
+			SKEW_PER_WORKER	= 4			// Default reorder window, in batches
+			};
+
+		typedef struct
+			{
+			BoundedQueue<TaskFFT>::Stats fft;		// Framing -> FFT
+			BoundedQueue<TaskFFT>::Stats aggregate;	// FFT -> aggregation
+			int64_t		done;						// Batches aggregated
+			int64_t		held;						// ... that waited for others
+			int64_t		late;						// Frames too late to reorder
+			int64_t		skipped;					// Frames never seen
+			} Stats;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(int, numWorkers);				// FFT worker threads
+	GET(QList<int>, cpus);				// CPUs to pin them to, or none
+	GET(int, fftThreads);				// Threads, so CPUs, per worker
+	GET(int, maxSkew);					// Reorder window, in batches
+
+	private:
+		/**********************************************************************\
+		|* A batch the aggregation queue had no room for: its first frame's
+		|* sequence, and its frames, so the reorder buffer needn't wait for it
+		\**********************************************************************/
+		typedef std::pair<int64_t, int> Dropped;
+
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		FFTAggregator *			_aggregator;	// Where the results go
+		BoundedQueue<TaskFFT>	_fftQueue;		// Batches waiting for an FFT
+		BoundedQueue<TaskFFT>	_aggQueue;		// ... for aggregation
+		BoundedQueue<Dropped>	_dropQueue;		// ... that didn't fit in it
+		std::vector<QThread *>	_workers;		// The FFT threads
+		QThread *				_aggThread;		// The aggregation thread
+		std::atomic<bool>		_stopping;		// Threads should exit
+		std::atomic<int64_t>	_done;			// Batches aggregated
+		ReorderBuffer<TaskFFT>	_reorder;		// Puts them back in order
+		std::atomic<int64_t>	_held;			// Its counters, for stats()
+		std::atomic<int64_t>	_late;
+		std::atomic<int64_t>	_lateBatches;
+		std::atomic<int64_t>	_skipped;
+		int64_t					_flagged;		// Skipped, as last flagged
+
+		/**********************************************************************\
+		|* Private methods: the thread loops
+		\**********************************************************************/
+		void _fftLoop(int worker);
+		void _aggregateLoop(void);
+
+		/**********************************************************************\
+		|* Private method: hand a batch, in order, to the aggregator
+		\**********************************************************************/
+		void _deliver(TaskFFT& task);
+
+		/**********************************************************************\
+		|* Private method: pin the calling thread to the worker's CPUs
+		\**********************************************************************/
+		void _pin(int worker);
+
+		/**********************************************************************\
+		|* Private Tests
+		\**********************************************************************/
+		Testable::TestResult _checkQueue(void);
+		Testable::TestResult _checkThreaded(void);
+		Testable::TestResult _checkReorder(void);
+		Testable::TestResult _checkAllocWatch(void);
+		Testable::TestResult _checkDroppedBatches(void);
+		Testable::TestResult _benchmarkLargeFFT(void);
+		Testable::TestResult _benchmarkScaling(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. 0 workers means one per core, less the
+		|* ones ingest needs. cpus is a list of CPUs to pin the workers to in
+		|* turn, {PIN_AUTO} to pick them, or empty not to pin. maxSkew is
+		|* how many batches may overtake one before it's given up on, 0 for
+		|* SKEW_PER_WORKER per worker. fftThreads is how many threads each
+		|* worker's FFT plans use, and so how many CPUs it's pinned to
+		\**********************************************************************/
+		DSPEngine(FFTAggregator *aggregator,
+				  int workers,
+				  const QList<int>& cpus,
+				  int maxSkew = 0,
+				  int depth = DEFAULT_DEPTH,
+				  int fftThreads = 1);
+		virtual ~DSPEngine(void);
+
+		/**********************************************************************\
+		|* The cores the FFTs may use: 'workers' if set, otherwise all but
+		|* the ones the radio and framing threads need
+		\**********************************************************************/
+		static int coresFor(int workers);
+
+		/**********************************************************************\
+		|* Start and stop the threads. Stopping drops any queued batches
+		\**********************************************************************/
+		void start(void);
+		void stop(void);
+
+		/**********************************************************************\
+		|* Wait until every batch submitted has been aggregated (or dropped)
+		\**********************************************************************/
+		void drain(void);
+
+		/**********************************************************************\
+		|* Framing: hand a batch over for its FFTs. Returns false, and drops
+		|* it, if the workers are too far behind
+		\**********************************************************************/
+		bool submit(TaskFFT&& task);
+
+		/**********************************************************************\
+		|* Return / log the queue depths and counters
+		\**********************************************************************/
+		Stats stats(void);
+		void logStats(void);
+
+		/**********************************************************************\
+		|* Public Tests interface
+		\**********************************************************************/
+		int numTests(void) override;
+		Testable::TestResult runTest(int idx) override;
+		const char * testClassName(void) override;
+	};
+
+#endif // DSPENGINE_H
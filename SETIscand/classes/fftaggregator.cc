@@ -1,9 +1,25 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
 #include <QDateTime>
 
+#include "allocwatch.h"
 #include "config.h"
 #include "constants.h"
+#include "converter.h"
 #include "datamgr.h"
 #include "fftaggregator.h"
+#include "samplesource.h"
+
+/******************************************************************************\
+|* The least mean power a bin is published with, so an empty one is -300 dB
+|* rather than -infinity
+\******************************************************************************/
+#define POWER_FLOOR			(1e-30)
 
 /******************************************************************************\
 |* Categorised logging support
@@ -18,129 +34,703 @@
 FFTAggregator::FFTAggregator(QObject *parent)
 			  :QObject(parent)
 			  ,_fftSize(0)
+			  ,_hop(0)
 			  ,_haveData(false)
 			  ,_updateSecs(5)
 			  ,_sampleSecs(300)
-			  ,_nextUpdate(0)
-			  ,_nextSample(0)
+			  ,_sampleRate(0)
+			  ,_updateSamples(0)
+			  ,_sampleSamples(0)
+			  ,_origin(0)
 			  ,_updatePasses(0)
 			  ,_samplePasses(0)
-			  ,_updateData(nullptr)
-			  ,_sampleData(nullptr)
-
+			  ,_band(0)
+			  ,_decimation(1)
+			  ,_offsetHz(0)
+			  ,_workers(0)
+			  ,_update()
+			  ,_sample()
+			  ,_power(nullptr)
+			  ,_powerFloat(nullptr)
+			  ,_anchor(-1)
+			  ,_updateFloor(0)
+			  ,_sampleFloor(0)
+			  ,_mergeInto(nullptr)
+			  ,_mergeChunks(0)
+			  ,_mergeNext(0)
+			  ,_mergeDone(0)
+			  ,_helpers(0)
+			  ,_merging(false)
 	{
 	Config &cfg = Config::instance();
 	_fftSize	= cfg.fftSize();
+	_hop		= cfg.fftHop();
 	_updateSecs	= cfg.secondsBetweenUpdates();
 	_sampleSecs	= cfg.secondsBetweenSamples();
+	setSampleRate(cfg.sampleRate());
+
+	_power		= Converter::instance().power();
+	_powerFloat	= Converter::instance().powerFloat();
 
-	_updateData	= new double[_fftSize];
-	memset(_updateData, 0, _fftSize * sizeof(double));
+	/**************************************************************************\
+	|* The snapshot blocks, one of each type to sum into and the spares. The
+	|* spares are only needed once windows are being sent, so it's enough
+	|* that they can be made then, if they can't now
+	\**************************************************************************/
+	DataMgr &dmgr	= DataMgr::instance();
+	size_t count	= SNAPSHOT_HEADER + (size_t)_fftSize;
+	_updateData		= dmgr.refFor<double>(count, DataBlock::TAG_AGGREGATION);
+	_sampleData		= dmgr.refFor<double>(count, DataBlock::TAG_AGGREGATION);
+	if (!_updateData || !_sampleData)
+		ERR << "Cannot allocate aggregation buffers within the memory budget";
+	else
+		{
+		memset(_sums(_updateData), 0, _fftSize * sizeof(double));
+		memset(_sums(_sampleData), 0, _fftSize * sizeof(double));
+		}
 
-	_sampleData	= new double[_fftSize];
-	memset(_sampleData, 0, _fftSize * sizeof(double));
+	for (int i=0; i<SNAPSHOTS-1; i++)
+		{
+		_updateSpares[i] = dmgr.refFor<double>(count, DataBlock::TAG_AGGREGATION);
+		_sampleSpares[i] = dmgr.refFor<double>(count, DataBlock::TAG_AGGREGATION);
+		}
 	}
 
 /******************************************************************************\
 |* Destructor
 \******************************************************************************/
 FFTAggregator::~FFTAggregator(void)
+	{}
+
+/******************************************************************************\
+|* Set the sample rate, which turns the configured intervals into sample
+|* counts. A window is never shorter than one frame. The windows will be
+|* anchored afresh, so any partial sums are let go
+\******************************************************************************/
+void FFTAggregator::setSampleRate(double rate)
 	{
-	if (_updateData != nullptr)
-		delete [] _updateData;
-	if (_sampleData != nullptr)
-		delete [] _sampleData;
+	QMutexLocker guard(&_lock);
+
+	_sampleRate		= rate;
+	_updateSamples	= std::max<qint64>(llround(_updateSecs * rate), _fftSize);
+	_sampleSamples	= std::max<qint64>(llround(_sampleSecs * rate), _fftSize);
+	_haveData		= false;
+	_anchor			= -1;
+
+	for (Partial& partial : _partials)
+		{
+		partial.window	= NO_WINDOW;
+		partial.frames	= 0;
+		memset(partial.sums.data(), 0, _fftSize * sizeof(double));
+		}
 	}
 
 /******************************************************************************\
-|* We've been sent an FFT packet. Aggregate it
+|* Give the workers partial sums of their own, a pair of windows' worth of
+|* each type. If they won't fit in the memory budget, the aggregation thread
+|* sums everything, as it does for a single worker
 \******************************************************************************/
-void FFTAggregator::fftReady(int buffer)
+void FFTAggregator::setWorkers(int workers)
 	{
 	QMutexLocker guard(&_lock);
-	DataMgr &dmgr	= DataMgr::instance();
+
+	_partials	= std::vector<Partial>();
+	_workers	= 0;
+	if (workers < 2)
+		return;
+
+	DataMgr &dmgr = DataMgr::instance();
+	std::vector<Partial> partials((size_t)workers * 2 * PARTIAL_SLOTS);
+	for (Partial& partial : partials)
+		{
+		partial.sums = dmgr.refFor<double>(_fftSize, DataBlock::TAG_AGGREGATION);
+		if (!partial.sums)
+			{
+			WARN << "Cannot allocate partial sums for" << workers
+				 << "workers within the memory budget, so they'll be summed"
+				 << "on one thread";
+			return;
+			}
+		memset(partial.sums.data(), 0, _fftSize * sizeof(double));
+		}
+
+	_partials	= std::move(partials);
+	_workers	= workers;
+	_mergeFrom.reserve(_partials.size());
+	_merged.reserve(_partials.size());
+	}
+
+/******************************************************************************\
+|* Set the band the windows are labelled with. Windows already open keep
+|* their labels, so set it before the first frame arrives
+\******************************************************************************/
+void FFTAggregator::setBand(int band, int decimation, qint64 offsetHz)
+	{
+	QMutexLocker guard(&_lock);
+
+	_band		= band;
+	_decimation	= decimation;
+	_offsetHz	= offsetHz;
+	}
+
+/******************************************************************************\
+|* Start a window: windows lie on a grid of 'length' samples from the origin,
+|* and this is the one that holds 'first'. Its time is that of the first
+|* frame aggregated into it
+\******************************************************************************/
+void FFTAggregator::_open(WindowInfo& window, qint64 length, qint64 first)
+	{
+	window.first	= _origin + ((first - _origin) / length) * length;
+	window.samples	= length;
+	window.timeNs	= 0;
+	window.frames	= 0;
+	window.flags	= 0;
+	window.band		= _band;
+	window.decimation = _decimation;
+	window.offsetHz	= _offsetHz;
+	}
+
+/******************************************************************************\
+|* We've been sent a batch of FFT frames. Aggregate them. Windows are
+|* measured in samples of the stream, so they hold the same amount of signal
+|* however busy the machine is. A frame belongs to the window its first
+|* sample is in, so overlapping frames are each counted once. A window
+|* closes with its last frame (the next one starts past its end), or early
+|* if samples were lost and this frame is already past its end; either way,
+|* a window that lost samples is flagged
+\******************************************************************************/
+void FFTAggregator::fftReady(BlockRef<fftw_complex> buffer,
+							 int frames,
+							 qint64 first,
+							 qint64 timeNs,
+							 int flags,
+							 quint64 summed)
+	{
+	_aggregate(buffer, frames, first, timeNs, flags, summed);
+	}
+
+void FFTAggregator::fftfReady(BlockRef<fftwf_complex> buffer,
+							  int frames,
+							  qint64 first,
+							  qint64 timeNs,
+							  int flags,
+							  quint64 summed)
+	{
+	_aggregate(buffer, frames, first, timeNs, flags, summed);
+	}
+
+/******************************************************************************\
+|* Aggregate a batch, in whichever precision it came, under one lock. Its
+|* frames follow each other at the hop, and any flags belong to the first
+\******************************************************************************/
+template <typename T>
+void FFTAggregator::_aggregate(BlockRef<T>& buffer,
+							   int frames,
+							   qint64 first,
+							   qint64 timeNs,
+							   int flags,
+							   quint64 summed)
+	{
+	QMutexLocker guard(&_lock);
+
+	if (!_updateData || !_sampleData)
+		return;
+
+	double nsPerFrame = (_sampleRate > 0) ? _hop * 1e9 / _sampleRate : 0;
+	for (int i=0; i<frames; i++)
+		_aggregateFrame(buffer,
+						i,
+						first + (qint64)i * _hop,
+						timeNs + llround(i * nsPerFrame),
+						(i == 0) ? flags : 0,
+						((summed >> i) & 1) != 0);
+	}
+
+/******************************************************************************\
+|* Aggregate one frame of a batch
+\******************************************************************************/
+template <typename T>
+void FFTAggregator::_aggregateFrame(BlockRef<T>& buffer,
+									int frame,
+									qint64 first,
+									qint64 timeNs,
+									int flags,
+									bool summed)
+	{
 
 	/**************************************************************************\
-	|* Set up the next sample/update point if we haven't got one. That way we
-	|* wait until data is streaming in before we start counting
+	|* Anchor the windows on the first frame we see. That way we wait until
+	|* data is streaming in before we start counting. From then on the
+	|* workers can work out which windows their frames are in
 	\**************************************************************************/
 	if (_haveData == false)
 		{
 		_haveData		= true;
-		_nextUpdate		= _deltaT(_updateSecs);
-		_nextSample		= _deltaT(_sampleSecs);
+		_origin			= first;
 		_updatePasses	= 0;
 		_samplePasses	= 0;
+		_open(_update, _updateSamples, first);
+		_open(_sample, _sampleSamples, first);
+		_updateFloor.store(0, std::memory_order_relaxed);
+		_sampleFloor.store(0, std::memory_order_relaxed);
+		_anchor.store(_origin, std::memory_order_release);
 		}
 
 	/**************************************************************************\
-	|* aggregate this pass
+	|* If samples were lost, this frame may be beyond the open windows: close
+	|* them short, and start the ones it belongs in. A window with no frames
+	|* of its own is just cleared
 	\**************************************************************************/
-	fftw_complex* data  = dmgr.asFFT(buffer);
-	for (int i=0; i<_fftSize; i++)
+	if (first >= _update.first + _update.samples)
 		{
-		double creal	= data[i][0] * data[i][0];
-		double cimag	= data[i][1] * data[i][1];
-		double power	= creal * creal + cimag * cimag;
-		double mag		= 0.05 * log(power+1);
+		int merged = _merge(TYPE_UPDATE,
+							_index(_update.first, _updateSamples),
+							_index(first, _updateSamples));
+		if (_update.frames > 0)
+			{
+			_publish(_sums(_updateData), _updatePasses + merged);
+			_update.flags  |= FLAG_DISCONTINUITY;
 
-		// FIXME: Add normalisation here
-		// mag -= _normalisation[i];
+			BlockRef<double> snapshot = _snapshot(_updateData, _updateSpares);
+			if (snapshot)
+				emit aggregatedDataReady(TYPE_UPDATE, _update, snapshot);
+			}
+		else
+			memset(_sums(_updateData), 0, _fftSize * sizeof(double));
+		_updatePasses	= 0;
+		_open(_update, _updateSamples, first);
+		}
 
-		_updateData[i] += mag;
-		_updatePasses  ++;
+	if (first >= _sample.first + _sample.samples)
+		{
+		int merged = _merge(TYPE_SAMPLE,
+							_index(_sample.first, _sampleSamples),
+							_index(first, _sampleSamples));
+		if (_sample.frames > 0)
+			{
+			_publish(_sums(_sampleData), _samplePasses + merged);
+			_sample.flags  |= FLAG_DISCONTINUITY;
 
-		_sampleData[i] += mag;
-		_samplePasses  ++;
+			BlockRef<double> snapshot = _snapshot(_sampleData, _sampleSpares);
+			if (snapshot)
+				emit aggregatedDataReady(TYPE_SAMPLE, _sample, snapshot);
+			}
+		else
+			memset(_sums(_sampleData), 0, _fftSize * sizeof(double));
+		_samplePasses	= 0;
+		_open(_sample, _sampleSamples, first);
+		}
+
+	if (flags & SampleSource::FLAG_DISCONTINUITY)
+		{
+		_update.flags |= FLAG_DISCONTINUITY;
+		_sample.flags |= FLAG_DISCONTINUITY;
+		}
+
+	if (_update.frames == 0)
+		_update.timeNs = timeNs;
+	if (_sample.frames == 0)
+		_sample.timeNs = timeNs;
+
+	/**************************************************************************\
+	|* Aggregate this pass, unless a worker has: add each bin's linear power
+	|* to both windows in one vectorised pass. It's averaged, and turned into
+	|* dB, only when the window is published
+	\**************************************************************************/
+	if (!summed)
+		{
+		AllocWatch::Scope pipeline;
+		T* data			= buffer.data() + (size_t)frame * _fftSize;
+		double *update	= _sums(_updateData);
+		double *sample	= _sums(_sampleData);
+		if constexpr (std::is_same<T, fftw_complex>::value)
+			_power(reinterpret_cast<const double *>(data), update, sample, _fftSize);
+		else
+			_powerFloat(reinterpret_cast<const float *>(data), update, sample, _fftSize);
+
+		_updatePasses ++;
+		_samplePasses ++;
 		}
+	_update.frames ++;
+	_sample.frames ++;
 
 	/**************************************************************************\
-	|* Check whether we're past the time for an update
+	|* Check whether this frame completes the update window
 	\**************************************************************************/
-	if (QDateTime::currentMSecsSinceEpoch() >= _nextUpdate)
+	qint64 next = first + _hop;
+	if (next >= _update.first + _update.samples)
 		{
-		// Create copy of buffer and send to update thread
-		for (int i=0; i<_fftSize; i++)
-			_updateData[i] /= _updatePasses;
+		int merged = _merge(TYPE_UPDATE,
+							_index(_update.first, _updateSamples),
+							_index(next, _updateSamples));
 
-		memset(_updateData, 0, _fftSize * sizeof(double));
-		_nextUpdate		= _deltaT(_updateSecs);
+		// Publish the block as it is, and sum into another
+		_publish(_sums(_updateData), _updatePasses + merged);
 		_updatePasses	= 0;
 
-		dmgr.retain(buffer);
-		emit aggregatedDataReady(TYPE_UPDATE, buffer);
+		BlockRef<double> snapshot = _snapshot(_updateData, _updateSpares);
+		if (snapshot)
+			emit aggregatedDataReady(TYPE_UPDATE, _update, snapshot);
+		_open(_update, _updateSamples, next);
 		}
 
 	/**************************************************************************\
-	|* Check whether we're past the time for a sample
+	|* Check whether this frame completes the sample window
 	\**************************************************************************/
-	if (QDateTime::currentMSecsSinceEpoch() >= _nextSample)
+	if (next >= _sample.first + _sample.samples)
 		{
-		// Create copy of buffer and send to update thread
-		for (int i=0; i<_fftSize; i++)
-			_sampleData[i] /= _samplePasses;
+		int merged = _merge(TYPE_SAMPLE,
+							_index(_sample.first, _sampleSamples),
+							_index(next, _sampleSamples));
 
-		memset(_sampleData, 0, _fftSize * sizeof(double));
-		_nextSample		= _deltaT(_sampleSecs);
+		// Publish the block as it is, and sum into another
+		_publish(_sums(_sampleData), _samplePasses + merged);
 		_samplePasses	= 0;
 
-		dmgr.retain(buffer);
-		emit aggregatedDataReady(TYPE_SAMPLE, buffer);
+		BlockRef<double> snapshot = _snapshot(_sampleData, _sampleSpares);
+		if (snapshot)
+			emit aggregatedDataReady(TYPE_SAMPLE, _sample, snapshot);
+		_open(_sample, _sampleSamples, next);
+		}
+	}
+
+/******************************************************************************\
+|* A worker's partial sums for a window: each worker has PARTIAL_SLOTS of
+|* each type, and windows take turns at them
+\******************************************************************************/
+FFTAggregator::Partial& FFTAggregator::_partial(int worker,
+												DataType type,
+												qint64 window)
+	{
+	size_t kind = (type == TYPE_SAMPLE) ? 1 : 0;
+	return _partials[((size_t)worker * 2 + kind) * PARTIAL_SLOTS
+					 + (size_t)(window % PARTIAL_SLOTS)];
+	}
+
+/******************************************************************************\
+|* Take a worker's partial sums to add to. They have to be for this window
+|* already, or free and the window not yet closed. If the aggregation thread
+|* is merging them, don't wait: the frame goes to it instead
+\******************************************************************************/
+bool FFTAggregator::_claim(Partial& partial,
+						   qint64 window,
+						   std::atomic<qint64>& floor)
+	{
+	if (partial.busy.exchange(true, std::memory_order_acquire))
+		return false;
+
+	if ((partial.window == window)
+			|| ((partial.window == NO_WINDOW)
+				&& (window >= floor.load(std::memory_order_acquire))))
+		{
+		partial.window = window;
+		return true;
+		}
+
+	partial.busy.store(false, std::memory_order_release);
+	return false;
+	}
+
+/******************************************************************************\
+|* On an FFT worker, before the batch is queued for aggregation: take the
+|* worker's partial sums for the update and sample windows each frame is
+|* in, and mark the frames they were had for as summed. Until the windows
+|* are anchored there's nothing to sum into; and a frame whose windows'
+|* partial sums are busy, or still hold other windows, is left to the
+|* aggregation thread. Nothing is summed yet: the batch may not be queued
+\******************************************************************************/
+void FFTAggregator::claim(TaskFFT& task, int worker, Claim& claim)
+	{
+	claim.held		= 0;
+	claim.summed	= 0;
+	task.setSummed(0);
+	if (worker >= _workers)
+		return;
+
+	qint64 origin = _anchor.load(std::memory_order_acquire);
+	if (origin < 0)
+		return;
+
+	claim.worker	= worker;
+	claim.origin	= origin;
+	claim.first		= task.first();
+	claim.frames	= task.frames();
+	for (int i=0; i<claim.frames; i++)
+		{
+		qint64 first = claim.first + (qint64)i * _hop;
+		if (first < origin)
+			continue;
+
+		if (_hold(claim, TYPE_UPDATE, (first - origin) / _updateSamples, _updateFloor)
+			&& _hold(claim, TYPE_SAMPLE, (first - origin) / _sampleSamples, _sampleFloor))
+			claim.summed |= (quint64)1 << i;
+		}
+
+	if (claim.summed != 0)
+		{
+		claim.results	= task.results();
+		claim.resultsF	= task.resultsF();
+		}
+	task.setSummed(claim.summed);
+	}
+
+/******************************************************************************\
+|* Hold a worker's partial sums for a window, unless this batch already
+|* does. A frame is only summed if both its windows' are held
+\******************************************************************************/
+bool FFTAggregator::_hold(Claim& claim,
+						  DataType type,
+						  qint64 window,
+						  std::atomic<qint64>& floor)
+	{
+	Partial& partial = _partial(claim.worker, type, window);
+	for (int i=0; i<claim.held; i++)
+		if (claim.partials[i] == &partial)
+			return partial.window == window;
+
+	if (!_claim(partial, window, floor))
+		return false;
+
+	claim.partials[claim.held++] = &partial;
+	return true;
+	}
+
+/******************************************************************************\
+|* On an FFT worker, once the batch has been queued: add the power of the
+|* frames claimed for to the partial sums, then let them go. If it couldn't
+|* be queued, its frames will never be counted in a window, so nothing is
+|* added. The aggregation thread waits for partial sums to be let go before
+|* merging them, so a window can't close without the frames in it
+\******************************************************************************/
+void FFTAggregator::accumulate(Claim& claim, bool queued)
+	{
+	if (claim.held == 0)
+		return;
+
+	if (queued)
+		{
+		AllocWatch::Scope pipeline;
+		for (int i=0; i<claim.frames; i++)
+			{
+			if (((claim.summed >> i) & 1) == 0)
+				continue;
+
+			qint64 first		= claim.first + (qint64)i * _hop;
+			Partial& update		= _partial(claim.worker, TYPE_UPDATE,
+										   (first - claim.origin) / _updateSamples);
+			Partial& sample		= _partial(claim.worker, TYPE_SAMPLE,
+										   (first - claim.origin) / _sampleSamples);
+
+			size_t offset = (size_t)i * _fftSize;
+			if (claim.resultsF.isValid())
+				_powerFloat(reinterpret_cast<const float *>(claim.resultsF.data() + offset),
+							update.sums.data(),
+							sample.sums.data(),
+							_fftSize);
+			else
+				_power(reinterpret_cast<const double *>(claim.results.data() + offset),
+					   update.sums.data(),
+					   sample.sums.data(),
+					   _fftSize);
+
+			update.frames ++;
+			sample.frames ++;
+			}
+		}
+
+	for (int i=0; i<claim.held; i++)
+		{
+		Partial *partial = claim.partials[i];
+		if (partial->frames == 0)
+			partial->window = NO_WINDOW;
+		partial->busy.store(false, std::memory_order_release);
+		}
+
+	claim.held = 0;
+	claim.results.reset();
+	claim.resultsF.reset();
+	}
+
+/******************************************************************************\
+|* Merge the workers' partial sums for a closing window into ours. First
+|* move the floor on, so no worker starts on this window again, then take
+|* each worker's partial sums in turn (waiting out a frame being added):
+|* those for this window are merged, those for windows we've moved past
+|* (late frames, after samples were lost) are let go, and those for windows
+|* still to come are left alone. Returns how many frames were merged
+\******************************************************************************/
+int FFTAggregator::_merge(DataType type, qint64 window, qint64 next)
+	{
+	std::atomic<qint64>& floor = (type == TYPE_UPDATE) ? _updateFloor
+													   : _sampleFloor;
+	floor.store(next, std::memory_order_release);
+	if (_partials.empty())
+		return 0;
+
+	int frames = 0;
+	_mergeFrom.clear();
+	_merged.clear();
+	for (int worker=0; worker<_workers; worker++)
+		for (int slot=0; slot<PARTIAL_SLOTS; slot++)
+			{
+			Partial& partial = _partial(worker, type, slot);
+			while (partial.busy.exchange(true, std::memory_order_acquire))
+				std::this_thread::yield();
+
+			if (partial.window == window)
+				{
+				frames += partial.frames;
+				_mergeFrom.push_back(partial.sums.data());
+				_merged.push_back(&partial);
+				continue;
+				}
+
+			if ((partial.window != NO_WINDOW) && (partial.window < next))
+				{
+				memset(partial.sums.data(), 0, _fftSize * sizeof(double));
+				partial.window	= NO_WINDOW;
+				partial.frames	= 0;
+				}
+			partial.busy.store(false, std::memory_order_release);
+			}
+
+	/**************************************************************************\
+	|* Share the chunks out with any workers between batches, and do what's
+	|* left ourselves. There's no point waking them for a single chunk
+	\**************************************************************************/
+	if (!_mergeFrom.empty())
+		{
+		_mergeInto		= (type == TYPE_UPDATE) ? _sums(_updateData)
+												: _sums(_sampleData);
+		_mergeChunks	= (_fftSize + MERGE_CHUNK - 1) / MERGE_CHUNK;
+		_mergeNext.store(0, std::memory_order_relaxed);
+		_mergeDone.store(0, std::memory_order_relaxed);
+		if (_mergeChunks > 1)
+			_merging.store(true);
+
+		for (int chunk; (chunk = _mergeNext.fetch_add(1)) < _mergeChunks; )
+			{
+			_mergeChunk(chunk);
+			_mergeDone.fetch_add(1, std::memory_order_release);
+			}
+		while (_mergeDone.load(std::memory_order_acquire) < _mergeChunks)
+			std::this_thread::yield();
+
+		_merging.store(false);
+		while (_helpers.load() > 0)
+			std::this_thread::yield();
 		}
 
-	dmgr.release(buffer);
+	for (Partial *partial : _merged)
+		{
+		partial->window	= NO_WINDOW;
+		partial->frames	= 0;
+		partial->busy.store(false, std::memory_order_release);
+		}
+	return frames;
 	}
 
-/*****************************************************************************\
-|* Produce a delta-time relative to now
+/******************************************************************************\
+|* Merge one chunk of bins: sum the partial sums pairwise, in a tree, into
+|* the first of them, add that to ours, and clear them all for re-use
+\******************************************************************************/
+void FFTAggregator::_mergeChunk(int chunk)
+	{
+	AllocWatch::Scope pipeline;
+	int from	= chunk * MERGE_CHUNK;
+	int bins	= std::min((int)MERGE_CHUNK, _fftSize - from);
+	int count	= (int)_mergeFrom.size();
+
+	for (int stride=1; stride<count; stride*=2)
+		for (int i=0; i+stride<count; i+=2*stride)
+			{
+			double *sums		= _mergeFrom[i] + from;
+			const double *more	= _mergeFrom[i + stride] + from;
+			for (int j=0; j<bins; j++)
+				sums[j] += more[j];
+			}
+
+	double *into		= _mergeInto + from;
+	const double *sums	= _mergeFrom[0] + from;
+	for (int j=0; j<bins; j++)
+		into[j] += sums[j];
+
+	for (double *partial : _mergeFrom)
+		memset(partial + from, 0, bins * sizeof(double));
+	}
+
+/******************************************************************************\
+|* On an FFT worker: help with a merge, if there is one. The count of
+|* helpers lets the aggregation thread know when the last has finished with
+|* it, so it can set up the next
 \******************************************************************************/
-qint64 FFTAggregator::_deltaT(double delta)
+void FFTAggregator::helpMerge(void)
 	{
-	qint64 now	 = QDateTime::currentMSecsSinceEpoch();
-	int secs	= (int)delta;
-	int msecs	= (int)(1000 * (delta - secs));
+	if (!_merging.load(std::memory_order_relaxed))
+		return;
+
+	_helpers.fetch_add(1);
+	if (_merging.load())
+		for (int chunk; (chunk = _mergeNext.fetch_add(1)) < _mergeChunks; )
+			{
+			_mergeChunk(chunk);
+			_mergeDone.fetch_add(1, std::memory_order_release);
+			}
+	_helpers.fetch_sub(1);
+	}
+
+/******************************************************************************\
+|* Turn a window's summed power into the mean power per bin, in dB. This is
+|* the only log taken, once per bin per window
+\******************************************************************************/
+void FFTAggregator::_publish(double *data, int passes)
+	{
+	AllocWatch::Scope pipeline;
+	double scale = 1.0 / std::max(passes, 1);
+	for (int i=0; i<_fftSize; i++)
+		{
+		double mean	= std::max(data[i] * scale, POWER_FLOOR);
+		data[i]		= 10 * log10(mean);
+
+		// FIXME: Add normalisation here
+		// data[i] -= _normalisation[i];
+		}
+	}
+
+/******************************************************************************\
+|* Take a published window's snapshot, and swap a free spare in to sum the
+|* next into. A spare is free once only we hold it: whoever it was sent to
+|* has let go. If they're all still out, a slow client say, carry on in a
+|* new block and let the ring forget one of them, which goes back to the
+|* pool when it's done with
+\******************************************************************************/
+BlockRef<double> FFTAggregator::_snapshot(BlockRef<double>& data,
+										  BlockRef<double> *spares)
+	{
+	BlockRef<double> snapshot = data;
+
+	int spare = -1;
+	for (int i=0; (i<SNAPSHOTS-1) && (spare < 0); i++)
+		if (spares[i].isValid() && (spares[i].block()->refs() == 1))
+			spare = i;
+
+	if (spare < 0)
+		{
+		BlockRef<double> fresh = DataMgr::instance()
+									.refFor<double>(data.count(),
+													DataBlock::TAG_AGGREGATION);
+		if (!fresh)
+			{
+			WARN << "No snapshot free, or room for one, so a window is dropped";
+			memset(_sums(data), 0, _fftSize * sizeof(double));
+			return BlockRef<double>();
+			}
+
+		spare			= 0;
+		spares[spare]	= std::move(fresh);
+		}
 
-	now += secs * 1000;
-	now += msecs;
-	return now;
+	std::swap(data, spares[spare]);
+	memset(_sums(data), 0, _fftSize * sizeof(double));
+	return snapshot;
 	}
@@ -1,11 +1,39 @@
 #ifndef FFTAGGREGATOR_H
 #define FFTAGGREGATOR_H
 
+#include <atomic>
+#include <vector>
+
 #include <QMutexLocker>
 #include <QObject>
 
+#include "blockref.h"
+#include "converter.h"
 #include "properties.h"
+#include "taskfft.h"
 
+/******************************************************************************\
+|* Sums the power of FFT frames over update and sample windows, and
+|* publishes each window's mean as it closes. Frames arrive in order on the
+|* DSP engine's aggregation thread, which tracks the windows.
+|*
+|* With several FFT workers, one thread summing every frame would be the
+|* ceiling, so each worker also keeps partial sums of its own, for the
+|* window its frames are in and the one after, and adds each frame's power
+|* to them straight after its FFT (see claim()). Nothing is shared
+|* between workers, so they don't contend. When a window closes, the
+|* aggregation thread merges the workers' partial sums into its own, chunk
+|* by chunk, each chunk summed pairwise across the workers, with workers
+|* between batches taking chunks too (see helpMerge()). A frame a worker
+|* couldn't sum - it came before the windows were anchored, or too far
+|* ahead of them - is summed by the aggregation thread instead.
+|*
+|* Each window is summed into a snapshot block, which is published as it
+|* stands once it holds the window's mean: there's no copy. Each type of
+|* window has SNAPSHOTS of them, so summing carries on into the next while
+|* the last is still being sent; one is only re-used once nothing else
+|* holds a reference to it.
+\******************************************************************************/
 class FFTAggregator : public QObject
 	{
 	Q_OBJECT
@@ -21,37 +49,213 @@ class FFTAggregator : public QObject
 			TYPE_SAMPLE
 			} DataType;
 
+		enum
+			{
+			FLAG_DISCONTINUITY	= 1<<0	// Samples were lost in the window
+			};
+
+		enum
+			{
+			SNAPSHOTS		= 3,		// Blocks per window type
+			SNAPSHOT_HEADER	= 16,		// Doubles free for a sender's header
+			PARTIAL_SLOTS	= 2,		// Windows a worker sums at once
+			MERGE_CHUNK		= 4096,		// Bins merged at a time
+			NO_WINDOW		= -1		// A partial sum that's free
+			};
+
+		/**********************************************************************\
+		|* An aggregation window: 'samples' samples of the stream from 'first'
+		|* on, made up of 'frames' FFT frames, the first of which was at timeNs.
+		|* Band 0 is the full band; others are down-converted sub-bands, whose
+		|* stream is decimated and centred offsetHz from the tuned frequency
+		\**********************************************************************/
+		typedef struct
+			{
+			qint64	first;				// Stream index the window starts at
+			qint64	samples;			// Window length, in samples
+			qint64	timeNs;				// Time of the first frame
+			int		frames;				// Frames aggregated
+			int		flags;				// FLAG_* as above
+			int		band;				// Which band, 0 for the full one
+			int		decimation;			// Of the band's stream, 1 if full
+			qint64	offsetHz;			// Band centre from the tuned one
+			} WindowInfo;
+
 	/**************************************************************************\
 	|* Properties
 	\**************************************************************************/
 	GET(int, fftSize);					// Bins in the FFT
+	GET(int, hop);						// Samples between frame starts
 	GET(bool, haveData);				// Whether we've received any data yet
 	GET(double, updateSecs);			// Seconds between updates
 	GET(double, sampleSecs);			// Seconds between samples
-	GET(qint64, nextUpdate);			// Next time to deliver an update
-	GET(qint64, nextSample);			// Next time to deliver a sample
-	GET(int, updatePasses);				// Count of update aggregations
-	GET(int, samplePasses);				// Count of sample aggregations
-
+	GET(double, sampleRate);			// Of the stream the frames come from
+	GET(qint64, updateSamples);			// Samples between updates
+	GET(qint64, sampleSamples);			// Samples between samples
+	GET(qint64, origin);				// Stream index the windows start at
+	GET(int, updatePasses);				// Frames in the update sums
+	GET(int, samplePasses);				// Frames in the sample sums
+	GET(int, band);						// Band being aggregated, 0 if full
+	GET(int, decimation);				// Of the band's stream
+	GET(qint64, offsetHz);				// Band centre from the tuned one
+	GET(int, workers);					// Workers keeping partial sums
 
 	private:
+		/**********************************************************************\
+		|* One worker's partial sums for one window. Only that worker adds to
+		|* it, and only the aggregation thread merges it; 'busy' is held by
+		|* whichever is using it, which is briefly. Each is on its own cache
+		|* lines, so workers don't share any
+		\**********************************************************************/
+		struct alignas(64) Partial
+			{
+			std::atomic<bool>	busy;		// Being added to or merged
+			qint64				window;		// Window index, or NO_WINDOW
+			int					frames;		// Frames summed into it
+			BlockRef<double>	sums;		// Power per bin
+
+			Partial(void) : busy(false), window(NO_WINDOW), frames(0) {}
+			};
+
 		/**********************************************************************\
 		|* Private variables
 		\**********************************************************************/
 		QMutex			_lock;			// Thread safety
-		double *		_updateData;	// Results of the update aggregation
-		double *		_sampleData;	// Results of the sample aggregation
+		BlockRef<double> _updateData;	// Power per bin, summed for update
+		BlockRef<double> _sampleData;	// ... and for the sample window
+		BlockRef<double> _updateSpares[SNAPSHOTS - 1]; // Sent, or to re-use
+		BlockRef<double> _sampleSpares[SNAPSHOTS - 1];
+		WindowInfo		_update;		// The update window being aggregated
+		WindowInfo		_sample;		// The sample window being aggregated
+		Converter::Power _power;		// Adds bins' power to the sums
+		Converter::PowerFloat _powerFloat; // ... from single precision
+
+		std::vector<Partial> _partials;	// Worker, then type, then slot
+		std::atomic<qint64> _anchor;	// Origin for the workers, or -1
+		std::atomic<qint64> _updateFloor; // Lowest update window open
+		std::atomic<qint64> _sampleFloor; // ... and sample window
+
+		std::vector<double *> _mergeFrom; // Partial sums being merged
+		std::vector<Partial *> _merged;	// ... and where they came from
+		double *		_mergeInto;		// What they're merged into
+		int				_mergeChunks;	// Chunks to merge
+		std::atomic<int> _mergeNext;	// The next one to take
+		std::atomic<int> _mergeDone;	// How many are finished
+		std::atomic<int> _helpers;		// Workers helping with it
+		std::atomic<bool> _merging;		// A merge is under way
 
 		/**********************************************************************\
 		|* Private methods
 		\**********************************************************************/
-		qint64 _deltaT(double delta);
+		void _open(WindowInfo& window, qint64 length, qint64 first);
+
+		/**********************************************************************\
+		|* The sums in a snapshot block, after the room for a header
+		\**********************************************************************/
+		inline double * _sums(BlockRef<double>& block)
+			{
+			return block.data() + SNAPSHOT_HEADER;
+			}
+
+		/**********************************************************************\
+		|* Take the snapshot of a window that's been published into 'data',
+		|* and carry on in a spare that nothing else holds. If none is free
+		|* and there's no room for another, the snapshot is dropped (an
+		|* empty ref is returned) and 'data' cleared to be summed into again
+		\**********************************************************************/
+		BlockRef<double> _snapshot(BlockRef<double>& data,
+								   BlockRef<double> *spares);
+
+		/**********************************************************************\
+		|* The index of the window of 'length' samples that 'first' is in
+		\**********************************************************************/
+		inline qint64 _index(qint64 first, qint64 length)
+			{
+			return (first - _origin) / length;
+			}
+
+		/**********************************************************************\
+		|* A worker's partial sums for a window, and take them to add to if
+		|* they're free or already for that window, and it's still open
+		\**********************************************************************/
+		Partial& _partial(int worker, DataType type, qint64 window);
+		bool _claim(Partial& partial,
+					qint64 window,
+					std::atomic<qint64>& floor);
+
+		/**********************************************************************\
+		|* Merge the workers' partial sums for a closing window into ours,
+		|* and let go of any for windows before 'next', which is now the
+		|* lowest open. Returns how many frames were merged
+		\**********************************************************************/
+		int _merge(DataType type, qint64 window, qint64 next);
+		void _mergeChunk(int chunk);
+
+		/**********************************************************************\
+		|* Turn a window's sums of power into its mean power per bin, in dB
+		\**********************************************************************/
+		void _publish(double *data, int passes);
+
+		/**********************************************************************\
+		|* Aggregate a batch, or one frame of it, of either precision. The
+		|* sums are always double, and frames a worker summed aren't again
+		\**********************************************************************/
+		template <typename T>
+		void _aggregate(BlockRef<T>& buffer,
+						int frames,
+						qint64 first,
+						qint64 timeNs,
+						int flags,
+						quint64 summed);
+		template <typename T>
+		void _aggregateFrame(BlockRef<T>& buffer,
+							 int frame,
+							 qint64 first,
+							 qint64 timeNs,
+							 int flags,
+							 bool summed);
+
+	public:
+		/**********************************************************************\
+		|* A worker's hold on its partial sums for one batch, from claim()
+		|* until accumulate(). Each worker keeps its own
+		\**********************************************************************/
+		struct Claim
+			{
+			int						worker;		// Whose partial sums
+			qint64					origin;		// Window origin when claimed
+			qint64					first;		// The batch's first sample
+			int						frames;		// ... and its frames
+			quint64					summed;		// Those to sum, a bit each
+			BlockRef<fftw_complex>	results;	// The batch's FFT output
+			BlockRef<fftwf_complex>	resultsF;	// ... or in single precision
+			int						held;		// Partial sums held
+			Partial *				partials[2 * PARTIAL_SLOTS];
+
+			Claim(void) : worker(0), origin(-1), first(0), frames(0),
+						  summed(0), held(0) {}
+			};
+
+	private:
+		/**********************************************************************\
+		|* Hold a worker's partial sums for a window, for a batch's claim
+		\**********************************************************************/
+		bool _hold(Claim& claim,
+				   DataType type,
+				   qint64 window,
+				   std::atomic<qint64>& floor);
 
 	signals:
 		/**********************************************************************\
-		|* Tell the world we have new data it might want to use
+		|* Tell the world we have new data it might want to use: a window's
+		|* mean power per bin, in dB, as fftSize doubles from SNAPSHOT_HEADER
+		|* on. The doubles before that are free for a header to be written
+		|* in, so it can be sent as it is. Don't write to the rest, and let
+		|* go of the ref once done, so the block can be summed into again
 		\**********************************************************************/
-		void aggregatedDataReady(DataType type, int buffer);
+		void aggregatedDataReady(DataType type,
+								 FFTAggregator::WindowInfo info,
+								 BlockRef<double> snapshot);
 
 	public:
 		/**********************************************************************\
@@ -60,12 +264,63 @@ class FFTAggregator : public QObject
 		explicit FFTAggregator(QObject *parent = nullptr);
 		~FFTAggregator(void);
 
-	public slots:
 		/**********************************************************************\
-		|* Receive an FFT buffer from a worker
+		|* Set the sample rate of the stream, which sizes the windows
 		\**********************************************************************/
-		void fftReady(int bufferId);
+		void setSampleRate(double rate);
+
+		/**********************************************************************\
+		|* Mark the windows as coming from a down-converted sub-band
+		\**********************************************************************/
+		void setBand(int band, int decimation, qint64 offsetHz);
+
+		/**********************************************************************\
+		|* Receive a batch of FFT frames from a worker, in double or single
+		|* precision. The first frame starts at 'first' in the stream, at
+		|* timeNs, and carries SampleSource::FLAG_* flags; the rest follow it
+		|* at the configured hop. Bit i of 'summed' is set if a worker has
+		|* already summed frame i. Called on the DSP engine's aggregation
+		|* thread
+		\**********************************************************************/
+		void fftReady(BlockRef<fftw_complex> buffer,
+					  int frames,
+					  qint64 first,
+					  qint64 timeNs,
+					  int flags,
+					  quint64 summed);
+		void fftfReady(BlockRef<fftwf_complex> buffer,
+					   int frames,
+					   qint64 first,
+					   qint64 timeNs,
+					   int flags,
+					   quint64 summed);
+
+		/**********************************************************************\
+		|* Give each of 'workers' FFT workers partial sums of its own. With
+		|* one (or none) there's nothing to gain, and none are kept. Call it
+		|* before the stream starts
+		\**********************************************************************/
+		void setWorkers(int workers);
+
+		/**********************************************************************\
+		|* Called on FFT worker 'worker' straight after a batch's FFTs, and
+		|* before it's queued for aggregation: hold the worker's partial sums
+		|* for whichever of its frames we can, and mark them in the task as
+		|* summed. Then, once it's been queued (or not), accumulate() adds
+		|* their power to the partial sums (only if it was) and lets go
+		\**********************************************************************/
+		void claim(TaskFFT& task, int worker, Claim& claim);
+		void accumulate(Claim& claim, bool queued);
+
+		/**********************************************************************\
+		|* Called on an FFT worker between batches: if a merge is under way,
+		|* take chunks of it until there are none left
+		\**********************************************************************/
+		void helpMerge(void);
 
 	};
 
+Q_DECLARE_METATYPE(FFTAggregator::DataType)
+Q_DECLARE_METATYPE(FFTAggregator::WindowInfo)
+
 #endif // FFTAGGREGATOR_H
@@ -0,0 +1,328 @@
+#include <algorithm>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRegularExpression>
+#include <QStringList>
+
+#include "constants.h"
+#include "datamgr.h"
+#include "fftplanner.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Where the kernel describes the CPU, and the lines that name it (x86 has a
+|* model name, aarch64 an implementer and part number)
+\******************************************************************************/
+#define CPUINFO				"/proc/cpuinfo"
+#define CPU_MODEL_KEYS		{"model name", "CPU implementer", "CPU part"}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+FFTPlanner::FFTPlanner(int fftSize,
+					   int batch,
+					   bool single,
+					   int threads,
+					   const QString& wisdomDir,
+					   QObject *parent)
+		   :QThread(parent)
+		   ,_fftSize(fftSize)
+		   ,_batch(batch)
+		   ,_single(single)
+		   ,_threads(std::max(threads, 1))
+		   ,_inPlace(fftSize >= LARGE_FFT)
+		   ,_estimated(false)
+		   ,_plan(nullptr)
+		   ,_planF(nullptr)
+	{
+	if (wisdomDir.isEmpty())
+		return;
+
+	if (!QDir().mkpath(wisdomDir))
+		WARN << "Cannot create the FFTW wisdom directory" << wisdomDir
+			 << "- plans won't be remembered";
+	else
+		_wisdomFile = wisdomDir;
+	}
+
+/******************************************************************************\
+|* Destructor. The owner must make sure no task is still running a plan
+\******************************************************************************/
+FFTPlanner::~FFTPlanner(void)
+	{
+	if (isRunning())
+		LOG << "Waiting for the FFT planner to finish";
+	wait();
+
+	QMutexLocker lock(&plannerLock());
+	for (fftw_plan plan : _retired)
+		fftw_destroy_plan(plan);
+	for (fftwf_plan plan : _retiredF)
+		fftwf_destroy_plan(plan);
+	if (_plan.load() != nullptr)
+		fftw_destroy_plan(_plan.load());
+	if (_planF.load() != nullptr)
+		fftwf_destroy_plan(_planF.load());
+	}
+
+/******************************************************************************\
+|* Make the first plan
+\******************************************************************************/
+bool FFTPlanner::init(void)
+	{
+	/**************************************************************************\
+	|* We won't actually use these buffers, but we can substitute others as
+	|* long as they are compatible, so allocate these in exactly the same way
+	|* as the ones we will use. An in-place plan is made on just the one
+	\**************************************************************************/
+	DataMgr &dmgr = DataMgr::instance();
+	if (_single)
+		{
+		_inF	= dmgr.fftfRefFor(_fftSize * _batch);
+		_outF	= _inPlace ? _inF : dmgr.fftfRefFor(_fftSize * _batch);
+		}
+	else
+		{
+		_in		= dmgr.fftRefFor(_fftSize * _batch);
+		_out	= _inPlace ? _in : dmgr.fftRefFor(_fftSize * _batch);
+		}
+	if (!(_in.isValid() && _out.isValid()) && !(_inF.isValid() && _outF.isValid()))
+		{
+		ERR << "Cannot allocate the FFT planning buffers";
+		return false;
+		}
+
+	/**************************************************************************\
+	|* If there's wisdom for this plan, that's all we need
+	\**************************************************************************/
+	QMutexLocker lock(&plannerLock());
+	if ((_threads > 1) && !_initThreads())
+		{
+		WARN << "Cannot run FFTs on" << _threads << "threads, using one";
+		_threads = 1;
+		}
+	if (!_wisdomFile.isEmpty())
+		{
+		_wisdomFile = QDir(_wisdomFile).filePath(_wisdomName());
+		if (QFile::exists(_wisdomFile))
+			{
+			QByteArray name	= QFile::encodeName(_wisdomFile);
+			int imported	= _single
+							? fftwf_import_wisdom_from_filename(name.constData())
+							: fftw_import_wisdom_from_filename(name.constData());
+			if (!imported)
+				WARN << "Cannot read FFTW wisdom from" << _wisdomFile;
+			}
+		}
+
+	if (_build(FFTW_PATIENT | FFTW_WISDOM_ONLY))
+		{
+		LOG << "FFT plan created from wisdom";
+		return true;
+		}
+
+	/**************************************************************************\
+	|* Otherwise start with an estimate, which is immediate, and leave
+	|* search() to look for the proper plan
+	\**************************************************************************/
+	if (!_build(FFTW_ESTIMATE))
+		{
+		ERR << "Cannot create an FFT plan";
+		return false;
+		}
+
+	_estimated = true;
+	return true;
+	}
+
+/******************************************************************************\
+|* Look for the proper plan in the background, if we only have an estimate
+\******************************************************************************/
+void FFTPlanner::search(void)
+	{
+	if (!_estimated || isRunning())
+		return;
+
+	LOG << "FFT plan estimated, searching for a better one in the background";
+	start(QThread::LowestPriority);
+	}
+
+/******************************************************************************\
+|* Find the patient plan, remember it, and swap it in
+\******************************************************************************/
+void FFTPlanner::run(void)
+	{
+	QElapsedTimer timer;
+	timer.start();
+
+	QMutexLocker lock(&plannerLock());
+	if (_single)
+		fftwf_set_timelimit(PLAN_SECS);
+	else
+		fftw_set_timelimit(PLAN_SECS);
+
+	bool ok = _build(FFTW_PATIENT);
+
+	if (_single)
+		fftwf_set_timelimit(FFTW_NO_TIMELIMIT);
+	else
+		fftw_set_timelimit(FFTW_NO_TIMELIMIT);
+
+	if (!ok)
+		{
+		WARN << "Cannot create a patient FFT plan, keeping the estimate";
+		return;
+		}
+
+	if (!_wisdomFile.isEmpty())
+		{
+		QByteArray name	= QFile::encodeName(_wisdomFile);
+		int exported	= _single
+						? fftwf_export_wisdom_to_filename(name.constData())
+						: fftw_export_wisdom_to_filename(name.constData());
+		if (!exported)
+			WARN << "Cannot save FFTW wisdom to" << _wisdomFile;
+		}
+
+	LOG << "FFT plan upgraded after" << timer.elapsed() / 1000.0 << "secs";
+	}
+
+/******************************************************************************\
+|* Build and install a plan. One plan does a whole batch: _batch frames, each
+|* _fftSize after the last. The plan it replaces is kept, since tasks may
+|* still be running it. The thread count is part of the plan, so it's set
+|* for this one and put back for anything else planning
+\******************************************************************************/
+bool FFTPlanner::_build(unsigned flags)
+	{
+	if (_threads > 1)
+		{
+		fftw_plan_with_nthreads(_threads);
+		fftwf_plan_with_nthreads(_threads);
+		}
+
+	bool ok = true;
+	if (_single)
+		{
+		fftwf_plan plan = fftwf_plan_many_dft(1, &_fftSize, _batch,
+											  _inF.data(), nullptr,
+											  1, _fftSize,
+											  _outF.data(), nullptr,
+											  1, _fftSize,
+											  FFTW_FORWARD,
+											  flags);
+		if (plan == nullptr)
+			ok = false;
+		else
+			{
+			fftwf_plan old = _planF.exchange(plan, std::memory_order_acq_rel);
+			if (old != nullptr)
+				_retiredF.push_back(old);
+			}
+		}
+	else
+		{
+		fftw_plan plan	= fftw_plan_many_dft(1, &_fftSize, _batch,
+											 _in.data(), nullptr,
+											 1, _fftSize,
+											 _out.data(), nullptr,
+											 1, _fftSize,
+											 FFTW_FORWARD,
+											 flags);
+		if (plan == nullptr)
+			ok = false;
+		else
+			{
+			fftw_plan old = _plan.exchange(plan, std::memory_order_acq_rel);
+			if (old != nullptr)
+				_retired.push_back(old);
+			}
+		}
+
+	if (_threads > 1)
+		{
+		fftw_plan_with_nthreads(1);
+		fftwf_plan_with_nthreads(1);
+		}
+	return ok;
+	}
+
+/******************************************************************************\
+|* Name the wisdom file: FFTW only reuses wisdom for the same transform, in
+|* the same layout and on the same alignment and threads, and it's only
+|* worth reusing on the same CPU
+\******************************************************************************/
+QString FFTPlanner::_wisdomName(void)
+	{
+	int alignment = _single
+				  ? fftwf_alignment_of(reinterpret_cast<float *>(_inF.data()))
+				  : fftw_alignment_of(reinterpret_cast<double *>(_in.data()));
+
+	QString layout;
+	if (_inPlace)
+		layout += "-ip";
+	if (_threads > 1)
+		layout += QString("-t%1").arg(_threads);
+
+	return QString("fftw-%1-%2x%3-a%4%5-%6.wisdom")
+				.arg(_single ? "single" : "double")
+				.arg(_fftSize)
+				.arg(_batch)
+				.arg(alignment)
+				.arg(layout)
+				.arg(_cpuModel());
+	}
+
+/******************************************************************************\
+|* Describe the CPU, in characters that are safe in a filename
+\******************************************************************************/
+QString FFTPlanner::_cpuModel(void)
+	{
+	QStringList model;
+
+	QFile info(CPUINFO);
+	if (info.open(QFile::ReadOnly | QFile::Text))
+		{
+		const QStringList lines = QString::fromLatin1(info.readAll()).split('\n');
+		for (const char *key : CPU_MODEL_KEYS)
+			for (const QString& line : lines)
+				if (line.startsWith(key))
+					{
+					model << line.section(':', 1).trimmed();
+					break;
+					}
+		}
+
+	QString name = model.join(' ')
+						.replace(QRegularExpression("[^A-Za-z0-9]+"), "-")
+						.remove(QRegularExpression("^-|-$"));
+	return name.isEmpty() ? QString("unknown-cpu") : name;
+	}
+
+/******************************************************************************\
+|* Set up FFTW's threads, for both precisions, the first time they're needed
+\******************************************************************************/
+bool FFTPlanner::_initThreads(void)
+	{
+	static int ready = -1;
+	if (ready < 0)
+		ready = (fftw_init_threads() != 0) && (fftwf_init_threads() != 0);
+	return ready != 0;
+	}
+
+/******************************************************************************\
+|* The one lock on the FFTW planner
+\******************************************************************************/
+QMutex& FFTPlanner::plannerLock(void)
+	{
+	static QMutex lock;
+	return lock;
+	}
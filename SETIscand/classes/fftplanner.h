@@ -0,0 +1,154 @@
+#ifndef FFTPLANNER_H
+#define FFTPLANNER_H
+
+#include <atomic>
+#include <vector>
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <fftw3.h>
+
+#include "blockref.h"
+#include "properties.h"
+
+/******************************************************************************\
+|* Plans the batched FFT for the processor, without holding up the start of
+|* the stream.
+|*
+|* FFTW wisdom is kept on disk, one file per FFT size, batch, precision,
+|* buffer alignment and CPU model, since wisdom from any other combination
+|* won't produce the same plan. If the file has wisdom for our plan, init()
+|* builds the FFTW_PATIENT plan from it straight away. If not, init() makes
+|* an FFTW_ESTIMATE plan, which takes no time, and search() starts a
+|* low-priority thread to find the FFTW_PATIENT one. The search holds the
+|* planner lock throughout, so every planner a process needs should be
+|* init()ed before any search() starts. When that's done, it is saved to the
+|* wisdom file and swapped in atomically: plan() is read for each task, so
+|* the next task dispatched uses it. Tasks still running the estimated plan
+|* keep it valid, because it's only destroyed with the planner.
+|*
+|* The FFTW planner isn't thread-safe (only executing plans is), so all
+|* planning, wisdom and plan destruction is done under plannerLock().
+|*
+|* Very large FFTs (LARGE_FFT bins and up, for Hz-level resolution) are
+|* planned in place, since a second frame-sized buffer per task would double
+|* the memory traffic for nothing, and can be split across several threads.
+|* FFTW runs those threads from a pool that the executing thread starts, so
+|* they inherit its CPU affinity: pinning the worker to a set of cores keeps
+|* the whole FFT on them.
+\******************************************************************************/
+class FFTPlanner : public QThread
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			PLAN_SECS		= 300,				// Most time to spend searching
+			LARGE_FFT		= 1 << 20			// In place, and worth threading
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(int, fftSize);						// Samples per frame
+	GET(int, batch);						// Frames per plan
+	GET(bool, single);						// Single-precision plan
+	GET(int, threads);						// Threads each FFT runs on
+	GET(bool, inPlace);						// Results overwrite the input
+	GET(QString, wisdomFile);				// Where the wisdom lives, or empty
+	GET(bool, estimated);					// init() could only estimate a plan
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		std::atomic<fftw_plan>	_plan;		// Plan to use now
+		std::atomic<fftwf_plan>	_planF;		// ... in single precision
+		std::vector<fftw_plan>	_retired;	// Superseded, may still be running
+		std::vector<fftwf_plan>	_retiredF;	// ... in single precision
+
+		BlockRef<fftw_complex>	_in;		// FFTW buffer used during planning
+		BlockRef<fftw_complex>	_out;		// FFTW buffer used during planning
+		BlockRef<fftwf_complex>	_inF;		// ... in single precision
+		BlockRef<fftwf_complex>	_outF;		// ... in single precision
+
+		/**********************************************************************\
+		|* Private method: build a plan for our buffers with the given flags,
+		|* and install it. Returns false if FFTW couldn't (eg: for
+		|* FFTW_WISDOM_ONLY, without the wisdom). Call with plannerLock() held
+		\**********************************************************************/
+		bool _build(unsigned flags);
+
+		/**********************************************************************\
+		|* Private method: the wisdom file's name for our plan on this CPU
+		\**********************************************************************/
+		QString _wisdomName(void);
+
+		/**********************************************************************\
+		|* Private method: the CPU model, as the kernel reports it
+		\**********************************************************************/
+		static QString _cpuModel(void);
+
+		/**********************************************************************\
+		|* Private method: set FFTW up for threaded plans, once. Returns
+		|* false if it can't be. Call with plannerLock() held
+		\**********************************************************************/
+		static bool _initThreads(void);
+
+	protected:
+		/**********************************************************************\
+		|* Find the FFTW_PATIENT plan, on the low-priority thread
+		\**********************************************************************/
+		void run(void) override;
+
+	public:
+		/**********************************************************************\
+		|* Constructor: plans of 'batch' frames of fftSize samples each, each
+		|* frame straight after the last, in double or single precision, and
+		|* each run on 'threads' threads. Wisdom is kept in wisdomDir, or not
+		|* kept if that is empty
+		\**********************************************************************/
+		FFTPlanner(int fftSize,
+				   int batch,
+				   bool single,
+				   int threads,
+				   const QString& wisdomDir,
+				   QObject *parent = nullptr);
+		~FFTPlanner(void);
+
+		/**********************************************************************\
+		|* Make the first plan, from wisdom if there is some, else estimated.
+		|* Returns false if no plan could be made
+		\**********************************************************************/
+		bool init(void);
+
+		/**********************************************************************\
+		|* If the plan was only estimated, start looking for a better one in
+		|* the background
+		\**********************************************************************/
+		void search(void);
+
+		/**********************************************************************\
+		|* The best plan so far, of the planner's precision
+		\**********************************************************************/
+		inline fftw_plan plan(void) const
+			{
+			return _plan.load(std::memory_order_acquire);
+			}
+		inline fftwf_plan planF(void) const
+			{
+			return _planF.load(std::memory_order_acquire);
+			}
+
+		/**********************************************************************\
+		|* Serialise use of the FFTW planner, process-wide
+		\**********************************************************************/
+		static QMutex& plannerLock(void);
+	};
+
+#endif // FFTPLANNER_H
@@ -0,0 +1,341 @@
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "config.h"
+#include "constants.h"
+#include "filesource.h"
+#include "processor.h"
+#include "ringconsumer.h"
+#include "samplering.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* SigMF keys and file extensions
+\******************************************************************************/
+#define SIGMF_META			"sigmf-meta"
+#define SIGMF_DATA			"sigmf-data"
+#define SIGMF_GLOBAL		"global"
+#define SIGMF_CAPTURES		"captures"
+#define SIGMF_DATATYPE		"core:datatype"
+#define SIGMF_RATE			"core:sample_rate"
+#define SIGMF_FREQUENCY		"core:frequency"
+
+/******************************************************************************\
+|* How long to back off when the ring is full in fast mode
+\******************************************************************************/
+#define BACKOFF_US			(50)
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+FileSource::FileSource(const QString& path,
+					   const QString& format,
+					   bool fast,
+					   Processor *processor)
+		   :QThread(processor)
+		   ,_path(path)
+		   ,_format(FMT_UNKNOWN)
+		   ,_sampleRate(Config::instance().sampleRate())
+		   ,_frequency(0)
+		   ,_isFast(fast)
+		   ,_isValid(false)
+		   ,_proc(processor)
+		   ,_ring(nullptr)
+		   ,_consumer(nullptr)
+		   ,_map(nullptr)
+		   ,_mapSize(0)
+		   ,_isActive(false)
+	{
+	/**************************************************************************\
+	|* Work out which files we have: SigMF is a .sigmf-meta / .sigmf-data pair
+	\**************************************************************************/
+	QFileInfo info(path);
+	QString suffix		= info.suffix().toLower();
+	QString dataPath	= path;
+
+	if ((suffix == SIGMF_META) || (suffix == SIGMF_DATA))
+		{
+		QString base	= info.path() + "/" + info.completeBaseName();
+		dataPath		= base + "." + SIGMF_DATA;
+		if (!_readSigMF(base + "." + SIGMF_META))
+			return;
+		}
+	else
+		_format = formatFor(suffix);
+
+	if (!format.isEmpty())
+		_format = formatFor(format);
+
+	if (_format == FMT_UNKNOWN)
+		{
+		ERR << "Cannot tell the sample format of" << path
+			<< "- use --replay-format";
+		return;
+		}
+
+	_isValid = _mapFile(dataPath);
+	if (_isValid)
+		LOG << "Replaying" << dataPath << ":" << (qint64)(_mapSize / sampleBytes())
+			<< "samples at" << _sampleRate << "Hz, centre" << _frequency << "Hz,"
+			<< (_isFast ? "as fast as possible" : "in real time");
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+FileSource::~FileSource(void)
+	{
+	stopWorker();
+	if (_map != nullptr)
+		::munmap(const_cast<uint8_t *>(_map), _mapSize);
+	}
+
+/******************************************************************************\
+|* Map a format name to a Format. Accepts our names and the SigMF ones
+\******************************************************************************/
+FileSource::Format FileSource::formatFor(const QString& name)
+	{
+	QString fmt = name.toLower();
+	if ((fmt == "cs8") || (fmt == "ci8"))
+		return FMT_CS8;
+	if (fmt == "cu8")
+		return FMT_CU8;
+	if (fmt == "cs12")
+		return FMT_CS12;
+	if ((fmt == "cs16") || (fmt == "ci16_le") || (fmt == "ci16"))
+		return FMT_CS16;
+	if ((fmt == "cf32") || (fmt == "cf32_le"))
+		return FMT_CF32;
+	return FMT_UNKNOWN;
+	}
+
+/******************************************************************************\
+|* Read the SigMF metadata: datatype and sample rate from the global object,
+|* centre frequency from the first capture
+\******************************************************************************/
+bool FileSource::_readSigMF(const QString& metaPath)
+	{
+	QFile file(metaPath);
+	if (!file.open(QFile::ReadOnly))
+		{
+		ERR << "Cannot open SigMF metadata" << metaPath;
+		return false;
+		}
+
+	QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+	if (!doc.isObject())
+		{
+		ERR << "SigMF metadata" << metaPath << "is not a JSON object";
+		return false;
+		}
+
+	QJsonObject global	= doc.object().value(SIGMF_GLOBAL).toObject();
+	QString datatype	= global.value(SIGMF_DATATYPE).toString();
+	_format				= formatFor(datatype);
+	_sampleRate			= global.value(SIGMF_RATE).toDouble(_sampleRate);
+
+	QJsonArray captures	= doc.object().value(SIGMF_CAPTURES).toArray();
+	if (!captures.isEmpty())
+		_frequency = captures.at(0).toObject().value(SIGMF_FREQUENCY).toDouble(0);
+
+	if (_format == FMT_UNKNOWN)
+		WARN << "Unsupported SigMF datatype" << datatype;
+	return true;
+	}
+
+/******************************************************************************\
+|* Map the sample data
+\******************************************************************************/
+bool FileSource::_mapFile(const QString& dataPath)
+	{
+	int fd = ::open(qPrintable(dataPath), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		{
+		ERR << "Cannot open" << dataPath;
+		return false;
+		}
+
+	struct stat sb;
+	if ((::fstat(fd, &sb) != 0) || (sb.st_size < sampleBytes()))
+		{
+		ERR << dataPath << "is empty";
+		::close(fd);
+		return false;
+		}
+
+	void *addr = ::mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
+		{
+		ERR << "Cannot map" << dataPath;
+		return false;
+		}
+
+	::madvise(addr, (size_t)sb.st_size, MADV_SEQUENTIAL);
+	_map		= reinterpret_cast<const uint8_t *>(addr);
+	_mapSize	= (size_t)sb.st_size;
+	return true;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: samples per buffer
+\******************************************************************************/
+int FileSource::streamMTU(void)
+	{
+	return FILE_MTU;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: samples per second
+\******************************************************************************/
+double FileSource::streamRate(void)
+	{
+	return _sampleRate;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: format of the delivered samples
+\******************************************************************************/
+SampleSource::Format FileSource::sampleFormat(void)
+	{
+	return _format;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: bytes per delivered sample
+\******************************************************************************/
+int FileSource::sampleBytes(void)
+	{
+	return bytesFor(_format);
+	}
+
+/******************************************************************************\
+|* SampleSource interface: full scale
+\******************************************************************************/
+int FileSource::fullScale(void)
+	{
+	switch (_format)
+		{
+		case FMT_CS8:
+		case FMT_CU8:
+			return 128;
+		case FMT_CS12:
+			return 2048;
+		case FMT_CS16:
+			return 32768;
+		default:
+			return 1;
+		}
+	}
+
+/******************************************************************************\
+|* SampleSource interface: start replaying
+\******************************************************************************/
+void FileSource::startWorker(void)
+	{
+	if (!_isValid || (_ring != nullptr))
+		return;
+
+	_ring = new SampleRing(Config::instance().ringSlots(),
+						   (size_t)streamMTU() * sampleBytes());
+	if (!_ring->isValid())
+		{
+		ERR << "Cannot allocate the sample ring";
+		delete _ring;
+		_ring = nullptr;
+		return;
+		}
+
+	_consumer = new RingConsumer(_ring, _proc);
+	_consumer->start(QThread::HighPriority);
+
+	_isActive = true;
+	start();
+	}
+
+/******************************************************************************\
+|* SampleSource interface: stop replaying
+\******************************************************************************/
+void FileSource::stopWorker(void)
+	{
+	if (_ring == nullptr)
+		return;
+
+	_isActive = false;
+	wait();
+
+	_consumer->stop();
+	delete _consumer;
+	_consumer = nullptr;
+
+	delete _ring;
+	_ring = nullptr;
+	}
+
+/******************************************************************************\
+|* Feed the file through the ring. Timestamps are derived from the sample
+|* count, as a radio would report them
+\******************************************************************************/
+void FileSource::run(void)
+	{
+	using namespace std::chrono;
+
+	size_t inBytes		= (size_t)sampleBytes();
+	int64_t total		= (int64_t)(_mapSize / inBytes);
+	int64_t sent		= 0;
+	auto start			= steady_clock::now();
+
+	while (_isActive && (sent < total))
+		{
+		int samples		= (int)std::min<int64_t>(FILE_MTU, total - sent);
+
+		/**********************************************************************\
+		|* In fast mode, wait for room rather than drop
+		\**********************************************************************/
+		if (_isFast)
+			while (_isActive && (_ring->occupancy() >= _ring->numSlots()))
+				std::this_thread::sleep_for(microseconds(BACKOFF_US));
+
+		::memcpy(_ring->claim(), _map + sent * inBytes, samples * inBytes);
+		_ring->publish(samples,
+					   SampleSource::FLAG_HAS_TIME,
+					   (long long)(sent * 1e9 / _sampleRate));
+		sent += samples;
+
+		if (!_isFast)
+			std::this_thread::sleep_until(start
+				+ nanoseconds((int64_t)(sent * 1e9 / _sampleRate)));
+		}
+
+	/**************************************************************************\
+	|* Let the pipeline finish with what we've sent, then report
+	\**************************************************************************/
+	while (_isActive && (_ring->occupancy() > 0))
+		std::this_thread::sleep_for(microseconds(BACKOFF_US));
+	_proc->drain();
+
+	double secs = duration<double>(steady_clock::now() - start).count();
+	SampleRing::Stats s = _ring->stats();
+	LOG << "Replay done:" << (qint64)sent << "samples in" << secs << "secs,"
+		<< (secs > 0 ? sent / secs / 1e6 : 0) << "Msamples/sec,"
+		<< (secs > 0 ? sent / secs / _sampleRate : 0) << "x real-time,"
+		<< s.overruns << "buffers dropped";
+	}
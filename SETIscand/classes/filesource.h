@@ -0,0 +1,106 @@
+#ifndef FILESOURCE_H
+#define FILESOURCE_H
+
+#include <atomic>
+
+#include <QString>
+#include <QThread>
+
+#include "properties.h"
+#include "samplesource.h"
+
+QT_FORWARD_DECLARE_CLASS(Processor)
+QT_FORWARD_DECLARE_CLASS(RingConsumer)
+QT_FORWARD_DECLARE_CLASS(SampleRing)
+
+/******************************************************************************\
+|* Replay a recording through the pipeline in place of a radio. The file is
+|* mmap()ed and fed through the same SampleRing and RingConsumer as live
+|* data, so everything from Processor::dataReceived onwards is the real code.
+|*
+|* Raw interleaved cs8, cu8, cs12, cs16 and cf32 files are supported, as are
+|* SigMF recordings (the .sigmf-meta supplies the datatype, sample rate and
+|* centre frequency). Samples are delivered in the file's own format, as a
+|* radio would deliver its native one.
+|*
+|* In real-time mode buffers are paced at the sample rate and, as with a
+|* radio, dropped if processing can't keep up. In fast mode they're sent as
+|* quickly as the pipeline will take them, nothing is dropped, and the
+|* throughput is reported at the end.
+\******************************************************************************/
+class FileSource : public QThread, public SampleSource
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			FILE_MTU		= 16384		// Samples per buffer
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(QString, path);					// File with the sample data
+	GET(Format, format);				// Format of the file's samples
+	GET(double, sampleRate);			// Samples per second
+	GET(double, frequency);				// Centre frequency, if known
+	GET(bool, isFast);					// As fast as possible, or real-time
+	GET(bool, isValid);					// File opened and understood
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		Processor *			_proc;		// Where the samples end up
+		SampleRing *		_ring;		// Producer -> consumer buffers
+		RingConsumer *		_consumer;	// Feeds the processor
+		const uint8_t *		_map;		// The mapped file
+		size_t				_mapSize;	// Size of the mapping
+		std::atomic<bool>	_isActive;	// Cleared to stop early
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		bool _readSigMF(const QString& metaPath);
+		bool _mapFile(const QString& dataPath);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. The format string is one of cs8, cu8,
+		|* cs12, cs16 or cf32; if empty it comes from the SigMF metadata or
+		|* the file extension
+		\**********************************************************************/
+		explicit FileSource(const QString& path,
+							const QString& format,
+							bool fast,
+							Processor *processor);
+		~FileSource(void);
+
+		/**********************************************************************\
+		|* Map a format name to a Format
+		\**********************************************************************/
+		static Format formatFor(const QString& name);
+
+		/**********************************************************************\
+		|* SampleSource interface
+		\**********************************************************************/
+		int streamMTU(void) override;
+		double streamRate(void) override;
+		Format sampleFormat(void) override;
+		int sampleBytes(void) override;
+		int fullScale(void) override;
+		void startWorker(void) override;
+		void stopWorker(void) override;
+
+	protected:
+		/**********************************************************************\
+		|* The producer loop
+		\**********************************************************************/
+		void run(void) override;
+	};
+
+#endif // FILESOURCE_H
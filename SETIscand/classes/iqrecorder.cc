@@ -0,0 +1,418 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "constants.h"
+#include "iqrecorder.h"
+#include "samplering.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_data) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* SigMF keys and file extensions
+\******************************************************************************/
+#define SIGMF_META			"sigmf-meta"
+#define SIGMF_DATA			"sigmf-data"
+#define SIGMF_VERSION		"1.0.0"
+#define SIGMF_GLOBAL		"global"
+#define SIGMF_CAPTURES		"captures"
+#define SIGMF_ANNOTATIONS	"annotations"
+#define SIGMF_DATATYPE		"core:datatype"
+#define SIGMF_RATE			"core:sample_rate"
+#define SIGMF_CORE_VERSION	"core:version"
+#define SIGMF_CHANNELS		"core:num_channels"
+#define SIGMF_RECORDER		"core:recorder"
+#define SIGMF_START			"core:sample_start"
+#define SIGMF_INDEX			"core:global_index"
+#define SIGMF_FREQUENCY		"core:frequency"
+#define SIGMF_DATETIME		"core:datetime"
+
+/******************************************************************************\
+|* How long the writer waits for a slot before checking whether to stop
+\******************************************************************************/
+#define WAIT_MS				(100)
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+IQRecorder::IQRecorder(const QString& directory,
+					   double sampleRate,
+					   double frequency,
+					   SampleSource::Format format,
+					   int64_t rotateBytes,
+					   int rotateSecs,
+					   QObject *parent)
+		   :QThread(parent)
+		   ,_directory(directory)
+		   ,_sampleRate(sampleRate)
+		   ,_frequency(frequency)
+		   ,_format(format)
+		   ,_rotateBytes(rotateBytes)
+		   ,_rotateSecs(rotateSecs)
+		   ,_isValid(false)
+		   ,_ring(nullptr)
+		   ,_slot(nullptr)
+		   ,_fill(0)
+		   ,_pending(0)
+		   ,_next(-1)
+		   ,_dropped(0)
+		   ,_stage(nullptr)
+		   ,_staged(0)
+		   ,_fd(-1)
+		   ,_isDirect(false)
+		   ,_fileBytes(0)
+		   ,_fileSamples(0)
+		   ,_expected(0)
+		   ,_files(0)
+		   ,_failed(false)
+		   ,_isActive(false)
+	{
+	if (_datatype() == nullptr)
+		{
+		ERR << "Cannot record this sample format as SigMF";
+		return;
+		}
+
+	if (!QDir().mkpath(directory))
+		{
+		ERR << "Cannot create the recording directory" << directory;
+		return;
+		}
+
+	/**************************************************************************\
+	|* The staging buffer holds a slot plus the part-page left from the last
+	\**************************************************************************/
+	void *stage = nullptr;
+	if (::posix_memalign(&stage, PAGE_BYTES, SLOT_BYTES + PAGE_BYTES) != 0)
+		{
+		ERR << "Cannot allocate the recorder's staging buffer";
+		return;
+		}
+	_stage	= reinterpret_cast<uint8_t *>(stage);
+
+	_ring	= new SampleRing(NUM_SLOTS, SLOT_BYTES, "recorder ring");
+	if (!_ring->isValid())
+		{
+		ERR << "Cannot allocate the recorder's buffers";
+		return;
+		}
+
+	_isValid	= true;
+	_isActive	= true;
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+IQRecorder::~IQRecorder(void)
+	{
+	stop();
+	delete _ring;
+	::free(_stage);
+	}
+
+/******************************************************************************\
+|* Ingest side: copy samples into the current slot, handing it over when full
+\******************************************************************************/
+void IQRecorder::record(const uint8_t *data, int samples, int64_t first)
+	{
+	if (!_isValid)
+		return;
+
+	/**************************************************************************\
+	|* The first samples set where the stream starts, which isn't a gap. After
+	|* that, if the source lost samples, hand over what we have and move the
+	|* ring's stream index on, so the writer starts a new capture segment
+	\**************************************************************************/
+	if (_next < 0)
+		_ring->skip(first);
+	else if (first != _next)
+		{
+		_publish();
+		_ring->skip(first - _next);
+		}
+	_next = first + samples;
+
+	size_t sampleBytes = SampleSource::bytesFor(_format);
+	while (samples > 0)
+		{
+		if (_slot == nullptr)
+			_slot = _ring->claim();
+
+		int room	= (int)((SLOT_BYTES - _fill) / sampleBytes);
+		int count	= std::min(room, samples);
+		size_t bytes = count * sampleBytes;
+
+		::memcpy(_slot + _fill, data, bytes);
+		_fill	   += bytes;
+		_pending   += count;
+		data	   += bytes;
+		samples	   -= count;
+
+		if (_fill + sampleBytes > SLOT_BYTES)
+			_publish();
+		}
+	}
+
+/******************************************************************************\
+|* Ingest side: hand the current slot to the writer, or count it as dropped
+\******************************************************************************/
+void IQRecorder::_publish(void)
+	{
+	if (_pending > 0)
+		if (!_ring->publish(_pending, 0, 0))
+			_dropped.fetch_add(_pending, std::memory_order_relaxed);
+
+	_slot		= nullptr;
+	_fill		= 0;
+	_pending	= 0;
+	}
+
+/******************************************************************************\
+|* Stop recording
+\******************************************************************************/
+void IQRecorder::stop(void)
+	{
+	if (!_isValid || !_isActive)
+		return;
+
+	_publish();
+	_isActive = false;
+	wait();
+
+	if (isFinished())
+		{
+		LOG << "Recorded" << _files << "files," << (qint64)dropped()
+			<< "samples dropped";
+		_ring->logStats();
+		}
+	}
+
+/******************************************************************************\
+|* Return the number of samples dropped
+\******************************************************************************/
+int64_t IQRecorder::dropped(void)
+	{
+	return _dropped.load(std::memory_order_relaxed);
+	}
+
+/******************************************************************************\
+|* SigMF name for the sample format, or nullptr if it has none
+\******************************************************************************/
+const char * IQRecorder::_datatype(void)
+	{
+	switch (_format)
+		{
+		case SampleSource::FMT_CS8:
+			return "ci8";
+		case SampleSource::FMT_CU8:
+			return "cu8";
+		case SampleSource::FMT_CS16:
+			return "ci16_le";
+		case SampleSource::FMT_CF32:
+			return "cf32_le";
+		default:
+			return nullptr;
+		}
+	}
+
+/******************************************************************************\
+|* Writer: start a new file, whose first sample is at 'first' in the stream
+\******************************************************************************/
+bool IQRecorder::_open(int64_t first)
+	{
+	_opened	= QDateTime::currentDateTimeUtc();
+	_base	= _directory + "/" + QString(APP_NAME).toLower() + "-"
+			+ _opened.toString("yyyyMMdd'T'HHmmss'Z'")
+			+ QString("-%1").arg(_files, 4, 10, QChar('0'));
+
+	QString path	= _base + "." + SIGMF_DATA;
+	int flags		= O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	_fd				= ::open(qPrintable(path), flags | O_DIRECT, 0644);
+	_isDirect		= (_fd >= 0);
+	if ((_fd < 0) && (errno == EINVAL))
+		_fd = ::open(qPrintable(path), flags, 0644);
+	if (_fd < 0)
+		{
+		ERR << "Cannot create recording" << path << ":" << ::strerror(errno);
+		return false;
+		}
+
+	_staged			= 0;
+	_fileBytes		= 0;
+	_fileSamples	= 0;
+	_expected		= first;
+	_captures		= QJsonArray();
+	_captures.append(QJsonObject({{SIGMF_START, 0},
+								  {SIGMF_INDEX, (qint64)first},
+								  {SIGMF_FREQUENCY, _frequency},
+								  {SIGMF_DATETIME, _opened.toString(Qt::ISODateWithMs)}}));
+	_writeMeta();
+
+	LOG << "Recording to" << path << (_isDirect ? "(direct)" : "(buffered)");
+	return true;
+	}
+
+/******************************************************************************\
+|* Writer: finish the current file
+\******************************************************************************/
+void IQRecorder::_close(void)
+	{
+	if (_fd < 0)
+		return;
+
+	if (!_flushStage(true))
+		_failed = true;
+	::close(_fd);
+	_fd = -1;
+	_files ++;
+
+	_writeMeta();
+	LOG << "Closed recording" << _base << ":" << (qint64)_fileSamples << "samples";
+	}
+
+/******************************************************************************\
+|* Writer: stage data, writing out whole pages as they fill
+\******************************************************************************/
+bool IQRecorder::_write(const uint8_t *data, size_t bytes)
+	{
+	_fileBytes += bytes;
+	while (bytes > 0)
+		{
+		size_t count = std::min<size_t>(bytes, SLOT_BYTES + PAGE_BYTES - _staged);
+		::memcpy(_stage + _staged, data, count);
+		_staged	+= count;
+		data	+= count;
+		bytes	-= count;
+
+		if (!_flushStage(false))
+			return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Writer: write out the staging buffer. With O_DIRECT only whole pages can be
+|* written, so any part-page is kept for next time unless this is the end of
+|* the file, in which case O_DIRECT is turned off to write it
+\******************************************************************************/
+bool IQRecorder::_flushStage(bool all)
+	{
+	size_t whole = _staged;
+	if (_isDirect && !all)
+		whole &= ~(size_t)(PAGE_BYTES - 1);
+	else if (_isDirect && ((whole % PAGE_BYTES) != 0))
+		{
+		::fcntl(_fd, F_SETFL, ::fcntl(_fd, F_GETFL) & ~O_DIRECT);
+		_isDirect = false;
+		}
+
+	size_t done = 0;
+	while (done < whole)
+		{
+		ssize_t rc = ::write(_fd, _stage + done, whole - done);
+		if (rc < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			ERR << "Cannot write recording" << _base << ":" << ::strerror(errno);
+			return false;
+			}
+		done += (size_t)rc;
+		}
+
+	_staged -= whole;
+	::memmove(_stage, _stage + whole, _staged);
+	return true;
+	}
+
+/******************************************************************************\
+|* Writer: (re)write the SigMF metadata for the current file
+\******************************************************************************/
+void IQRecorder::_writeMeta(void)
+	{
+	QJsonObject global({{SIGMF_DATATYPE, _datatype()},
+						{SIGMF_RATE, _sampleRate},
+						{SIGMF_CORE_VERSION, SIGMF_VERSION},
+						{SIGMF_CHANNELS, 1},
+						{SIGMF_RECORDER, APP_NAME " " APP_VERSION}});
+
+	QJsonObject meta({{SIGMF_GLOBAL, global},
+					  {SIGMF_CAPTURES, _captures},
+					  {SIGMF_ANNOTATIONS, QJsonArray()}});
+
+	QFile file(_base + "." + SIGMF_META);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		{
+		ERR << "Cannot write SigMF metadata" << file.fileName();
+		return;
+		}
+	file.write(QJsonDocument(meta).toJson());
+	}
+
+/******************************************************************************\
+|* The writer loop: write slots out until stopped and drained
+\******************************************************************************/
+void IQRecorder::run(void)
+	{
+	size_t sampleBytes = SampleSource::bytesFor(_format);
+
+	while (_isActive || (_ring->occupancy() > 0))
+		{
+		SampleRing::Slot *slot = _ring->wait(WAIT_MS);
+		if (slot == nullptr)
+			continue;
+
+		size_t bytes = slot->samples * sampleBytes;
+		if (!_failed)
+			{
+			/******************************************************************\
+			|* Rotate on size or age
+			\******************************************************************/
+			if ((_fd >= 0) && (_fileBytes > 0))
+				if (((_rotateBytes > 0) && (_fileBytes + (int64_t)bytes > _rotateBytes))
+				 || ((_rotateSecs > 0)
+					&& (_opened.secsTo(QDateTime::currentDateTimeUtc()) >= _rotateSecs)))
+					_close();
+
+			/******************************************************************\
+			|* Start a new file, or a new capture segment after a gap
+			\******************************************************************/
+			if (_fd < 0)
+				_failed = !_open(slot->first);
+			else if (slot->first != _expected)
+				_captures.append(QJsonObject({{SIGMF_START, (qint64)_fileSamples},
+											  {SIGMF_INDEX, (qint64)slot->first},
+											  {SIGMF_FREQUENCY, _frequency},
+											  {SIGMF_DATETIME, QDateTime::currentDateTimeUtc()
+														.toString(Qt::ISODateWithMs)}}));
+
+			if (!_failed)
+				_failed = !_write(slot->buffer.data(), bytes);
+
+			_fileSamples   += slot->samples;
+			_expected		= slot->first + slot->samples;
+			if (_failed)
+				ERR << "Recording stopped";
+			}
+		else
+			_dropped.fetch_add(slot->samples, std::memory_order_relaxed);
+
+		_ring->release();
+		}
+
+	_close();
+	}
@@ -0,0 +1,136 @@
+#ifndef IQRECORDER_H
+#define IQRECORDER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QString>
+#include <QThread>
+
+#include "properties.h"
+#include "samplesource.h"
+
+QT_FORWARD_DECLARE_CLASS(SampleRing)
+
+/******************************************************************************\
+|* Record the raw IQ the processor is given, in the source's own format, to a
+|* series of SigMF recordings (.sigmf-data plus .sigmf-meta). SigMF has no
+|* packed 12-bit type, so CS12 sources can't be recorded.
+|*
+|* The processor calls record() on the ingest thread. That copies the samples
+|* into the current slot of a SampleRing, and once a slot is full publishes
+|* it to the writer thread. If the writer has fallen behind and the ring is
+|* full, the slot is dropped and counted, so record() never waits on the disk.
+|*
+|* The writer copies each slot into a page-aligned staging buffer and writes
+|* whole pages with O_DIRECT, keeping the page cache out of the way of a
+|* long recording. Filesystems that don't support O_DIRECT get buffered
+|* writes. Files rotate once they reach a size or an age, always on a slot
+|* boundary. Where slots were dropped, the metadata gets a new capture
+|* segment whose core:global_index says where in the stream it resumes.
+\******************************************************************************/
+class IQRecorder : public QThread
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			SLOT_BYTES		= 4 << 20,	// Hand over to the writer in 4 MiB
+			NUM_SLOTS		= 8,		// How far the writer may fall behind
+			PAGE_BYTES		= 4096		// O_DIRECT alignment
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(QString, directory);			// Where the recordings go
+	GET(double, sampleRate);			// For the metadata
+	GET(double, frequency);				// For the metadata
+	GET(SampleSource::Format, format);	// Of the samples recorded
+	GET(int64_t, rotateBytes);			// Start a new file after this many
+	GET(int, rotateSecs);				// ... or this long (0=never)
+	GET(bool, isValid);					// Buffers allocated, directory ok
+
+	private:
+		/**********************************************************************\
+		|* Private variables - ingest side
+		\**********************************************************************/
+		SampleRing *		_ring;		// Ingest -> writer slots
+		uint8_t *			_slot;		// The slot being filled, or nullptr
+		size_t				_fill;		// Bytes in the current slot
+		int					_pending;	// Samples in the current slot
+		int64_t				_next;		// Stream index record() expects, or -1
+		std::atomic<int64_t> _dropped;	// Samples dropped, disk too slow
+
+		/**********************************************************************\
+		|* Private variables - writer side
+		\**********************************************************************/
+		uint8_t *			_stage;		// Page-aligned staging buffer
+		size_t				_staged;	// Bytes waiting in the staging buffer
+		int					_fd;		// Current data file
+		bool				_isDirect;	// File is open with O_DIRECT
+		QString				_base;		// Current file, without extension
+		int64_t				_fileBytes;	// Bytes in the current file
+		int64_t				_fileSamples; // Samples in the current file
+		int64_t				_expected;	// Stream index of the next sample
+		QDateTime			_opened;	// When the current file was started
+		QJsonArray			_captures;	// Capture segments in the file
+		int					_files;		// Files written
+		bool				_failed;	// A write failed, stop recording
+		std::atomic<bool>	_isActive;	// Cleared to stop
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		void _publish(void);
+		bool _open(int64_t first);
+		void _close(void);
+		bool _write(const uint8_t *data, size_t bytes);
+		bool _flushStage(bool all);
+		void _writeMeta(void);
+		const char * _datatype(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit IQRecorder(const QString& directory,
+							double sampleRate,
+							double frequency,
+							SampleSource::Format format,
+							int64_t rotateBytes,
+							int rotateSecs,
+							QObject *parent = nullptr);
+		~IQRecorder(void);
+
+		/**********************************************************************\
+		|* Ingest side: record some samples, the first of which is at 'first'
+		|* in the stream. Only ever called from one thread
+		\**********************************************************************/
+		void record(const uint8_t *data, int samples, int64_t first);
+
+		/**********************************************************************\
+		|* Stop: hand over what's been recorded so far, let the writer finish
+		|* with it, and close the file. Call once nothing is calling record()
+		\**********************************************************************/
+		void stop(void);
+
+		/**********************************************************************\
+		|* Return the number of samples dropped because the disk was too slow
+		\**********************************************************************/
+		int64_t dropped(void);
+
+	protected:
+		/**********************************************************************\
+		|* The writer loop
+		\**********************************************************************/
+		void run(void) override;
+	};
+
+#endif // IQRECORDER_H
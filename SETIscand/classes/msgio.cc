@@ -10,8 +10,15 @@
 \******************************************************************************/
 Q_LOGGING_CATEGORY(log_net, "seti.net   ")
 
-#define LOG qDebug(log_net) << QTime::currentTime().toString("hh:mm:ss.zzz")
-#define ERR qCritical(log_net) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define LOG  qDebug(log_net) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_net) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_net) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* A client may have at most 1/NETWORK_SHARE of the memory budget queued up
+|* in its socket before we stop sending to it
+\******************************************************************************/
+#define NETWORK_SHARE		(8)
 
 /******************************************************************************\
 |* Helper function: Create an identifier for a connection
@@ -25,7 +32,9 @@ static QString getIdentifier(QWebSocket *peer)
 /******************************************************************************\
 |* Constructor
 \******************************************************************************/
-MsgIO::MsgIO(QObject *parent) : QObject(parent)
+MsgIO::MsgIO(QObject *parent)
+	  :QObject(parent)
+	  ,_dropped(0)
 	{}
 
 /******************************************************************************\
@@ -108,37 +117,66 @@ void MsgIO::socketDisconnected(void)
 	}
 
 /******************************************************************************\
-|* We have new smoothed data, send it off to all the clients
+|* We have new smoothed data, send it off to all the clients. The header goes
+|* in the room before the data in the aggregator's snapshot, and the message
+|* is sent straight from the block: sendBinaryMessage() copies it into the
+|* socket before it returns, so there's no copy of our own, and the block
+|* can go back to the aggregator as soon as we're done
 \******************************************************************************/
-void MsgIO::newData(FFTAggregator::DataType type, int64_t bufferId)
+void MsgIO::newData(FFTAggregator::DataType type,
+					FFTAggregator::WindowInfo info,
+					BlockRef<double> snapshot)
 	{
-	DataMgr &dmgr	= DataMgr::instance();
-
-	size_t extent	= dmgr.extent(bufferId);
-	uint8_t *src	= dmgr.asUint8(bufferId);
+	static_assert(sizeof(SampleHeader)
+					<= FFTAggregator::SNAPSHOT_HEADER * sizeof(double),
+				  "SampleHeader must fit in the aggregator's snapshot");
 
-	int dstId		= dmgr.blockFor(extent+sizeof(SampleHeader));
-	char *dst		= reinterpret_cast<char *>(dmgr.asUint8(dstId));
+	DataMgr &dmgr	= DataMgr::instance();
 
-	if ((src == nullptr) || (dst == nullptr))
+	if (snapshot.count() <= FFTAggregator::SNAPSHOT_HEADER)
 		{
-		ERR << "Cannot get src(" << src <<") or dst(" << dst <<") in send";
+		ERR << "Cannot send an empty snapshot";
+		return;
 		}
-	else
+
+	size_t extent	= (snapshot.count() - FFTAggregator::SNAPSHOT_HEADER)
+					* sizeof(double);
+	char *data		= reinterpret_cast<char *>(snapshot.data()
+											   + FFTAggregator::SNAPSHOT_HEADER);
+	char *dst		= data - sizeof(SampleHeader);
+
+	SampleHeader hdr;
+	hdr.extent	= (uint32_t)extent;
+	hdr.type	= (uint16_t)type;
+	hdr.frames	= (uint32_t)info.frames;
+	hdr.first	= (uint64_t)info.first;
+	hdr.samples	= (uint64_t)info.samples;
+	hdr.timeNs	= info.timeNs;
+	hdr.band	= (uint32_t)info.band;
+	hdr.decimation = (uint32_t)info.decimation;
+	hdr.offsetHz = info.offsetHz;
+	if (info.flags & FFTAggregator::FLAG_DISCONTINUITY)
+		hdr.flags |= HDR_DISCONTINUITY;
+	memcpy(dst, &hdr, sizeof(SampleHeader));
+
+	QByteArray msg = QByteArray::fromRawData(dst, (int)(sizeof(SampleHeader) + extent));
+
+	/**************************************************************************\
+	|* A stalled client's socket buffers everything we send it, so with a
+	|* budget set, skip any client that's too far behind
+	\**************************************************************************/
+	qint64 limit = dmgr.budget() / NETWORK_SHARE;
+	for (QWebSocket *client : qAsConst(_clients))
 		{
-		SampleHeader hdr;
-		hdr.extent	= (uint32_t)extent;
-		hdr.type	= (uint16_t)type;
-		memcpy(dst, &hdr, sizeof(SampleHeader));
-		memcpy(dst+sizeof(SampleHeader), src, extent);
-
-		const char * buffer = const_cast<char *>(dst);
-		QByteArray msg(buffer, extent + sizeof(SampleHeader));
-		for (QWebSocket *client : qAsConst(_clients))
-			client->sendBinaryMessage(msg);
-
-		dmgr.release(dstId);
+		if ((limit > 0) && (client->bytesToWrite() > limit))
+			{
+			_dropped ++;
+			if ((_dropped & (_dropped - 1)) == 0)
+				WARN << "Client" << getIdentifier(client)
+					 << "is not keeping up, dropped" << _dropped
+					 << "messages so far";
+			continue;
+			}
+		client->sendBinaryMessage(msg);
 		}
-
-	dmgr.release(bufferId);
 	}
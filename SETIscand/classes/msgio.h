@@ -19,6 +19,21 @@ class MsgIO: public Singleton<MsgIO>, public QObject
 		/**********************************************************************\
 		|* Typedefs and enums
 		\**********************************************************************/
+		enum
+			{
+			HDR_DISCONTINUITY	= 1<<0	// Samples were lost in the window
+			};
+
+		/**********************************************************************\
+		|* Clients find the data at 'offset', so fields are only ever added
+		|* to the end. The data is the window's mean power per bin, in dB,
+		|* as 'extent' bytes of doubles. first/samples describe the window
+		|* in the sample stream, and timeNs is when it started. band is 0
+		|* for the full band, or a sub-band 'offsetHz' from it, decimated;
+		|* first and samples then count the sub-band's own (decimated)
+		|* samples. The header is written into the room the aggregator
+		|* leaves before the data, so it has to fit
+		\**********************************************************************/
 		struct SampleHeader
 			{
 			uint16_t order;
@@ -26,6 +41,13 @@ class MsgIO: public Singleton<MsgIO>, public QObject
 			uint32_t extent;
 			uint16_t type;
 			uint16_t flags;
+			uint32_t frames;
+			uint64_t first;
+			uint64_t samples;
+			int64_t timeNs;
+			uint32_t band;
+			uint32_t decimation;
+			int64_t offsetHz;
 
 			SampleHeader(void)
 				{
@@ -34,6 +56,13 @@ class MsgIO: public Singleton<MsgIO>, public QObject
 				extent	= 0;
 				type	= 0;
 				flags	= 0;
+				frames	= 0;
+				first	= 0;
+				samples	= 0;
+				timeNs	= 0;
+				band	= 0;
+				decimation = 1;
+				offsetHz = 0;
 				}
 			};
 
@@ -43,6 +72,7 @@ class MsgIO: public Singleton<MsgIO>, public QObject
 		\**********************************************************************/
 		QWebSocketServer *		_server;		// Handle the connection
 		QList<QWebSocket *>		_clients;		// List of connected clients
+		int64_t					_dropped;		// Messages not sent, over budget
 
 
 	private slots:
@@ -70,7 +100,9 @@ class MsgIO: public Singleton<MsgIO>, public QObject
 		/**********************************************************************\
 		|* Receive data ready to send out, from the aggregator
 		\**********************************************************************/
-		void newData(FFTAggregator::DataType type, int64_t bufferId);
+		void newData(FFTAggregator::DataType type,
+					 FFTAggregator::WindowInfo info,
+					 BlockRef<double> snapshot);
 
 	};
 
@@ -1,40 +1,67 @@
+#include <algorithm>
+#include <cmath>
 #include <complex>
 
-#include <QThreadPool>
+#include <QDateTime>
 
+#include "allocwatch.h"
 #include "config.h"
 #include "constants.h"
+#include "converter.h"
 #include "datamgr.h"
+#include "ddc.h"
+#include "dspengine.h"
 #include "fftaggregator.h"
+#include "fftplanner.h"
+#include "iqrecorder.h"
 #include "msgio.h"
 #include "processor.h"
-#include "soapyio.h"
+#include "samplesource.h"
 #include "taskfft.h"
 
 /******************************************************************************\
 |* Categorised logging support
 \******************************************************************************/
-#define LOG qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
-#define ERR qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
 
 /******************************************************************************\
 |* Constructor
 \******************************************************************************/
-Processor::Processor(Config& cfg, QObject *parent)
+Processor::Processor(Config& cfg, QObject *parent, int band)
 		  : QObject(parent)
 		  ,_cfg(cfg)
-		  ,_sio(nullptr)
+		  ,_band(band)
+		  ,_source(nullptr)
 		  ,_fftSize(0)
-		  ,_work(-1)
-		  ,_fftIn(-1)
-		  ,_fftOut(-1)
-		  ,_window(-1)
+		  ,_hop(0)
+		  ,_single(false)
+		  ,_batch(1)
+		  ,_taps(1)
+		  ,_dropped(0)
+		  ,_gaps(0)
+		  ,_nextIndex(-1)
+		  ,_frameFlags(0)
+		  ,_nsPerSample(0)
+		  ,_originNs(-1)
+		  ,_ingest(nullptr)
+		  ,_ingestF(nullptr)
+		  ,_ingestAdd(nullptr)
+		  ,_ingestAddF(nullptr)
+		  ,_fullScale(1)
+		  ,_sampleBytes(0)
+		  ,_nextStart(-1)
+		  ,_sequence(0)
+		  ,_planner(nullptr)
+		  ,_engine(nullptr)
+		  ,_recorder(nullptr)
+		  ,_normalise(nullptr)
 	{
 	/**************************************************************************\
-	|* Use a background thread for data-aggregation
+	|* The aggregator is run by the DSP engine's aggregation thread
 	\**************************************************************************/
 	_aggregator = new FFTAggregator(this);
-	_aggregator->moveToThread(&_bgThread);
 
 	/**************************************************************************\
 	|* Connect up the aggregator to the MsgIO class
@@ -42,11 +69,6 @@ Processor::Processor(Config& cfg, QObject *parent)
 	MsgIO &mio = MsgIO::instance();
 	connect(_aggregator, &FFTAggregator::aggregatedDataReady,
 			&mio, &MsgIO::newData);
-
-	/**************************************************************************\
-	|* Start the background thread
-	\**************************************************************************/
-	_bgThread.start();
 	}
 
 /******************************************************************************\
@@ -54,131 +76,470 @@ Processor::Processor(Config& cfg, QObject *parent)
 \******************************************************************************/
 Processor::~Processor(void)
 	{
-	DataMgr &dmgr	= DataMgr::instance();
-	ERR << "Destroying processor";
-
-	if (_fftIn >= 0)
-		dmgr.release(_fftIn);
-	if (_fftOut >= 0)
-		dmgr.release(_fftOut);
-	if (_work >= 0)
-		dmgr.release(_work);
-	if (_window >= 0)
-		dmgr.release(_window);
+	if (_band == 0)
+		ERR << "Destroying processor";
+
+	/**************************************************************************\
+	|* The planner destroys the plans, so stop the workers running them first
+	\**************************************************************************/
+	delete _engine;
+
+	for (Subband& sub : _subbands)
+		{
+		delete sub.processor;
+		delete sub.ddc;
+		}
 	}
 
 /******************************************************************************\
 |* We got data back
 \******************************************************************************/
-void Processor::dataReceived(int64_t buffer, int samples, int max, int bytes)
+void Processor::dataReceived(BlockRef<uint8_t> buffer,
+							 int samples,
+							 int64_t first,
+							 long long timeNs,
+							 int flags)
 	{
-	DataMgr &dmgr	= DataMgr::instance();
-	int8_t * src8	= dmgr.asInt8(buffer);
-	int16_t *src16	= dmgr.asInt16(buffer);
-	double *work	= dmgr.asDouble(_work);
-	double scale	= 1.0 / (double)max;
+	if ((_ingest == nullptr) && (_ingestF == nullptr))
+		return;
+
+	if (_recorder != nullptr)
+		_recorder->record(buffer.data(), samples, first);
+
+	bool lost	= false;
+	bool fresh	= (_nextIndex < 0);
 
 	/**************************************************************************\
-	|* We expect complex (interleaved I,Q) data since we use the native format
-	|* of the device, so multiply samples by 2
+	|* A frame must not span lost samples, so on a discontinuity drop any
+	|* partial frames (and the batches they're in), start afresh, and flag
+	|* the next batch so its aggregation windows are marked
 	\**************************************************************************/
-	samples *= 2;
+	if ((flags & SampleSource::FLAG_DISCONTINUITY)
+		|| ((_nextIndex >= 0) && (first != _nextIndex)))
+		{
+		_gaps ++;
+		if ((_gaps & (_gaps - 1)) == 0)
+			WARN << "Samples lost before stream index" << (qint64)first
+				 << "-" << _gaps << "discontinuities so far";
+		_frames.clear();
+		_batches.clear();
+		_nextStart	= first;
+		_frameFlags |= SampleSource::FLAG_DISCONTINUITY;
+		lost		= true;
+		}
+	if (_nextStart < 0)
+		_nextStart = first;
+	_nextIndex = first + samples;
 
 	/**************************************************************************\
-	|* Convert the buffer to double values
+	|* Frames are timed from the source's clock if it has one, otherwise from
+	|* when the stream started
 	\**************************************************************************/
-	for (int i=0; i<samples; i++)
-		*work++ = (bytes == 1) ? (*src8++) * scale : (*src16++) * scale;
-	work = dmgr.asDouble(_work);
+	if (flags & SampleSource::FLAG_HAS_TIME)
+		_originNs = timeNs - llround(first * _nsPerSample);
+	else if (_originNs < 0)
+		_originNs = QDateTime::currentMSecsSinceEpoch() * 1000000LL
+				  - llround(first * _nsPerSample);
+	int64_t index		= first;
+	const uint8_t *src	= buffer.data();
+
+	if (!_subbands.empty())
+		_downconvert(src, samples, first, fresh || lost, lost);
 
 	/**************************************************************************\
-	|* There are three cases:
-	|* 1: The number of elems from before + this batch < fftSize
+	|* Convert and window the samples straight into FFT frames, with the
+	|* ingest chosen for the source's format in init(). A frame starts every
+	|* _hop samples, so with overlap a sample goes into several frames, each
+	|* under its own part of the window. Windowed data can't be shared
+	|* between them, so each is filled from the source buffer directly
+	|* rather than copying the overlap across. Frames that aren't full yet
+	|* wait for the next buffer.
+	|*
+	|* With the polyphase filter bank, a frame takes in _taps frames' worth
+	|* of samples under the prototype filter, folded onto the one frame: the
+	|* first _fftSize are written, and each later _fftSize is added on, so
+	|* the frame ends up as the FIR's output for every branch at once
 	\**************************************************************************/
-	if (_previous.size() + samples < _fftSize*2)
-		{
-		for (int i=0; i<samples; i++)
-			_previous.enqueue(work[i]);
-		}
-	else
+	while (samples > 0)
 		{
-		while (samples > _fftSize*2)
+		if (index == _nextStart)
 			{
-			TaskFFT *task = nullptr;
-
-			/******************************************************************\
-			|* 2: There are entries left over from the last run
-			\******************************************************************/
-			if (_previous.size() > 0)
-				{
-				task = new TaskFFT(_previous.data(),
-								   _previous.size(),
-								   work,
-								   _fftSize * 2 - _previous.size());
-
-				samples -= _previous.size();
-				work += _fftSize * 2 - _previous.size();
-				_previous.clear();
-				}
-			else
-				{
-				/**************************************************************\
-				|* 3: We just have to iterate through the passed-in data
-				\**************************************************************/
-				task = new TaskFFT(work, _fftSize*2);
-
-				work += _fftSize*2;
-				samples -= _fftSize*2;
-				}
+			_nextStart += _hop;
+			_openFrame(index);
+			}
 
-			connect(task, &TaskFFT::fftDone,
-					_aggregator, &FFTAggregator::fftReady);
+		/**********************************************************************\
+		|* Fill the open frames up to the next frame start, or until one of
+		|* them is full
+		\**********************************************************************/
+		int count = (int) std::min<int64_t>(samples, _nextStart - index);
+		for (Frame& frame : _frames)
+			count = std::min(count, _fftSize - frame.fill % _fftSize);
 
-			task->setPlan(_fftPlan);
-			task->setWindow(_window);
-			QThreadPool::globalInstance()->start(task);
+		for (Frame& frame : _frames)
+			{
+			AllocWatch::Scope pipeline;
+			int at		= frame.fill % _fftSize;
+			bool add	= frame.fill >= _fftSize;
+			if (_single)
+				(add ? _ingestAddF : _ingestF)(src,
+											   frame.dataF + 2 * at,
+											   count,
+											   _fullScale,
+											   _windowF.data() + 2 * frame.fill);
+			else
+				(add ? _ingestAdd : _ingest)(src,
+											 frame.data + 2 * at,
+											 count,
+											 _fullScale,
+											 _window.data() + 2 * frame.fill);
+			frame.fill += count;
+			}
+		src		+= count * _sampleBytes;
+		samples	-= count;
+		index	+= count;
 
+		/**********************************************************************\
+		|* The oldest frame fills first, and it's in the oldest batch. Hand
+		|* that to the DSP engine once all its frames are full
+		\**********************************************************************/
+		if (!_frames.empty() && (_frames.front().fill == _fftSize * _taps))
+			{
+			_frames.erase(_frames.begin());
+			if (++ _batches.front().filled == _batch)
+				_dispatch();
 			}
+		}
+	}
+
+/******************************************************************************\
+|* Start a frame. Frames go into the newest batch until it has _batch of
+|* them, each _hop after the last
+\******************************************************************************/
+void Processor::_openFrame(int64_t index)
+	{
+	if (_batches.empty() || (_batches.back().opened == _batch))
+		{
+		Batch batch = {BlockRef<fftw_complex>(),
+					   BlockRef<fftwf_complex>(),
+					   index,
+					   0,
+					   0};
+		if (_single)
+			batch.dataF = DataMgr::instance().fftfRefFor(_fftSize * _batch,
+														 DataBlock::TAG_FFT);
+		else
+			batch.data	= DataMgr::instance().fftRefFor(_fftSize * _batch,
+														DataBlock::TAG_FFT);
 
 		/**********************************************************************\
-		|* If any samples are left over, enqueue them for the next pass
+		|* If the memory budget has been reached, drop the frame rather than
+		|* queue more work behind whatever is stalled, and flag the next batch
+		|* queued, so the aggregation windows still show the gap
 		\**********************************************************************/
-		if (samples > 0)
+		if (!batch.data.isValid() && !batch.dataF.isValid())
 			{
-			for (int i=0; i<samples; i++)
-				_previous.enqueue(*work ++);
+			_frameFlags |= SampleSource::FLAG_DISCONTINUITY;
+			_drop(1);
+			return;
 			}
+		_batches.push_back(batch);
 		}
+
+	Batch& batch	= _batches.back();
+	size_t offset	= (size_t)_fftSize * batch.opened ++;
+	Frame frame		= {nullptr, nullptr, 0};
+	if (_single)
+		frame.dataF	= reinterpret_cast<float *>(batch.dataF.data() + offset);
+	else
+		frame.data	= reinterpret_cast<double *>(batch.data.data() + offset);
+	_frames.push_back(frame);
 	}
 
+/******************************************************************************\
+|* Hand the oldest batch to the DSP engine for the FFTs
+\******************************************************************************/
+void Processor::_dispatch(void)
+	{
+	Batch& batch	= _batches.front();
+	bool inPlace	= _planner->inPlace();
+	TaskFFT task	= _single ? TaskFFT(batch.dataF, _fftSize, _batch, inPlace)
+							  : TaskFFT(batch.data, _fftSize, _batch, inPlace);
+	int64_t start	= batch.first;
+	_batches.erase(_batches.begin());
+
+	if (!task.isValid())
+		{
+		_frameFlags |= SampleSource::FLAG_DISCONTINUITY;
+		_drop(_batch);
+		return;
+		}
+
+	fftw_plan plan		= _planner->plan();
+	fftwf_plan planF	= _planner->planF();
+	task.setPlan(plan);
+	task.setPlanF(planF);
+	task.setSequence(_sequence);
+	task.setFirst(start);
+	task.setTimeNs(_originNs + llround(start * _nsPerSample));
+	task.setFlags(_frameFlags);
 
+	/**************************************************************************\
+	|* If the workers are that far behind, drop the batch. Its flags go with
+	|* the next one, so the aggregation windows still show the gap. Only
+	|* batches that are queued are numbered, so the engine doesn't wait for
+	|* the ones that weren't
+	\**************************************************************************/
+	if (!_engine->submit(std::move(task)))
+		{
+		_frameFlags |= SampleSource::FLAG_DISCONTINUITY;
+		_drop(_batch);
+		return;
+		}
+	_sequence  += _batch;
+	_frameFlags = 0;
+	}
 
+/******************************************************************************\
+|* Count dropped frames, and say so each time the count passes a power of two
+\******************************************************************************/
+void Processor::_drop(int frames)
+	{
+	int64_t was	= _dropped;
+	_dropped   += frames;
+	if ((was == 0) || (__builtin_clzll(was) != __builtin_clzll(_dropped)))
+		WARN << "Over memory budget or DSP workers behind, dropped"
+			 << _dropped << "FFT frames so far";
+	}
 
 /******************************************************************************\
 |* Initialise
 \******************************************************************************/
-void Processor::init(SoapyIO *sio)
+void Processor::init(SampleSource *source)
 	{
-	_sio		= sio;
-	_fftSize	= _cfg.fftSize();
+	_source			= source;
+	_fftSize		= _cfg.fftSize();
+	_hop			= _cfg.fftHop();
+	_single			= _cfg.fftSinglePrecision();
+	_batch			= _cfg.fftBatch();
+	if (_batch <= 0)
+		_batch		= TaskFFT::batchFor(_fftSize, _hop, source->streamRate());
+	_taps			= (_cfg.fftWindowType() == Config::W_PFB)
+					? _cfg.fftPfbTaps()
+					: 1;
+	_nsPerSample	= 1e9 / source->streamRate();
+
+	/**************************************************************************\
+	|* Pick the conversion for the source's sample format and the pipeline's
+	|* precision, once
+	\**************************************************************************/
+	Converter& conv	= Converter::instance();
+	_ingest			= _single ? nullptr : conv.ingest(source->sampleFormat());
+	_ingestF		= _single ? conv.ingestFloat(source->sampleFormat()) : nullptr;
+	_ingestAdd		= _single ? nullptr : conv.ingestAdd(source->sampleFormat());
+	_ingestAddF		= _single ? conv.ingestFloatAdd(source->sampleFormat()) : nullptr;
+	_fullScale		= source->fullScale();
+	_sampleBytes	= source->sampleBytes();
+	if ((_ingest == nullptr) && (_ingestF == nullptr))
+		ERR << "Unsupported sample format, no data will be processed";
+	_aggregator->setSampleRate(source->streamRate());
 	_allocate();
 
 	/**************************************************************************\
-	|* Create the FFT plan. We won't actually use these buffers, but we can
-	|* substitute others as long as they are compatible, so allocate these
-	|* in exactly the same way as the ones we will use.
+	|* Create the FFT plan, from wisdom if we have it. If not, we start with
+	|* a quick estimate and the planner swaps in a better plan when it has
+	|* found one, so data flows straight away. The search for it holds the
+	|* planner lock, so it waits until the sub-bands have planned too.
+	|*
+	|* Very large FFTs come too slowly to keep more than one worker busy,
+	|* so unless told otherwise, all the DSP cores work on each one together.
+	|* A sub-band's FFTs are never that large for its rate
+	\**************************************************************************/
+	int cores		= DSPEngine::coresFor(_cfg.dspThreads());
+	int threads		= _cfg.fftThreads();
+	if (threads <= 0)
+		threads		= (_fftSize >= FFTPlanner::LARGE_FFT) ? cores : 1;
+	if (_band > 0)
+		threads		= 1;
+
+	_planner = new FFTPlanner(_fftSize,
+							  _batch,
+							  _single,
+							  threads,
+							  _cfg.fftWisdomDir(),
+							  this);
+	if (!_planner->init())
+		{
+		_ingest		= nullptr;
+		_ingestF	= nullptr;
+		}
+	LOG << "FFT planned in" << (_single ? "single" : "double")
+		<< "precision, for" << _batch << "frames per task on"
+		<< _planner->threads() << (_planner->threads() == 1 ? "thread" : "threads");
+	if (_taps > 1)
+		LOG << "Channelising with a polyphase filter bank of" << _taps
+			<< "taps per branch";
+
+	/**************************************************************************\
+	|* Start the workers that run the FFTs and the aggregation, sharing the
+	|* cores between them. A sub-band has a fraction of the full band's
+	|* samples, so one unpinned worker keeps up with it, and leaves the
+	|* pinned CPUs to the full band
 	\**************************************************************************/
-	DataMgr &dmgr		= DataMgr::instance();
-	fftw_complex *in	= dmgr.asFFT(_fftIn);
-	fftw_complex *out	= dmgr.asFFT(_fftOut);
-	_fftPlan			= fftw_plan_dft_1d(_fftSize,
-										   in,
-										   out,
-										   FFTW_FORWARD,
-										   FFTW_PATIENT);
-	LOG << "FFT plan created";
+	int skew	= _cfg.fftMaxSkew();
+	int workers	= std::max(1, cores / _planner->threads());
+	_engine		= new DSPEngine(_aggregator,
+								(_band == 0) ? workers : 1,
+								(_band == 0) ? _cfg.dspCpus() : QList<int>(),
+								(skew + _batch - 1) / _batch,
+								DSPEngine::DEFAULT_DEPTH,
+								_planner->threads());
+	_engine->start();
 
 	_populateWindowData();
+
+	if (_band > 0)
+		{
+		Config::Subband sub = _cfg.subbands().at(_band - 1);
+		_aggregator->setBand(_band, sub.decimation, llround(sub.offsetHz));
+		return;
+		}
+	_initSubbands(source);
+	_searchPlans();
+
+	/**************************************************************************\
+	|* Tap the raw samples off to disk if asked to
+	\**************************************************************************/
+	if (!_cfg.recordDir().isEmpty())
+		{
+		_recorder = new IQRecorder(_cfg.recordDir(),
+								   source->streamRate(),
+								   _cfg.centerFrequency(),
+								   source->sampleFormat(),
+								   (int64_t)_cfg.recordRotateSize() << 20,
+								   _cfg.recordRotateTime(),
+								   this);
+		if (_recorder->isValid())
+			_recorder->start(QThread::LowPriority);
+		}
+	}
+
+/******************************************************************************\
+|* Wait for the DSP engine to catch up
+\******************************************************************************/
+void Processor::drain(void)
+	{
+	if (_engine != nullptr)
+		_engine->drain();
+
+	for (Subband& sub : _subbands)
+		sub.processor->drain();
+	}
+
+/******************************************************************************\
+|* Set up a down-converter and a processor for each sub-band asked for. The
+|* down-converters take CF32, so the full band is normalised once for all
+|* of them
+\******************************************************************************/
+void Processor::_initSubbands(SampleSource *source)
+	{
+	QList<Config::Subband> bands = _cfg.subbands();
+	if (bands.isEmpty())
+		return;
+
+	_normalise	= Converter::instance().normalise(source->sampleFormat());
+	_normalised	= DataMgr::instance().refFor<float>(2 * source->streamMTU(),
+													DataBlock::TAG_INGEST);
+	if ((_normalise == nullptr) || !_normalised.isValid())
+		{
+		ERR << "Cannot down-convert this source, ignoring the sub-bands";
+		return;
+		}
+
+	_subbands.reserve(bands.size());
+	for (int i=0; i<bands.size(); i++)
+		{
+		DDC *ddc = new DDC(source->streamRate(),
+						   bands[i].offsetHz,
+						   bands[i].decimation,
+						   source->streamMTU());
+		BlockRef<uint8_t> out;
+		if (ddc->isValid())
+			out = DataMgr::instance().refFor<uint8_t>(ddc->streamMTU()
+													  * ddc->sampleBytes(),
+													  DataBlock::TAG_INGEST);
+		if (!out.isValid())
+			{
+			WARN << "Sub-band" << i + 1 << "cannot be set up, ignoring it";
+			delete ddc;
+			continue;
+			}
+
+		Processor *child = new Processor(_cfg, this, i + 1);
+		child->init(ddc);
+		_subbands.push_back({ddc, child, out});
+		}
+	}
+
+/******************************************************************************\
+|* Start looking for better plans where only estimates could be made
+\******************************************************************************/
+void Processor::_searchPlans(void)
+	{
+	if (_planner != nullptr)
+		_planner->search();
+
+	for (Subband& sub : _subbands)
+		sub.processor->_searchPlans();
+	}
+
+/******************************************************************************\
+|* Down-convert a buffer of the full band into each of the sub-bands, and
+|* pass what comes out to their processors. A sub-band's samples are timed
+|* from the full band's clock, at the input sample they were decimated from,
+|* so all the bands agree on time; the filters' delay isn't taken off
+\******************************************************************************/
+void Processor::_downconvert(const uint8_t *src,
+							 int samples,
+							 int64_t first,
+							 bool restart,
+							 bool lost)
+	{
+	if (restart)
+		for (Subband& sub : _subbands)
+			sub.ddc->reset(first);
+
+	int most = _subbands.front().ddc->maxInput();
+	while (samples > 0)
+		{
+		int count = std::min(samples, most);
+			{
+			AllocWatch::Scope pipeline;
+			_normalise(src, _normalised.data(), count, _fullScale);
+			}
+
+		for (Subband& sub : _subbands)
+			{
+			int64_t index	= sub.ddc->position();
+			int made		= sub.ddc->process(_normalised.data(),
+											   count,
+											   reinterpret_cast<float *>
+												   (sub.out.data()));
+			if (made == 0)
+				continue;
+
+			long long timeNs = _originNs
+							 + llround(index * sub.ddc->decimation() * _nsPerSample);
+			sub.processor->dataReceived(sub.out,
+										made,
+										index,
+										timeNs,
+										SampleSource::FLAG_HAS_TIME
+										| (lost ? SampleSource::FLAG_DISCONTINUITY : 0));
+			}
+		src		+= count * _sampleBytes;
+		samples	-= count;
+		}
 	}
 
 /******************************************************************************\
@@ -188,21 +549,17 @@ void Processor::_allocate(void)
 	{
 	DataMgr &dmgr = DataMgr::instance();
 
-	if (_work >= 0)
-		dmgr.release(_work);
-	_work	= dmgr.blockFor(Config::instance().sampleRate(), sizeof(double));
-
-	if (_fftIn >= 0)
-		dmgr.release(_fftIn);
-	_fftIn	= dmgr.fftBlockFor(_fftSize);
-
-	if (_fftOut >= 0)
-		dmgr.release(_fftOut);
-	_fftOut	= dmgr.fftBlockFor(_fftSize);
+	int span		= _fftSize * _taps;
+	if (_single)
+		_windowF	= dmgr.refFor<float>(2 * span, DataBlock::TAG_FFT);
+	_window			= dmgr.refFor<double>(2 * span, DataBlock::TAG_FFT);
 
-	if (_window >= 0)
-		dmgr.release(_window);
-	_window	= dmgr.blockFor(_fftSize, sizeof(double));
+	/**************************************************************************\
+	|* Room for every frame (and so batch) that can be open at once, so
+	|* opening one never allocates
+	\**************************************************************************/
+	_frames.reserve((span + _hop - 1) / _hop + 1);
+	_batches.reserve((span + _hop - 1) / _hop + 1);
 	}
 
 
@@ -211,8 +568,8 @@ void Processor::_allocate(void)
 \******************************************************************************/
 void Processor::_populateWindowData(void)
 	{
-	DataMgr &dmgr		= DataMgr::instance();
-	double *win			= dmgr.asDouble(_window);
+	double *win			= _window.data();
+	int span			= _fftSize * _taps;
 
 	switch (Config::instance().fftWindowType())
 		{
@@ -257,5 +614,35 @@ void Processor::_populateWindowData(void)
 				win[i] = 1 - fabs (range / sizep1);
 				}
 			break;
+
+		/**********************************************************************\
+		|* The filter bank's prototype low-pass filter: a sinc one bin wide,
+		|* over _taps frames, tapered by a Hamming window of the same span
+		\**********************************************************************/
+		case Config::W_PFB:
+			for (int i=0; i<span; i++)
+				{
+				double x	= (i - span / 2.0) / _fftSize;
+				double sinc	= (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+				win[i]		= sinc * (0.54 - 0.46 * cos (2 * M_PI * i / span));
+				}
+			break;
 		}
+
+	/**************************************************************************\
+	|* The ingest windows interleaved I,Q components, so give each its own
+	|* copy of the window, working backwards so we don't overwrite it
+	\**************************************************************************/
+	for (int i=span-1; i>=0; i--)
+		{
+		win[2*i+1]	= win[i];
+		win[2*i]	= win[i];
+		}
+
+	/**************************************************************************\
+	|* The single-precision pipeline uses a float copy of the window
+	\**************************************************************************/
+	if (_single)
+		for (int i=0; i<2*span; i++)
+			_windowF.data()[i] = (float)win[i];
 	}
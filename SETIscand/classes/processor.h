@@ -1,63 +1,179 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
+#include <vector>
+
 #include <QObject>
 #include <QThread>
-#include <QQueue>
 #include <fftw3.h>
+
+#include "blockref.h"
+#include "converter.h"
 #include "properties.h"
 
 QT_FORWARD_DECLARE_CLASS(Config)
+QT_FORWARD_DECLARE_CLASS(DDC)
+QT_FORWARD_DECLARE_CLASS(DSPEngine)
 QT_FORWARD_DECLARE_CLASS(FFTAggregator)
-QT_FORWARD_DECLARE_CLASS(SoapyIO)
+QT_FORWARD_DECLARE_CLASS(FFTPlanner)
+QT_FORWARD_DECLARE_CLASS(IQRecorder)
+QT_FORWARD_DECLARE_CLASS(SampleSource)
 
 class Processor : public QObject
 	{
 	Q_OBJECT
 
 	private:
+		/**********************************************************************\
+		|* A batch of frames for one FFT task, contiguous in one block. Only
+		|* the data of the pipeline's precision is used
+		\**********************************************************************/
+		typedef struct
+			{
+			BlockRef<fftw_complex> data;	// Pooled FFT input
+			BlockRef<fftwf_complex> dataF;	// ... in single precision
+			int64_t		first;				// Stream index of its first frame
+			int			opened;				// Frames started in it so far
+			int			filled;				// Frames completed in it so far
+			} Batch;
+
+		/**********************************************************************\
+		|* A frame being filled, in its batch. With overlap, several are open
+		|* at once
+		\**********************************************************************/
+		typedef struct
+			{
+			double *	data;				// Where it is in its batch
+			float *		dataF;				// ... in single precision
+			int			fill;				// Samples in it so far, up to
+											// _fftSize * _taps
+			} Frame;
+
+		/**********************************************************************\
+		|* A sub-band: its down-converter, and the processor that frames,
+		|* FFTs and aggregates what comes out of it
+		\**********************************************************************/
+		typedef struct
+			{
+			DDC *		ddc;				// Full band in, sub-band out
+			Processor *	processor;			// ... which goes on to this
+			BlockRef<uint8_t> out;			// Its samples, as CF32
+			} Subband;
+
 		/**********************************************************************\
 		|* Private variables
 		\**********************************************************************/
 		Config&			_cfg;			// Configuration
-		SoapyIO *		_sio;			// IO object
+		int				_band;			// 0 for the full band
+		SampleSource *	_source;		// Where the samples come from
 		int				_fftSize;		// Size of the FFT
+		int				_hop;			// Samples between frame starts
+		bool			_single;		// Single-precision pipeline
+		int				_batch;			// Frames per FFT task
+		int				_taps;			// Filter bank taps, 1 if windowed
+		int64_t			_dropped;		// Frames dropped over budget
+		int64_t			_gaps;			// Discontinuities in the stream
+		int64_t			_nextIndex;		// Stream index we expect next
+		int				_frameFlags;	// Flags for the next frame out
+		double			_nsPerSample;	// At the source's sample rate
+		qint64			_originNs;		// Time of stream index 0
+		Converter::Ingest _ingest;		// Conversion for the sample format
+		Converter::IngestFloat _ingestF; // ... to single precision
+		Converter::Ingest _ingestAdd;	// ... adding on, for the filter bank
+		Converter::IngestFloat _ingestAddF; // ... to single precision
+		double			_fullScale;		// Of the source's samples
+		int				_sampleBytes;	// Bytes per complex sample
 
-		int64_t			_work;			// Working buffer
-		QQueue<double>	_previous;		// Data left over from last pass
+		std::vector<Batch> _batches;	// Batches being filled, oldest first
+		std::vector<Frame> _frames;		// Frames being filled, oldest first
+		int64_t			_nextStart;		// Stream index of the next frame
+		int64_t			_sequence;		// Number of the next frame queued
 
-		fftw_plan		_fftPlan;		// Plan for the FFT
-		int64_t			_fftIn;			// FFTW buffer used during planning
-		int64_t			_fftOut;		// FFTW buffer used during planning
-		int64_t			_window;		// Buffer holding the windowing data
+		FFTPlanner *	_planner;		// Plans for the FFT
+		BlockRef<double> _window;		// Window or filter, per component
+		BlockRef<float> _windowF;		// ... in single precision
 
-		QThread			_bgThread;		// Background aggregation thread
+		DSPEngine *		_engine;		// FFT and aggregation threads
 		FFTAggregator *	_aggregator;	// Collect data and send it off
+		IQRecorder *	_recorder;		// Raw IQ tap, if recording
+
+		Converter::Normalise _normalise; // To CF32, for the sub-bands
+		BlockRef<float>	_normalised;	// ... into here
+		std::vector<Subband> _subbands;	// Sub-bands zoomed in on
 
 		/**********************************************************************\
 		|* Private method: allocate the RAM buffers we need
 		\**********************************************************************/
 		void _allocate(void);
 
+		/**********************************************************************\
+		|* Private method: start a frame at a stream index, in the newest
+		|* batch or a new one
+		\**********************************************************************/
+		void _openFrame(int64_t index);
+
+		/**********************************************************************\
+		|* Private method: hand the oldest batch to the DSP engine
+		\**********************************************************************/
+		void _dispatch(void);
+
+		/**********************************************************************\
+		|* Private method: count frames dropped over the memory budget, or
+		|* with the DSP workers too far behind
+		\**********************************************************************/
+		void _drop(int frames);
+
 		/**********************************************************************\
 		|* Private method: Populate the windowing data
 		\**********************************************************************/
 		void _populateWindowData(void);
 
+		/**********************************************************************\
+		|* Private method: set up the sub-bands asked for, and pass them a
+		|* buffer of samples, starting them afresh at 'first' if restarting
+		\**********************************************************************/
+		void _initSubbands(SampleSource *source);
+		void _downconvert(const uint8_t *src,
+						  int samples,
+						  int64_t first,
+						  bool restart,
+						  bool lost);
+
+		/**********************************************************************\
+		|* Private method: start the background plan searches, for this band
+		|* and its sub-bands, once all their first plans have been made
+		\**********************************************************************/
+		void _searchPlans(void);
+
 	public:
 		/**********************************************************************\
-		|* Constructor
+		|* Constructor. Band 0 is the full band, from the radio; sub-bands
+		|* are numbered from 1, and are made by the full band's processor
 		\**********************************************************************/
-		explicit Processor(Config& cfg, QObject *parent = nullptr);
+		explicit Processor(Config& cfg, QObject *parent = nullptr, int band = 0);
 		~Processor(void);
 
 		/**********************************************************************\
 		|* Initialise with the data-stream params
 		\**********************************************************************/
-		void init(SoapyIO *sio);
+		void init(SampleSource *source);
+
+		/**********************************************************************\
+		|* Wait until every batch handed to the DSP engine has been aggregated
+		\**********************************************************************/
+		void drain(void);
 
 	public slots:
-		void dataReceived(int64_t handle, int samples, int max, int bytes);
+		/**********************************************************************\
+		|* Process a buffer of samples, in the source's native format. Called
+		|* on the RingConsumer thread. 'first' is the stream index of the
+		|* first sample, and timeNs and flags are as the source published them
+		\**********************************************************************/
+		void dataReceived(BlockRef<uint8_t> buffer,
+						  int samples,
+						  int64_t first,
+						  long long timeNs,
+						  int flags);
 
 	};
 
@@ -0,0 +1,216 @@
+#ifndef REORDERBUFFER_H
+#define REORDERBUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Puts items that carry frame sequence numbers back in order, for a single
+|* consumer. Each item is a run of frames: sequence() is the number of its
+|* first frame and frames() how many it holds, the same for every item, so
+|* the next item in order starts at sequence() + frames().
+|*
+|* An item that arrives early waits in a slot until the ones before it turn
+|* up. There are only so many slots, which bounds the skew: if an item is so
+|* far ahead that it won't fit, the buffer gives up on the oldest missing
+|* item, counts its frames as skipped, and moves on. An item that turns up
+|* after the buffer has moved past it is counted as late and let go. An item
+|* that is known never to be coming can be skipped, so nothing waits for it.
+|* Nothing is allocated after construction.
+\******************************************************************************/
+template <typename T>
+class ReorderBuffer
+	{
+	NON_COPYABLE_NOR_MOVEABLE(ReorderBuffer);
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(int64_t, next);					// Sequence expected next
+	GET(int64_t, late);					// Frames that arrived too late
+	GET(int64_t, skipped);				// Frames given up on
+	GET(int64_t, held);					// Items that had to wait
+	GET(int, pending);					// Items waiting now
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		std::vector<T>			_slots;		// Items waiting, by sequence
+		std::vector<int64_t>	_seqs;		// Their sequences, -1 if empty
+		std::vector<char>		_gone;		// Never coming, just skip it
+		int64_t					_step;		// Frames per item
+
+		/**********************************************************************\
+		|* Private method: the slot an item waits in
+		\**********************************************************************/
+		inline size_t _slot(int64_t seq) const
+			{
+			return (size_t)((seq / _step) % (int64_t)_slots.size());
+			}
+
+		/**********************************************************************\
+		|* Private method: hand on the items that are next in order
+		\**********************************************************************/
+		template <typename F>
+		void _release(F& deliver)
+			{
+			for (;;)
+				{
+				size_t slot = _slot(_next);
+				if (_seqs[slot] != _next)
+					return;
+
+				_seqs[slot]		= -1;
+				_pending --;
+				_next		   += _step;
+				if (_gone[slot])
+					{
+					_gone[slot]	= 0;
+					_skipped   += _step;
+					continue;
+					}
+
+				T item			= std::move(_slots[slot]);
+				deliver(item);
+				}
+			}
+
+		/**********************************************************************\
+		|* Private method: stop waiting for the next item, handing it on if
+		|* it's here and counting it as skipped if not
+		\**********************************************************************/
+		template <typename F>
+		void _advance(F& deliver)
+			{
+			size_t slot = _slot(_next);
+			if (_seqs[slot] == _next)
+				_release(deliver);
+			else
+				{
+				_skipped   += _step;
+				_next	   += _step;
+				_release(deliver);
+				}
+			}
+
+	public:
+		/**********************************************************************\
+		|* Constructor: hold up to numSlots items waiting for earlier ones,
+		|* starting from the item whose first frame is 'first'
+		\**********************************************************************/
+		explicit ReorderBuffer(int numSlots, int64_t first = 0)
+			:_next(first)
+			,_late(0)
+			,_skipped(0)
+			,_held(0)
+			,_pending(0)
+			,_slots(std::max(numSlots, 1))
+			,_seqs(std::max(numSlots, 1), -1)
+			,_gone(std::max(numSlots, 1), 0)
+			,_step(0)
+			{}
+
+		/**********************************************************************\
+		|* Take an item, and call deliver(T&) for each item it lets go in
+		|* order, which may be none, it, or it and some that were waiting
+		\**********************************************************************/
+		template <typename F>
+		void push(T&& item, F deliver)
+			{
+			int64_t seq = item.sequence();
+			if (_step == 0)
+				_step = std::max<int64_t>(item.frames(), 1);
+
+			if (seq < _next)
+				{
+				_late += item.frames();
+				item = T();
+				return;
+				}
+
+			if (seq == _next)
+				{
+				_next += _step;
+				deliver(item);
+				_release(deliver);
+				return;
+				}
+
+			/******************************************************************\
+			|* Early: make room if it's too far ahead, then wait
+			\******************************************************************/
+			while (seq >= _next + (int64_t)_slots.size() * _step)
+				_advance(deliver);
+
+			if (seq == _next)
+				{
+				_next += _step;
+				deliver(item);
+				_release(deliver);
+				return;
+				}
+
+			size_t slot		= _slot(seq);
+			_slots[slot]	= std::move(item);
+			_seqs[slot]		= seq;
+			_pending ++;
+			_held ++;
+			}
+
+		/**********************************************************************\
+		|* Give up on an item, of 'frames' frames from 'seq', that will never
+		|* arrive (it was dropped on the way), so the ones after it needn't
+		|* wait. Its frames are counted as skipped. If the buffer has already
+		|* moved past it, there's nothing to do
+		\**********************************************************************/
+		template <typename F>
+		void skip(int64_t seq, int frames, F deliver)
+			{
+			if (_step == 0)
+				_step = std::max<int64_t>(frames, 1);
+			if (seq < _next)
+				return;
+
+			if (seq == _next)
+				{
+				_skipped   += _step;
+				_next	   += _step;
+				_release(deliver);
+				return;
+				}
+
+			while (seq >= _next + (int64_t)_slots.size() * _step)
+				_advance(deliver);
+
+			if (seq == _next)
+				{
+				_skipped   += _step;
+				_next	   += _step;
+				_release(deliver);
+				return;
+				}
+
+			size_t slot		= _slot(seq);
+			_seqs[slot]		= seq;
+			_gone[slot]		= 1;
+			_pending ++;
+			}
+
+		/**********************************************************************\
+		|* Hand on everything waiting, in order, skipping what's missing. For
+		|* when the stream has gone quiet and nothing more is coming
+		\**********************************************************************/
+		template <typename F>
+		void flush(F deliver)
+			{
+			while (_pending > 0)
+				_advance(deliver);
+			}
+	};
+
+#endif // REORDERBUFFER_H
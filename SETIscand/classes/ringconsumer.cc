@@ -0,0 +1,80 @@
+#include <QDateTime>
+
+#include "constants.h"
+#include "processor.h"
+#include "ringconsumer.h"
+#include "samplering.h"
+
+/******************************************************************************\
+|* How long to sleep on the ring before checking for a stop, and how often
+|* to report on it
+\******************************************************************************/
+#define WAIT_MS				(100)
+#define REPORT_MS			(10000)
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+RingConsumer::RingConsumer(SampleRing *ring,
+						   Processor *processor,
+						   QObject *parent)
+			 :QThread(parent)
+			 ,_ring(ring)
+			 ,_processor(processor)
+	{}
+
+/******************************************************************************\
+|* Stop the thread
+\******************************************************************************/
+void RingConsumer::stop(void)
+	{
+	requestInterruption();
+	_ring->stop();
+	wait();
+	}
+
+/******************************************************************************\
+|* Take buffers off the ring until told to stop
+\******************************************************************************/
+void RingConsumer::run(void)
+	{
+	qint64 nextReport	= QDateTime::currentMSecsSinceEpoch() + REPORT_MS;
+	int64_t overruns	= 0;
+
+	while (!isInterruptionRequested())
+		{
+		SampleRing::Slot *slot = _ring->wait(WAIT_MS);
+		if (slot != nullptr)
+			{
+			_processor->dataReceived(slot->buffer,
+									 slot->samples,
+									 slot->first,
+									 slot->timeNs,
+									 slot->flags);
+			_ring->release();
+			}
+
+		/**********************************************************************\
+		|* Report periodically, and loudly if we've been dropping data
+		\**********************************************************************/
+		qint64 now = QDateTime::currentMSecsSinceEpoch();
+		if (now >= nextReport)
+			{
+			SampleRing::Stats s = _ring->stats();
+			if (s.overruns != overruns)
+				WARN << "Sample ring dropped" << (s.overruns - overruns)
+					 << "buffers in the last" << REPORT_MS/1000 << "secs,"
+					 << "high-water" << s.highWater << "of" << _ring->numSlots()
+					 << "slots, max lag" << s.maxLagUs << "us";
+			_ring->logStats();
+			overruns	= s.overruns;
+			nextReport	= now + REPORT_MS;
+			}
+		}
+	}
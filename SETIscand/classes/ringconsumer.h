@@ -0,0 +1,47 @@
+#ifndef RINGCONSUMER_H
+#define RINGCONSUMER_H
+
+#include <QThread>
+
+#include "properties.h"
+
+QT_FORWARD_DECLARE_CLASS(Processor)
+QT_FORWARD_DECLARE_CLASS(SampleRing)
+
+/******************************************************************************\
+|* The thread that takes sample buffers off the SampleRing and runs them
+|* through the Processor. It sleeps on the ring rather than on a Qt event
+|* loop, so there's no queued signal (and no event allocation) per buffer.
+|* It also reports the ring's overruns, occupancy and lag periodically.
+\******************************************************************************/
+class RingConsumer : public QThread
+	{
+	Q_OBJECT
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(SampleRing *, ring);			// Where the samples come from
+	GET(Processor *, processor);		// Where they go
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit RingConsumer(SampleRing *ring,
+							  Processor *processor,
+							  QObject *parent = nullptr);
+
+		/**********************************************************************\
+		|* Stop the thread and wait for it to finish
+		\**********************************************************************/
+		void stop(void);
+
+	protected:
+		/**********************************************************************\
+		|* The consumer loop
+		\**********************************************************************/
+		void run(void) override;
+	};
+
+#endif // RINGCONSUMER_H
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "datamgr.h"
+#include "samplering.h"
+
+/******************************************************************************\
+|* Testing
+\******************************************************************************/
+#define MAX_TESTS			(2)
+#define TEST_SLOTS			(4)
+#define TEST_ITEMS			(200000)
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Monotonic time in ns
+\******************************************************************************/
+static inline int64_t _nowNs(void)
+	{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+SampleRing::SampleRing(int numSlots, size_t slotBytes, const char *name)
+		   :_name(name)
+		   ,_numSlots((numSlots < 2) ? 2 : numSlots)
+		   ,_slotBytes(slotBytes)
+		   ,_isValid(false)
+		   ,_ring(nullptr)
+		   ,_head(0)
+		   ,_tailCache(0)
+		   ,_inScratch(false)
+		   ,_offered(0)
+		   ,_overruns(0)
+		   ,_highWater(0)
+		   ,_tail(0)
+		   ,_headCache(0)
+		   ,_lagTotalUs(0)
+		   ,_lagMaxUs(0)
+		   ,_sleeping(false)
+		   ,_stopping(false)
+		   ,_eventFd(-1)
+	{
+	DataMgr& dmgr	= DataMgr::instance();
+	_ring			= new Slot[_numSlots];
+	_isValid		= true;
+
+	for (int i=0; i<_numSlots; i++)
+		{
+		_ring[i].buffer		= dmgr.refFor<uint8_t>(slotBytes, DataBlock::TAG_INGEST);
+		_ring[i].samples	= 0;
+		_ring[i].flags		= 0;
+		_ring[i].timeNs		= 0;
+		_ring[i].first		= 0;
+		_ring[i].postedNs	= 0;
+		_isValid			= _isValid && _ring[i].buffer.isValid();
+		}
+	_scratch	= dmgr.refFor<uint8_t>(slotBytes, DataBlock::TAG_INGEST);
+	_isValid	= _isValid && _scratch.isValid();
+
+	_eventFd	= ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventFd < 0)
+		{
+		ERR << "Cannot create the sample ring's eventfd";
+		_isValid = false;
+		}
+	}
+
+/******************************************************************************\
+|* Destructor. Both threads must have finished with the ring by now
+\******************************************************************************/
+SampleRing::~SampleRing(void)
+	{
+	delete [] _ring;
+	if (_eventFd >= 0)
+		::close(_eventFd);
+	}
+
+/******************************************************************************\
+|* Producer: find the buffer for the next read
+\******************************************************************************/
+uint8_t * SampleRing::claim(void)
+	{
+	uint64_t head = _head.load(std::memory_order_relaxed);
+	if (head - _tailCache >= (uint64_t)_numSlots)
+		{
+		_tailCache = _tail.load(std::memory_order_acquire);
+		if (head - _tailCache >= (uint64_t)_numSlots)
+			{
+			_inScratch = true;
+			return _scratch.data();
+			}
+		}
+
+	_inScratch = false;
+	return _ring[head % _numSlots].buffer.data();
+	}
+
+/******************************************************************************\
+|* Producer: publish the claimed slot. The store to _head and the load of
+|* _sleeping are both sequentially consistent, pairing with the consumer's
+|* store to _sleeping and reload of _head, so a consumer going to sleep either
+|* sees the new slot or gets woken
+\******************************************************************************/
+bool SampleRing::publish(int samples, int flags, long long timeNs)
+	{
+	int64_t first	= _offered;
+	_offered	   += samples;
+
+	if (_inScratch)
+		{
+		int64_t overruns = _overruns.fetch_add(1, std::memory_order_relaxed) + 1;
+		if ((overruns & (overruns - 1)) == 0)
+			WARN << _name << "full, dropped" << overruns
+				 << "buffers so far - the consumer is not keeping up";
+		return false;
+		}
+
+	uint64_t head	= _head.load(std::memory_order_relaxed);
+	Slot& slot		= _ring[head % _numSlots];
+	slot.samples	= samples;
+	slot.flags		= flags;
+	slot.timeNs		= timeNs;
+	slot.first		= first;
+	slot.postedNs	= _nowNs();
+
+	_head.store(head + 1, std::memory_order_seq_cst);
+
+	int64_t used	= (int64_t)(head + 1 - _tail.load(std::memory_order_relaxed));
+	if (used > _highWater.load(std::memory_order_relaxed))
+		_highWater.store(used, std::memory_order_relaxed);
+
+	if (_sleeping.load(std::memory_order_seq_cst))
+		_wake();
+	return true;
+	}
+
+/******************************************************************************\
+|* Producer: account for samples that never reached the ring
+\******************************************************************************/
+void SampleRing::skip(int64_t samples)
+	{
+	_offered += samples;
+	}
+
+/******************************************************************************\
+|* Consumer: wait for a published slot
+\******************************************************************************/
+SampleRing::Slot * SampleRing::wait(int timeoutMs)
+	{
+	if (_stopping.load(std::memory_order_relaxed))
+		return nullptr;
+
+	uint64_t tail = _tail.load(std::memory_order_relaxed);
+	if (_headCache == tail)
+		_headCache = _head.load(std::memory_order_acquire);
+
+	if (_headCache == tail)
+		{
+		_sleeping.store(true, std::memory_order_seq_cst);
+		_headCache = _head.load(std::memory_order_seq_cst);
+		if ((_headCache == tail) && !_stopping.load(std::memory_order_relaxed))
+			{
+			struct pollfd pfd = {_eventFd, POLLIN, 0};
+			if (::poll(&pfd, 1, timeoutMs) > 0)
+				{
+				uint64_t value;
+				ssize_t rc = ::read(_eventFd, &value, sizeof(value));
+				Q_UNUSED(rc);
+				}
+			}
+		_sleeping.store(false, std::memory_order_relaxed);
+
+		_headCache = _head.load(std::memory_order_acquire);
+		if ((_headCache == tail) || _stopping.load(std::memory_order_relaxed))
+			return nullptr;
+		}
+
+	Slot *slot		= &_ring[tail % _numSlots];
+	int64_t lag		= (_nowNs() - slot->postedNs) / 1000;
+	_lagTotalUs.store(_lagTotalUs.load(std::memory_order_relaxed) + lag,
+					  std::memory_order_relaxed);
+	if (lag > _lagMaxUs.load(std::memory_order_relaxed))
+		_lagMaxUs.store(lag, std::memory_order_relaxed);
+
+	return slot;
+	}
+
+/******************************************************************************\
+|* Consumer: hand the slot back
+\******************************************************************************/
+void SampleRing::release(void)
+	{
+	_tail.store(_tail.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+/******************************************************************************\
+|* Stop the consumer
+\******************************************************************************/
+void SampleRing::stop(void)
+	{
+	_stopping = true;
+	_wake();
+	}
+
+/******************************************************************************\
+|* Wake the consumer
+\******************************************************************************/
+void SampleRing::_wake(void)
+	{
+	uint64_t one	= 1;
+	ssize_t rc		= ::write(_eventFd, &one, sizeof(one));
+	Q_UNUSED(rc);
+	}
+
+/******************************************************************************\
+|* Return the number of slots waiting
+\******************************************************************************/
+int SampleRing::occupancy(void)
+	{
+	return (int)(_head.load(std::memory_order_acquire)
+			   - _tail.load(std::memory_order_acquire));
+	}
+
+/******************************************************************************\
+|* Return the counters
+\******************************************************************************/
+SampleRing::Stats SampleRing::stats(void)
+	{
+	Stats stats;
+	int64_t consumed	= (int64_t)_tail.load(std::memory_order_relaxed);
+	stats.published		= (int64_t)_head.load(std::memory_order_relaxed);
+	stats.overruns		= _overruns.load(std::memory_order_relaxed);
+	stats.highWater		= _highWater.load(std::memory_order_relaxed);
+	stats.maxLagUs		= _lagMaxUs.load(std::memory_order_relaxed);
+	stats.meanLagUs		= (consumed > 0)
+						? _lagTotalUs.load(std::memory_order_relaxed) / consumed
+						: 0;
+	return stats;
+	}
+
+/******************************************************************************\
+|* Log the counters
+\******************************************************************************/
+void SampleRing::logStats(void)
+	{
+	Stats s = stats();
+	LOG << _name << ": published" << s.published
+		<< "overruns" << s.overruns
+		<< "high-water" << s.highWater << "of" << _numSlots
+		<< "lag mean" << s.meanLagUs << "us"
+		<< "max" << s.maxLagUs << "us";
+	}
+
+/******************************************************************************\
+|* Test interface : return the number of tests we can run
+\******************************************************************************/
+int SampleRing::numTests(void)
+	{
+	return MAX_TESTS;
+	}
+
+/******************************************************************************\
+|* Test interface : run a test
+\******************************************************************************/
+Testable::TestResult SampleRing::runTest(int idx)
+	{
+	switch (idx)
+		{
+		case 0:
+			return _checkOverrun();
+		case 1:
+			return _checkThreaded();
+		}
+
+	ERR << "Test requested outside of range";
+	return Testable::TEST_FAIL;
+	}
+
+/******************************************************************************\
+|* Test interface : Check a full ring drops new data rather than overwriting
+|* what hasn't been consumed
+\******************************************************************************/
+Testable::TestResult SampleRing::_checkOverrun(void)
+	{
+	SampleRing ring(TEST_SLOTS, sizeof(int64_t));
+	if (!ring.isValid())
+		{
+		ERR << "Cannot create a test ring";
+		return Testable::TEST_FAIL;
+		}
+
+	for (int i=0; i<TEST_SLOTS+2; i++)
+		{
+		*reinterpret_cast<int64_t *>(ring.claim()) = i;
+		ring.publish(1, 0, 0);
+		}
+
+	Stats s = ring.stats();
+	if ((s.overruns != 2) || (s.published != TEST_SLOTS) || (s.highWater != TEST_SLOTS))
+		{
+		ERR << "Full ring did not count overruns";
+		return Testable::TEST_FAIL;
+		}
+
+	for (int i=0; i<TEST_SLOTS; i++)
+		{
+		Slot *slot = ring.wait(0);
+		if ((slot == nullptr) || (slot->first != i)
+				|| (*reinterpret_cast<int64_t *>(slot->buffer.data()) != i))
+			{
+			ERR << "Ring slot" << i << "was overwritten";
+			return Testable::TEST_FAIL;
+			}
+		ring.release();
+		}
+
+	if (ring.wait(0) != nullptr)
+		{
+		ERR << "Empty ring returned a slot";
+		return Testable::TEST_FAIL;
+		}
+
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Run a producer thread flat out against a consumer that
+|* sometimes stalls. Everything published must arrive in order, and
+|* everything else must be counted as an overrun
+\******************************************************************************/
+Testable::TestResult SampleRing::_checkThreaded(void)
+	{
+	SampleRing ring(TEST_SLOTS, sizeof(int64_t));
+	std::atomic<bool> done(false);
+
+	std::thread producer([&]()
+		{
+		for (int64_t i=0; i<TEST_ITEMS; i++)
+			{
+			*reinterpret_cast<int64_t *>(ring.claim()) = i;
+			ring.publish(1, 0, 0);
+			}
+		done = true;
+		});
+
+	int64_t last		= -1;
+	int64_t received	= 0;
+	bool ordered		= true;
+	for (;;)
+		{
+		Slot *slot = ring.wait(10);
+		if (slot != nullptr)
+			{
+			int64_t seq = *reinterpret_cast<int64_t *>(slot->buffer.data());
+			ordered		= ordered && (seq > last);
+			last		= seq;
+			received ++;
+			ring.release();
+
+			if ((received & 1023) == 0)
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		else if (done && (ring.occupancy() == 0))
+			break;
+		}
+	producer.join();
+
+	Stats s = ring.stats();
+	if (!ordered || (received != s.published) || (received + s.overruns != TEST_ITEMS))
+		{
+		ERR << "Ring lost or re-ordered data: received" << received
+			<< "overruns" << s.overruns;
+		return Testable::TEST_FAIL;
+		}
+
+	ring.logStats();
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : identify the class being tested
+\******************************************************************************/
+const char * SampleRing::testClassName(void)
+	{
+	return "SampleRing";
+	}
@@ -0,0 +1,179 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "blockref.h"
+#include "properties.h"
+#include "testable.h"
+
+/******************************************************************************\
+|* A single-producer / single-consumer ring of MTU-sized sample buffers, to
+|* carry raw samples from the SoapyWorker thread to the consumer thread that
+|* runs the Processor. The producer claims the next free slot, reads into it,
+|* and publishes it; the consumer waits for a published slot, processes it,
+|* and releases it.
+|*
+|* If the consumer falls so far behind that the ring is full, the producer
+|* reads into a scratch buffer instead and the data is dropped and counted as
+|* an overrun - unconsumed slots are never overwritten. The indices live on
+|* their own cache lines, as does each slot, so the two threads only share a
+|* line when one of them actually hands something over. The consumer sleeps
+|* on an eventfd, which the producer only writes to if the consumer is asleep.
+\******************************************************************************/
+class SampleRing : public Testable
+	{
+	NON_COPYABLE_NOR_MOVEABLE(SampleRing);
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum
+			{
+			CACHE_LINE		= 64,
+			DEFAULT_SLOTS	= 16
+			};
+
+		struct alignas(CACHE_LINE) Slot
+			{
+			BlockRef<uint8_t>	buffer;		// Sample data
+			int					samples;	// Number of samples in the buffer
+			int					flags;		// Stream flags from the device
+			long long			timeNs;		// Device timestamp
+			int64_t				first;		// Stream index of the first sample
+			int64_t				postedNs;	// When it was published
+			};
+
+		typedef struct
+			{
+			int64_t		published;		// Buffers handed to the consumer
+			int64_t		overruns;		// Buffers dropped with the ring full
+			int64_t		highWater;		// Most slots ever in use at once
+			int64_t		maxLagUs;		// Longest publish -> consume delay
+			int64_t		meanLagUs;		// Average publish -> consume delay
+			} Stats;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(const char *, name);			// What to call it in the logs
+	GET(int, numSlots);					// Number of slots in the ring
+	GET(size_t, slotBytes);				// Size of each slot's buffer
+	GET(bool, isValid);					// All slots were allocated
+
+	private:
+		/**********************************************************************\
+		|* Private variables - the slots, and a buffer to read into when the
+		|* ring is full
+		\**********************************************************************/
+		Slot *					_ring;
+		BlockRef<uint8_t>		_scratch;
+
+		/**********************************************************************\
+		|* Private variables - producer side. The cached tail saves reading
+		|* the consumer's line until the ring looks full
+		\**********************************************************************/
+		alignas(CACHE_LINE)
+		std::atomic<uint64_t>	_head;		// Next slot to publish
+		uint64_t				_tailCache;	// Last tail the producer saw
+		bool					_inScratch;	// Current claim is the scratch
+		int64_t					_offered;	// Samples published or dropped
+		std::atomic<int64_t>	_overruns;
+		std::atomic<int64_t>	_highWater;
+
+		/**********************************************************************\
+		|* Private variables - consumer side
+		\**********************************************************************/
+		alignas(CACHE_LINE)
+		std::atomic<uint64_t>	_tail;		// Next slot to consume
+		uint64_t				_headCache;	// Last head the consumer saw
+		std::atomic<int64_t>	_lagTotalUs;
+		std::atomic<int64_t>	_lagMaxUs;
+
+		/**********************************************************************\
+		|* Private variables - wake-up
+		\**********************************************************************/
+		alignas(CACHE_LINE)
+		std::atomic<bool>		_sleeping;	// Consumer is (about to be) asleep
+		std::atomic<bool>		_stopping;	// Consumer should exit
+		int						_eventFd;	// What the consumer sleeps on
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		void _wake(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. The slot buffers come from DataMgr and
+		|* are accounted as ingest
+		\**********************************************************************/
+		explicit SampleRing(int numSlots,
+							size_t slotBytes,
+							const char *name = "sample ring");
+		virtual ~SampleRing(void);
+
+		/**********************************************************************\
+		|* Producer: return the buffer to read the next lot of samples into.
+		|* Calling again before publish() returns the same buffer
+		\**********************************************************************/
+		uint8_t * claim(void);
+
+		/**********************************************************************\
+		|* Producer: hand the claimed buffer to the consumer. If the ring was
+		|* full when it was claimed, this just counts the overrun and returns
+		|* false. Either way the samples count towards the stream index, so
+		|* the consumer can see where data went missing
+		\**********************************************************************/
+		bool publish(int samples, int flags, long long timeNs);
+
+		/**********************************************************************\
+		|* Producer: move the stream index on past samples lost elsewhere
+		\**********************************************************************/
+		void skip(int64_t samples);
+
+		/**********************************************************************\
+		|* Consumer: wait up to timeoutMs for a slot. Returns nullptr on
+		|* timeout, or once stop() has been called
+		\**********************************************************************/
+		Slot * wait(int timeoutMs);
+
+		/**********************************************************************\
+		|* Consumer: give the slot from wait() back to the producer
+		\**********************************************************************/
+		void release(void);
+
+		/**********************************************************************\
+		|* Make the consumer's wait() return and keep returning nullptr
+		\**********************************************************************/
+		void stop(void);
+
+		/**********************************************************************\
+		|* Return the number of slots waiting to be consumed
+		\**********************************************************************/
+		int occupancy(void);
+
+		/**********************************************************************\
+		|* Return / log the counters
+		\**********************************************************************/
+		Stats stats(void);
+		void logStats(void);
+
+		/**********************************************************************\
+		|* Public Tests interface
+		\**********************************************************************/
+		int numTests(void);
+		Testable::TestResult runTest(int idx);
+		const char * testClassName(void);
+
+	private:
+		/**********************************************************************\
+		|* Private Tests
+		\**********************************************************************/
+		Testable::TestResult _checkOverrun(void);
+		Testable::TestResult _checkThreaded(void);
+	};
+
+#endif // SAMPLERING_H
@@ -0,0 +1,93 @@
+#ifndef SAMPLESOURCE_H
+#define SAMPLESOURCE_H
+
+/******************************************************************************\
+|* Something that produces IQ samples into a SampleRing for the Processor: a
+|* live radio (SoapyIO), a recording (FileSource) or the synthesiser
+|* (SynthSource). Samples are delivered in the source's native format, as
+|* sampleFormat() says, with fullScale() as full scale; the processor picks
+|* the conversion for that format once, when it's initialised.
+|*
+|* Each buffer is published with a timestamp and the flags below. The ring
+|* numbers the samples, so anything lost along the way shows up as a jump in
+|* the stream index as well as a flag.
+\******************************************************************************/
+class SampleSource
+	{
+	public:
+		/**********************************************************************\
+		|* Flags published with each buffer
+		\**********************************************************************/
+		enum
+			{
+			FLAG_HAS_TIME		= 1 << 0,	// timeNs is the source's clock
+			FLAG_DISCONTINUITY	= 1 << 1	// Samples were lost just before
+			};
+
+		/**********************************************************************\
+		|* Sample formats, as SoapySDR names them. CS12 packs I and Q into
+		|* three bytes; CU8 is offset binary, centred on 127.5
+		\**********************************************************************/
+		typedef enum
+			{
+			FMT_UNKNOWN	= 0,
+			FMT_CS8,
+			FMT_CU8,
+			FMT_CS12,
+			FMT_CS16,
+			FMT_CF32,
+			FMT_MAX
+			} Format;
+
+		virtual ~SampleSource(void) {}
+
+		/**********************************************************************\
+		|* Bytes per complex sample in a format
+		\**********************************************************************/
+		static inline int bytesFor(Format format)
+			{
+			switch (format)
+				{
+				case FMT_CS8:
+				case FMT_CU8:
+					return 2;
+				case FMT_CS12:
+					return 3;
+				case FMT_CS16:
+					return 4;
+				case FMT_CF32:
+					return 8;
+				default:
+					return 0;
+				}
+			}
+
+		/**********************************************************************\
+		|* Samples per second
+		\**********************************************************************/
+		virtual double streamRate(void) = 0;
+
+		/**********************************************************************\
+		|* Maximum number of samples delivered in one buffer
+		\**********************************************************************/
+		virtual int streamMTU(void) = 0;
+
+		/**********************************************************************\
+		|* The format of the samples delivered, and bytes per complex sample
+		\**********************************************************************/
+		virtual Format sampleFormat(void) = 0;
+		virtual int sampleBytes(void) = 0;
+
+		/**********************************************************************\
+		|* Full-scale value of a component
+		\**********************************************************************/
+		virtual int fullScale(void) = 0;
+
+		/**********************************************************************\
+		|* Start/Stop delivering samples
+		\**********************************************************************/
+		virtual void startWorker(void) = 0;
+		virtual void stopWorker(void) = 0;
+	};
+
+#endif // SAMPLESOURCE_H
@@ -1,6 +1,8 @@
 #include "config.h"
 #include "constants.h"
 #include "processor.h"
+#include "ringconsumer.h"
+#include "samplering.h"
 #include "soapyio.h"
 #include "soapyworker.h"
 
@@ -31,6 +33,8 @@ SoapyIO::SoapyIO(Processor *processor)
 		,_sampleRate(0)
 		,_thread(nullptr)
 		,_worker(nullptr)
+		,_ring(nullptr)
+		,_consumer(nullptr)
 		,_rx(nullptr)
 		,_proc(processor)
 	{
@@ -192,9 +196,27 @@ void SoapyIO::startWorker(void)
 	{
 	if (_worker == nullptr)
 		{
+		/**********************************************************************\
+		|* Set up the ring the worker reads into, and the thread that takes
+		|* buffers off it and runs them through the processor
+		\**********************************************************************/
+		_ring = new SampleRing(Config::instance().ringSlots(),
+							   (size_t)streamMTU() * sampleBytes());
+		if (!_ring->isValid())
+			{
+			ERR << "Cannot allocate the sample ring";
+			delete _ring;
+			_ring = nullptr;
+			return;
+			}
+
+		_consumer = new RingConsumer(_ring, _proc);
+		_consumer->start(QThread::HighPriority);
+
 		_thread = new QThread(this);
 		_worker = new SoapyWorker();
 		_worker->setSdr(this);
+		_worker->setRing(_ring);
 
 		_worker->moveToThread(_thread);
 
@@ -204,8 +226,6 @@ void SoapyIO::startWorker(void)
 				_worker, &SoapyWorker::stopSampling);
 		connect(_thread, &QThread::finished,
 				_worker, &QObject::deleteLater);
-		connect(_worker, &SoapyWorker::dataAvailable,
-				_proc, &Processor::dataReceived);
 		_thread->start();
 
 		emit startWorkerSampling();
@@ -219,9 +239,20 @@ void SoapyIO::stopWorker(void)
 	{
 	if (_worker != nullptr)
 		{
+		_worker->stopSampling();
 		emit stopWorkerSampling();
 		_thread->quit();
 		_thread->wait();
+		_worker = nullptr;
+
+		// The producer has gone, so the ring can go once the consumer has
+		_consumer->stop();
+		delete _consumer;
+		_consumer = nullptr;
+
+		_ring->logStats();
+		delete _ring;
+		_ring = nullptr;
 		}
 	}
 
@@ -274,6 +305,26 @@ int SoapyIO::sampleBytes(void)
 	return bits/8;
 	}
 
+SampleSource::Format SoapyIO::sampleFormat(void)
+	{
+	if (_format == "CS8")
+		return FMT_CS8;
+	if (_format == "CU8")
+		return FMT_CU8;
+	if (_format == "CS12")
+		return FMT_CS12;
+	if (_format == "CS16")
+		return FMT_CS16;
+	if (_format == "CF32")
+		return FMT_CF32;
+	return FMT_UNKNOWN;
+	}
+
+int SoapyIO::fullScale(void)
+	{
+	return _maxValue;
+	}
+
 
 /******************************************************************************\
 |* Create or return the current RX stream
@@ -295,6 +346,24 @@ SoapySDR::Stream * SoapyIO::rxStream(void)
 	return _rx;
 	}
 
+/******************************************************************************\
+|* Return the MTU of the RX stream
+\******************************************************************************/
+int SoapyIO::streamMTU(void)
+	{
+	if (_dev == nullptr)
+		return 0;
+	return (int)_dev->getStreamMTU(rxStream());
+	}
+
+/******************************************************************************\
+|* Return the sample rate
+\******************************************************************************/
+double SoapyIO::streamRate(void)
+	{
+	return _sampleRate;
+	}
+
 /******************************************************************************\
 |* Read data from a stream
 \******************************************************************************/
@@ -302,7 +371,7 @@ int SoapyIO::waitForData(SoapySDR::Stream *stream,
 						 void *const *buffers,
 						 int elems,
 						 int &flags,
-						 long long ns,
+						 long long &ns,
 						 const long timeoutUs)
 	{
 	return _dev->readStream(stream, buffers, elems, flags, ns, timeoutUs);
@@ -12,11 +12,14 @@
 #include <SoapySDR/Formats.hpp>
 
 #include "properties.h"
+#include "samplesource.h"
 
 QT_FORWARD_DECLARE_CLASS(Processor)
+QT_FORWARD_DECLARE_CLASS(RingConsumer)
+QT_FORWARD_DECLARE_CLASS(SampleRing)
 QT_FORWARD_DECLARE_CLASS(SoapyWorker)
 
-class SoapyIO : public QObject
+class SoapyIO : public QObject, public SampleSource
 	{
 	Q_OBJECT
 
@@ -47,6 +50,8 @@ class SoapyIO : public QObject
 		\**********************************************************************/
 		QThread *			_thread;			// Thread to tidy up later
 		SoapyWorker *		_worker;			// Worker or nullptr
+		SampleRing *		_ring;				// Worker -> consumer buffers
+		RingConsumer *		_consumer;			// Feeds the processor
 		SoapySDR::Stream *	_rx;				// Receiving-data stream
 		Processor *			_proc;				// Processing chain
 
@@ -88,14 +93,24 @@ class SoapyIO : public QObject
 		/**********************************************************************\
 		|* Start/Stop a worker sampling, creating it if necessary
 		\**********************************************************************/
-		void startWorker(void);
-		void stopWorker(void);
+		void startWorker(void) override;
+		void stopWorker(void) override;
 
 		/**********************************************************************\
 		|* Return a set-up stream
 		\**********************************************************************/
 		SoapySDR::Stream * rxStream(void);
 
+		/**********************************************************************\
+		|* Return the MTU of the RX stream, in samples
+		\**********************************************************************/
+		int streamMTU(void) override;
+
+		/**********************************************************************\
+		|* Return the sample rate the device was set to
+		\**********************************************************************/
+		double streamRate(void) override;
+
 		/**********************************************************************\
 		|* Shim around the readStream call
 		\**********************************************************************/
@@ -103,7 +118,7 @@ class SoapyIO : public QObject
 						void * const *buffers,
 						int elems,
 						int &flags,
-						long long ns,
+						long long &ns,
 						const long timeoutUs=100000);
 
 		/**********************************************************************\
@@ -113,7 +128,9 @@ class SoapyIO : public QObject
 		bool isFloatStream(void);
 		bool isUnsignedStream(void);
 		bool isSignedStream(void);
-		int sampleBytes(void);
+		Format sampleFormat(void) override;
+		int sampleBytes(void) override;
+		int fullScale(void) override;
 
 	signals:
 		/**********************************************************************\
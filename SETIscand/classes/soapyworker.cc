@@ -1,9 +1,12 @@
+#include <cmath>
+
 #include <unistd.h>
 
 #include <SoapySDR/Device.hpp>
 
 #include "constants.h"
-#include "datamgr.h"
+#include "samplering.h"
+#include "samplesource.h"
 #include "soapyio.h"
 #include "soapyworker.h"
 
@@ -19,6 +22,7 @@
 \******************************************************************************/
 SoapyWorker::SoapyWorker(QObject *parent)
 			:QObject(parent)
+			,_ring(nullptr)
 			,_isActive(false)
 	{}
 
@@ -37,40 +41,70 @@ void SoapyWorker::startSampling(void)
 	/**************************************************************************\
 	|* Get the MTU for the stream, so we know how much we can request
 	\**************************************************************************/
-	int mtu = _sdr->dev()->getStreamMTU(rx);
-
-	/**************************************************************************\
-	|* Obtain a sample buffer from the data manager
-	\**************************************************************************/
-	int64_t ping	= DataMgr::instance().blockFor(mtu, _sdr->sampleBytes());
-	int64_t pong	= DataMgr::instance().blockFor(mtu, _sdr->sampleBytes());
-
-	void *pingBuffers[]		= {DataMgr::instance().asUint8(ping)};
-	void *pongBuffers[]		= {DataMgr::instance().asUint8(pong)};
+	int mtu = _sdr->streamMTU();
 
+	if ((_ring == nullptr) || !_ring->isValid())
+		{
+		ERR << "No sample ring to read into";
+		_isActive = false;
+		return;
+		}
 
 	/**************************************************************************\
-	|* Enter the loop
+	|* Enter the loop, reading into whichever slot the ring gives us. If the
+	|* ring is full that's a scratch buffer, and the data is dropped (and
+	|* counted) rather than overwriting anything not yet processed.
+	|*
+	|* An overflow, or a stream that ends abruptly, means the device lost
+	|* samples, so the next buffer is flagged as a discontinuity. If the
+	|* device timestamps its buffers we can also tell how many were lost, and
+	|* move the stream index on to match
 	\**************************************************************************/
-	bool isPing = true;
+	double nsPerSample	= 1e9 / _sdr->streamRate();
+	long long expected	= -1;
+	bool lost			= false;
+	int64_t overflows	= 0;
+
 	while (_isActive)
 		{
-		void **buffers = isPing ? pingBuffers : pongBuffers;
+		void *buffers[] = {_ring->claim()};
 		int flags = 0;
 		long long time_ns = 0;
 
 		// Read the data
 		int samples = _sdr->waitForData(rx, buffers, mtu, flags, time_ns);
-		if (samples < 0)
+		if (samples == SOAPY_SDR_OVERFLOW)
+			{
+			lost = true;
+			overflows ++;
+			if ((overflows & (overflows - 1)) == 0)
+				WARN << "Device overflow," << overflows << "so far";
+			continue;
+			}
+		else if (samples < 0)
+			{
 			ERR << "waitForData() returned" << samples;
-		else
-			emit dataAvailable(isPing ? ping : pong,
-							   samples,
-							   _sdr->maxValue(),
-							   _sdr->sampleBytes());
+			continue;
+			}
 
-		// Cycle around with the next buffer
-		isPing = !isPing;
+		int streamFlags = lost ? SampleSource::FLAG_DISCONTINUITY : 0;
+		if (flags & SOAPY_SDR_HAS_TIME)
+			{
+			streamFlags |= SampleSource::FLAG_HAS_TIME;
+			if (expected >= 0)
+				{
+				int64_t gap = llround((time_ns - expected) / nsPerSample);
+				if (gap > 0)
+					{
+					_ring->skip(gap);
+					streamFlags |= SampleSource::FLAG_DISCONTINUITY;
+					}
+				}
+			expected = time_ns + llround(samples * nsPerSample);
+			}
+
+		_ring->publish(samples, streamFlags, time_ns);
+		lost = (flags & SOAPY_SDR_END_ABRUPT) != 0;
 		}
 	}
 
@@ -79,5 +113,5 @@ void SoapyWorker::startSampling(void)
 \******************************************************************************/
 void SoapyWorker::stopSampling(void)
 	{
-
+	_isActive = false;
 	}
@@ -1,10 +1,13 @@
 #ifndef SOAPYWORKER_H
 #define SOAPYWORKER_H
 
+#include <atomic>
+
 #include <QObject>
 #include <SoapySDR/Device.hpp>
 
 #include "properties.h"
+QT_FORWARD_DECLARE_CLASS(SampleRing)
 QT_FORWARD_DECLARE_CLASS(SoapyIO)
 
 class SoapyWorker : public QObject
@@ -15,7 +18,8 @@ class SoapyWorker : public QObject
 	|* Properties
 	\**************************************************************************/
 	GETSET(SoapyIO*, sdr, Sdr);
-	GET(bool, isActive);
+	GETSET(SampleRing*, ring, Ring);
+	GET(std::atomic<bool>, isActive);
 
 	private:
 
@@ -30,10 +34,12 @@ class SoapyWorker : public QObject
 	\**************************************************************************/
 	public slots:
 		void startSampling(void);
-		void stopSampling(void);
 
-	signals:
-		void dataAvailable(int64_t handle, int elems, int max, int bytes);
+		/**********************************************************************\
+		|* Safe to call directly from another thread - the sampling loop never
+		|* returns to the event loop, so a queued call would never arrive
+		\**********************************************************************/
+		void stopSampling(void);
 	};
 
 #endif // SOAPYWORKER_H
@@ -0,0 +1,705 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include <QStringList>
+
+#include "config.h"
+#include "constants.h"
+#include "datamgr.h"
+#include "processor.h"
+#include "ringconsumer.h"
+#include "samplering.h"
+#include "synthsource.h"
+
+/******************************************************************************\
+|* Testing
+\******************************************************************************/
+#define MAX_TESTS			(3)
+#define TEST_RATE			(1024000.0)		// 1 kHz bins with TEST_BINS
+#define TEST_BINS			(1024)
+#define TEST_BUFFERS		(1024)			// ~16M samples for the benchmark
+#define TARGET_MSPS			(50.0)
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+#define LOG  qDebug(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define WARN qWarning(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR  qCritical(log_dsp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* How long to back off when the ring is full in fast mode
+\******************************************************************************/
+#define BACKOFF_US			(50)
+
+/******************************************************************************\
+|* The noise is the sum of four uniform bytes: mean 510, variance 4 x
+|* (256^2-1)/12. Scale by this to get unit variance
+\******************************************************************************/
+#define NOISE_MEAN			(510)
+#define NOISE_NORM			(1.0f / 147.800541f)
+
+/******************************************************************************\
+|* Vector types: eight floats or eight 32-bit ints, whatever the target's
+|* SIMD unit makes of them
+\******************************************************************************/
+typedef float		v8f __attribute__((vector_size(32)));
+typedef int32_t		v8i __attribute__((vector_size(32)));
+typedef uint32_t	v8u __attribute__((vector_size(32)));
+
+static inline void _load(v8f& v, const float *src)
+	{
+	::memcpy(&v, src, sizeof(v));
+	}
+
+static inline void _store(float *dst, const v8f& v)
+	{
+	::memcpy(dst, &v, sizeof(v));
+	}
+
+/******************************************************************************\
+|* Quantise planar I/Q to interleaved integers, rounding to nearest
+\******************************************************************************/
+template <typename T>
+static void _quantise(const float *I, const float *Q, T *out, int count, float scale)
+	{
+	for (int i=0; i<count; i++)
+		{
+		float vi	= I[i] * scale;
+		float vq	= Q[i] * scale;
+		vi			= (vi > scale) ? scale : (vi < -scale) ? -scale : vi;
+		vq			= (vq > scale) ? scale : (vq < -scale) ? -scale : vq;
+		out[2*i]	= (T)(vi + ((vi >= 0.0f) ? 0.5f : -0.5f));
+		out[2*i+1]	= (T)(vq + ((vq >= 0.0f) ? 0.5f : -0.5f));
+		}
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+SynthSource::SynthSource(double sampleRate,
+						 Format format,
+						 uint64_t seed,
+						 double noise,
+						 bool fast,
+						 Processor *processor)
+			:QThread(processor)
+			,_sampleRate(sampleRate)
+			,_format(format)
+			,_seed(seed)
+			,_noise(noise)
+			,_isFast(fast)
+			,_position(0)
+			,_proc(processor)
+			,_ring(nullptr)
+			,_consumer(nullptr)
+			,_isActive(false)
+	{
+	DataMgr& dmgr	= DataMgr::instance();
+	_i				= dmgr.refFor<float>(SYNTH_MTU, DataBlock::TAG_INGEST);
+	_q				= dmgr.refFor<float>(SYNTH_MTU, DataBlock::TAG_INGEST);
+	_seedLanes();
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+SynthSource::~SynthSource(void)
+	{
+	stopWorker();
+	}
+
+/******************************************************************************\
+|* Seed the per-lane generators with splitmix64, which never gives two lanes
+|* the same state
+\******************************************************************************/
+void SynthSource::_seedLanes(void)
+	{
+	uint64_t state = _seed;
+	for (int i=0; i<LANES; i++)
+		{
+		uint64_t z	= (state += 0x9E3779B97F4A7C15ULL);
+		z			= (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z			= (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z			= z ^ (z >> 31);
+		_lanes[i]	= ((uint32_t)z != 0) ? (uint32_t)z : 0x2545F491;
+		}
+	}
+
+/******************************************************************************\
+|* Add Gaussian noise of the given sigma to 'count' floats
+\******************************************************************************/
+void SynthSource::_addNoise(float *dst, int count, float sigma)
+	{
+	v8u x;
+	::memcpy(&x, _lanes, sizeof(x));
+	v8f k = (v8f){} + sigma * NOISE_NORM;
+
+	for (int i=0; i<count; i+=LANES)
+		{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+
+		v8u sum	= (x & 0xFF) + ((x >> 8) & 0xFF) + ((x >> 16) & 0xFF) + (x >> 24);
+		v8f g	= __builtin_convertvector((v8i)sum - NOISE_MEAN, v8f) * k;
+
+		if (i + LANES <= count)
+			{
+			v8f d;
+			_load(d, dst + i);
+			_store(dst + i, d + g);
+			}
+		else
+			for (int j=0; i+j<count; j++)
+				dst[i+j] += g[j];
+		}
+
+	::memcpy(_lanes, &x, sizeof(x));
+	}
+
+/******************************************************************************\
+|* Add a carrier to 'count' samples starting 'offset' into the buffer. The
+|* phase is worked out exactly (in double) at the start of every BLOCK, and
+|* advanced in between by rotating eight phasors, each a sample apart, by
+|* eight samples' worth at a time. A drifting carrier holds the frequency of
+|* the middle of each block
+\******************************************************************************/
+void SynthSource::_addCarrier(int offset, int count, const Signal& signal)
+	{
+	float *I	= _i.data() + offset;
+	float *Q	= _q.data() + offset;
+
+	for (int b=0; b<count; b+=BLOCK)
+		{
+		int len			= std::min<int>(BLOCK, count - b);
+		double t		= (double)(_position + offset + b) / _sampleRate;
+		double cycles	= signal.frequency * t + 0.5 * signal.drift * t * t;
+		double phase	= 2.0 * M_PI * (cycles - std::floor(cycles));
+		double freq		= signal.frequency
+						+ signal.drift * (t + 0.5 * len / _sampleRate);
+		double step		= 2.0 * M_PI * freq / _sampleRate;
+
+		v8f re, im;
+		for (int k=0; k<LANES; k++)
+			{
+			re[k]	= (float)(signal.amplitude * std::cos(phase + k * step));
+			im[k]	= (float)(signal.amplitude * std::sin(phase + k * step));
+			}
+		float rr	= (float)std::cos(LANES * step);
+		float ri	= (float)std::sin(LANES * step);
+
+		int full	= len & ~(LANES - 1);
+		int i		= 0;
+		for (; i<full; i+=LANES)
+			{
+			v8f vi, vq;
+			_load(vi, I + b + i);
+			_load(vq, Q + b + i);
+			_store(I + b + i, vi + re);
+			_store(Q + b + i, vq + im);
+
+			v8f next	= re * rr - im * ri;
+			im			= re * ri + im * rr;
+			re			= next;
+			}
+		for (int k=0; i<len; i++, k++)
+			{
+			I[b+i] += re[k];
+			Q[b+i] += im[k];
+			}
+		}
+	}
+
+/******************************************************************************\
+|* Add a pulse or RFI burst wherever it's switched on in the next 'count'
+|* samples. Bursts start every 'period' seconds from t=0 and last 'width'
+\******************************************************************************/
+void SynthSource::_addGated(int count, const Signal& signal)
+	{
+	double period	= signal.period * _sampleRate;
+	double width	= signal.width * _sampleRate;
+	int64_t first	= _position;
+	int64_t last	= _position + count;
+
+	if ((period < 1.0) || (width <= 0.0))
+		return;
+
+	for (int64_t k = (int64_t)(first / period); k * period < last; k++)
+		{
+		int64_t on	= std::max<int64_t>(first, (int64_t)std::ceil(k * period));
+		int64_t off	= std::min<int64_t>(last, (int64_t)std::ceil(k * period + width));
+		if (on >= off)
+			continue;
+
+		int offset	= (int)(on - first);
+		int len		= (int)(off - on);
+		if (signal.type == SIG_PULSE)
+			_addCarrier(offset, len, signal);
+		else
+			{
+			_addNoise(_i.data() + offset, len, (float)signal.amplitude);
+			_addNoise(_q.data() + offset, len, (float)signal.amplitude);
+			}
+		}
+	}
+
+/******************************************************************************\
+|* Write the planar buffers out in the output format
+\******************************************************************************/
+void SynthSource::_pack(uint8_t *dst, int count)
+	{
+	const float *I	= _i.data();
+	const float *Q	= _q.data();
+
+	switch (_format)
+		{
+		case FMT_CS8:
+			_quantise(I, Q, reinterpret_cast<int8_t *>(dst), count, 127.0f);
+			break;
+
+		case FMT_CS16:
+			_quantise(I, Q, reinterpret_cast<int16_t *>(dst), count, 32767.0f);
+			break;
+
+		case FMT_CF32:
+			{
+			float *out = reinterpret_cast<float *>(dst);
+			for (int i=0; i<count; i++)
+				{
+				out[2*i]	= I[i];
+				out[2*i+1]	= Q[i];
+				}
+			break;
+			}
+
+		default:
+			break;
+		}
+	}
+
+/******************************************************************************\
+|* Generate the next lot of samples
+\******************************************************************************/
+void SynthSource::generate(uint8_t *dst, int count)
+	{
+	count = std::min<int>(count, SYNTH_MTU);
+	if (!_i.isValid() || !_q.isValid() || (count <= 0))
+		return;
+
+	::memset(_i.data(), 0, count * sizeof(float));
+	::memset(_q.data(), 0, count * sizeof(float));
+
+	if (_noise > 0.0)
+		{
+		_addNoise(_i.data(), count, (float)_noise);
+		_addNoise(_q.data(), count, (float)_noise);
+		}
+
+	for (const Signal& signal : _signals)
+		if ((signal.type == SIG_TONE) || (signal.type == SIG_DRIFT))
+			_addCarrier(0, count, signal);
+		else
+			_addGated(count, signal);
+
+	_pack(dst, count);
+	_position += count;
+	}
+
+/******************************************************************************\
+|* Start again
+\******************************************************************************/
+void SynthSource::rewind(void)
+	{
+	_position = 0;
+	_seedLanes();
+	}
+
+/******************************************************************************\
+|* Add a signal
+\******************************************************************************/
+void SynthSource::addSignal(const Signal& signal)
+	{
+	_signals.push_back(signal);
+	}
+
+/******************************************************************************\
+|* Parse a signal description, eg: "drift:125000:-1.5:0.01"
+\******************************************************************************/
+bool SynthSource::parseSignal(const QString& spec, Signal& signal)
+	{
+	QStringList parts	= spec.split(':');
+	QString type		= parts.takeFirst().toLower();
+	double v[4]			= {0, 0, 0, 0};
+
+	if (parts.size() > 4)
+		return false;
+	for (int i=0; i<parts.size(); i++)
+		{
+		bool ok	= false;
+		v[i]	= parts[i].toDouble(&ok);
+		if (!ok)
+			return false;
+		}
+
+	signal = {SIG_TONE, 0, 0, 0, 0, 0};
+	if ((type == "tone") && (parts.size() == 2))
+		{
+		signal.frequency	= v[0];
+		signal.amplitude	= v[1];
+		}
+	else if ((type == "drift") && (parts.size() == 3))
+		{
+		signal.type			= SIG_DRIFT;
+		signal.frequency	= v[0];
+		signal.drift		= v[1];
+		signal.amplitude	= v[2];
+		}
+	else if ((type == "pulse") && (parts.size() == 4))
+		{
+		signal.type			= SIG_PULSE;
+		signal.frequency	= v[0];
+		signal.amplitude	= v[1];
+		signal.period		= v[2];
+		signal.width		= v[3];
+		}
+	else if ((type == "rfi") && (parts.size() == 3))
+		{
+		signal.type			= SIG_RFI;
+		signal.amplitude	= v[0];
+		signal.period		= v[1];
+		signal.width		= v[2];
+		}
+	else
+		return false;
+
+	return true;
+	}
+
+/******************************************************************************\
+|* Map a format name to a Format
+\******************************************************************************/
+bool SynthSource::formatFor(const QString& name, Format& format)
+	{
+	QString fmt = name.toLower();
+	if (fmt == "cs8")
+		format = FMT_CS8;
+	else if (fmt == "cs16")
+		format = FMT_CS16;
+	else if (fmt == "cf32")
+		format = FMT_CF32;
+	else
+		return false;
+	return true;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: samples per buffer
+\******************************************************************************/
+int SynthSource::streamMTU(void)
+	{
+	return SYNTH_MTU;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: samples per second
+\******************************************************************************/
+double SynthSource::streamRate(void)
+	{
+	return _sampleRate;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: format of the delivered samples
+\******************************************************************************/
+SampleSource::Format SynthSource::sampleFormat(void)
+	{
+	return _format;
+	}
+
+/******************************************************************************\
+|* SampleSource interface: bytes per delivered sample
+\******************************************************************************/
+int SynthSource::sampleBytes(void)
+	{
+	return bytesFor(_format);
+	}
+
+/******************************************************************************\
+|* SampleSource interface: full scale
+\******************************************************************************/
+int SynthSource::fullScale(void)
+	{
+	switch (_format)
+		{
+		case FMT_CS8:
+			return 128;
+		case FMT_CS16:
+			return 32768;
+		default:
+			return 1;
+		}
+	}
+
+/******************************************************************************\
+|* SampleSource interface: start generating
+\******************************************************************************/
+void SynthSource::startWorker(void)
+	{
+	if (_ring != nullptr)
+		return;
+
+	_ring = new SampleRing(Config::instance().ringSlots(),
+						   (size_t)streamMTU() * sampleBytes());
+	if (!_ring->isValid() || !_i.isValid() || !_q.isValid())
+		{
+		ERR << "Cannot allocate the synthesiser's buffers";
+		delete _ring;
+		_ring = nullptr;
+		return;
+		}
+
+	LOG << "Synthesising" << (int)_signals.size() << "signals in noise of"
+		<< _noise << "at" << _sampleRate << "Hz, seed" << (quint64)_seed << ","
+		<< (_isFast ? "as fast as possible" : "in real time");
+
+	_consumer = new RingConsumer(_ring, _proc);
+	_consumer->start(QThread::HighPriority);
+
+	_isActive = true;
+	start();
+	}
+
+/******************************************************************************\
+|* SampleSource interface: stop generating
+\******************************************************************************/
+void SynthSource::stopWorker(void)
+	{
+	if (_ring == nullptr)
+		return;
+
+	_isActive = false;
+	wait();
+
+	_consumer->stop();
+	delete _consumer;
+	_consumer = nullptr;
+
+	delete _ring;
+	_ring = nullptr;
+	}
+
+/******************************************************************************\
+|* Generate into the ring until stopped. Timestamps come from the sample
+|* count, as a radio would report them
+\******************************************************************************/
+void SynthSource::run(void)
+	{
+	using namespace std::chrono;
+
+	int64_t first	= _position;
+	auto start		= steady_clock::now();
+
+	while (_isActive)
+		{
+		/**********************************************************************\
+		|* In fast mode, wait for room rather than drop
+		\**********************************************************************/
+		if (_isFast)
+			while (_isActive && (_ring->occupancy() >= _ring->numSlots()))
+				std::this_thread::sleep_for(microseconds(BACKOFF_US));
+
+		long long timeNs = (long long)(_position * 1e9 / _sampleRate);
+		generate(_ring->claim(), SYNTH_MTU);
+		_ring->publish(SYNTH_MTU, SampleSource::FLAG_HAS_TIME, timeNs);
+
+		if (!_isFast)
+			std::this_thread::sleep_until(start
+				+ nanoseconds((int64_t)((_position - first) * 1e9 / _sampleRate)));
+		}
+
+	int64_t sent	= _position - first;
+	double secs		= duration<double>(steady_clock::now() - start).count();
+	SampleRing::Stats s = _ring->stats();
+	LOG << "Synthesis done:" << (qint64)sent << "samples in" << secs << "secs,"
+		<< (secs > 0 ? sent / secs / 1e6 : 0) << "Msamples/sec,"
+		<< (secs > 0 ? sent / secs / _sampleRate : 0) << "x real-time,"
+		<< s.overruns << "buffers dropped";
+	}
+
+/******************************************************************************\
+|* Test interface : return the number of tests we can run
+\******************************************************************************/
+int SynthSource::numTests(void)
+	{
+	return MAX_TESTS;
+	}
+
+/******************************************************************************\
+|* Test interface : run a test
+\******************************************************************************/
+Testable::TestResult SynthSource::runTest(int idx)
+	{
+	switch (idx)
+		{
+		case 0:
+			return _checkRepeatable();
+		case 1:
+			return _checkSignals();
+		case 2:
+			return _checkThroughput();
+		}
+
+	ERR << "Test requested outside of range";
+	return Testable::TEST_FAIL;
+	}
+
+/******************************************************************************\
+|* Test interface : Check the same seed gives the same samples, after a
+|* rewind too, and a different seed doesn't
+\******************************************************************************/
+Testable::TestResult SynthSource::_checkRepeatable(void)
+	{
+	Signal rfi = {SIG_RFI, 0, 0, 0.2, 0.01, 0.002};
+	SynthSource a(TEST_RATE, FMT_CS16, 42, 0.1, true);
+	SynthSource b(TEST_RATE, FMT_CS16, 42, 0.1, true);
+	SynthSource c(TEST_RATE, FMT_CS16, 43, 0.1, true);
+	a.addSignal(rfi);
+	b.addSignal(rfi);
+	c.addSignal(rfi);
+
+	size_t bytes = SYNTH_MTU * 4;
+	std::vector<uint8_t> pa(bytes), pb(bytes), pc(bytes);
+	bool same		= true;
+	bool differ		= false;
+	for (int i=0; i<3; i++)
+		{
+		a.generate(pa.data(), SYNTH_MTU);
+		b.generate(pb.data(), SYNTH_MTU);
+		c.generate(pc.data(), SYNTH_MTU);
+		same	= same && (::memcmp(pa.data(), pb.data(), bytes) == 0);
+		differ	= differ || (::memcmp(pa.data(), pc.data(), bytes) != 0);
+		}
+
+	a.rewind();
+	b.rewind();
+	b.generate(pb.data(), SYNTH_MTU);
+	a.generate(pa.data(), SYNTH_MTU);
+	same = same && (::memcmp(pa.data(), pb.data(), bytes) == 0);
+
+	if (!same || !differ)
+		{
+		ERR << "Synthesised samples don't depend only on the seed";
+		return Testable::TEST_FAIL;
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Return the power in one DFT bin of TEST_BINS CF32 samples
+\******************************************************************************/
+static double _binPower(const float *iq, int bin)
+	{
+	double re = 0, im = 0;
+	for (int n=0; n<TEST_BINS; n++)
+		{
+		double w = -2.0 * M_PI * bin * n / TEST_BINS;
+		re += iq[2*n] * std::cos(w) - iq[2*n+1] * std::sin(w);
+		im += iq[2*n] * std::sin(w) + iq[2*n+1] * std::cos(w);
+		}
+	return re * re + im * im;
+	}
+
+/******************************************************************************\
+|* Test interface : Check a tone, a drifting carrier and a pulse all turn up
+|* where and when they should, well clear of the noise
+\******************************************************************************/
+Testable::TestResult SynthSource::_checkSignals(void)
+	{
+	std::vector<float> iq(TEST_BINS * 2);
+	float *buf		= iq.data();
+	uint8_t *dst	= reinterpret_cast<uint8_t *>(buf);
+	bool ok			= true;
+
+	/**************************************************************************\
+	|* A tone in bin 100: 100 kHz with 1 kHz bins
+	\**************************************************************************/
+	SynthSource tone(TEST_RATE, FMT_CF32, 1, 0.01, true);
+	tone.addSignal({SIG_TONE, 100000, 0, 0.1, 0, 0});
+	tone.generate(dst, TEST_BINS);
+	ok = ok && (_binPower(buf, 100) > 1000 * _binPower(buf, 300));
+
+	/**************************************************************************\
+	|* A carrier starting in bin 50 and drifting a bin per buffer, so after
+	|* 100 more buffers it's in bin 150
+	\**************************************************************************/
+	SynthSource drift(TEST_RATE, FMT_CF32, 1, 0.01, true);
+	drift.addSignal({SIG_DRIFT, 50000, 1000 * TEST_RATE / TEST_BINS, 0.1, 0, 0});
+	drift.generate(dst, TEST_BINS);
+	ok = ok && (_binPower(buf, 50) > 100 * _binPower(buf, 150));
+	for (int i=0; i<100; i++)
+		drift.generate(dst, TEST_BINS);
+	ok = ok && (_binPower(buf, 150) > 100 * _binPower(buf, 50));
+
+	/**************************************************************************\
+	|* A pulse on for one buffer in every two
+	\**************************************************************************/
+	double width = TEST_BINS / TEST_RATE;
+	SynthSource pulse(TEST_RATE, FMT_CF32, 1, 0.01, true);
+	pulse.addSignal({SIG_PULSE, 200000, 0, 0.1, 2 * width, width});
+	pulse.generate(dst, TEST_BINS);
+	double on	= _binPower(buf, 200);
+	pulse.generate(dst, TEST_BINS);
+	double off	= _binPower(buf, 200);
+	ok = ok && (on > 1000 * off);
+
+	if (!ok)
+		{
+		ERR << "Synthesised signals are not where they should be";
+		return Testable::TEST_FAIL;
+		}
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : Report how fast we generate a busy CS16 stream. This only
+|* fails if nothing is generated: the rate depends on the machine
+\******************************************************************************/
+Testable::TestResult SynthSource::_checkThroughput(void)
+	{
+	using namespace std::chrono;
+
+	SynthSource synth(TEST_RATE, FMT_CS16, 1, 0.1, true);
+	synth.addSignal({SIG_TONE, 100000, 0, 0.01, 0, 0});
+	synth.addSignal({SIG_DRIFT, -200000, 2.5, 0.01, 0, 0});
+	synth.addSignal({SIG_PULSE, 300000, 0, 0.05, 0.01, 0.001});
+	synth.addSignal({SIG_RFI, 0, 0, 0.3, 0.1, 0.002});
+
+	std::vector<uint8_t> out(SYNTH_MTU * 4);
+	auto start = steady_clock::now();
+	for (int i=0; i<TEST_BUFFERS; i++)
+		synth.generate(out.data(), SYNTH_MTU);
+	double secs = duration<double>(steady_clock::now() - start).count();
+
+	if (synth.position() != (int64_t)TEST_BUFFERS * SYNTH_MTU)
+		{
+		ERR << "Synthesiser did not generate anything";
+		return Testable::TEST_FAIL;
+		}
+
+	double msps = synth.position() / secs / 1e6;
+	LOG << "Synthesiser:" << msps << "Msamples/sec with noise and 4 signals";
+	if (msps < TARGET_MSPS)
+		WARN << "Synthesiser is slower than" << TARGET_MSPS << "Msamples/sec";
+	return Testable::TEST_PASS;
+	}
+
+/******************************************************************************\
+|* Test interface : identify the class being tested
+\******************************************************************************/
+const char * SynthSource::testClassName(void)
+	{
+	return "SynthSource";
+	}
@@ -0,0 +1,175 @@
+#ifndef SYNTHSOURCE_H
+#define SYNTHSOURCE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <QString>
+#include <QThread>
+
+#include "blockref.h"
+#include "properties.h"
+#include "samplesource.h"
+#include "testable.h"
+
+QT_FORWARD_DECLARE_CLASS(Processor)
+QT_FORWARD_DECLARE_CLASS(RingConsumer)
+QT_FORWARD_DECLARE_CLASS(SampleRing)
+
+/******************************************************************************\
+|* A synthetic signal source, to drive the pipeline without hardware. It makes
+|* seeded Gaussian noise plus any number of:
+|*
+|*	tone:<Hz>:<amplitude>							- a CW carrier
+|*	drift:<Hz>:<Hz/sec>:<amplitude>				- a linearly drifting carrier
+|*	pulse:<Hz>:<amplitude>:<period s>:<width s>	- a gated carrier
+|*	rfi:<amplitude>:<period s>:<width s>			- broadband noise bursts
+|*
+|* Amplitudes are relative to full scale (1.0). Output is CS8, CS16 or CF32,
+|* delivered through the same SampleRing and RingConsumer as a radio, either
+|* paced at the sample rate or as fast as the pipeline will take it. The
+|* output depends only on the seed, the signals and the buffer sizes, so runs
+|* are repeatable. CF32 is delivered as-is: the processor reads floats.
+|*
+|* Generation works on planar I and Q float buffers with GCC/Clang vector
+|* types, eight lanes at a time, so the compiler emits AVX2, SSE or NEON as
+|* the target allows. Noise uses an xorshift generator per lane and the sum
+|* of four 8-bit uniforms as a (tail-limited) Gaussian; carriers use a phasor
+|* recurrence per lane, re-seeded from the exact phase every block.
+\******************************************************************************/
+class SynthSource : public QThread, public SampleSource, public Testable
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef enum
+			{
+			SIG_TONE = 0,
+			SIG_DRIFT,
+			SIG_PULSE,
+			SIG_RFI
+			} SignalType;
+
+		typedef struct
+			{
+			SignalType	type;
+			double		frequency;		// Hz, at t=0 for a drift
+			double		drift;			// Hz per second
+			double		amplitude;		// Relative to full scale
+			double		period;			// Pulse/burst repeat, seconds
+			double		width;			// Pulse/burst length, seconds
+			} Signal;
+
+		enum
+			{
+			SYNTH_MTU		= 16384,	// Samples per buffer
+			LANES			= 8,		// Vector width, in floats
+			BLOCK			= 256		// Samples between phase re-seeds
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(double, sampleRate);			// Samples per second
+	GET(Format, format);				// Output format
+	GET(uint64_t, seed);				// Noise seed
+	GET(double, noise);					// Noise sigma, relative to full scale
+	GET(bool, isFast);					// As fast as possible, or real-time
+	GET(int64_t, position);				// Index of the next sample
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		std::vector<Signal>	_signals;	// What to inject
+		BlockRef<float>		_i;			// Planar I working buffer
+		BlockRef<float>		_q;			// Planar Q working buffer
+		uint32_t			_lanes[LANES] __attribute__((aligned(32)));
+
+		Processor *			_proc;		// Where the samples end up
+		SampleRing *		_ring;		// Producer -> consumer buffers
+		RingConsumer *		_consumer;	// Feeds the processor
+		std::atomic<bool>	_isActive;	// Cleared to stop
+
+		/**********************************************************************\
+		|* Private methods
+		\**********************************************************************/
+		void _seedLanes(void);
+		void _addNoise(float *dst, int count, float sigma);
+		void _addCarrier(int offset, int count, const Signal& signal);
+		void _addGated(int count, const Signal& signal);
+		void _pack(uint8_t *dst, int count);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit SynthSource(double sampleRate,
+							 Format format,
+							 uint64_t seed,
+							 double noise,
+							 bool fast,
+							 Processor *processor = nullptr);
+		~SynthSource(void);
+
+		/**********************************************************************\
+		|* Add a signal, or parse one from its description (see above)
+		\**********************************************************************/
+		void addSignal(const Signal& signal);
+		static bool parseSignal(const QString& spec, Signal& signal);
+
+		/**********************************************************************\
+		|* Map a format name (cs8, cs16 or cf32) to a Format, returning false
+		|* if it's not one the synthesiser makes
+		\**********************************************************************/
+		static bool formatFor(const QString& name, Format& format);
+
+		/**********************************************************************\
+		|* Generate the next 'count' samples (up to SYNTH_MTU) into dst, in
+		|* the output format, and move the position on
+		\**********************************************************************/
+		void generate(uint8_t *dst, int count);
+
+		/**********************************************************************\
+		|* Go back to sample 0 with the original seed
+		\**********************************************************************/
+		void rewind(void);
+
+		/**********************************************************************\
+		|* SampleSource interface
+		\**********************************************************************/
+		int streamMTU(void) override;
+		double streamRate(void) override;
+		Format sampleFormat(void) override;
+		int sampleBytes(void) override;
+		int fullScale(void) override;
+		void startWorker(void) override;
+		void stopWorker(void) override;
+
+		/**********************************************************************\
+		|* Public Tests interface
+		\**********************************************************************/
+		int numTests(void) override;
+		Testable::TestResult runTest(int idx) override;
+		const char * testClassName(void) override;
+
+	protected:
+		/**********************************************************************\
+		|* The producer loop
+		\**********************************************************************/
+		void run(void) override;
+
+	private:
+		/**********************************************************************\
+		|* Private Tests
+		\**********************************************************************/
+		Testable::TestResult _checkRepeatable(void);
+		Testable::TestResult _checkSignals(void);
+		Testable::TestResult _checkThroughput(void);
+	};
+
+#endif // SYNTHSOURCE_H
@@ -1,86 +1,97 @@
-#include <cstring>
+#include <algorithm>
 
+#include "allocwatch.h"
 #include "datamgr.h"
 #include "taskfft.h"
 
 /******************************************************************************\
-|* Constructor: single buffer
+|* Constructors
 \******************************************************************************/
-TaskFFT::TaskFFT(double *iq, int num)
-		: QRunnable()
-		, _numIQ(num/2)
-		, _data(-1)
-		,_results(-1)
+TaskFFT::TaskFFT(void)
+		: _numIQ(0)
+		, _frames(0)
+		, _plan(nullptr)
+		, _planF(nullptr)
+		, _sequence(0)
+		, _first(0)
+		, _timeNs(0)
+		, _flags(0)
+		, _summed(0)
+	{}
+
+TaskFFT::TaskFFT(BlockRef<fftw_complex> batch,
+				 int numIQ,
+				 int frames,
+				 bool inPlace)
+		: _numIQ(numIQ)
+		, _frames(frames)
+		, _data(batch)
+		, _plan(nullptr)
+		, _planF(nullptr)
+		, _sequence(0)
+		, _first(0)
+		, _timeNs(0)
+		, _flags(0)
+		, _summed(0)
 	{
-	Q_ASSERT(num % 2 == 0);
-
-	DataMgr &dmgr		= DataMgr::instance();
-
-	_results			= dmgr.fftBlockFor(_numIQ);
-
-	_data				= dmgr.fftBlockFor(_numIQ);
-	fftw_complex *data	= dmgr.asFFT(_data);
-	::memcpy(data, iq, _numIQ * sizeof(fftw_complex));
+	_results = inPlace ? batch
+					   : DataMgr::instance().fftRefFor(_numIQ * _frames,
+													   DataBlock::TAG_FFT);
 	}
 
-/******************************************************************************\
-|* Constructor: two buffers
-\******************************************************************************/
-TaskFFT::TaskFFT(double *iq1, int num1, double *iq2, int num2)
-		: QRunnable()
-		,_numIQ((num1+num2)/2)
-		,_data(-1)
-		,_results(-1)
+TaskFFT::TaskFFT(BlockRef<fftwf_complex> batch,
+				 int numIQ,
+				 int frames,
+				 bool inPlace)
+		: _numIQ(numIQ)
+		, _frames(frames)
+		, _dataF(batch)
+		, _plan(nullptr)
+		, _planF(nullptr)
+		, _sequence(0)
+		, _first(0)
+		, _timeNs(0)
+		, _flags(0)
+		, _summed(0)
 	{
-	DataMgr &dmgr		= DataMgr::instance();
-
-	_results			= dmgr.fftBlockFor(_numIQ);
-
-	_data				= dmgr.fftBlockFor(_numIQ);
-	fftw_complex *data	= dmgr.asFFT(_data);
-
-	memcpy(data, iq1, num1*sizeof(double));
-
-	data += num1/2;
-	memcpy(data, iq2, num2*sizeof(double));
+	_resultsF = inPlace ? batch
+						: DataMgr::instance().fftfRefFor(_numIQ * _frames,
+														 DataBlock::TAG_FFT);
 	}
 
 /******************************************************************************\
-|* Destructor
+|* Pick the batch size: enough frames that there are no more than
+|* TASKS_PER_SEC tasks a second (so the batch covers no more than a
+|* millisecond or so of signal), but no more than fits in L2
 \******************************************************************************/
-TaskFFT::~TaskFFT(void)
+int TaskFFT::batchFor(int fftSize, int hop, double rate)
 	{
-	if (_data >= 0)
-		DataMgr::instance().release(_data);
-	}
+	int batch	= (int)(rate / std::max(hop, 1) / TASKS_PER_SEC);
+	int fits	= MAX_BATCH_BYTES / std::max<int>(fftSize * sizeof(fftw_complex), 1);
 
+	return std::max(1, std::min({batch, fits, (int)MAX_BATCH}));
+	}
 
 /******************************************************************************\
 |* Process the FFT
 \******************************************************************************/
 void TaskFFT::run(void)
 	{
-	DataMgr &dmgr		= DataMgr::instance();
+	AllocWatch::Scope pipeline;
 
 	/**********************************************************************\
-	|* Apply the windowing function to the data
+	|* Perform the FFTs, in whichever precision the batch is, with one call.
+	|* The frames were windowed as they were filled, and the input isn't
+	|* needed after this (unless the results are in it)
 	\**********************************************************************/
-	double *window		= dmgr.asDouble(_window);
-	fftw_complex *input	= dmgr.asFFT(_data);
-
-	for (int i=0; i<_numIQ; i++)
+	if (_dataF.isValid())
 		{
-		input[i][0] *= window[i];
-		input[i][1] *= window[i];
+		fftwf_execute_dft(_planF, _dataF.data(), _resultsF.data());
+		_dataF.reset();
+		}
+	else
+		{
+		fftw_execute_dft(_plan, _data.data(), _results.data());
+		_data.reset();
 		}
-
-	/**********************************************************************\
-	|* Perform the FFT
-	\**********************************************************************/
-	fftw_execute_dft(_plan, dmgr.asFFT(_data), dmgr.asFFT(_results));
-
-	/**********************************************************************\
-	|* And tell the world we're done
-	\**********************************************************************/
-	emit fftDone(_results);
 	}
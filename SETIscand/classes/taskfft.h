@@ -3,42 +3,91 @@
 
 #include <fftw3.h>
 
-#include <QObject>
-#include <QRunnable>
-
+#include "blockref.h"
 #include "properties.h"
 
-class TaskFFT : public QObject, public QRunnable
+/******************************************************************************\
+|* An FFT task for the DSP engine: a batch of one or more frames, contiguous
+|* in one block, transformed by a single (fftw_plan_many_dft) plan. Batching
+|* pays the hand-over costs once per batch rather than once per frame.
+|*
+|* It's a plain value: the processor fills one in and moves it onto the
+|* engine's FFT queue, a worker runs it and moves it onto the aggregation
+|* queue, and the aggregator reads the results from it (the worker may have
+|* summed some frames' power already; 'summed' says which). Nothing about
+|* it is allocated on the heap but its (pooled) buffers
+\******************************************************************************/
+class TaskFFT
 	{
-	Q_OBJECT
+	public:
+		/**********************************************************************\
+		|* Enums and Typedefs
+		\**********************************************************************/
+		enum
+			{
+			TASKS_PER_SEC	= 1000,				// Aim for no more than this
+			MAX_BATCH		= 64,				// Frames per batch: bits in summed
+			MAX_BATCH_BYTES	= 1 << 20			// Keep a batch in L2
+			};
 
 	/**************************************************************************\
 	|* Properties
 	\**************************************************************************/
-	GET(int, numIQ);						// Number of IQ points
-	GET(int64_t, data);						// Buffer: Input to FFT
-	GET(int64_t, results);					// Buffer: Output from FFT
+	GET(int, numIQ);						// Number of IQ points per frame
+	GET(int, frames);						// Number of frames in the batch
+	GET(BlockRef<fftw_complex>, data);		// Buffer: Input to FFT
+	GET(BlockRef<fftw_complex>, results);	// Buffer: Output from FFT
+	GET(BlockRef<fftwf_complex>, dataF);	// Or in single precision
+	GET(BlockRef<fftwf_complex>, resultsF);	// Or in single precision
 	SET(fftw_plan, plan, Plan);				// FFT plan for fftw3
-	GETSET(int64_t, window, Window);		// Buffer: FFT windowing data
+	SET(fftwf_plan, planF, PlanF);			// Single-precision plan
+	GETSET(qint64, sequence, Sequence);		// Frame number of the first frame
+	GETSET(qint64, first, First);			// Stream index of the first sample
+	GETSET(qint64, timeNs, TimeNs);			// Time of the first sample
+	GETSET(int, flags, Flags);				// SampleSource::FLAG_*
+	GETSET(quint64, summed, Summed);		// Frames a worker summed, a bit each
 
 	public:
 		/**********************************************************************\
-		|* Constructors and destructor
+		|* Constructor: an empty task, for the queues to hold
+		\**********************************************************************/
+		TaskFFT(void);
+
+		/**********************************************************************\
+		|* Constructor: take a batch of frames of numIQ samples each, already
+		|* windowed, in double or single precision. The results are the same
+		|* precision, and need a plan of that precision for that many frames.
+		|* If the plan is in place, the results overwrite the batch
+		\**********************************************************************/
+		TaskFFT(BlockRef<fftw_complex> batch,
+				int numIQ,
+				int frames,
+				bool inPlace = false);
+		TaskFFT(BlockRef<fftwf_complex> batch,
+				int numIQ,
+				int frames,
+				bool inPlace = false);
+
+		/**********************************************************************\
+		|* How many frames to batch, for frames of fftSize samples starting
+		|* every hop samples of a stream at 'rate' samples per second
 		\**********************************************************************/
-		TaskFFT(double *iq, int num);
-		TaskFFT(double *iq1, int num1, double *iq2, int num2);
-		~TaskFFT(void);
+		static int batchFor(int fftSize, int hop, double rate);
 
 		/**********************************************************************\
-		|* Method called to run the task
+		|* Run the FFTs. The input buffer goes back to its pool once done
 		\**********************************************************************/
-		void run() override;
+		void run(void);
 
-	signals:
 		/**********************************************************************\
-		|* FFT done, please aggregate this data
+		|* Whether the buffers are there (the results may not be, if the
+		|* memory budget has been reached). An invalid task must not be run
 		\**********************************************************************/
-		void fftDone(int bufferId);
+		inline bool isValid(void) const
+			{
+			return (_data.isValid() && _results.isValid())
+				|| (_dataF.isValid() && _resultsF.isValid());
+			}
 	};
 
 #endif // TASKFFT_H
@@ -1,13 +1,29 @@
 #include <QCoreApplication>
+#include <QTimer>
 
+#include "allocwatch.h"
 #include "config.h"
 #include "constants.h"
+#include "converter.h"
 #include "datamgr.h"
+#include "ddc.h"
+#include "dspengine.h"
+#include "fftaggregator.h"
+#include "filesource.h"
 #include "msgio.h"
 #include "processor.h"
+#include "samplering.h"
 #include "soapyio.h"
+#include "synthsource.h"
 #include "tester.h"
 
+/******************************************************************************\
+|* Time to let the stream settle before policing allocations, and how often to
+|* report on them
+\******************************************************************************/
+#define WARMUP_MS			(2000)
+#define ALLOC_REPORT_MS		(10000)
+
 int main(int argc, char *argv[])
 	{
 	QCoreApplication a(argc, argv);
@@ -25,15 +41,95 @@ int main(int argc, char *argv[])
 	\**************************************************************************/
 	Config &cfg = Config::instance();
 
+	/**************************************************************************\
+	|* Register the types that travel through queued signals
+	\**************************************************************************/
+	qRegisterMetaType<BlockRef<uint8_t>>();
+	qRegisterMetaType<BlockRef<double>>();
+	qRegisterMetaType<BlockRef<fftw_complex>>();
+	qRegisterMetaType<BlockRef<fftwf_complex>>();
+	qRegisterMetaType<FFTAggregator::DataType>();
+	qRegisterMetaType<FFTAggregator::WindowInfo>();
+
+	/**************************************************************************\
+	|* Run the internal tests if asked to, and exit
+	\**************************************************************************/
+	if (cfg.runSelfTests())
+		{
+		Tester tester;
+		SampleRing ring(SampleRing::DEFAULT_SLOTS, 0);
+		SynthSource synth(cfg.sampleRate(), SynthSource::FMT_CS16, 1, 0, true);
+		DSPEngine engine(nullptr, 1, QList<int>());
+		DDC ddc(cfg.sampleRate(), 0, 32, 16384);
+		tester.duts().append(&DataMgr::instance());
+		tester.duts().append(&ring);
+		tester.duts().append(&synth);
+		tester.duts().append(&Converter::instance());
+		tester.duts().append(&engine);
+		tester.duts().append(&ddc);
+		tester.test();
+		return 0;
+		}
+
+	/**************************************************************************\
+	|* Set up the backing arena for the data blocks, if there is one, and
+	|* the limit on how much memory they may use
+	\**************************************************************************/
+	DataMgr::instance().setupArena();
+	DataMgr::instance().setupBudget();
+
 	/**************************************************************************\
 	|* Set up the processing hierarchy
 	\**************************************************************************/
 	Processor processor(cfg, &a);
 
 	/**************************************************************************\
-	|* Set up the data stream
+	|* Set up the data stream: a recording or the synthesiser if we've been
+	|* asked for one, otherwise the radio. Either way the processor owns it
 	\**************************************************************************/
-	SoapyIO sio(&processor);
+	SampleSource *source = nullptr;
+	if (!cfg.replayFile().isEmpty())
+		{
+		FileSource *replay = new FileSource(cfg.replayFile(),
+											cfg.replayFormat(),
+											cfg.replayFast(),
+											&processor);
+		if (!replay->isValid())
+			return -1;
+
+		QObject::connect(replay, &QThread::finished,
+						 &a, &QCoreApplication::quit);
+		source = replay;
+		}
+	else if (cfg.synth())
+		{
+		SynthSource::Format format;
+		if (!SynthSource::formatFor(cfg.synthFormat(), format))
+			{
+			qCritical(log_dsp) << "Unknown synthetic sample format" << cfg.synthFormat();
+			return -1;
+			}
+
+		SynthSource *synth = new SynthSource(cfg.sampleRate(),
+											 format,
+											 cfg.synthSeed(),
+											 cfg.synthNoise(),
+											 cfg.synthFast(),
+											 &processor);
+		for (const QString& spec : cfg.synthSignals())
+			{
+			SynthSource::Signal signal;
+			if (!SynthSource::parseSignal(spec, signal))
+				{
+				qCritical(log_dsp) << "Cannot understand synthetic signal" << spec;
+				return -1;
+				}
+			synth->addSignal(signal);
+			}
+		source = synth;
+		}
+	else
+		source = new SoapyIO(&processor);
 
 	/**************************************************************************\
 	|* Configure the message-io handler (websocket based)
@@ -48,12 +144,29 @@ int main(int argc, char *argv[])
 	/**************************************************************************\
 	|* Configure the processor
 	\**************************************************************************/
-	processor.init(&sio);
+	processor.init(source);
+
+	/**************************************************************************\
+	|* Allocate the pipeline's buffers now rather than on the hot path, and
+	|* if asked, police allocations once the stream has settled
+	\**************************************************************************/
+	DataMgr::instance().prewarm(source->streamMTU(),
+								source->sampleBytes(),
+								source->streamRate());
+
+	AllocWatch::Mode strict = (AllocWatch::Mode)cfg.strictAlloc();
+	QTimer allocReport;
+	if (strict != AllocWatch::MODE_OFF)
+		{
+		QTimer::singleShot(WARMUP_MS, [strict]() { AllocWatch::arm(strict); });
+		QObject::connect(&allocReport, &QTimer::timeout, &AllocWatch::report);
+		allocReport.start(ALLOC_REPORT_MS);
+		}
 
 	/**************************************************************************\
 	|* Start streaming data in
 	\**************************************************************************/
-	sio.startWorker();
+	source->startWorker();
 
 	return a.exec();
 	}